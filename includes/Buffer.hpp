@@ -5,29 +5,28 @@
 #include <unistd.h>
 #include <string>
 #include <string_view>
+#include <cstdint>
 #include "WebServErr.hpp"
 #include "SharedTypes.hpp"
 #include "LogSys.hpp"
+#include "ChunkedDecoder.hpp"
 
-static constexpr size_t MAX_CHUNK_HEADER_SPACE = 20;
-static constexpr size_t CRLF = 2; // CRLF size
+static constexpr size_t CRLF = 2;                    // CRLF size
+static constexpr size_t CHUNK_COALESCE_SIZE = 512;   // Body spans below it are moved next to the previous one.
+static constexpr int MAX_WRITE_IOV = 64;             // Max views written by one writev.
+static constexpr size_t DEFAULT_BLOCK_SIZE = 16384;  // Default block size, also the size of pooled blocks.
+static constexpr size_t MAX_POOLED_BLOCKS = 256;     // Max free blocks kept per thread.
+static constexpr size_t MAX_CHUNK_PREFIX_SIZE = 20;  // Hex chunk size and CRLF of an output chunk.
 
-typedef enum e_scratch_type
-{
-    None,
-    Header,
-    Body
-} t_scratch_type;
-
-typedef enum e_chunked_status
+/**
+ * @brief A run of output bytes, sent as a chunk in chunked output mode.
+ */
+typedef struct s_out_chunk
 {
-    NEXT_HEADER,
-    PARTIAL_HEADER,
-    BODY_PROCESSING,
-    WAITING_DELIMITER,
-    CHUNKED_EOF,
-    CHUNKED_ERROR
-} t_chunked_status;
+    size_t size;  // Payload bytes of the chunk, 0 for the last chunk.
+    size_t sent;  // Bytes already written, framing included.
+    bool framed;  // Whether the chunk framing is added, false for the response head.
+} t_out_chunk;
 
 /**
  * @brief A buffer class with reference-counted blocks and optional chunked transfer parsing.
@@ -39,23 +38,29 @@ typedef enum e_chunked_status
  * - Blocks are appended as needed, views track the readable region, reference counting ensures blocks are freed when no longer used.
  *
  * ## Chunked transfer encoding mode
- * It's the tricky part.
- * For each read, we may receive several chunks, or a partial chunk.
- * For a partial chunk, it may be a partial header, or a partial body, or a partial CRLF delimiter.
+ * For each read, we may receive several chunks, or a partial chunk,
+ * split anywhere: in a chunk size, an extension, a CRLF, a body, or a trailer.
  *
- * It would be difficult to parse the chunked data across buffer blocks,
- * so we use another string_view, a FSM, and some state variables to handle the chunked parsing.
+ * The framing is parsed by a `ChunkedDecoder`, which keeps its state per byte,
+ * so reads go to the free space of the last block, whatever the split point is.
+ * The decoded body spans are kept in place:
+ * - A small span is moved right after the previous one, and extends its view.
+ * - A large span gets its own view, without copying.
+ * Then the write position is rewound to the end of the body, so the next read
+ * overwrites the framing bytes. Memory per byte of body stays close to 1.0,
+ * even for a client sending 1-byte chunks.
  *
- * And we also apply 2 rules during the processing:
- * 1. Ensure chunk header and trailing CRLF are not split across blocks.
- * 2. Chunked bodies can span multiple blocks.
+ * ## Chunked output mode
+ * When a response has no known length (CGI output without `Content-Length`),
+ * the bytes after the head are sent with the chunked transfer coding.
+ * Each read is recorded as a chunk, the framing is generated in `writeSocket`
+ * as separate iovecs around the body views, so the body is never copied.
  *
  * ## Why we couple the chunked parsing with the buffer class?
  * - We cannot defer parsing with an large buffer, since input may exceed available memory.
  * - Using a temporary file introduces an extra data copy.
- * - imo, handling chunked parsing in Buffer is efficient and nearly zero-copy,
- *   tho brings lots of complexity, and does not follow single-responsibility, as a cost.
- *   But I don't have better ideas now.
+ * - imo, handling chunked parsing in Buffer is efficient and nearly zero-copy.
+ *   The grammar lives in `ChunkedDecoder`, the Buffer only places the body spans.
  */
 class Buffer
 {
@@ -67,39 +72,106 @@ private:
     size_t write_pos_;                       // The current write position in the last block
     size_t size_;                            // The current size of the buffer.
     size_t block_size_;                      // The size of each block in the buffer.
-    t_scratch_type scratch_type_;            // The current scratch type.
-    std::string scratched_;                  // The scratched data for chunked transfer.
-    size_t remain_chunk_size_;               // The remain size of the chunk in chunked mode.
+    ChunkedDecoder chunked_decoder_;         // The decoder of the chunked framing.
     bool is_chunked_;                        // Whether the buffer is in chunked mode.
     bool is_eof_;                            // Whether the EOF has been reached in chunked mode.
+    std::string overflow_;                   // Bytes beyond the current message, the start of the next one.
+    bool is_chunked_output_;                 // Whether the output is framed with the chunked coding.
+    std::deque<t_out_chunk> out_chunks_;     // The output chunks not fully written, in chunked output mode.
+
+    /**
+     * @brief Decodes the chunked bytes `[from, to)` of the last block in place.
+     * @return The body bytes decoded, or `CHUNKED_ERR`.
+     */
+    ssize_t decodeChunked(size_t from, size_t to);
+
+    /**
+     * @brief Appends a decoded body span of the last block to the readable views.
+     */
+    void appendBodySpan(size_t offset, size_t size);
+
+    /**
+     * @brief Removes the first view, and frees its block if it was the last view of it.
+     */
+    void popFrontView();
+
+    /**
+     * @brief Removes the last view, and frees its block if it was the last view of it.
+     */
+    void popBackView();
 
-    ssize_t handleNextHeader(std::string_view data, ssize_t parsed, size_t skipped);
-    ssize_t handleBodyProcessing(std::string_view data, ssize_t parsed, size_t skipped);
-    ssize_t handleChunkedEOF(ssize_t parsed);
-    ssize_t handleChunkedError();
+    /**
+     * @brief Recycles all the blocks, and clears the views.
+     */
+    void releaseBlocks();
 
     /**
-     * @brief The finite state machine scheduler for parsing chunked data.
+     * @brief Copies all readable bytes into a single block of at least `min_block_size` bytes.
      */
-    ssize_t fsmScheduler(t_chunked_status status, std::string_view data);
+    void linearize(size_t min_block_size);
 
     /**
      * @brief Reads data from the file descriptor into the buffer in chunked mode.
      */
     ssize_t readFdChunked(int fd);
 
+    /**
+     * @brief Records `size` bytes just read as chunk payload, `size == 0` records the last chunk.
+     */
+    void addOutChunk(size_t size);
+
+    /**
+     * @brief Writes the buffer with the chunked framing, see `writeSocket`.
+     */
+    ssize_t writeSocketChunked(int fd);
+
+    /**
+     * @brief Removes `size` bytes from the front views.
+     */
+    void consumeFront(size_t size);
+
 public:
     Buffer();
     Buffer(const Buffer &) = default;
     Buffer &operator=(const Buffer &) = default;
-    ~Buffer() = default;
+    ~Buffer();
 
     Buffer(size_t capacity, size_t block_size);
 
+    /**
+     * @brief Returns a block of `size` bytes, reused from the pool of the thread when possible.
+     * @details
+     * The bytes of a reused block are not cleared.
+     * `acquireBlock(0)` returns an empty string with a pooled capacity, for appending,
+     * e.g. serializing a response head, which is then moved into a buffer by `insertHeader`.
+     */
+    static std::string acquireBlock(size_t size = DEFAULT_BLOCK_SIZE);
+
+    /**
+     * @brief Returns a block to the pool of the thread, or frees it.
+     * @details
+     * Only blocks of a usual capacity are kept, a huge linearized head is freed.
+     */
+    static void recycleBlock(std::string &&block);
+
+    /**
+     * @brief Moves up to `size` bytes from `in` to `out` in the kernel, one of them being a pipe.
+     * @return The bytes moved, `EOF_REACHED` at the end of `in`, `SPLICE_AGAIN` when an end would block,
+     * `SPLICE_UNSUPPORTED` when an fd cannot be spliced (nothing was moved), `RW_ERROR` otherwise.
+     */
+    static ssize_t spliceFd(int in, int out, size_t size);
+
+    /**
+     * @brief Moves the `size` bytes waiting in `pipe_fd` to the file `fd`.
+     * @return `size`, or `RW_ERROR`.
+     */
+    static ssize_t drainPipe(int pipe_fd, int fd, size_t size);
+
     /**
      * @brief Reads data from the file descriptor(a file/socket/pipe) into the buffer.
+     * @param max_size Reads at most this many bytes, e.g. the rest of a body, ignored in chunked mode.
      */
-    ssize_t readFd(int fd);
+    ssize_t readFd(int fd, size_t max_size = SIZE_MAX);
 
     /**
      * @brief Writes data from the buffer to the socket descriptor(a socket/pipe).
@@ -131,32 +203,75 @@ public:
      */
     size_t size() const;
 
+    /**
+     * @brief Returns the bytes still to be written by `writeSocket`, chunk framing included.
+     */
+    size_t outputSize() const;
+
+    /**
+     * @brief Switches to chunked output mode, the first `head_size` bytes are sent as is.
+     * @details
+     * The bytes after the head, and all the bytes read later, are sent as chunks;
+     * the last chunk is added when the EOF is read.
+     */
+    void startChunkedOutput(size_t head_size);
+
     /**
      * @brief Returns the first string in the buffer without removing it.
      */
     const std::string_view peek() const;
 
+    /**
+     * @brief Returns all the bytes of the buffer as one view, for parsing a request head.
+     * @details
+     * A head may span several blocks when it is larger than a block (big cookies, JWTs).
+     * Then the buffer is linearized once, into a block of `max_size` bytes (the header limit),
+     * capped by the capacity.
+     */
+    const std::string_view peekHead(size_t max_size);
+
     /**
      * @brief Removes the first `size` bytes from the buffer, and sets the chunked mode.
      * @details
      * It is used for removing request header after parsing.
-     * At that time, there should be only one block in the buffer.
-     * If there are multiple blocks, or the given size is larger than the size of the first block,
-     * it returns false.
-     * If the buffer is in chunked mode, it also processes the rest body in chunked mode.
+     * The header must be in the first view, which `peekHead` ensures,
+     * otherwise it throws.
+     * If the buffer is in chunked mode, it also processes the rest body in chunked mode,
+     * and returns false if the chunked body is malformed.
      */
     bool removeHeaderAndSetChunked(const std::size_t size, bool is_chunked);
 
     /**
-     * @brief Replaces the header in the buffer with the given string.
+     * @brief Drops up to `size` bytes from the front, e.g. the body of a rejected request.
+     * @return The bytes dropped.
+     */
+    size_t discard(size_t size);
+
+    /**
+     * @brief Keeps the first `size` bytes, the rest is moved to the overflow for the next message.
+     */
+    void trimTo(size_t size);
+
+    /**
+     * @brief Resets the message state for the next pipelined request, the overflow becomes its input.
+     */
+    void startNextMessage();
+
+    /**
+     * @brief Moves all the bytes of `other` to the end of this buffer, without copying.
+     */
+    void append(Buffer &other);
+
+    /**
+     * @brief Replaces the first `old_size` bytes of the buffer with the given string.
      * @details
-     * It is used for replacing request header after CGI response parsing.
-     * At that time, there should be only one block in the buffer.
+     * It is used for replacing the CGI header with the HTTP response head.
+     * The CGI header must be in the first view, which `peekHead` ensures.
      */
-    bool replaceHeader(std::string str);
+    bool replaceHeader(size_t old_size, std::string str);
 
     /**
-     * @brief Inserts a header string into the buffer.
+     * @brief Appends a header string to the buffer.
      */
     bool insertHeader(std::string str);
 };
\ No newline at end of file
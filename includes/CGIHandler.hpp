@@ -4,6 +4,9 @@
 #include <vector>
 #include <string>
 #include <filesystem>
+#include <array>
+#include <fcntl.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -12,7 +15,10 @@
 #include "WebServErr.hpp"
 #include "LogSys.hpp"
 #include "SharedTypes.hpp"
+#include "HttpHeaders.hpp"
 #include "RaiiFd.hpp"
+#include "FastCgiPool.hpp"
+#include "CgiWorkerPool.hpp"
 #include <cctype>
 #include <cstring>
 #include <unistd.h>
@@ -23,19 +29,35 @@
 class CGIHandler
 {
 private:
-    std::vector<char*> envp;
+    EpollHelper &epoll_helper_;
+    std::string env_arena_;    // The environment, "NAME=value\0" entries
+    std::vector<char*> envp;   // Entries of `env_arena_`, null-terminated
     std::vector<char*> argv;
     t_file result;
 
     // Setters
-    void setENVP(const std::unordered_map<std::string, std::string> &requestLine, const std::unordered_map<std::string, std::string> &requestHeader);
+    void setENVP(const t_cgi_config &cgi, const std::unordered_map<std::string, std::string> &requestLine, const HttpHeaders &requestHeader);
     void setARGV(bool isInterpreter, const std::string &interpreter, std::string &prog_name);
 
     // Processes
-    void handleCGIProcess(std::filesystem::path &path, std::string &cmd, int inPipe[2], int outPipe[2]);
+    pid_t spawnCGI(const std::filesystem::path &path, const std::string &cmd, int inPipe[2], int outPipe[2]);
     std::filesystem::path getTargetCGI(const std::filesystem::path &path, t_server_config &server, bool *isPython);
     void checkRootValidity(const std::filesystem::path &root);
 
+    /**
+     * @brief Prepares a request for a FastCGI application, instead of forking.
+     * @details
+     * The pipes look like the ones of a CGI to the connection, the pool of the server takes their other ends.
+     */
+    t_file getFastCgiJob(const t_cgi_config &cgi, std::string &prog_name, const std::unordered_map<std::string, std::string> &requestLine, const HttpHeaders &requestHeader);
+
+    /**
+     * @brief Prepares a request for a pre-spawned interpreter, instead of forking.
+     * @details
+     * The connection keeps the server ends of the pipes, the worker gets the others from the pool.
+     */
+    t_file getPreforkJob(const t_cgi_config &cgi, std::string &prog_name, const std::unordered_map<std::string, std::string> &requestLine, const HttpHeaders &requestHeader, time_t max_duration);
+
 public:
     CGIHandler() = delete;
     CGIHandler(EpollHelper &epoll_helper);
@@ -44,5 +66,17 @@ public:
     CGIHandler &operator=(const CGIHandler &copy) = delete;
 
     // Getters
-    t_file getCGIOutput(std::string &targetRef, std::unordered_map<std::string, std::string> requestLine, std::unordered_map<std::string, std::string> requestHeader, t_server_config &server);
+    t_file getCGIOutput(std::string &targetRef, std::unordered_map<std::string, std::string> requestLine, const HttpHeaders &requestHeader, t_server_config &server);
 };
+
+/**
+ * @brief The script of a CGI target, after `/cgi-bin/`.
+ * @throws WebServErr::MethodException 400 if the target is not under `/cgi-bin/`.
+ */
+std::string getProgName(std::string &targetRef);
+
+/**
+ * @brief The extension of a CGI script, with its dot.
+ * @throws WebServErr::MethodException 400 if the script has no extension.
+ */
+std::string getExtName(std::string &prog_name);
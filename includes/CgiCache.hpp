@@ -0,0 +1,127 @@
+#pragma once
+
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "SharedTypes.hpp"
+#include "RaiiFd.hpp"
+#include "ChildReaper.hpp"
+
+static constexpr size_t CGI_CACHE_IO_SIZE = 65536;        // Bytes per read of a CGI output.
+static constexpr size_t CGI_CACHE_MAX_LAG = 256 * 1024;   // Bytes a reader may lag behind before the CGI is not read.
+
+/**
+ * @brief The output of one CGI run, shared by the requests it answers.
+ * @details
+ * While the CGI runs it is a flight: identical requests join it and get the output from its first byte.
+ * Once complete, and if the CGI allows it, it is the cache entry of its URL till it expires.
+ */
+typedef struct s_cgi_flight
+{
+    std::string key;
+    std::string output;        // The CGI output, from `base`.
+    size_t base;               // Bytes dropped from the front, once no reader needs them and it cannot be stored.
+    int source;                // The output pipe of the CGI, -1 once closed.
+    pid_t pid;                 // The forked CGI, -1 for a pool.
+    time_t deadline;           // When a forked CGI is stopped.
+    t_cgi_cache_config config;
+    bool is_storable;          // Whether it may still be stored and joined.
+    bool is_done;              // Whether the CGI output ended.
+    time_t expires;            // When the stored entry goes stale.
+    std::multimap<time_t, std::string>::iterator expiry; // Its place in the expiry order of the cache, once stored.
+    std::vector<int> readers;  // Pipes of the requests, by fd.
+} t_cgi_flight;
+
+/**
+ * @brief A request served from a flight, through the pipe the connection reads as a CGI output.
+ */
+typedef struct s_cgi_cache_reader
+{
+    int fd;                               // Write end of the pipe.
+    std::shared_ptr<t_cgi_flight> flight;
+    size_t offset;                        // Bytes of the output written.
+} t_cgi_cache_reader;
+
+/**
+ * @brief Opt-in micro-cache of CGI GET outputs, with single-flight collapsing.
+ * @details
+ * The key is the server, the method and the target with its query.
+ * - A fresh entry is replayed to the request, no CGI runs.
+ * - A request identical to a running one joins it, one CGI answers any number of them.
+ * - Otherwise the request starts a flight: its CGI output pipe is taken by the cache,
+ *   and the connection reads a pipe of the cache instead.
+ *
+ * The output is stored after the CGI ended, unless its header says otherwise:
+ * a status other than 200, `Cache-Control: no-store`, `no-cache` or `private`, or a `Set-Cookie`.
+ * `max-age` lowers the TTL of the extension. An output larger than `max_size` is streamed, not stored.
+ * The entries share `CGI_CACHE_MAX_BYTES`, the ones expiring first are evicted first.
+ *
+ * The `Server` routes the events of the fds the cache owns to `handleEvent`.
+ */
+class CgiCache
+{
+private:
+    EpollHelper &epoll_;
+    ChildReaper &children_;
+    std::unordered_map<std::string, std::shared_ptr<t_cgi_flight>> flights_; // Running and joinable, by key.
+    std::unordered_map<std::string, std::shared_ptr<t_cgi_flight>> entries_; // Stored, by key.
+    std::multimap<time_t, std::string> entry_order_;                         // Keys of the entries, by expiry.
+    size_t stored_bytes_;
+    std::unordered_map<int, std::shared_ptr<t_cgi_flight>> sources_;         // Flights, by CGI output pipe.
+    std::unordered_map<int, t_cgi_cache_reader> readers_;                    // By pipe.
+
+    t_file addReader(const std::shared_ptr<t_cgi_flight> &flight, t_msg_from_serv &msg);
+    void onSourceEvent(t_cgi_flight &flight, t_msg_from_serv &msg);
+    void flushReaders(t_cgi_flight &flight, t_msg_from_serv &msg);
+
+    /**
+     * @brief Writes what the reader has not got yet, closes its pipe once the output is complete.
+     */
+    void flushReader(t_cgi_cache_reader &reader, t_msg_from_serv &msg);
+    void closeReader(int fd, t_msg_from_serv &msg);
+    void endFlight(t_cgi_flight &flight, t_msg_from_serv &msg);
+    void store(const std::shared_ptr<t_cgi_flight> &flight, time_t now);
+    void dropEntry(const std::string &key);
+
+    /**
+     * @brief Drops the output no reader needs, once it cannot be stored.
+     */
+    void trim(t_cgi_flight &flight);
+
+public:
+    CgiCache(EpollHelper &epoll, ChildReaper &children);
+
+    static std::string key(size_t config_idx, std::string_view method, std::string_view target);
+
+    bool owns(int fd) const;
+
+    /**
+     * @brief Serves a request from a fresh entry or a running flight, returns false when its CGI must run.
+     * @param res Set to the pipes the connection uses as a CGI, on success.
+     */
+    bool join(const std::string &key, t_file &res, t_msg_from_serv &msg);
+
+    /**
+     * @brief Takes the output pipe of a CGI started for `key`, `res` gets a pipe of the cache instead.
+     */
+    t_msg_from_serv startFlight(const std::string &key, const t_cgi_cache_config &config, t_file &res, time_t max_duration);
+
+    t_msg_from_serv handleEvent(int fd, t_event_type event_type);
+
+    /**
+     * @brief Stops the forked CGIs of the flights past their deadline, drops the expired entries.
+     */
+    void tick(time_t now);
+
+    size_t storedBytes() const;
+};
+
+/**
+ * @brief Seconds a CGI output may be stored, from its header and the TTL of the extension, 0 if it may not.
+ * @param output The output, its header first. An incomplete header is not storable.
+ */
+time_t cgiCacheTtl(std::string_view output, time_t ttl);
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+#include "SharedTypes.hpp"
+#include "RaiiFd.hpp"
+
+static constexpr time_t CGI_WORKER_START_TIMEOUT = 10; // Seconds a worker may take to load the interpreter.
+static constexpr time_t CGI_WORKER_PING_INTERVAL = 10; // Seconds between two health checks of an idle worker.
+static constexpr time_t CGI_WORKER_PING_TIMEOUT = 2;   // Seconds a worker may take to answer a health check.
+static constexpr size_t CGI_WORKER_MAX_MESSAGE = 1 << 20; // Max size of a request message, the environment included.
+
+/**
+ * @brief A request for a pre-spawned interpreter, built by the `CGIHandler`, served by the `CgiWorkerPool`.
+ * @details
+ * The connection state machine sees a CGI: it writes the body to a pipe, and reads the output from another.
+ * The other ends are passed to a worker, which runs the script with them as its stdin and stdout.
+ */
+typedef struct s_cgi_job
+{
+    std::string group;                 // The worker group, see `CgiWorkerPool::groupKey`.
+    std::string message;               // The request message: 'Q', then the directory, the script and the environment, NUL-separated.
+    std::shared_ptr<RaiiFd> stdin_fd;  // Read end of the body pipe, for the worker.
+    std::shared_ptr<RaiiFd> stdout_fd; // Write end of the output pipe, for the worker.
+    time_t max_duration;               // Seconds the worker may run the script, the request timeout of the server.
+} t_cgi_job;
+
+typedef enum e_cgi_worker_state
+{
+    WORKER_STARTING, // The interpreter is loading, the worker sends 'R' when it is ready.
+    WORKER_IDLE,     // Parked on its control socket.
+    WORKER_PINGING,  // A health check is sent, the worker answers 'O'.
+    WORKER_BUSY      // Running a script, the worker sends 'D' when it is done.
+} t_cgi_worker_state;
+
+typedef struct s_cgi_worker
+{
+    pid_t pid;
+    int fd;                   // Our end of the control socket.
+    std::string group;
+    t_cgi_worker_state state;
+    time_t state_since;       // When the worker entered its state.
+    time_t idle_since;        // When the worker finished its last script, or got ready.
+    time_t deadline;          // When a busy worker is killed.
+    size_t served;            // Requests served.
+} t_cgi_worker;
+
+typedef struct s_cgi_worker_group
+{
+    std::string interpreter;
+    t_prefork_config config;
+    time_t retry_after;                             // No spawn before, after a worker failed to start.
+    std::deque<std::shared_ptr<t_cgi_job>> waiting; // Requests waiting for an idle worker.
+} t_cgi_worker_group;
+
+/**
+ * @brief Pre-spawned interpreters of the CGI extensions configured with `prefork`.
+ * @details
+ * A worker is an interpreter running a small bootstrap, parked on a control socket (SOCK_SEQPACKET).
+ * For each request it receives the environment and the two pipes of the connection (SCM_RIGHTS),
+ * runs the script in its own process, restores its stdin and stdout, and parks again.
+ * The interpreter start and the imports of the bootstrap are paid once per worker, not per request.
+ *
+ * - At least `min_workers` are kept, idle workers above it are retired after `idle_timeout`.
+ * - Workers are spawned on demand up to `max_workers`, requests queue while all are busy.
+ * - A worker is replaced after `max_requests`, as the scripts share its process.
+ * - Idle workers are pinged, a worker that does not answer, does not start,
+ *   or runs a script past the request timeout is killed.
+ *
+ * The bootstrap is Python, so `prefork` requires a Python interpreter.
+ * The `Server` routes the events of the control sockets to `handleEvent`, and calls `tick` on each loop.
+ */
+class CgiWorkerPool
+{
+private:
+    EpollHelper &epoll_;
+    std::unordered_map<std::string, t_cgi_worker_group> groups_; // By `groupKey`.
+    std::unordered_map<int, t_cgi_worker> workers_;              // By control socket.
+    std::vector<pid_t> reaping_;                                 // Stopped workers, not waited for yet.
+
+    bool spawn(const std::string &group_key, t_msg_from_serv &msg);
+    void dispatch(const std::string &group_key, t_msg_from_serv &msg);
+    bool sendJob(t_cgi_worker &worker, t_cgi_job &job);
+
+    /**
+     * @brief Closes the control socket of a worker, and kills it unless it exits on its own.
+     */
+    void removeWorker(int fd, bool kill_it, t_msg_from_serv &msg);
+
+public:
+    CgiWorkerPool(EpollHelper &epoll, const std::vector<t_server_config> &configs);
+    ~CgiWorkerPool();
+
+    /**
+     * @brief Workers are shared by the extensions of an interpreter, the directory comes with each request.
+     */
+    static std::string groupKey(const t_cgi_config &cgi);
+
+    bool owns(int fd) const;
+
+    /**
+     * @brief Queues a request, any new worker is returned for registration.
+     */
+    t_msg_from_serv submit(std::shared_ptr<t_cgi_job> job);
+
+    t_msg_from_serv handleEvent(int fd, t_event_type event_type);
+
+    /**
+     * @brief Keeps the pool sizes, runs the health checks, and reaps the stopped workers.
+     */
+    t_msg_from_serv tick(time_t now);
+};
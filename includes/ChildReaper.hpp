@@ -0,0 +1,58 @@
+#pragma once
+
+#include <ctime>
+#include <unordered_map>
+#include <sys/types.h>
+#include "SharedTypes.hpp"
+#include "RaiiFd.hpp"
+
+static constexpr time_t CGI_KILL_GRACE = 2; // Seconds a stopped CGI has between SIGTERM and SIGKILL.
+
+typedef struct s_child
+{
+    pid_t pid;
+    int pidfd;
+} t_child;
+
+/**
+ * @brief Reaps the forked CGI scripts of a `Server` from the event loop.
+ * @details
+ * Each child is watched through its pidfd, registered in epoll like any other fd:
+ * its exit is a read event, the status is collected then, no child is polled.
+ * A child that must stop gets SIGTERM, and SIGKILL after `CGI_KILL_GRACE` if it is still there.
+ * Signals go through the pidfd, a reaped pid reused by another process is never hit.
+ */
+class ChildReaper
+{
+private:
+    EpollHelper &epoll_;
+    std::unordered_map<int, t_child> children_;    // By pidfd.
+    std::unordered_map<pid_t, int> pidfds_;        // Pidfds, by pid.
+    std::unordered_map<int, time_t> stopping_;     // When SIGKILL follows the SIGTERM, 0 once sent, by pidfd.
+
+public:
+    explicit ChildReaper(EpollHelper &epoll);
+    ~ChildReaper();
+
+    bool owns(int fd) const;
+
+    /**
+     * @brief Watches a child, its pidfd is returned for registration.
+     */
+    t_msg_from_serv watch(pid_t pid);
+
+    /**
+     * @brief Sends SIGTERM to a watched child, SIGKILL comes with `tick` after the grace period.
+     */
+    void stop(pid_t pid, time_t now);
+
+    /**
+     * @brief Collects the exit status of a child.
+     */
+    t_msg_from_serv handleEvent(int fd, t_event_type event_type);
+
+    /**
+     * @brief Kills the stopped children past their grace period.
+     */
+    void tick(time_t now);
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+static constexpr size_t MAX_CHUNK_LINE_SIZE = 4096; // Max size of a chunk-size line, extensions included.
+static constexpr size_t MAX_TRAILER_SIZE = 8192;    // Max size of the whole trailer section.
+
+/**
+ * @brief The states of the chunked decoder, one per grammar position.
+ */
+typedef enum e_chunk_state
+{
+    CHUNK_SIZE_FIRST, // Expecting the first hex digit of a chunk size.
+    CHUNK_SIZE,       // Inside the hex digits.
+    CHUNK_EXT,        // Inside the chunk extensions, ignored till CR.
+    CHUNK_SIZE_LF,    // Expecting the LF of the chunk-size line.
+    CHUNK_DATA,       // Inside the chunk data.
+    CHUNK_DATA_CR,    // Expecting the CR after the chunk data.
+    CHUNK_DATA_LF,    // Expecting the LF after the chunk data.
+    CHUNK_TRAILER,    // At the start of a trailer line, or of the final CRLF.
+    CHUNK_TRAILER_LINE,
+    CHUNK_TRAILER_LF,
+    CHUNK_FINAL_LF,
+    CHUNK_DONE,
+    CHUNK_ERROR
+} t_chunk_state;
+
+/**
+ * @brief A streaming decoder of the chunked transfer coding (RFC 9112 section 7.1).
+ * @details
+ * The state is kept per byte, so the input can be split at any point:
+ * in the middle of a chunk size, of an extension, of a CRLF, or of a trailer.
+ * The decoder never copies: body bytes are handed back as views into the input.
+ *
+ * Usage:
+ * ```
+ * while (!data.empty() && !decoder.isDone() && !decoder.isError())
+ * {
+ *     std::string_view body;
+ *     data.remove_prefix(decoder.next(data, body));
+ *     consume(body);
+ * }
+ * ```
+ * Chunk extensions and trailer fields are validated for size and discarded.
+ */
+class ChunkedDecoder
+{
+private:
+    t_chunk_state state_;
+    size_t remain_;     // Remaining bytes of the current chunk, or the size being decoded.
+    size_t line_size_;  // Bytes of the current chunk-size line.
+    size_t trailer_size_;
+
+    void fail();
+
+public:
+    ChunkedDecoder();
+
+    /**
+     * @brief Decodes the framing at the start of `data`, up to and including the next body span.
+     * @param body Set to the body span found, a view into `data`, empty if there is none.
+     * @return The number of bytes consumed from `data`, the body span included.
+     * Stops early when the last chunk is done, the rest of `data` is not consumed.
+     */
+    size_t next(std::string_view data, std::string_view &body);
+
+    bool isDone() const;
+    bool isError() const;
+
+    /**
+     * @brief Resets the decoder for a new message.
+     */
+    void reset();
+};
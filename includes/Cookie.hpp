@@ -1,23 +1,30 @@
 #pragma once
 
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include "HttpRequests.hpp"
 #include "HttpResponse.hpp"
+#include "SessionStore.hpp"
 
 const int MAX_COOKIE_AGE = 3600; // 1 hour
 
 class Cookie
 {
 private:
-    std::unordered_map<std::string, time_t> cookies_;
-    bool checkValidAndExtendCookie(const std::string &cookie);
-    std::string setCookie(std::string &cookie, time_t ts);
+    SessionStore sessions_;
+    std::string setCookie(const t_session_id &id) const;
 
 public:
-    Cookie();
-    Cookie(const Cookie &other) = default;
-    Cookie &operator=(const Cookie &other) = default;
+    Cookie(size_t max_sessions, const std::string &session_file);
+    Cookie(Cookie &&other) noexcept = default;
+    Cookie(const Cookie &other) = delete;
+    Cookie &operator=(const Cookie &other) = delete;
     ~Cookie();
+
+    /**
+     * @brief The value of `session_id` in a `Cookie` header, empty when there is none.
+     */
+    static std::string_view sessionId(std::string_view header);
+
     std::string set(HttpRequests &request);
-};
\ No newline at end of file
+};
@@ -1,26 +1,35 @@
 #pragma once
-#include "EpollHelper.hpp"
 #include "SharedTypes.hpp"
-#include "RaiiFd.hpp"
 #include "WebServErr.hpp"
 #include "LogSys.hpp"
-#include <memory>
+#include <string>
 #include <unordered_map>
-#include <filesystem>
-#include <fcntl.h>
-#include <unistd.h>
 
+static constexpr size_t ERROR_PAGE_MAX_SIZE = 65536; // Larger pages are not served, the response fits the write buffer
+
+/**
+ * @brief The error pages of a server, read once at start.
+ * @details
+ * An error is answered from memory: the event loop neither opens nor stats a file for it.
+ * A page which cannot be read, or is larger than `ERROR_PAGE_MAX_SIZE`, is left out with a warning.
+ * A page changed on disk is served again after a restart.
+ */
 class ErrorResponse
 {
 private: 
-    t_file  response_;
+    std::unordered_map<t_status_error_codes, std::string> pages_;
 
 public:
     ErrorResponse() = delete;
-    ErrorResponse(EpollHelper &epoll_helper);
+    explicit ErrorResponse(const std::unordered_map<t_status_error_codes, std::string> &errPages);
     ErrorResponse(const ErrorResponse &copy) = delete;
+    ErrorResponse(ErrorResponse &&other) noexcept = default;
     ErrorResponse &operator= (const ErrorResponse &copy) = delete;
     ~ErrorResponse();
     
-    t_file  getErrorPage(std::unordered_map<t_status_error_codes, std::string> &errPages, t_status_error_codes &code);
+    /**
+     * @brief The content of the page of `code`.
+     * @throws WebServErr::ErrorResponseException when the server has none.
+     */
+    const std::string &getErrorPage(t_status_error_codes code) const;
 };
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "SharedTypes.hpp"
+#include "RaiiFd.hpp"
+
+static constexpr size_t FCGI_HEADER_SIZE = 8;
+static constexpr size_t FCGI_MAX_CONTENT = 65535;           // Max content of a record.
+static constexpr size_t FCGI_MAX_CONNS_PER_APP = 8;         // Connections opened to one application server.
+static constexpr size_t FCGI_MAX_REQS_PER_CONN = 64;        // Requests multiplexed on a connection, if the application allows it.
+static constexpr size_t FCGI_MAX_PENDING = 256 * 1024;      // Bytes buffered for a pipe or a connection before reading stops.
+static constexpr size_t FCGI_IO_SIZE = 65536;               // Bytes per read.
+static constexpr std::string_view FCGI_BAD_GATEWAY = "Status: 502 Bad Gateway\r\nContent-Length: 0\r\n\r\n";
+
+/**
+ * @brief Record types, FastCGI specification section 8.
+ */
+typedef enum e_fcgi_record_type
+{
+    FCGI_BEGIN_REQUEST = 1,
+    FCGI_ABORT_REQUEST = 2,
+    FCGI_END_REQUEST = 3,
+    FCGI_PARAMS = 4,
+    FCGI_STDIN = 5,
+    FCGI_STDOUT = 6,
+    FCGI_STDERR = 7,
+    FCGI_DATA = 8,
+    FCGI_GET_VALUES = 9,
+    FCGI_GET_VALUES_RESULT = 10,
+    FCGI_UNKNOWN_TYPE = 11
+} t_fcgi_record_type;
+
+/**
+ * @brief A request for a FastCGI application, built by the `CGIHandler`, served by the `FastCgiPool`.
+ * @details
+ * The connection state machine sees a CGI: it writes the body to a pipe, and reads a CGI output from another.
+ * The pool holds the other ends, it forwards the body as STDIN records and the STDOUT records as the output.
+ */
+typedef struct s_fcgi_job
+{
+    std::string address;               // The application server, "unix:<path>" or "<host>:<port>".
+    std::string params;                // The encoded name-value pairs of the PARAMS stream.
+    size_t content_length;             // Bytes of the body, SIZE_MAX when the end is the EOF of the pipe.
+    std::shared_ptr<RaiiFd> body_fd;   // Read end of the body pipe, handed to the main loop on submission.
+    std::shared_ptr<RaiiFd> output_fd; // Write end of the output pipe, handed to the main loop on submission.
+    int body;                          // The fd of `body_fd`, -1 once closed.
+    int output;                        // The fd of `output_fd`, -1 once closed.
+    int conn_fd;                       // The connection to the application, -1 while waiting for one.
+    uint16_t request_id;
+    size_t body_sent;                  // Body bytes sent as STDIN.
+    std::string pending;               // STDOUT bytes not written to the output pipe yet.
+    bool output_started;               // Whether any output reached the pipe.
+    bool is_ended;                     // Whether the application ended the request.
+    bool is_aborted;                   // Whether the client is gone, the output is dropped.
+} t_fcgi_job;
+
+/**
+ * @brief A connection to an application server.
+ */
+typedef struct s_fcgi_conn
+{
+    int fd;
+    std::string address;
+    bool is_connected;                 // Whether the non-blocking connect completed.
+    bool can_multiplex;                // FCGI_MPXS_CONNS of the application, false till it answers.
+    size_t max_requests;               // Requests it may carry at once.
+    std::string in;                    // Received bytes not parsed yet.
+    std::string out;                   // Records to send, from `out_pos`.
+    size_t out_pos;
+    std::unordered_map<uint16_t, std::shared_ptr<t_fcgi_job>> requests; // Active requests, by id.
+} t_fcgi_conn;
+
+/**
+ * @brief The FastCGI client of a `Server`, with its persistent connections to the application servers.
+ * @details
+ * - Connections are kept open (FCGI_KEEP_CONN), up to `FCGI_MAX_CONNS_PER_APP` per application.
+ * - A new connection asks for FCGI_MPXS_CONNS and FCGI_MAX_REQS, it carries one request at a time
+ *   till the application says it multiplexes.
+ * - Requests wait in a queue when every connection is busy.
+ * - An application that cannot be reached, or drops a request before its output, answers `502`.
+ *
+ * The `Server` routes the events of the fds the pool owns to `handleEvent`.
+ */
+class FastCgiPool
+{
+private:
+    EpollHelper &epoll_;
+    std::unordered_map<int, t_fcgi_conn> conns_;                               // Connections, by fd.
+    std::unordered_map<int, std::shared_ptr<t_fcgi_job>> job_fds_;             // Body and output pipes, by fd.
+    std::unordered_map<std::string, std::deque<std::shared_ptr<t_fcgi_job>>> waiting_; // Queued requests, by application.
+
+    void dispatch(const std::string &address, t_msg_from_serv &msg);
+    bool openConn(const std::string &address, t_msg_from_serv &msg);
+    void startRequest(t_fcgi_conn &conn, std::shared_ptr<t_fcgi_job> job, t_msg_from_serv &msg);
+    void closeConn(int fd, t_msg_from_serv &msg);
+
+    void onConnEvent(t_fcgi_conn &conn, t_event_type event_type, t_msg_from_serv &msg);
+    bool processRecords(t_fcgi_conn &conn, t_msg_from_serv &msg);
+    void onBodyEvent(t_fcgi_job &job, t_msg_from_serv &msg);
+    void onOutputEvent(t_fcgi_job &job, t_event_type event_type, t_msg_from_serv &msg);
+
+    /**
+     * @brief Writes the pending output, closes the pipe once the request ended and everything is written.
+     */
+    void flushOutput(t_fcgi_job &job, t_msg_from_serv &msg);
+
+    /**
+     * @brief Ends a request the application will not answer, with a `502` if no output was sent.
+     */
+    void failJob(t_fcgi_job &job, t_msg_from_serv &msg);
+    void closeBody(t_fcgi_job &job, t_msg_from_serv &msg);
+    void closeOutput(t_fcgi_job &job, t_msg_from_serv &msg);
+
+public:
+    explicit FastCgiPool(EpollHelper &epoll);
+
+    /**
+     * @brief Whether `fd` is a connection or a pipe of the pool.
+     */
+    bool owns(int fd) const;
+
+    /**
+     * @brief Queues a request, its pipes and any new connection are returned for registration.
+     */
+    t_msg_from_serv submit(std::shared_ptr<t_fcgi_job> job);
+
+    t_msg_from_serv handleEvent(int fd, t_event_type event_type);
+};
+
+/**
+ * @brief Appends a record, `content` must fit in one.
+ */
+void fcgiAppendRecord(std::string &out, t_fcgi_record_type type, uint16_t request_id, std::string_view content);
+
+/**
+ * @brief Appends a name-value pair, in the encoding of PARAMS and GET_VALUES.
+ */
+void fcgiAppendParam(std::string &out, std::string_view name, std::string_view value);
+
+/**
+ * @brief Decodes name-value pairs, returns false if they are malformed.
+ */
+bool fcgiParseParams(std::string_view in, std::unordered_map<std::string, std::string> &params);
+
+/**
+ * @brief Starts a non-blocking connect to "unix:<path>" or "<host>:<port>", returns the socket or -1.
+ * @param is_connected Set to true when the connect completed right away.
+ */
+int connectTo(const std::string &address, bool &is_connected);
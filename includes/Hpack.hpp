@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+static constexpr size_t HPACK_STATIC_TABLE_SIZE = 61;    // Entries of the static table, RFC 7541 appendix A.
+static constexpr size_t HPACK_DEFAULT_TABLE_SIZE = 4096; // Default size of the dynamic table.
+static constexpr size_t HPACK_ENTRY_OVERHEAD = 32;       // Bytes accounted per dynamic entry, besides its name and value.
+
+typedef std::pair<std::string, std::string> t_header_field;
+typedef std::vector<t_header_field> t_header_list;
+
+/**
+ * @brief The outcome of decoding a header block.
+ */
+typedef enum e_hpack_status
+{
+    HPACK_OK,
+    HPACK_MALFORMED, // A connection error of type COMPRESSION_ERROR.
+    HPACK_TOO_LARGE  // The decoded list passed the limit, the fields were dropped.
+} t_hpack_status;
+
+/**
+ * @brief A static table entry.
+ */
+typedef struct s_hpack_field
+{
+    std::string_view name;
+    std::string_view value;
+} t_hpack_field;
+
+/**
+ * @brief The index space of HPACK (RFC 7541 section 2.3): the static table, then the dynamic table.
+ * @details
+ * Indexes 1 to 61 address the static table, the next ones the dynamic table, newest entry first.
+ * Adding an entry evicts the oldest ones till the table fits its maximum size.
+ */
+class HpackTable
+{
+private:
+    std::deque<t_header_field> dynamic_; // Newest entry first.
+    size_t size_;                        // Size of the dynamic table, overheads included.
+    size_t max_size_;                    // Maximum size of the dynamic table.
+
+    void evictTo(size_t max_size);
+
+public:
+    explicit HpackTable(size_t max_size = HPACK_DEFAULT_TABLE_SIZE);
+
+    /**
+     * @brief Gets the entry at `index`, returns false if there is none.
+     */
+    bool get(size_t index, std::string_view &name, std::string_view &value) const;
+
+    /**
+     * @brief Adds an entry, an entry larger than the table just empties it.
+     */
+    void add(std::string_view name, std::string_view value);
+
+    void setMaxSize(size_t max_size);
+    size_t maxSize() const;
+    size_t size() const;
+
+    /**
+     * @brief Searches a field, returns its index, or 0 if neither the field nor its name is found.
+     * @param name_only Set to true when only the name matched.
+     */
+    size_t find(std::string_view name, std::string_view value, bool &name_only) const;
+};
+
+/**
+ * @brief Decodes the header blocks of a connection, keeps the dynamic table of the peer's encoder.
+ */
+class HpackDecoder
+{
+private:
+    HpackTable table_;
+    size_t max_table_size_; // The limit the peer's size updates may not exceed, our SETTINGS_HEADER_TABLE_SIZE.
+
+public:
+    explicit HpackDecoder(size_t max_table_size = HPACK_DEFAULT_TABLE_SIZE);
+
+    /**
+     * @brief Decodes a complete header block, the fields are appended to `fields` in order.
+     * @param max_list_size The largest decoded list, each field counted as its name, value and 32 bytes (RFC 9113 section 6.5.2).
+     */
+    t_hpack_status decode(std::string_view block, t_header_list &fields, size_t max_list_size = SIZE_MAX);
+};
+
+/**
+ * @brief Encodes the header blocks of a connection.
+ * @details
+ * - Fields of the static or dynamic table are sent as an index.
+ * - Other fields are added to the dynamic table, except the ones changing on every response
+ *   (e.g. `content-length`, `date`), which would only evict useful entries.
+ * - Strings are Huffman coded when it makes them shorter.
+ */
+class HpackEncoder
+{
+private:
+    HpackTable table_;
+    size_t min_size_update_; // The smallest size since the last block, SIZE_MAX if none.
+    bool size_update_;       // Whether a size update is due at the start of the next block.
+
+    void encodeString(std::string &out, std::string_view str);
+
+public:
+    HpackEncoder();
+
+    /**
+     * @brief Applies the peer's SETTINGS_HEADER_TABLE_SIZE, announced at the start of the next block.
+     */
+    void setMaxTableSize(size_t max_size);
+
+    /**
+     * @brief Appends a field to the header block `out`.
+     */
+    void encode(std::string &out, std::string_view name, std::string_view value);
+};
+
+/**
+ * @brief Appends an HPACK integer with a `prefix_bits` prefix, `first` holds the flag bits of the first byte.
+ */
+void hpackEncodeInt(std::string &out, size_t value, uint8_t prefix_bits, uint8_t first);
+
+/**
+ * @brief Decodes a Huffman coded string (RFC 7541 appendix B), returns false if it is malformed.
+ */
+bool huffmanDecode(std::string_view in, std::string &out);
+
+/**
+ * @brief Returns the size of `in` once Huffman coded.
+ */
+size_t huffmanEncodedSize(std::string_view in);
+
+/**
+ * @brief Appends the Huffman code of `in`, padded with the EOS prefix.
+ */
+void huffmanEncode(std::string_view in, std::string &out);
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+#include "ChunkedDecoder.hpp"
+#include "Hpack.hpp"
+
+static constexpr std::string_view H2_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"; // The client connection preface.
+static constexpr size_t H2_FRAME_HEADER_SIZE = 9;
+static constexpr size_t H2_DEFAULT_FRAME_SIZE = 16384;         // Max frame payload, we never raise ours.
+static constexpr int64_t H2_DEFAULT_WINDOW = 65535;            // Initial window of a stream, and of the connection.
+static constexpr int64_t H2_MAX_WINDOW = 0x7fffffff;           // Largest flow-control window.
+static constexpr int64_t H2_CONNECTION_WINDOW = 1024 * 1024;   // Our receive window of the connection, for parallel uploads.
+static constexpr size_t H2_MAX_CONCURRENT_STREAMS = 100;       // Streams a client may open at once.
+static constexpr size_t H2_MAX_RESPONSE_HEAD = 64 * 1024;      // Max response head read from a gateway.
+static constexpr size_t H2_MAX_RESPONSE_BUFFER = 64 * 1024;    // Max response body buffered per stream.
+static constexpr size_t H2_MAX_OUTPUT = 256 * 1024;            // Frames queued before the socket must drain.
+static constexpr size_t H2_MAX_INPUT = H2_CONNECTION_WINDOW + H2_MAX_OUTPUT; // Bytes held unprocessed while the output drains.
+static constexpr size_t H2_IO_SIZE = 16384;                    // Bytes per read.
+
+/**
+ * @brief Frame types, RFC 9113 section 6.
+ */
+typedef enum e_h2_frame_type
+{
+    H2_DATA = 0x0,
+    H2_HEADERS = 0x1,
+    H2_PRIORITY = 0x2,
+    H2_RST_STREAM = 0x3,
+    H2_SETTINGS = 0x4,
+    H2_PUSH_PROMISE = 0x5,
+    H2_PING = 0x6,
+    H2_GOAWAY = 0x7,
+    H2_WINDOW_UPDATE = 0x8,
+    H2_CONTINUATION = 0x9
+} t_h2_frame_type;
+
+/**
+ * @brief Frame flags, the same bit has a different meaning per frame type.
+ */
+typedef enum e_h2_flag
+{
+    H2_FLAG_END_STREAM = 0x1, // DATA, HEADERS
+    H2_FLAG_ACK = 0x1,        // SETTINGS, PING
+    H2_FLAG_END_HEADERS = 0x4,
+    H2_FLAG_PADDED = 0x8,
+    H2_FLAG_PRIORITY = 0x20
+} t_h2_flag;
+
+/**
+ * @brief Error codes of RST_STREAM and GOAWAY.
+ */
+typedef enum e_h2_error
+{
+    H2_NO_ERROR = 0x0,
+    H2_PROTOCOL_ERROR = 0x1,
+    H2_INTERNAL_ERROR = 0x2,
+    H2_FLOW_CONTROL_ERROR = 0x3,
+    H2_STREAM_CLOSED = 0x5,
+    H2_FRAME_SIZE_ERROR = 0x6,
+    H2_REFUSED_STREAM = 0x7,
+    H2_CANCEL = 0x8,
+    H2_COMPRESSION_ERROR = 0x9,
+    H2_ENHANCE_YOUR_CALM = 0xb
+} t_h2_error;
+
+/**
+ * @brief Settings identifiers.
+ */
+typedef enum e_h2_setting
+{
+    H2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    H2_SETTINGS_ENABLE_PUSH = 0x2,
+    H2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    H2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    H2_SETTINGS_MAX_FRAME_SIZE = 0x5,
+    H2_SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+} t_h2_setting;
+
+/**
+ * @brief How the end of a response body read from a gateway is found.
+ */
+typedef enum e_h2_res_state
+{
+    H2_RES_HEAD,     // Reading the response head.
+    H2_RES_LENGTH,   // The body has a Content-Length.
+    H2_RES_CHUNKED,  // The body is chunked.
+    H2_RES_UNTIL_EOF,// The body ends when the gateway is closed.
+    H2_RES_DONE      // The whole body is read.
+} t_h2_res_state;
+
+/**
+ * @brief A stream, with the gateway connection serving its request.
+ */
+typedef struct s_h2_stream
+{
+    uint32_t id;
+    int gateway_fd;              // Our end of the gateway socket, -1 before it is attached or once closed.
+    bool end_stream_received;    // Whether the client finished the request.
+    bool is_chunked_request;     // Whether the request body is forwarded with the chunked coding.
+    size_t expected_length;      // The Content-Length of the request, SIZE_MAX if none.
+    size_t data_received;        // Request body bytes received.
+    std::string to_gateway;      // Request bytes not written to the gateway yet.
+    size_t uncredited;           // Received DATA bytes not given back with a WINDOW_UPDATE yet.
+    int64_t recv_window;         // Our receive window of the stream.
+    int64_t send_window;         // The peer's receive window of the stream.
+    t_h2_res_state res_state;
+    std::string res_head;        // The response head, till it is complete.
+    size_t res_remaining;        // Body bytes still expected, in H2_RES_LENGTH.
+    ChunkedDecoder res_decoder;  // Body decoder, in H2_RES_CHUNKED.
+    t_header_list res_fields;    // Response fields, encoded when the HEADERS frame is sent.
+    bool res_head_ready;         // Whether the response head is parsed.
+    bool headers_sent;           // Whether the HEADERS frame is sent.
+    std::string res_body;        // Body bytes not sent yet, from `res_body_pos`.
+    size_t res_body_pos;
+    bool res_end;                // Whether the body is complete, END_STREAM is sent after `res_body`.
+} t_h2_stream;
+
+/**
+ * @brief An HTTP/2 connection (RFC 9113), in cleartext.
+ * @details
+ * The session parses the frames, keeps the HPACK contexts and the flow-control windows,
+ * and multiplexes the responses of its streams on the connection.
+ *
+ * ## Gateways
+ * Each stream is served by the HTTP/1.1 state machine of the `Server`, unchanged:
+ * the request is translated to HTTP/1.1 and written to a gateway socket,
+ * whose other end is a regular connection of the server.
+ * The response read back is translated to HEADERS and DATA frames.
+ * So GET, POST, DELETE, CGI, redirects and error pages work the same on both protocols.
+ *
+ * The gateway requests carry `Connection: close`, the end of a response is known by its
+ * `Content-Length`, its chunked coding, or the close.
+ *
+ * ## Flow control
+ * - Request DATA is given back to the client once written to the gateway,
+ *   so a slow handler holds at most about one window per stream.
+ * - Response DATA is sent within the windows of the client, round-robin over the streams,
+ *   so a large download does not block the other streams.
+ *
+ * ## I/O
+ * The session owns its socket buffers, the `Server` calls it on the events of the socket
+ * and of the gateways, then opens and closes the gateways it asks for.
+ */
+class Http2Session
+{
+private:
+    std::string in_;                           // Received bytes not parsed yet, from `in_pos_`.
+    size_t in_pos_;
+    std::string out_;                          // Bytes to send, from `out_pos_`.
+    size_t out_pos_;
+    bool preface_received_;
+    bool is_closing_;                          // A GOAWAY is sent after a connection error, the connection closes once it is written.
+    bool peer_goaway_;                         // The client sent a GOAWAY.
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+    std::map<uint32_t, t_h2_stream> streams_;  // Open streams, by id.
+    std::unordered_map<int, uint32_t> gateways_; // Gateway fds to their stream.
+    uint32_t last_stream_id_;                  // Highest stream id opened by the client.
+    uint32_t last_sent_stream_;                // Stream of the last DATA frame, for round-robin.
+    uint32_t header_stream_;                   // Stream of an unfinished header block, 0 if none.
+    uint8_t header_flags_;                     // Flags of the HEADERS frame starting the block.
+    std::string header_block_;                 // The header block fragments received so far.
+    size_t max_header_list_size_;              // Our SETTINGS_MAX_HEADER_LIST_SIZE.
+    int64_t conn_recv_window_;
+    int64_t conn_send_window_;
+    size_t conn_uncredited_;                   // Received DATA bytes of the connection, not given back yet.
+    int64_t peer_initial_window_;              // The peer's SETTINGS_INITIAL_WINDOW_SIZE.
+    size_t peer_max_frame_size_;               // The peer's SETTINGS_MAX_FRAME_SIZE.
+    std::vector<uint32_t> opened_;             // New streams, waiting for a gateway.
+    std::vector<int> closed_gateways_;         // Gateway fds to close.
+
+    void appendFrameHeader(size_t length, uint8_t type, uint8_t flags, uint32_t stream_id);
+    void appendFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+    void appendWindowUpdate(uint32_t stream_id, size_t increment);
+
+    /**
+     * @brief Sends a GOAWAY and stops reading, returns false so the caller stops too.
+     */
+    bool connectionError(t_h2_error code);
+
+    /**
+     * @brief Sends a RST_STREAM and closes the stream.
+     */
+    void resetStream(uint32_t stream_id, t_h2_error code);
+
+    /**
+     * @brief Closes a stream and its gateway, the DATA not given back is given back to the connection.
+     */
+    void closeStream(uint32_t stream_id);
+
+    /**
+     * @brief Processes the complete frames of the input, till the output holds `H2_MAX_OUTPUT` bytes.
+     */
+    void processInput();
+    bool processFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+    bool onData(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    bool onHeaders(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    bool onContinuation(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    bool onSettings(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    bool onWindowUpdate(uint32_t stream_id, std::string_view payload);
+
+    /**
+     * @brief Decodes a complete header block, then opens a stream, or ends one with its trailers.
+     */
+    bool finishHeaderBlock();
+
+    /**
+     * @brief Applies a SETTINGS payload, returns the error, or H2_NO_ERROR.
+     */
+    t_h2_error applySettings(std::string_view payload);
+
+    /**
+     * @brief Translates the request fields to an HTTP/1.1 request head, returns false if the request is malformed.
+     */
+    bool buildRequest(const t_header_list &fields, bool end_stream, t_h2_stream &stream);
+
+    /**
+     * @brief Marks the end of the request, the body length is checked against its Content-Length.
+     */
+    void endRequest(t_h2_stream &stream);
+
+    /**
+     * @brief Parses the response head read from the gateway, returns false if it is malformed.
+     */
+    bool parseResponseHead(t_h2_stream &stream, std::string_view head);
+    void appendResponseBody(t_h2_stream &stream, std::string_view data);
+
+    /**
+     * @brief Gives back the DATA written to the gateways with WINDOW_UPDATE frames.
+     */
+    void sendCredits(t_h2_stream *stream);
+
+    /**
+     * @brief Queues the HEADERS, and the DATA the windows allow.
+     */
+    void flushStreams();
+    void sendHeaders(t_h2_stream &stream);
+
+    /**
+     * @brief Called once END_STREAM is sent, closes the stream, or resets it if the request is still coming.
+     */
+    void finishResponse(uint32_t stream_id);
+
+public:
+    /**
+     * @param max_header_list_size The largest request head accepted, announced to the client.
+     */
+    explicit Http2Session(size_t max_header_list_size);
+
+    /**
+     * @brief Queues the server preface: our SETTINGS, and the larger connection window.
+     */
+    void start();
+
+    /**
+     * @brief Starts a session upgraded from HTTP/1.1 (`Upgrade: h2c`).
+     * @param settings The `HTTP2-Settings` header, a base64url SETTINGS payload.
+     * @param request The upgrading request, translated for the gateway, answered on stream 1.
+     * @return false if the settings are malformed, then the request is served in HTTP/1.1.
+     */
+    bool upgrade(std::string_view settings, std::string request);
+
+    /**
+     * @brief Processes bytes received on the connection.
+     * @details
+     * Past `H2_MAX_INPUT` unprocessed bytes the connection fails with ENHANCE_YOUR_CALM.
+     */
+    void feed(std::string_view bytes);
+
+    /**
+     * @brief Reads from the socket and processes the frames.
+     * @return The bytes read, `EOF_REACHED` or `RW_ERROR`.
+     */
+    ssize_t readSocket(int fd);
+
+    /**
+     * @brief Writes the queued frames to the socket.
+     * @return The bytes written, or `RW_ERROR`.
+     */
+    ssize_t writeSocket(int fd);
+
+    /**
+     * @brief Reads the response of a stream from its gateway.
+     */
+    void readGateway(int fd);
+
+    /**
+     * @brief Writes the request of a stream to its gateway.
+     */
+    void writeGateway(int fd);
+
+    /**
+     * @brief Processes response bytes read from a gateway, `data` empty means EOF.
+     */
+    void onGatewayData(int fd, std::string_view data);
+
+    /**
+     * @brief Returns the request bytes not written to a gateway yet.
+     */
+    std::string_view gatewayOutput(int fd) const;
+
+    /**
+     * @brief Returns the new streams, each needs a gateway.
+     */
+    std::vector<uint32_t> takeOpenedStreams();
+
+    void attachGateway(uint32_t stream_id, int fd);
+
+    /**
+     * @brief Resets a stream that could not get a gateway.
+     */
+    void refuseStream(uint32_t stream_id);
+
+    /**
+     * @brief Returns the gateways to close.
+     */
+    std::vector<int> takeClosedGateways();
+
+    /**
+     * @brief Returns all the gateways, open or to close.
+     */
+    std::vector<int> gatewayFds() const;
+
+    /**
+     * @brief Returns the frames not written yet.
+     */
+    std::string_view output() const;
+
+    /**
+     * @brief Drops the first `size` bytes of the output, once written.
+     */
+    void consumeOutput(size_t size);
+
+    /**
+     * @brief Whether the connection can be closed: after a GOAWAY, once all is written.
+     */
+    bool isDone() const;
+};
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief IDs of the well-known request headers.
+ * @details
+ * The last entries are not real HTTP headers, they are derived by the parser
+ * (`host` is split into `servername` and `requestport`, `content-type` yields `boundary`).
+ */
+typedef enum e_header_id
+{
+    HDR_HOST,
+    HDR_CONNECTION,
+    HDR_CONTENT_LENGTH,
+    HDR_CONTENT_TYPE,
+    HDR_TRANSFER_ENCODING,
+    HDR_COOKIE,
+    HDR_EXPECT,
+    HDR_UPGRADE,
+    HDR_HTTP2_SETTINGS,
+    HDR_TE,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_ACCEPT_LANGUAGE,
+    HDR_USER_AGENT,
+    HDR_REFERER,
+    HDR_ORIGIN,
+    HDR_AUTHORIZATION,
+    HDR_CACHE_CONTROL,
+    HDR_PRAGMA,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_IF_NONE_MATCH,
+    HDR_RANGE,
+    HDR_SERVERNAME,
+    HDR_REQUESTPORT,
+    HDR_BOUNDARY,
+    HDR_COUNT,
+    HDR_UNKNOWN = HDR_COUNT
+} t_header_id;
+
+/**
+ * @brief Lowercase names of the well-known headers, indexed by `t_header_id`.
+ */
+inline constexpr std::array<std::string_view, HDR_COUNT> KNOWN_HEADER_NAMES = {
+    "host",
+    "connection",
+    "content-length",
+    "content-type",
+    "transfer-encoding",
+    "cookie",
+    "expect",
+    "upgrade",
+    "http2-settings",
+    "te",
+    "accept",
+    "accept-encoding",
+    "accept-language",
+    "user-agent",
+    "referer",
+    "origin",
+    "authorization",
+    "cache-control",
+    "pragma",
+    "if-modified-since",
+    "if-none-match",
+    "range",
+    "servername",
+    "requestport",
+    "boundary",
+};
+
+inline constexpr size_t HEADER_HASH_SLOTS = 64; // Power of 2, a bit more than 2x the known headers.
+
+/**
+ * @brief Hashes a header name by its length and 3 sampled bytes, so the cost does not depend on the name length.
+ */
+constexpr uint32_t headerHash(std::string_view name, uint32_t seed)
+{
+    if (name.empty())
+        return 0;
+    uint32_t h = seed ^ static_cast<uint32_t>(name.size());
+    h = (h ^ static_cast<unsigned char>(name[0])) * 0x9E3779B1u;
+    h = (h ^ static_cast<unsigned char>(name[name.size() / 2])) * 0x85EBCA77u;
+    h = (h ^ static_cast<unsigned char>(name[name.size() - 1])) * 0xC2B2AE3Du;
+    return (h ^ (h >> 15)) & (HEADER_HASH_SLOTS - 1);
+}
+
+/**
+ * @brief Searches, at compile time, the first seed which maps every known header to its own slot.
+ */
+constexpr uint32_t findHeaderSeed()
+{
+    for (uint32_t seed = 1; seed < 1000000; ++seed)
+    {
+        std::array<bool, HEADER_HASH_SLOTS> used{};
+        bool ok = true;
+        for (const auto &name : KNOWN_HEADER_NAMES)
+        {
+            const uint32_t slot = headerHash(name, seed);
+            if (used[slot])
+            {
+                ok = false;
+                break;
+            }
+            used[slot] = true;
+        }
+        if (ok)
+            return seed;
+    }
+    return 0;
+}
+
+inline constexpr uint32_t HEADER_HASH_SEED = findHeaderSeed();
+static_assert(HEADER_HASH_SEED != 0, "No perfect hash seed found for the known headers");
+
+/**
+ * @brief The perfect-hash table, maps a hash slot to the header ID living there, or `HDR_UNKNOWN`.
+ */
+constexpr std::array<uint8_t, HEADER_HASH_SLOTS> buildHeaderSlots()
+{
+    std::array<uint8_t, HEADER_HASH_SLOTS> slots{};
+    for (auto &slot : slots)
+        slot = HDR_UNKNOWN;
+    for (size_t id = 0; id < HDR_COUNT; ++id)
+        slots[headerHash(KNOWN_HEADER_NAMES[id], HEADER_HASH_SEED)] = static_cast<uint8_t>(id);
+    return slots;
+}
+
+inline constexpr std::array<uint8_t, HEADER_HASH_SLOTS> HEADER_SLOTS = buildHeaderSlots();
+
+/**
+ * @brief Maps a lowercase header name to its ID, or `HDR_UNKNOWN`.
+ */
+constexpr t_header_id headerIdOf(std::string_view name)
+{
+    const t_header_id id = static_cast<t_header_id>(HEADER_SLOTS[headerHash(name, HEADER_HASH_SEED)]);
+    if (id == HDR_UNKNOWN || KNOWN_HEADER_NAMES[id] != name)
+        return HDR_UNKNOWN;
+    return id;
+}
+
+static_assert(headerIdOf("content-length") == HDR_CONTENT_LENGTH);
+static_assert(headerIdOf("x-forwarded-for") == HDR_UNKNOWN);
+
+/**
+ * @brief The header storage of a request.
+ * @details
+ * Well-known headers are stored in a fixed slot array indexed by `t_header_id`,
+ * the ID is resolved once by the perfect hash when the header is parsed.
+ * Unknown headers go to a fallback list, in the order they were received.
+ *
+ * All names are expected to be lowercase, as produced by the request parser.
+ * Hot paths should use the `t_header_id` overloads, which are a plain array index.
+ */
+class HttpHeaders
+{
+private:
+    std::array<std::string, HDR_COUNT> known_;                 // Values of the known headers.
+    std::bitset<HDR_COUNT> present_;                           // Which known headers are set.
+    std::vector<std::pair<std::string, std::string>> unknown_; // Fallback list for the other headers.
+
+    std::string *findUnknown(std::string_view name);
+    const std::string *findUnknown(std::string_view name) const;
+
+public:
+    HttpHeaders() = default;
+    HttpHeaders(const HttpHeaders &other) = default;
+    HttpHeaders &operator=(const HttpHeaders &other) = default;
+    ~HttpHeaders() = default;
+
+    /**
+     * @brief Returns a pointer to the value of the header, or nullptr if it is not set.
+     */
+    const std::string *find(t_header_id id) const;
+    const std::string *find(std::string_view name) const;
+
+    bool contains(t_header_id id) const;
+    bool contains(std::string_view name) const;
+
+    /**
+     * @brief Returns the value of the header.
+     * @throws std::out_of_range if the header is not set.
+     */
+    const std::string &at(t_header_id id) const;
+    const std::string &at(std::string_view name) const;
+
+    /**
+     * @brief Returns the value of the header, inserts an empty one if it is not set.
+     */
+    std::string &operator[](t_header_id id);
+    std::string &operator[](std::string_view name);
+
+    /**
+     * @brief Sets the header, overwriting any previous value.
+     */
+    void set(std::string_view name, std::string value);
+
+    /**
+     * @brief Removes the header if it is set.
+     */
+    void erase(t_header_id id);
+
+    /**
+     * @brief Returns the number of headers set.
+     */
+    size_t size() const;
+
+    void clear();
+
+    /**
+     * @brief Calls `fn(name, value)` for every header, known headers first.
+     */
+    template <typename F>
+    void forEach(F &&fn) const
+    {
+        for (size_t id = 0; id < HDR_COUNT; ++id)
+        {
+            if (present_[id])
+                fn(KNOWN_HEADER_NAMES[id], known_[id]);
+        }
+        for (const auto &kv : unknown_)
+            fn(std::string_view(kv.first), kv.second);
+    }
+};
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <algorithm>
 #include "SharedTypes.hpp"
+#include "HttpHeaders.hpp"
 #include "WebServErr.hpp"
 #include "LogSys.hpp"
 
@@ -11,7 +12,7 @@ class HttpRequests
 {
 private:
 	size_t upToBodyCounter;
-	std::unordered_map<std::string, std::string> requestHeaderMap;
+	HttpHeaders requestHeaderMap;
 	std::unordered_map<std::string, std::string> requestLineMap;
 	std::unordered_map<std::string, std::string> requestBodyMap;
 	bool is_chunked;
@@ -51,7 +52,7 @@ public:
 	// getters
 	size_t getupToBodyCounter();
 
-	std::unordered_map<std::string, std::string> getrequestHeaderMap();
+	const HttpHeaders &getrequestHeaderMap() const;
 	std::unordered_map<std::string, std::string> getrequestLineMap();
 	std::unordered_map<std::string, std::string> getrequestBodyMap();
 
@@ -21,5 +21,14 @@ public:
 
     std::string successResponse(t_conn *conn, Cookie &cookie);
     std::string failedResponse(t_conn *conn, t_status_error_codes error_code, const std::string &error_message,size_t errPageSize, Cookie &cookie);
-    std::string CGIResponse(std::string_view cgiString);
+
+    /**
+     * @brief Builds the HTTP response head from the header of a CGI output.
+     * @details
+     * Sets `conn->res_framing`, and `conn->output_length` when the CGI sends a `Content-Length`.
+     * @param cgi_head_size Set to the size of the CGI header, the empty line included.
+     * @throws WebServErr::CgiHeaderNotFound when the header is not complete yet.
+     * @throws WebServErr::InvalidCgiHeader when the header is malformed, or larger than `max_size`.
+     */
+    std::string CGIResponse(t_conn *conn, std::string_view cgi_output, size_t max_size, size_t &cgi_head_size);
 };
\ No newline at end of file
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "SharedTypes.hpp"
+#include "RaiiFd.hpp"
+
+/**
+ * @brief A blocking call run by the `IoPool`.
+ */
+typedef struct s_io_task
+{
+    std::function<void()> work;                  // Runs on a worker thread, it only touches what it captured
+    std::function<void(t_msg_from_serv &)> done; // Runs on the event loop once the work returned
+} t_io_task;
+
+/**
+ * @brief The state shared by the event loop and the workers.
+ */
+typedef struct s_io_queue
+{
+    std::mutex mutex;
+    std::condition_variable ready;   // Signaled on a new task, or the stop
+    std::deque<t_io_task> tasks;     // Waiting for a worker
+    std::deque<t_io_task> completed; // Waiting for the event loop
+    int wake;                        // Write end of the pipe waking the event loop
+    unsigned int idle;               // Workers waiting for a task
+    bool is_stopping;
+} t_io_queue;
+
+/**
+ * @brief A few threads running the blocking file-system calls of a `Server`, off the event loop.
+ * @details
+ * - A thread is started when a task finds none idle, up to the size: a server which never blocks has none,
+ *   and a slow call does not hold the tasks behind it while the pool can grow.
+ * - A worker writes a byte to a pipe when a task is done, the event loop reads it and runs the `done` of the tasks.
+ *   A pipe rather than an eventfd: every fd is registered for `EPOLLOUT`, and an eventfd is always writable.
+ * - Tasks run in any order and in parallel, a caller needing an order submits the next one from `done`.
+ * - A `done` is called even when its caller is gone, it must check that itself.
+ *
+ * The `Server` routes the events of the pipe to `handleEvent`.
+ */
+class IoPool
+{
+private:
+    EpollHelper &epoll_;
+    unsigned int size_;                  // Threads at most, started when a task finds none idle
+    std::unique_ptr<t_io_queue> queue_;  // Not moved with the pool once the threads run
+    std::vector<std::thread> threads_;
+    std::shared_ptr<RaiiFd> wake_in_;    // Read end of the wake-up pipe, -1 till the first task
+    std::shared_ptr<RaiiFd> wake_out_;
+
+    static void run(t_io_queue &queue);
+
+public:
+    IoPool(EpollHelper &epoll, unsigned int size);
+    IoPool(IoPool &&other) = default;
+    IoPool(const IoPool &) = delete;
+    IoPool &operator=(const IoPool &) = delete;
+
+    /**
+     * @brief Stops the workers after their current task, the waiting tasks are dropped.
+     */
+    ~IoPool();
+
+    bool owns(int fd) const;
+
+    /**
+     * @brief Queues a task, the first one also returns the wake-up pipe for registration.
+     */
+    t_msg_from_serv submit(t_io_task task);
+
+    /**
+     * @brief Runs the `done` of the completed tasks.
+     */
+    t_msg_from_serv handleEvent(int fd, t_event_type event_type);
+};
@@ -5,6 +5,7 @@
 #include <chrono>
 #include <sstream>
 #include <queue>
+#include <mutex>
 
 typedef enum e_priority {
     TRACE, DEBUG, INFO, WARN, ERROR, FATAL
@@ -21,6 +22,7 @@ class LogSys {
 private:
     t_priority priority_ = TRACE;
     std::queue<LogMessage> logQueue;
+    std::mutex mutex_; // The I/O pool logs from its threads
     const size_t autoFlushSize = 1; // Flush automatically when queue reaches this size
 
     LogSys() {}
@@ -44,6 +46,7 @@ private:
                  const char* function, Args&&... args) 
     {
         if(priority_ <= prio) {
+            std::lock_guard<std::mutex> lock(mutex_);
             logQueue.push({priority_str, prio, function, formatMessage(std::forward<Args>(args)...)});
             if(logQueue.size() >= autoFlushSize) {
                 flush(); // Automatically flush when queue grows too large
@@ -108,6 +111,7 @@ public:
 
     // Manual flush
     static void flushLogs() {
+        std::lock_guard<std::mutex> lock(getLogSys().mutex_);
         getLogSys().flush();
     }
 };
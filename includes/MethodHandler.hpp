@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cerrno>
 #include <cstddef>
 #include <cstdint>
 #include <unordered_map>
@@ -15,18 +16,24 @@
 #include <algorithm>
 #include <fstream>
 #include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
 #include <iomanip>
 #include <ctime>
 #include <random>
 #include <unistd.h>
 
 #include "SharedTypes.hpp"
+#include "HttpHeaders.hpp"
 #include "LogSys.hpp"
 #include "WebServErr.hpp"
 #include "Config.hpp"
 #include "CGIHandler.hpp"
+#include "ProxyPool.hpp"
+#include "UploadQuota.hpp"
 #include "RaiiFd.hpp"
 #include "urlHelper.hpp"
+#include "utils.hpp"
 
 #define MAX_BODY_SIZE 1024
 
@@ -41,33 +48,42 @@ class MethodHandler
 {
 private:
 	t_file requested_;
+	UploadQuota &quota_;
+	EpollHelper &epoll_helper_;
 
 	t_file callGetMethod(bool useAutoIndex, std::filesystem::path &path, std::string &targetRef);
-	t_file callPostMethod(std::filesystem::path &path, std::unordered_map<std::string, std::string> requestHeader, std::string &targetRef, const std::string &root);
+	t_file handleBeneath(const t_location_config &location, t_method method, const std::string &path, const HttpHeaders &requestHeader, std::string &targetRef);
+	t_file callPostMethod(std::filesystem::path &path, int dirFd, const HttpHeaders &requestHeader, std::string &targetRef, const t_location_config &location);
 	void callDeleteMethod(std::filesystem::path &path);
-	t_file callCGIMethod(std::string &targetRef, std::unordered_map<std::string, std::string> requestLine, std::unordered_map<std::string, std::string> requestHeader, EpollHelper &epoll_helper, t_server_config &server);
+	t_file callCGIMethod(std::string &targetRef, std::unordered_map<std::string, std::string> requestLine, const HttpHeaders &requestHeader, EpollHelper &epoll_helper, t_server_config &server);
+	t_file callProxyMethod(const t_proxy_config &proxy, t_method method, std::string &targetRef, std::unordered_map<std::string, std::string> &requestLine, const HttpHeaders &requestHeader, EpollHelper &epoll_helper);
 
-	void setContentLength(std::unordered_map<std::string, std::string> requestHeader);
+	void setContentLength(const HttpHeaders &requestHeader);
 	void checkContentType(std::unordered_map<std::string, std::string> requestBody) const;
 	void checkIfRegFile(const std::filesystem::path &path);
 	bool checkIfDirectory(std::unordered_map<std::string, t_location_config> &locations, std::filesystem::path &path, const std::string &rootDestination, const std::string &targetRef);
 	void checkIfLocExists(const std::filesystem::path &path);
 	bool checkIfSafe(const std::filesystem::path &root, const std::filesystem::path &path);
-	size_t	checkFileCount(const std::string &root);
 
 	// std::string matchLocation(std::unordered_map<std::string, t_location_config> &locations, std::string &targetRef);
 	
 	std::filesystem::path createRealPath(const std::string &server, const std::string &target);
-	std::filesystem::path createRandomFilename(std::filesystem::path &path, std::string &extension);
+	int createUploadFile(std::filesystem::path &path, int dirFd, std::string &extension, t_upload &upload);
+
+	/**
+	 * @brief Opens `relative` beneath the root fd, without following a symlink.
+	 * @throws WebServErr::MethodException 404 if it does not exist, 403 if it leaves the root, 500 on a symlink.
+	 */
+	int openBeneath(int rootFd, const std::string &relative, uint64_t flags);
 	std::string generateDynamicPage(std::filesystem::path &path, std::string &targetRef);
 	bool	canAccess(std::filesystem::path &path, t_access access_type);
 
 public:
 	MethodHandler() = delete;
-	MethodHandler(EpollHelper &epoll_helper);
+	MethodHandler(EpollHelper &epoll_helper, UploadQuota &quota);
 	MethodHandler(const MethodHandler &copy) = delete;
 	~MethodHandler();
 	MethodHandler &operator=(const MethodHandler &copy) = delete;
 
-	t_file handleRequest(t_server_config server, std::unordered_map<std::string, std::string> requestLine, std::unordered_map<std::string, std::string> requestHeader, EpollHelper &epoll_helper);
+	t_file handleRequest(t_server_config server, std::unordered_map<std::string, std::string> requestLine, const HttpHeaders &requestHeader, EpollHelper &epoll_helper);
 };
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstddef>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "SharedTypes.hpp"
+#include "RaiiFd.hpp"
+#include "HttpHeaders.hpp"
+#include "ChunkedDecoder.hpp"
+
+static constexpr size_t PROXY_IO_SIZE = 65536;                // Bytes per read.
+static constexpr size_t PROXY_MAX_PENDING = 256 * 1024;       // Bytes buffered for a pipe or a connection before reading stops.
+static constexpr size_t PROXY_MAX_HEAD = 64 * 1024;           // Max size of a response head of an upstream.
+static constexpr size_t PROXY_MAX_IDLE = 32;                  // Kept-alive connections per upstream.
+static constexpr time_t PROXY_IDLE_TIMEOUT = 60;              // Seconds an idle connection is kept.
+static constexpr time_t PROXY_CONNECT_TIMEOUT = 5;            // Seconds a connect may take.
+static constexpr std::string_view PROXY_BAD_GATEWAY = "Status: 502 Bad Gateway\r\nContent-Length: 0\r\n\r\n";
+
+/**
+ * @brief How the body of a response of an upstream ends.
+ */
+typedef enum e_proxy_framing
+{
+    PROXY_BODY_NONE,    // No body: 204, 304.
+    PROXY_BODY_LENGTH,  // After `Content-Length` bytes.
+    PROXY_BODY_CHUNKED, // After the last chunk.
+    PROXY_BODY_CLOSE    // At the EOF, the connection is not reused.
+} t_proxy_framing;
+
+/**
+ * @brief A request for the upstreams of a proxy location, built by the `MethodHandler`, served by the `ProxyPool`.
+ * @details
+ * As for FastCGI, the connection state machine sees a CGI: it writes the body to a pipe, and reads a CGI output from another.
+ * The pool forwards the body to an upstream, and the response as a CGI output: its status line becomes a `Status` field.
+ */
+typedef struct s_proxy_job
+{
+    t_proxy_config config;             // The upstreams of the location.
+    std::string group;                 // Key of the upstream list, for the round-robin.
+    std::string head;                  // The request line and fields sent upstream, without the empty line.
+    size_t content_length;             // Bytes of the body, SIZE_MAX when the end is the EOF of the pipe, sent chunked.
+    bool is_idempotent;                // Whether it may be sent again to another upstream.
+    std::shared_ptr<RaiiFd> body_fd;   // Read end of the body pipe, handed to the main loop on submission.
+    std::shared_ptr<RaiiFd> output_fd; // Write end of the output pipe, handed to the main loop on submission.
+    int body;                          // The fd of `body_fd`, -1 once closed.
+    int output;                        // The fd of `output_fd`, -1 once closed.
+    int conn_fd;                       // The connection to the upstream, -1 while it has none.
+    std::vector<std::string> tried;    // Upstreams tried, the last one included.
+    size_t body_sent;                  // Body bytes sent.
+    std::string pending;               // Output bytes not written to the output pipe yet.
+    bool output_started;               // Whether the upstream answered, it is not retried anymore.
+    bool is_ended;                     // Whether the response is complete, or failed.
+    bool is_aborted;                   // Whether the client is gone, the output is dropped.
+} t_proxy_job;
+
+/**
+ * @brief A connection to an upstream, carrying one request at a time.
+ */
+typedef struct s_proxy_conn
+{
+    int fd;
+    std::string address;
+    bool is_connected;                 // Whether the non-blocking connect completed.
+    time_t since;                      // When the connect started, or the connection became idle.
+    std::string out;                   // Bytes to send, from `out_pos`.
+    size_t out_pos;
+    std::string in;                    // Received bytes not parsed yet.
+    std::shared_ptr<t_proxy_job> job;  // nullptr while idle.
+    bool is_head_done;                 // Whether the response head was parsed.
+    t_proxy_framing framing;
+    size_t remaining;                  // Body bytes left, for `PROXY_BODY_LENGTH`.
+    ChunkedDecoder decoder;
+    bool keep_alive;                   // Whether it may carry another request.
+} t_proxy_conn;
+
+/**
+ * @brief The state of an upstream, shared by the locations using it.
+ */
+typedef struct s_upstream
+{
+    size_t active;                     // Requests being served.
+    unsigned int fails;                // Failures in a row.
+    time_t down_until;                 // Skipped till then, after `max_fails` failures.
+    std::vector<int> idle;             // Kept-alive connections, the newest last.
+} t_upstream;
+
+/**
+ * @brief The reverse proxy of a `Server`, with its pools of keep-alive connections to the upstreams.
+ * @details
+ * - A request goes to an upstream of its location, in turn or to the least busy one.
+ *   An idle connection to it is reused, else one is opened.
+ * - Passive health check: an upstream failing `max_fails` times in a row (connect, reset, malformed or
+ *   truncated response) is skipped for `fail_timeout` seconds. If all are skipped, they are tried anyway.
+ * - A GET or DELETE which fails before the response starts is sent to the next upstream.
+ *   Anything else failing before its response answers `502`.
+ * - The body is sent with its `Content-Length`, or chunked when the client sent it chunked.
+ * - A complete response leaves its connection idle for the next request, unless the upstream closes it.
+ *   Idle connections are out of the epoll, one closed by the upstream is found when it is reused.
+ *
+ * The `Server` routes the events of the fds the pool owns to `handleEvent`.
+ */
+class ProxyPool
+{
+private:
+    EpollHelper &epoll_;
+    std::unordered_map<int, t_proxy_conn> conns_;                        // Connections, by fd.
+    std::unordered_map<int, std::shared_ptr<t_proxy_job>> job_fds_;      // Body and output pipes, by fd.
+    std::unordered_map<std::string, t_upstream> upstreams_;              // By address.
+    std::unordered_map<std::string, size_t> next_;                       // Round-robin positions, by upstream list.
+
+    /**
+     * @brief The next upstream of the request, nullptr once none is left to try.
+     */
+    const std::string *pick(const t_proxy_job &job, time_t now);
+
+    /**
+     * @brief Sends the request to the upstreams in turn till a connection is found, returns false if none is.
+     */
+    bool dispatch(const std::shared_ptr<t_proxy_job> &job, t_msg_from_serv &msg);
+    void startRequest(t_proxy_conn &conn, const std::shared_ptr<t_proxy_job> &job, t_msg_from_serv &msg);
+    void endResponse(t_proxy_conn &conn, t_msg_from_serv &msg);
+    void closeConn(int fd, t_msg_from_serv &msg);
+
+    /**
+     * @brief Closes a failed connection, its request is retried or fails.
+     */
+    void failConn(int fd, t_msg_from_serv &msg);
+    void markFailure(const std::string &address, const t_proxy_config &config, time_t now);
+
+    void onConnEvent(t_proxy_conn &conn, t_event_type event_type, t_msg_from_serv &msg);
+    bool processResponse(t_proxy_conn &conn, t_msg_from_serv &msg);
+    void onBodyEvent(t_proxy_job &job, t_msg_from_serv &msg);
+    void onOutputEvent(t_proxy_job &job, t_event_type event_type, t_msg_from_serv &msg);
+
+    /**
+     * @brief Writes the pending output, closes the pipe once the response ended and everything is written.
+     */
+    void flushOutput(t_proxy_job &job, t_msg_from_serv &msg);
+
+    /**
+     * @brief Ends a request no upstream will answer, with a `502` if no output was sent.
+     */
+    void failJob(t_proxy_job &job, t_msg_from_serv &msg);
+    void closeBody(t_proxy_job &job, t_msg_from_serv &msg);
+    void closeOutput(t_proxy_job &job, t_msg_from_serv &msg);
+
+public:
+    explicit ProxyPool(EpollHelper &epoll);
+
+    /**
+     * @brief Whether `fd` is a connection or a pipe of the pool.
+     */
+    bool owns(int fd) const;
+
+    /**
+     * @brief Sends a request upstream, its pipes and any new connection are returned for registration.
+     */
+    t_msg_from_serv submit(std::shared_ptr<t_proxy_job> job);
+
+    t_msg_from_serv handleEvent(int fd, t_event_type event_type);
+
+    /**
+     * @brief Fails the connects which take too long, closes the connections idle for too long.
+     */
+    t_msg_from_serv tick(time_t now);
+};
+
+/**
+ * @brief Builds the head of a request forwarded upstream, without its empty line.
+ * @details
+ * The decoded target is encoded again. The fields about the connection, the framing and `Expect`
+ * are dropped; the framing of the body is set from `content_length`.
+ */
+std::string proxyRequestHead(std::string_view method, std::string_view target, const HttpHeaders &headers, size_t content_length);
+
+/**
+ * @brief Turns the head of a response of an upstream into a CGI header.
+ * @param head The status line and the fields, up to the empty line included.
+ * @param status Set to the status code.
+ * @param cgi_header Set to the CGI header, empty line included.
+ * @param framing Set to how the body ends, `remaining` to its length.
+ * @param keep_alive Set to whether the connection may be reused.
+ * @return False if the head is malformed.
+ */
+bool proxyResponseHead(std::string_view head, int &status, std::string &cgi_header, t_proxy_framing &framing, size_t &remaining, bool &keep_alive);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+// Preformatted header fragments
+static constexpr std::string_view FIELD_CONNECTION_CLOSE = "Connection: close\r\n";
+static constexpr std::string_view FIELD_CONTENT_TYPE_HTML = "Content-Type: text/html\r\n";
+static constexpr std::string_view FIELD_TRANSFER_ENCODING_CHUNKED = "Transfer-Encoding: chunked\r\n";
+
+/**
+ * @brief Serializes a response head into a string, usually a pooled buffer block.
+ * @details
+ * - Status lines are constants, one per supported code.
+ * - The `Date` field is formatted at most once per second, and shared by all responses.
+ * - Numbers are formatted with `std::to_chars`, without temporary strings.
+ *
+ * Usage:
+ * ```
+ * std::string out = Buffer::acquireBlock();
+ * ResponseHead(out).status(200).date().field("Content-Length", size).end();
+ * ```
+ */
+class ResponseHead
+{
+private:
+    std::string &out_;
+
+public:
+    explicit ResponseHead(std::string &out);
+
+    /**
+     * @brief Appends the status line of `code`, an unknown code is sent as 500.
+     */
+    ResponseHead &status(int code);
+
+    /**
+     * @brief Appends a status line from a code and a reason phrase, e.g. the `Status` field of a CGI.
+     */
+    ResponseHead &status(std::string_view status_text);
+
+    /**
+     * @brief Appends the cached `Date` field.
+     */
+    ResponseHead &date();
+
+    ResponseHead &field(std::string_view name, std::string_view value);
+    ResponseHead &field(std::string_view name, size_t value);
+
+    /**
+     * @brief Appends preformatted fields, each ending with CRLF.
+     */
+    ResponseHead &raw(std::string_view fields);
+
+    /**
+     * @brief Appends the blank line ending the head.
+     */
+    ResponseHead &end();
+
+    /**
+     * @brief Returns the status line of `code`, CRLF included.
+     */
+    static std::string_view statusLine(int code);
+
+    /**
+     * @brief Returns the status code and reason phrase of `code`, e.g. `404 Not Found`.
+     */
+    static std::string_view statusText(int code);
+
+    /**
+     * @brief Returns the `Date` field for `now`, reformatted only when the second changes.
+     */
+    static std::string_view dateField(time_t now = time(NULL));
+
+    /**
+     * @brief Returns the `Content-Type` field for the extension of `path`.
+     */
+    static std::string_view contentTypeField(std::string_view path);
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief A set of bytes, used by the character-class validation kernel.
+ * @details
+ * - `bits` is the 256-bit lookup table used by the scalar kernel.
+ * - `lo_nibble`/`hi_nibble` are the tables for the AVX2 kernel (byte shuffles):
+ *   a byte `c` is a member when `lo_nibble[c & 0xF] & hi_nibble[c >> 4]` is not zero.
+ *   It only works for ASCII members, which is all we need for HTTP.
+ * - `members` is the list used by the SSE2 kernel, which has no byte shuffle.
+ */
+class CharClass
+{
+public:
+    static constexpr size_t MAX_SIMD_MEMBERS = 16;
+
+    std::array<uint64_t, 4> bits{};
+    std::array<uint8_t, 16> lo_nibble{};
+    std::array<uint8_t, 16> hi_nibble{};
+    std::array<char, MAX_SIMD_MEMBERS> members{};
+    size_t member_count = 0;
+    bool simd_ok = true; // False if there is a non-ASCII member, or too many members for SSE2.
+
+    constexpr explicit CharClass(std::string_view set)
+    {
+        for (int h = 0; h < 8; ++h)
+            hi_nibble[h] = static_cast<uint8_t>(1u << h);
+        for (char ch : set)
+        {
+            const unsigned char c = static_cast<unsigned char>(ch);
+            if (contains(c))
+                continue;
+            bits[c >> 6] |= uint64_t{1} << (c & 63);
+            if (c >= 0x80 || member_count >= MAX_SIMD_MEMBERS)
+            {
+                simd_ok = false;
+                continue;
+            }
+            lo_nibble[c & 0xF] |= static_cast<uint8_t>(1u << (c >> 4));
+            members[member_count++] = ch;
+        }
+    }
+
+    constexpr bool contains(unsigned char c) const
+    {
+        return (bits[c >> 6] >> (c & 63)) & 1;
+    }
+};
+
+/**
+ * @brief The instruction set levels of the scanning kernels.
+ */
+typedef enum e_scan_level
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+} t_scan_level;
+
+/**
+ * @brief One implementation of every scanning kernel.
+ * @details Each kernel returns the offset of the first match, or `size` when there is none.
+ */
+typedef struct s_scan_kernels
+{
+    size_t (*find_byte)(const char *data, size_t size, char c);
+    size_t (*find_pair)(const char *data, size_t size, char a, char b);
+    size_t (*find_quad)(const char *data, size_t size, const char *quad);
+    size_t (*find_first_of)(const char *data, size_t size, const CharClass &cls);
+} t_scan_kernels;
+
+/**
+ * @brief Returns the kernels of the given level, falls back to the best supported one below it.
+ */
+const t_scan_kernels &scanKernels(t_scan_level level);
+
+/**
+ * @brief Returns the best level supported by this CPU, detected once through CPUID.
+ */
+t_scan_level scanBestLevel();
+
+//
+// Hot path helpers, dispatched to the best kernels at runtime.
+// All of them return `std::string_view::npos` when nothing is found.
+//
+
+size_t scanFindByte(std::string_view data, char c, size_t from = 0);
+
+/**
+ * @brief Finds the two-byte sequence `ab`.
+ */
+size_t scanFindPair(std::string_view data, char a, char b, size_t from = 0);
+
+/**
+ * @brief Finds `\r\n`.
+ */
+size_t scanFindCRLF(std::string_view data, size_t from = 0);
+
+/**
+ * @brief Finds `\r\n\r\n`.
+ */
+size_t scanFindDoubleCRLF(std::string_view data, size_t from = 0);
+
+/**
+ * @brief Finds the first byte which is a member of `cls`.
+ */
+size_t scanFindFirstOf(std::string_view data, const CharClass &cls, size_t from = 0);
+
+/**
+ * @brief Returns the value of a hex digit, or -1.
+ */
+int hexDigitValue(char c);
+
+/**
+ * @brief Decodes `%XX` sequences of `in` into `out`.
+ * @return false if a `%` is not followed by 2 hex digits.
+ */
+bool scanPercentDecode(std::string_view in, std::string &out);
@@ -18,6 +18,14 @@
 #include "ErrorResponse.hpp"
 #include "Cookie.hpp"
 #include "RedirectHandler.hpp"
+#include "Http2Session.hpp"
+#include "FastCgiPool.hpp"
+#include "ProxyPool.hpp"
+#include "CgiWorkerPool.hpp"
+#include "ChildReaper.hpp"
+#include "CgiCache.hpp"
+#include "IoPool.hpp"
+#include "UploadQuota.hpp"
 
 class Config;
 class Cookie;
@@ -37,9 +45,19 @@ private:
     EpollHelper &epoll_;                                            // Reference to the epoll helper
     std::vector<t_server_config> configs_;                          // List of server configurations
     std::vector<Cookie> cookies_;                                   // List of server cookies
+    std::vector<ErrorResponse> error_pages_;                        // The error pages of each server, read at start
     std::list<t_conn> conns_;                                       // List of active connections
     std::unordered_map<int, t_conn *> conn_map_;                    // Map of fds(in epoll) to connections
     std::unordered_map<int, std::shared_ptr<RaiiFd>> inner_fd_map_; // Map of internal fds to RaiiFd objects
+    size_t max_headers_size_;                                       // The largest header limit, before the server is known
+    std::vector<std::shared_ptr<RaiiFd>> root_fds_;                 // The roots of the locations, opened once for `openat2`
+    FastCgiPool fcgi_;                                              // Connections to the FastCGI applications
+    ProxyPool proxy_;                                               // Connections to the upstreams of the proxy locations
+    CgiWorkerPool cgi_workers_;                                     // Pre-spawned interpreters of the CGI extensions
+    ChildReaper children_;                                          // Forked CGI scripts, reaped from the event loop
+    CgiCache cgi_cache_;                                            // Cached and in-flight CGI outputs of the GET requests
+    UploadQuota upload_quota_;                                      // Files and bytes under the roots of the upload locations
+    IoPool io_pool_;                                                // Threads running the file-system calls, last: joined first
 
     //
     // Helper functions
@@ -48,6 +66,53 @@ private:
     t_msg_from_serv closeConn(t_conn *conn);
     t_msg_from_serv resetConnMap(t_conn *conn);
 
+    /**
+     * @brief Writes the queued responses to the socket, returns false on error.
+     */
+    bool flushQueuedOut(t_conn *conn);
+
+    /**
+     * @brief Drops the body of a request rejected by a routine error, returns false when the connection must close.
+     * @param prev_status The status in which the error occurred.
+     */
+    bool discardRequestBody(t_conn *conn, t_status prev_status);
+
+    /**
+     * @brief Closes the input pipe of a CGI once its body is written, so it reads an EOF.
+     */
+    void closeCgiInput(t_conn *conn, t_msg_from_serv &msg);
+
+    /**
+     * @brief The cache settings of the CGI extension of the request, nullptr if it is not cached.
+     */
+    const t_cgi_cache_config *cgiCacheConfig(t_conn *conn);
+
+    /**
+     * @brief Drops an upload whose body did not complete: its file, and its place in the quota.
+     */
+    void discardUpload(const std::shared_ptr<t_upload> &upload);
+
+    /**
+     * @brief Gives the complete upload its name, returns false if it fails.
+     */
+    bool publishUpload(t_conn *conn);
+
+    /**
+     * @brief Publishes the upload of the connection once its body is complete, a failure answers 500.
+     */
+    void finishUpload(t_conn *conn);
+
+    /**
+     * @brief Switches the connection to HTTP/2.
+     * @param input The bytes read after the HTTP/1.1 part, the client preface onwards.
+     */
+    t_msg_from_serv startHttp2(t_conn *conn, std::shared_ptr<Http2Session> session, std::string_view input);
+
+    /**
+     * @brief Opens the gateways of the new streams, closes the finished ones, and closes the connection when the session is done.
+     */
+    t_msg_from_serv syncHttp2(t_conn *conn);
+
     //
     // Finite State Machine (FSM) Handlers
     //
@@ -55,18 +120,56 @@ private:
     /**
      * @brief Handler for parsing request headers.
      */
-    t_msg_from_serv reqHeaderParsingHandler(int fd, t_conn *conn);
+    t_msg_from_serv reqHeaderParsingHandler(int fd, t_conn *conn, bool is_initial = false);
 
     /**
      * @brief Handler for processing request headers.
      */
     t_msg_from_serv reqHeaderProcessingHandler(int fd, t_conn *conn);
 
+    /**
+     * @brief Hands the request to the method handler in the I/O pool, the socket is not read till it returns.
+     */
+    t_msg_from_serv waitFileSystem(t_conn *conn);
+
+    /**
+     * @brief Handler for a request handled by the I/O pool, resumes it.
+     */
+    t_msg_from_serv fileSystemHandler(int socket_fd, const std::shared_ptr<t_fs_request> &request);
+
+    /**
+     * @brief Starts the body or the response of a request resolved by the method handler.
+     * @param msg The fds to register so far, e.g. those of the CGI cache.
+     * @param is_shared Whether the CGI is shared through the cache, it is not stopped by this connection then.
+     */
+    t_msg_from_serv reqHandledHandler(int fd, t_conn *conn, t_msg_from_serv msg, bool is_shared);
+
     /**
      * @brief Handler for processing request body.
      */
     t_msg_from_serv reqBodyProcessingInHandler(int fd, t_conn *conn, bool is_initial = false);
 
+    /**
+     * @brief Ends the request body once it is all received and written, else waits for more of it.
+     */
+    t_msg_from_serv reqBodyWrittenHandler(t_conn *conn);
+
+    /**
+     * @brief Moves a body of known length from the socket to the CGI input or the upload file, without the buffer.
+     */
+    t_msg_from_serv spliceRequestBody(t_conn *conn);
+
+    /**
+     * @brief Hands bytes of the body to the I/O pool, the socket is not read till they are in the file.
+     * @param from_pipe Bytes spliced to the body pipe, 0 to write the read buffer.
+     */
+    t_msg_from_serv writeUpload(t_conn *conn, size_t from_pipe);
+
+    /**
+     * @brief Handler for a completed write of an upload, resumes the body.
+     */
+    t_msg_from_serv uploadWrittenHandler(int socket_fd, const std::shared_ptr<t_upload> &upload);
+
     /**
      * @brief Handler for processing request body (for CGI).
      */
@@ -87,6 +190,16 @@ private:
      */
     t_msg_from_serv responseOutHandler(int fd, t_conn *conn);
 
+    /**
+     * @brief Moves the CGI body from the pipe to the socket in the kernel, without the buffer.
+     */
+    t_msg_from_serv spliceCgiOutput(t_conn *conn);
+
+    /**
+     * @brief Handler for HTTP/2 connections, the events of the socket and of the stream gateways.
+     */
+    t_msg_from_serv http2Handler(int fd, t_conn *conn, t_event_type event_type);
+
     /**
      * @brief Handler for completed connections.
      */
@@ -100,8 +213,8 @@ private:
 public:
     Server() = delete;
     Server(WebServ &webserv, EpollHelper &epoll, const std::vector<t_server_config> &configs);
-    Server(const Server &) = default;
-    Server(Server &&) = default;
+    Server(const Server &) = delete;
+    Server(Server &&) = delete;
     Server &operator=(const Server &) = delete;
     ~Server() = default;
 
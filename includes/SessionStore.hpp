@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+
+static constexpr size_t SESSION_ID_SIZE = 16;          // Random bytes of a session id, 32 hex digits in the cookie
+static constexpr size_t SESSION_RANDOM_POOL = 4096;    // Bytes asked to `getrandom` at once, for 256 ids
+static constexpr uint32_t SESSION_NONE = UINT32_MAX;   // No slot
+static constexpr uint32_t SESSION_TABLE_VERSION = 1;   // Bumped on any change of the layout below
+
+typedef std::array<unsigned char, SESSION_ID_SIZE> t_session_id;
+
+/**
+ * @brief A slot of the `SessionStore`.
+ */
+typedef struct s_session
+{
+    t_session_id id;
+    int64_t expires_at; // Seconds since the epoch
+    uint32_t prev;      // Used more recently, `SESSION_NONE` at the head
+    uint32_t next;      // Used less recently, or the next free slot
+} t_session;
+
+/**
+ * @brief The head of a session table, followed by `capacity` sessions and `index_size` index entries.
+ */
+typedef struct s_session_table
+{
+    char magic[8];       // "WSSESS\0\0"
+    uint32_t version;    // `SESSION_TABLE_VERSION`
+    uint32_t capacity;
+    uint32_t index_size; // A power of two, twice the capacity at least
+    uint32_t head;       // Most recently used
+    uint32_t tail;       // Least recently used, the first to expire
+    uint32_t free;       // First never used or erased slot
+    uint64_t size;
+    int64_t ttl;
+    uint32_t is_writing; // Set while the table is changed, a table left with it set is dropped
+    uint32_t reserved[3];
+} t_session_table;
+
+static_assert(sizeof(t_session) == 32 && sizeof(t_session_table) == 64, "the session table layout is fixed");
+
+/**
+ * @brief The sessions of a server, at most `capacity` of them whatever the traffic.
+ * @details
+ * - The ids are random, from `getrandom`, read into a pool to make one call per 256 ids.
+ * - The slots are allocated once, the ids are found by an open-addressing index of twice as many entries,
+ *   with linear probing, and a backward shift on erase rather than tombstones.
+ * - A lookup extends a session by the TTL and moves it to the head of the LRU list.
+ *   Every session lives for the same TTL from its last use, so the list is also ordered by expiry:
+ *   the expired ones are swept from the tail, and a new session takes the tail when the store is full.
+ *
+ * The whole table is one mapping, with slots referring to each other by index.
+ * Given a file, the mapping is shared with it: the sessions survive a restart, which maps the table back as is.
+ * A file of another layout, capacity or TTL, left in the middle of a change, or with broken links, is started afresh.
+ */
+class SessionStore
+{
+private:
+    t_session_table *table_;
+    t_session *sessions_;
+    uint32_t *index_; // Slot of each id by its hash, `SESSION_NONE` when empty
+    size_t map_size_;
+    std::array<unsigned char, SESSION_RANDOM_POOL> random_;
+    size_t random_used_;
+
+    /**
+     * @brief Maps the table from `path`, false when it cannot be.
+     * @param is_loaded Set when the file held a table which is kept.
+     */
+    bool mapFile(const std::string &path, bool &is_loaded);
+    void reset(uint32_t capacity, uint32_t index_size, time_t ttl);
+
+    /**
+     * @brief Whether the links and the index of a mapped table are whole, checked before it is resumed.
+     */
+    bool isConsistent() const;
+
+    /**
+     * @brief The position of `id` in the index, or of the empty entry ending its probe.
+     */
+    size_t find(const t_session_id &id) const;
+
+    void unlink(uint32_t slot);
+    void pushFront(uint32_t slot);
+    void erase(uint32_t slot);
+    void dropExpired(time_t now);
+    t_session_id randomId();
+
+    /**
+     * @brief Marks the table changing, for a process killed before `endWrite`.
+     */
+    void beginWrite();
+    void endWrite();
+
+public:
+    /**
+     * @param path The file keeping the table, empty to keep it in memory only.
+     */
+    SessionStore(size_t capacity, time_t ttl, const std::string &path = "");
+    SessionStore(SessionStore &&other) noexcept;
+    SessionStore(const SessionStore &) = delete;
+    SessionStore &operator=(const SessionStore &) = delete;
+    ~SessionStore();
+
+    /**
+     * @brief Extends the session `id` to `now` + TTL.
+     * @return false when it is unknown, or expired.
+     */
+    bool touch(const t_session_id &id, time_t now);
+
+    /**
+     * @brief Starts a new session, the least recently used one is evicted when the store is full.
+     */
+    t_session_id create(time_t now);
+
+    /**
+     * @brief Erases the sessions expired at `now`, from the tail of the LRU list.
+     */
+    void expire(time_t now);
+
+    size_t size() const;
+    size_t capacity() const;
+
+    /**
+     * @brief Reads an id from its hex digits, false when they are not exactly `2 * SESSION_ID_SIZE`.
+     */
+    static bool parse(std::string_view hex, t_session_id &id);
+
+    static std::string format(const t_session_id &id);
+};
@@ -6,6 +6,7 @@
 #include <utility>
 #include <ctime>
 #include <memory>
+#include <sys/types.h>
 
 /**
  * @brief Enumeration of HTTP status error codes.
@@ -20,6 +21,7 @@ typedef enum e_status_error_codes
     ERR_404_NOT_FOUND = 404,
     ERR_405_METHOD_NOT_ALLOWED = 405,
     ERR_409_CONFLICT = 409,
+    ERR_413_CONTENT_TOO_LARGE = 413,
     ERR_500_INTERNAL_SERVER_ERROR = 500,
     ERR_501_NOT_IMPLEMENTED = 501
 } t_status_error_codes;
@@ -30,11 +32,33 @@ constexpr unsigned int GLOBAL_REQUEST_TIMEOUT = 10000u;             // in millis
 constexpr unsigned int GLOBAL_HEARTBEAT_TIMEOUT = 5000u;            // 5 seconds
 constexpr size_t MAX_REQUEST_SIZE = 2048 * 1024 * 1024u;            // 2 GB
 constexpr unsigned int MAX_HEADERS_SIZE = 8192u;                    // 8 KB
+constexpr size_t MAX_DISCARD_SIZE = 64 * 1024u;                     // Max unread body of a rejected request, dropped to keep the connection
+constexpr unsigned int CGI_MIN_WORKERS = 1u;                        // Pre-spawned workers kept per interpreter
+constexpr unsigned int CGI_MAX_WORKERS = 8u;                        // Pre-spawned workers at most per interpreter
+constexpr unsigned int CGI_WORKER_MAX_REQUESTS = 1000u;             // Requests served by a pre-spawned interpreter before it is replaced
+constexpr unsigned int CGI_WORKER_IDLE_TIMEOUT = 60u;               // Seconds an idle interpreter above the minimum lives
+constexpr int CGI_PIPE_SIZE = 1024 * 1024;                          // Capacity asked for the CGI output pipe, capped by the kernel
+constexpr size_t CGI_SPLICE_SIZE = 1024 * 1024u;                    // Max bytes moved from the CGI pipe to the socket per splice
+constexpr size_t CGI_CACHE_MAX_ENTRY = 1024 * 1024u;                // Largest CGI output cached for a URL, by default
+constexpr size_t CGI_CACHE_MAX_BYTES = 64 * 1024 * 1024u;           // CGI outputs cached at most per server
+constexpr size_t BODY_SPLICE_SIZE = 1024 * 1024u;                   // Max bytes of a request body moved from the socket per splice
+constexpr unsigned int PROXY_MAX_FAILS = 1u;                        // Failures in a row before an upstream is skipped, by default
+constexpr unsigned int PROXY_FAIL_TIMEOUT = 10u;                    // Seconds a failed upstream is skipped, by default
+constexpr unsigned int IO_POOL_THREADS = 16u;                       // Threads at most running the blocking file-system calls of a server
+constexpr size_t UPLOAD_MAX_FILES = 20000u;                         // Files under the root of an upload location, by default
+constexpr unsigned int UPLOAD_NAME_ATTEMPTS = 8u;                   // Random names tried for an upload before it fails
+constexpr unsigned int SESSION_MAX_COUNT = 10000u;                  // Sessions kept at most per server, by default
 
 class HttpRequests;
 class HttpResponse;
 class Buffer;
 class RaiiFd;
+class Http2Session;
+typedef struct s_fcgi_job t_fcgi_job;
+typedef struct s_cgi_job t_cgi_job;
+typedef struct s_proxy_job t_proxy_job;
+typedef struct s_dir_usage t_dir_usage;
+typedef struct s_upload t_upload;
 
 typedef struct s_FormData
 {
@@ -53,6 +77,10 @@ typedef struct s_file
     std::string dynamicPage;
     std::string postFilename;
     pid_t pid;
+    std::shared_ptr<t_fcgi_job> fcgi; // A FastCGI request, handed to the pool of the server
+    std::shared_ptr<t_cgi_job> job;   // A request for a pre-spawned interpreter, handed to the worker pool of the server
+    std::shared_ptr<t_proxy_job> proxy; // A request for the upstreams of a proxy location, handed to the proxy pool of the server
+    std::shared_ptr<t_upload> upload; // The file of an upload, written by the I/O pool of the server
 } t_file;
 
 /**
@@ -64,7 +92,10 @@ typedef enum e_buff_error_code
     RW_ERROR = -1,
     BUFFER_FULL = -2,
     BUFFER_EMPTY = -3,
-    CHUNKED_ERR = -4
+    CHUNKED_ERR = -4,
+    CHUNKED_NO_BODY = -5,   // Bytes were read, but only chunked framing was decoded.
+    SPLICE_AGAIN = -6,      // Nothing was spliced, an end would block.
+    SPLICE_UNSUPPORTED = -7 // An fd cannot be spliced, its bytes are to be copied.
 } t_buff_error_code;
 
 /**
@@ -93,6 +124,16 @@ typedef enum e_direction
     OUT
 } t_direction;
 
+/**
+ * @brief How the end of a response body is marked.
+ */
+typedef enum e_res_framing
+{
+    FRAMING_LENGTH,  // Content-Length, the length is known before the body is sent
+    FRAMING_CHUNKED, // Transfer-Encoding: chunked, for an unknown length
+    FRAMING_CLOSE    // The connection is closed, for an unknown length to an HTTP/1.0 client
+} t_res_framing;
+
 /**
  * @brief Enumeration of connection statuses.
  */
@@ -100,13 +141,44 @@ typedef enum e_status
 {
     REQ_HEADER_PARSING,    // Stage for parsing HTTP headers
     REQ_HEADER_PROCESSING, // Stage for processing HTTP headers
+    REQ_WAITING_FS,        // Stage waiting for the I/O pool to look the target up in the file system
     REQ_BODY_PROCESSING,   // Stage for processing HTTP body
     RES_HEADER_PROCESSING, // Stage for preparing HTTP response headers
     RESPONSE,              // Stage for writing HTTP response
     DONE,                  // Stage indicating the connection is done
-    TERMINATED             // Stage indicating the connection is terminated
+    TERMINATED,            // Stage indicating the connection is terminated
+    H2_SESSION             // Stage for an HTTP/2 connection, its streams are served by gateway connections
 } t_status;
 
+/**
+ * @brief The file of an upload, written by the I/O pool of the server.
+ */
+typedef struct s_upload
+{
+    std::shared_ptr<RaiiFd> file; // Open till the last write completed, even if the connection is gone
+    size_t reserve;               // Bytes preallocated before the first write, 0 once done or when the length is unknown
+    size_t sync_size;             // Bytes written between two flushes of the page cache, 0 to leave them to the kernel
+    size_t written;               // Bytes in the file
+    size_t synced;                // Bytes whose flush was started
+    size_t flushed;               // Bytes whose flush was waited for
+    ssize_t result;               // Bytes of the last write, RW_ERROR if it failed
+    bool is_writing;              // Whether a write runs in the pool, the socket is out of the epoll meanwhile
+    t_dir_usage *usage;           // The root the upload is counted in, by the quota of the server
+    std::string path;             // Where the file is published once the body is complete
+    bool is_tmpfile;              // Whether the file has no name till then, else it is created at `path`
+    bool is_published;
+} t_upload;
+
+/**
+ * @brief A request handled by the method handler in the I/O pool, off the event loop.
+ */
+typedef struct s_fs_request
+{
+    t_file res;
+    t_status_error_codes error_code; // Of the method handler, ERR_NO_ERROR when it succeeded
+    std::string error_message;
+} t_fs_request;
+
 /**
  * @brief Structure representing a client connection.
  */
@@ -118,6 +190,14 @@ typedef struct s_conn
     int config_idx;                         // Index of the server configuration used
     bool is_cgi;                            // Is this connection handling a CGI request?
     bool cgi_header_ready;                  // Is the CGI response header ready
+    t_res_framing res_framing;              // How the end of the response body is marked
+    bool cgi_splice;                        // Is the CGI body moved from the pipe to the socket by splice
+    std::shared_ptr<RaiiFd> body_pipe_in;   // Write end of the pipe an upload is spliced through, created on demand
+    std::shared_ptr<RaiiFd> body_pipe_out;  // Read end of the same pipe, spliced to the file
+    std::shared_ptr<t_upload> upload;       // The file of a POST, while its body is written
+    std::shared_ptr<t_fs_request> fs_request; // The request while the I/O pool handles it
+    bool must_close;                        // Is the connection closed after the response
+    size_t body_to_discard;                 // Unread body bytes of a rejected request, dropped before the next request
     t_status status;                        // Current status of the connection
     t_status_error_codes error_code;        // Error code if any error occurs
     time_t start_timestamp;                 // Timestamp when the connection was established
@@ -129,9 +209,11 @@ typedef struct s_conn
     t_file res;                             // File/resource associated with the response
     std::unique_ptr<Buffer> read_buf;       // Buffer for reading data
     std::unique_ptr<Buffer> write_buf;      // Buffer for writing data
+    std::unique_ptr<Buffer> queued_out;     // Responses of finished pipelined requests, sent before write_buf
     std::shared_ptr<HttpRequests> request;  // Parsed HTTP request
     std::shared_ptr<HttpResponse> response; // HTTP response generator
     std::string error_message;              // Error  message
+    std::shared_ptr<Http2Session> h2;       // The HTTP/2 session, once the connection switched protocol
 } t_conn;
 
 /**
@@ -143,17 +225,65 @@ typedef struct s_msg_from_serv
     std::vector<int> fds_to_unregister;
 } t_msg_from_serv;
 
+/**
+ * @brief How a proxy location picks its upstream.
+ */
+typedef enum e_proxy_balance
+{
+    PROXY_ROUND_ROBIN, // In turn
+    PROXY_LEAST_CONN   // The one serving the fewest requests
+} t_proxy_balance;
+
+/**
+ * @brief Upstreams of a proxy location.
+ */
+typedef struct s_proxy_config
+{
+    std::vector<std::string> upstreams; // "unix:<path>" or "<host>:<port>", empty when the location is not proxied
+    t_proxy_balance balance;
+    unsigned int max_fails;             // Failures in a row before an upstream is skipped, 0 to never skip it
+    unsigned int fail_timeout;          // Seconds a failed upstream is skipped
+} t_proxy_config;
+
 typedef struct s_location_config
 {
     std::vector<t_method> methods; // Allowed methods for this location
     std::string root;              // Root directory for this location
     std::string index;             // Default index file for this location
+    size_t max_files;              // Files under the root at most, a POST beyond answers 403
+    size_t max_bytes;              // Bytes under the root at most, 0 when unlimited, a POST beyond answers 413
+    int root_fd;                   // The root opened by the server for `openat2`, -1 to resolve the paths from `/`
+    t_proxy_config proxy;          // Upstreams the requests are forwarded to, instead of the root
 } t_location_config;
 
+/**
+ * @brief Sizes of the pre-spawned interpreters of a CGI extension.
+ */
+typedef struct s_prefork_config
+{
+    unsigned int min_workers;  // Workers kept, even when idle
+    unsigned int max_workers;  // Workers at most, 0 when the scripts are forked per request
+    unsigned int max_requests; // Requests served by a worker before it is replaced
+    unsigned int idle_timeout; // Seconds an idle worker above `min_workers` lives
+} t_prefork_config;
+
+/**
+ * @brief Micro-cache of the GET outputs of a CGI extension.
+ */
+typedef struct s_cgi_cache_config
+{
+    unsigned int ttl;          // Seconds an output is served again, 0 when the extension is not cached
+    size_t max_size;           // Largest output stored, a larger one is only streamed
+} t_cgi_cache_config;
+
 typedef struct s_cgi_config
 {
-    std::string root;        // Default root path for this CGI
-    std::string interpreter; // Interpreter path for this CGI
+    std::string root;         // Default root path for this CGI
+    std::string interpreter;  // Interpreter path for this CGI
+    std::string fastcgi;      // FastCGI application address, "unix:<path>" or "<host>:<port>", empty to fork a CGI
+    t_prefork_config prefork; // Pre-spawned interpreters, instead of a fork per request
+    t_cgi_cache_config cache; // Micro-cache of the GET outputs
+    std::string env_template; // Environment entries shared by the requests, "NAME=value\0" each
 } t_cgi_config;
 
 /**
@@ -167,6 +297,9 @@ typedef struct s_server_config
     unsigned int max_heartbeat_timeout;                              // Maximum heartbeat timeout in milliseconds
     unsigned int max_request_size;                                   // Maximum size of a request in bytes
     unsigned int max_headers_size;                                   // Maximum size of headers in bytes
+    unsigned int upload_sync_size;                                   // Bytes written to an upload between two flushes of the page cache, 0 to leave them to the kernel
+    unsigned int max_sessions;                                       // Sessions kept at most, the least recently used is evicted
+    std::string session_file;                                        // File the sessions are mapped from, to survive a restart, empty to keep them in memory
     bool is_cgi;                                                     // Is this an CGI server?
     std::unordered_map<std::string, t_location_config> locations;    // Locations : methods
     std::unordered_map<std::string, t_cgi_config> cgi_paths;         // CGI paths for different extensions
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "SharedTypes.hpp"
+#include "IoPool.hpp"
+
+static constexpr time_t UPLOAD_RECONCILE_INTERVAL = 60; // Seconds between two scans of a root changed by the requests
+
+/**
+ * @brief What the regular files under an upload root hold, kept by the `UploadQuota`.
+ */
+typedef struct s_dir_usage
+{
+    size_t files;
+    size_t bytes;
+    time_t scanned_at; // When the counters were last set by a scan
+    bool is_dirty;     // Whether a request changed them since the last scan started
+    bool is_scanning;  // Whether a scan runs in the I/O pool
+} t_dir_usage;
+
+/**
+ * @brief Files and bytes under the upload roots, for the limits of their locations.
+ * @details
+ * The roots are the ones of the locations taking a POST, tracked when the server starts.
+ * Each is scanned by the I/O pool on the first tick, then its counters follow the requests:
+ * a POST adds a file, and its bytes once published; a DELETE removes a file and its size.
+ * Files changed behind the server are found by a new scan, run by the I/O pool,
+ * at most every `UPLOAD_RECONCILE_INTERVAL` seconds for a root the requests changed.
+ *
+ * A file is counted under the most specific root holding it: the scan of `/` skips `/uploads` if it is a root too.
+ * A file under no root is not counted, its DELETE changes nothing.
+ *
+ * The method handler runs in the I/O pool too, the counters are behind a mutex.
+ */
+class UploadQuota
+{
+private:
+    std::mutex mutex_;
+    std::map<std::string, t_dir_usage> roots_; // By path, made lexically normal; never erased, a usage keeps its address
+
+    /**
+     * @brief The usage of the most specific root holding `path`, nullptr when it is under none, with the mutex held.
+     */
+    t_dir_usage *rootOf(const std::string &path);
+
+    /**
+     * @brief The roots beneath `root`, which its scan skips, with the mutex held.
+     */
+    std::vector<std::string> nestedRoots(const std::string &root) const;
+
+public:
+    UploadQuota();
+
+    /**
+     * @brief Counts the regular files under `root` and their sizes, a blocking walk of the tree.
+     * @param skipped Directories under `root` not walked, the roots counted on their own.
+     */
+    static t_dir_usage scan(const std::string &root, const std::vector<std::string> &skipped = {});
+
+    /**
+     * @brief Tracks the upload root `root`, scanned on the next `tick`.
+     */
+    void track(const std::string &root);
+
+    /**
+     * @brief Counts a new upload under the root of the location, if its limits allow it.
+     * @param length The declared length of the body, 0 when it is chunked.
+     * @return The usage the bytes of the upload are added to, nullptr when the root is not tracked.
+     * @throws WebServErr::MethodException 403 when the files are at `max_files`, 413 when the bytes would exceed `max_bytes`.
+     */
+    t_dir_usage *addFile(const t_location_config &location, size_t length);
+
+    /**
+     * @brief Uncounts the deleted file `path` of `size` bytes, from the root holding it if any.
+     */
+    void removeFile(const std::string &path, size_t size);
+
+    /**
+     * @brief Counts the bytes of a published upload.
+     */
+    void addBytes(t_dir_usage *usage, size_t bytes);
+
+    /**
+     * @brief Gives back the file of an upload which was not published.
+     */
+    void release(t_dir_usage *usage);
+
+    /**
+     * @brief Starts the scans of the new roots, and of the changed ones due for one, in `io_pool`.
+     */
+    t_msg_from_serv tick(time_t now, IoPool &io_pool);
+};
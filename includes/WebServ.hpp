@@ -4,6 +4,7 @@
 #include <string>
 #include <unordered_map>
 #include <list>
+#include <vector>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <sys/epoll.h>
@@ -31,6 +32,7 @@ private:
     std::list<std::shared_ptr<RaiiFd>> fds_;       // List of RAII wrappers for listening sockets
     std::unordered_map<int, Server *> server_map_; // Maps `listen` file descriptors to pointers to Server instances
     std::unordered_map<int, Server *> conn_map_;   // Maps `connections` file descriptors to pointers to Server instances
+    std::vector<std::shared_ptr<RaiiFd>> closing_; // Unregistered during a batch of events, closed after it
     
     void handleServerMsg(const t_msg_from_serv &msg, Server *server);
     void timeoutKiller(const std::unordered_map<int, Server *> &serverMap);
@@ -5,5 +5,4 @@
 #include <iostream>
 #include "LogSys.hpp"
 
-void sigchld_handler(int);
 void setup_signal_handlers();
\ No newline at end of file
@@ -2,6 +2,17 @@
 
 #include <algorithm>
 #include <string>
+#include <string_view>
 #include <cctype>
 
-std::string toLower(const std::string &s);
\ No newline at end of file
+std::string toLower(const std::string &s);
+
+/**
+ * @brief Whether a comma-separated list, e.g. a `Connection` value, holds `token`.
+ */
+bool hasToken(std::string_view list, std::string_view token);
+
+/**
+ * @brief A random name for an upload, e.g. `upload_3kF9aQ0xLm2Z.txt`; its uniqueness is left to the open or the link.
+ */
+std::string randomUploadName(const std::string &extension);
@@ -1,187 +1,174 @@
 #include "Buffer.hpp"
 #include <LogSys.hpp>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
 
-Buffer::Buffer(size_t capacity, size_t block_size) : data_(), ref_(), data_view_(), capacity_(capacity), write_pos_(0), size_(0), block_size_(block_size), scratch_type_(None), scratched_() {}
+Buffer::Buffer(size_t capacity, size_t block_size) : data_(), ref_(), data_view_(), capacity_(capacity), write_pos_(0), size_(0), block_size_(block_size), chunked_decoder_(), is_chunked_(false), is_eof_(false), overflow_(), is_chunked_output_(false), out_chunks_() {}
+
+Buffer::~Buffer()
+{
+    for (auto &block : data_)
+        recycleBlock(std::move(block));
+}
+
+namespace
+{
+    // Free blocks, per thread, so the pool needs no lock.
+    thread_local std::vector<std::string> block_pool;
+}
 
 /**
  * @details
- * This function handles the chunk header parsing.
- * The given `data` should contain the full chunk header,
- * and may also contain the chunk body, or next chunks.
- *
- * If the chunk size is zero, it means the last chunk has been reached.
+ * Every connection allocates blocks for its request and its response,
+ * a pooled block saves the allocation and the zero-filling of 16 KiB.
  */
-ssize_t Buffer::handleNextHeader(std::string_view data, ssize_t parsed, size_t skipped)
+std::string Buffer::acquireBlock(size_t size)
 {
-    size_t pos = data.find("\r\n");
-    if (pos == std::string_view::npos)
-    {
-        scratch_type_ = Header;
-        scratched_ = std::string(data);
-        return parsed;
-    }
-
-    scratch_type_ = None;
-    std::string_view header = data.substr(0, pos);
-    std::string_view crlf = data.substr(pos, CRLF);
-    if (crlf != "\r\n")
-        return handleChunkedError();
-    std::string_view rest = data.substr(pos + CRLF);
-    skipped += CRLF;
+    if (size > DEFAULT_BLOCK_SIZE || block_pool.empty())
+        return std::string(size, '\0');
 
-    size_t chunk_size = 0;
-    try
-    {
-        chunk_size = std::stoul(std::string(header), nullptr, 16);
-        // Handle the zero-size chunk (last chunk)
-        if (chunk_size == 0)
-        {
-            std::string_view final_crlf = rest.substr(0, CRLF);
-            if (final_crlf != "\r\n")
-                return handleChunkedError();
-            rest.remove_prefix(CRLF);
-
-            // Headers are not included in size_.
-            skipped += chunk_size + CRLF;
+    std::string block = std::move(block_pool.back());
+    block_pool.pop_back();
+    block.resize(size);
+    return block;
+}
 
-            // Should be no more data after the last chunk
-            if (!rest.empty())
-                return handleChunkedError();
+void Buffer::recycleBlock(std::string &&block)
+{
+    const size_t capacity = block.capacity();
+    if (capacity < DEFAULT_BLOCK_SIZE || capacity > 2 * DEFAULT_BLOCK_SIZE || block_pool.size() >= MAX_POOLED_BLOCKS)
+        return;
+    block_pool.push_back(std::move(block));
+}
 
-            // Mark EOF and return
-            return handleChunkedEOF(parsed);
-        }
+/**
+ * @details
+ * The pipe side does not block, the other side blocks as its fd does: a socket of the server does not.
+ * `EINVAL` is an fd without splice support, e.g. a file opened with `O_APPEND`, which a copy still reaches.
+ */
+ssize_t Buffer::spliceFd(int in, int out, size_t size)
+{
+    const ssize_t moved = splice(in, NULL, out, NULL, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved >= 0)
+        return moved;
+    if (errno == EAGAIN)
+        return SPLICE_AGAIN;
+    return errno == EINVAL ? SPLICE_UNSUPPORTED : RW_ERROR;
+}
 
-        scratch_type_ = None;
-        remain_chunk_size_ = chunk_size;
-        return handleBodyProcessing(rest, parsed, skipped);
-    }
-    catch (const std::exception &e)
+/**
+ * @details
+ * Called by the I/O pool as `writeFile`, a short splice is retried.
+ * The bytes are in the pipe already, one which would block is an error.
+ */
+ssize_t Buffer::drainPipe(int pipe_fd, int fd, size_t size)
+{
+    size_t moved = 0;
+    while (moved < size)
     {
-        return handleChunkedError();
+        const ssize_t n = spliceFd(pipe_fd, fd, size - moved);
+        if (n <= 0)
+            return RW_ERROR;
+        moved += n;
     }
+    return moved;
+}
+
+void Buffer::releaseBlocks()
+{
+    for (auto &block : data_)
+        recycleBlock(std::move(block));
+    data_.clear();
+    ref_.clear();
+    data_view_.clear();
 }
 
 /**
  * @details
- * This function handles the chunk body processing.
- * The given `data` should contain part or all of the chunk body,
- * or the next chunks. But it should contain the full CRLF if the chunk body is complete.
- *
- * If the chunk body is not fully available, it will read as much as possible,
- * and update the remain_chunk_size_ accordingly.
- * If the chunk body is fully available, it will check for the trailing CRLF,
- * and then call handleNextHeader to process the next chunk header.
+ * `to` is the end of the bytes just read.
+ * Body spans are handed to `appendBodySpan`, framing bytes are dropped,
+ * and the bytes after the last chunk are kept in the overflow.
  */
-ssize_t Buffer::handleBodyProcessing(std::string_view data, ssize_t parsed, size_t skipped)
+ssize_t Buffer::decodeChunked(size_t from, size_t to)
 {
-    ssize_t to_read = std::min(remain_chunk_size_ + CRLF, data.size());
+    const std::string &block = data_.back();
+    std::string_view input(block.data() + from, to - from);
+    size_t decoded = 0;
 
-    // We need to be sure CRLF is not splitted, so at least 1 byte of body stays with CRLF.
-    if (to_read >= static_cast<ssize_t>(remain_chunk_size_))
+    while (!input.empty() && !chunked_decoder_.isDone())
     {
-        if (to_read < static_cast<ssize_t>(remain_chunk_size_ + CRLF))
+        std::string_view body;
+        input.remove_prefix(chunked_decoder_.next(input, body));
+        if (chunked_decoder_.isError())
+            return CHUNKED_ERR;
+        if (!body.empty())
         {
-            // Not enough to keep body and full CRLF together: leave 1 byte to join with CRLF next time
-            to_read = remain_chunk_size_ - 1;
-            scratch_type_ = Body;
-            scratched_ = std::string(data.substr(to_read));
-        }
-        else
-        {
-            // We have full body + CRLF available: read body only here
-            to_read = remain_chunk_size_;
+            appendBodySpan(body.data() - block.data(), body.size());
+            decoded += body.size();
         }
     }
 
-    if (to_read == 0)
-        return parsed;
-
-    std::string_view body = data.substr(0, to_read);
-    std::string_view rest = data.substr(to_read);
-
-    data_view_.push_back(body);
-    ref_.back() += 1;
-    parsed += to_read;
-    remain_chunk_size_ -= to_read;
-
-    // There are more data to read, so we wait for next call.
-    if (remain_chunk_size_ > 0)
-        return parsed;
-
-    // We have read the whole chunk, now we need to check the trailing CRLF.
-    std::string_view crlf = rest.substr(0, CRLF);
-    if (crlf != "\r\n")
-        return handleChunkedError();
-    rest.remove_prefix(CRLF);
-    skipped += CRLF;
-
-    // If there is no more data, we wait for next call.
-    if (rest.empty())
-        return parsed;
-
-    // Otherwise, we start to parse the next chunk header.
-    return handleNextHeader(rest, parsed, skipped);
-}
+    if (chunked_decoder_.isDone())
+    {
+        is_eof_ = true;
+        overflow_.append(input); // The start of the next pipelined request
+    }
 
-ssize_t Buffer::handleChunkedEOF(ssize_t parsed)
-{
-    scratch_type_ = None;
-    is_eof_ = true;
-    return parsed;
+    size_ += decoded;
+    return decoded;
 }
 
-ssize_t Buffer::handleChunkedError()
+/**
+ * @details
+ * The span is always at or after `write_pos_`, since framing bytes are only dropped.
+ * A small span is moved to `write_pos_`, so tiny chunks do not leave holes;
+ * a large one stays where it is, the hole before it is a few framing bytes.
+ */
+void Buffer::appendBodySpan(size_t offset, size_t size)
 {
-    scratch_type_ = None;
-    return CHUNKED_ERROR;
-}
+    std::string &block = data_.back();
+    if (offset != write_pos_ && size < CHUNK_COALESCE_SIZE)
+    {
+        std::memmove(&block[write_pos_], &block[offset], size);
+        offset = write_pos_;
+    }
 
-ssize_t Buffer::fsmScheduler(t_chunked_status status, std::string_view data)
-{
-    switch (status)
+    const char *start = block.data() + offset;
+    const bool is_contiguous = ref_.back() > 0 && data_view_.back().data() + data_view_.back().size() == start;
+    if (is_contiguous)
+        data_view_.back() = std::string_view(data_view_.back().data(), data_view_.back().size() + size);
+    else
     {
-    case NEXT_HEADER:
-        return handleNextHeader(data, 0, 0);
-    case BODY_PROCESSING:
-        return handleBodyProcessing(data, 0, 0);
-    default:
-        throw WebServErr::ShouldNotBeHereException("Buffer::fsmScheduler: invalid state");
+        data_view_.push_back(std::string_view(start, size));
+        ++ref_.back();
     }
+    write_pos_ = offset + size;
 }
 
 /**
  * @details
- * This function handles the epollin event on the socket.
- * The most important responsibility of this function is to ensure
- * that no incomplete-chunk-header/chunk-body-awaiting-its-trailing-delimiter
- * is sent to the FSM scheduler.
- * So if the buffer block may not have enough space, we create a new one here,
- * and copy any remaining partial header/body to the string_view, then send to FSM.
+ * This function handles the epollin event on the socket in chunked mode.
+ * Data is read right after the decoded body of the last block,
+ * the decoder handles any split point, so no block is wasted for alignment.
+ *
+ * Returns the body bytes decoded, `CHUNKED_NO_BODY` when only framing was read.
  */
 ssize_t Buffer::readFdChunked(int fd)
 {
-    // Ensure enough space for chunk header and trailing CRLF
-    const size_t remain_space = block_size_ - write_pos_;
-    if (data_.empty() || remain_space < MAX_CHUNK_HEADER_SPACE                                   // Ensure enough space for chunk header
-        || ((remain_chunk_size_ <= remain_space) && (remain_space < remain_chunk_size_ + CRLF))) // Ensure the trailing CRLF will not be split
+    // A block without views holds only framing, it can be overwritten.
+    if (!data_.empty() && ref_.back() == 0)
+        write_pos_ = 0;
+    if (data_.empty() || write_pos_ >= data_.back().size())
     {
-        data_.push_back(std::string(block_size_, '\0'));
+        data_.push_back(acquireBlock(block_size_));
         ref_.push_back(0);
-        auto &new_buf = data_.back();
-
-        if (scratch_type_ != None)
-        {
-            std::copy(scratched_.begin(), scratched_.end(), new_buf.begin());
-            scratch_type_ = None;
-            write_pos_ = scratched_.size();
-            scratched_.clear();
-        } else
-            write_pos_ = 0;
+        write_pos_ = 0;
     }
 
     // Now read into the last block
-    size_t read_size = std::min(block_size_ - write_pos_, capacity_ - size_);
+    size_t read_size = std::min(data_.back().size() - write_pos_, capacity_ - size_);
     ssize_t read_bytes = read(fd, &(data_.back().data()[write_pos_]), read_size);
 
     if (read_bytes < 0)
@@ -193,22 +180,13 @@ ssize_t Buffer::readFdChunked(int fd)
         return EOF_REACHED;
     }
 
-    // Parse read data, + any unprocessed partial header/body.
-    std::string_view chunked_data(data_.back().data(), write_pos_ + read_bytes);
-
-    t_chunked_status status = remain_chunk_size_ > 0 ? BODY_PROCESSING : NEXT_HEADER;
-
-    ssize_t parsed = fsmScheduler(status, chunked_data);
-    if (parsed == CHUNKED_ERROR)
-        return CHUNKED_ERROR;
-
-    write_pos_ += read_bytes;
-    size_ += parsed;
-
-    return parsed;
+    ssize_t decoded = decodeChunked(write_pos_, write_pos_ + read_bytes);
+    if (decoded == 0)
+        return CHUNKED_NO_BODY;
+    return decoded;
 }
 
-ssize_t Buffer::readFd(int fd)
+ssize_t Buffer::readFd(int fd, size_t max_size)
 {
     if (isFull())
         return BUFFER_FULL;
@@ -219,15 +197,15 @@ ssize_t Buffer::readFd(int fd)
     bool new_block = false;
 
     // Allocate a new block if needed
-    if (data_.empty() || write_pos_ >= block_size_)
+    if (data_.empty() || write_pos_ >= data_.back().size())
     {
-        data_.push_back(std::string(block_size_, '\0'));
+        data_.push_back(acquireBlock(block_size_));
         write_pos_ = 0;
         new_block = true;
     }
 
     // Now read into the last block
-    size_t read_size = std::min(block_size_ - write_pos_, capacity_ - size_);
+    size_t read_size = std::min(std::min(data_.back().size() - write_pos_, capacity_ - size_), max_size);
     ssize_t read_bytes = read(fd, &(data_.back().data()[write_pos_]), read_size);
 
     if (read_bytes < 0)
@@ -236,6 +214,8 @@ ssize_t Buffer::readFd(int fd)
     if (read_bytes == 0)
     {
         LOG_DEBUG("Buffer::readFd: EOF reached", "");
+        if (is_chunked_output_ && !is_eof_)
+            addOutChunk(0);
         is_eof_ = true;
         return EOF_REACHED;
     }
@@ -243,25 +223,42 @@ ssize_t Buffer::readFd(int fd)
     // Update buffer state
     write_pos_ += read_bytes;
     size_ += read_bytes;
+    if (is_chunked_output_)
+        addOutChunk(read_bytes);
 
     if (new_block)
     {
         data_view_.push_back(std::string_view(data_.back().data(), write_pos_));
         ref_.push_back(1);
     }
-    else
-        data_view_.back() = std::string_view(data_.back().data(), write_pos_);
+    else // Only the end moves, the view may have been trimmed from the front.
+        data_view_.back() = std::string_view(data_view_.back().data(), data_view_.back().size() + read_bytes);
 
     return read_bytes;
 }
 
+/**
+ * @details
+ * All the views are written with one `writev`, so queued responses,
+ * or a header and its body in different blocks, go out in one syscall.
+ */
 ssize_t Buffer::writeSocket(int fd)
 {
     if (isEmpty())
         return BUFFER_EMPTY;
 
-    auto &block = data_view_.front();
-    ssize_t write_bytes = write(fd, block.data(), block.size());
+    if (is_chunked_output_)
+        return writeSocketChunked(fd);
+
+    struct iovec iov[MAX_WRITE_IOV];
+    int iov_count = 0;
+    for (auto it = data_view_.begin(); it != data_view_.end() && iov_count < MAX_WRITE_IOV; ++it, ++iov_count)
+    {
+        iov[iov_count].iov_base = const_cast<char *>(it->data());
+        iov[iov_count].iov_len = it->size();
+    }
+
+    ssize_t write_bytes = writev(fd, iov, iov_count);
     if (write_bytes < 0)
         return RW_ERROR;
     if (write_bytes == 0)
@@ -270,71 +267,200 @@ ssize_t Buffer::writeSocket(int fd)
         return EOF_REACHED;
     }
 
-    if (write_bytes < static_cast<ssize_t>(block.size()))
-        block.remove_prefix(write_bytes);
-    else
+    if (static_cast<size_t>(write_bytes) > size_)
+        throw WebServErr::ShouldNotBeHereException("Buffer::writeFd: size underflow");
+
+    consumeFront(write_bytes);
+    return write_bytes;
+}
+
+void Buffer::consumeFront(size_t size)
+{
+    size_ -= size;
+    while (size > 0)
     {
-        data_view_.pop_front();
-        auto &ref = ref_.front();
-        if (ref == 1)
+        auto &block = data_view_.front();
+        if (size < block.size())
         {
-            data_.pop_front();
-            ref_.pop_front();
+            block.remove_prefix(size);
+            break;
         }
-        else
-            --ref;
+        size -= block.size();
+        popFrontView();
     }
+}
 
-    if (static_cast<size_t>(write_bytes) > size_)
-        throw WebServErr::ShouldNotBeHereException("Buffer::writeFd: size underflow");
+namespace
+{
+    size_t chunkPrefixSize(const t_out_chunk &chunk)
+    {
+        if (!chunk.framed)
+            return 0;
+        size_t digits = 1;
+        for (size_t size = chunk.size >> 4; size > 0; size >>= 4)
+            ++digits;
+        return digits + CRLF;
+    }
+
+    size_t chunkWireSize(const t_out_chunk &chunk)
+    {
+        return chunk.framed ? chunkPrefixSize(chunk) + chunk.size + CRLF : chunk.size;
+    }
+}
+
+/**
+ * @details
+ * A chunk not started yet grows with the next read, so a fast producer
+ * gets large chunks, and the framing stays a few bytes per write.
+ */
+void Buffer::addOutChunk(size_t size)
+{
+    if (size > 0 && !out_chunks_.empty())
+    {
+        t_out_chunk &last = out_chunks_.back();
+        if (last.framed && last.sent == 0 && last.size > 0)
+        {
+            last.size += size;
+            return;
+        }
+    }
+    out_chunks_.push_back(t_out_chunk{size, 0, true});
+}
+
+/**
+ * @details
+ * The iovecs follow the wire format: for each chunk the rest of its size line,
+ * the rest of its payload (the front views), then the rest of its CRLF.
+ * A partial write may stop anywhere, `sent` tells where each chunk resumes.
+ */
+ssize_t Buffer::writeSocketChunked(int fd)
+{
+    static const char crlf[] = "\r\n";
+    char prefixes[MAX_WRITE_IOV][MAX_CHUNK_PREFIX_SIZE];
+    struct iovec iov[MAX_WRITE_IOV];
+    int iov_count = 0;
+    auto addIov = [&](const char *data, size_t size)
+    {
+        if (size == 0)
+            return true;
+        if (iov_count == MAX_WRITE_IOV)
+            return false;
+        iov[iov_count].iov_base = const_cast<char *>(data);
+        iov[iov_count].iov_len = size;
+        ++iov_count;
+        return true;
+    };
+
+    auto view_it = data_view_.begin();
+    size_t view_offset = 0; // A view may hold the end of a chunk and the start of the next one.
+    for (size_t i = 0; i < out_chunks_.size() && iov_count < MAX_WRITE_IOV; ++i)
+    {
+        const t_out_chunk &chunk = out_chunks_[i];
+        const size_t prefix_size = chunkPrefixSize(chunk);
+        if (chunk.sent < prefix_size)
+        {
+            char *end = std::to_chars(prefixes[i], prefixes[i] + MAX_CHUNK_PREFIX_SIZE, chunk.size, 16).ptr;
+            std::memcpy(end, crlf, CRLF);
+            if (!addIov(prefixes[i] + chunk.sent, prefix_size - chunk.sent))
+                break;
+        }
+
+        // Payload bytes already written are gone from the views.
+        size_t payload = chunk.size - std::min(chunk.size, chunk.sent - std::min(chunk.sent, prefix_size));
+        bool is_full = false;
+        while (payload > 0 && view_it != data_view_.end())
+        {
+            const size_t take = std::min(payload, view_it->size() - view_offset);
+            if (!addIov(view_it->data() + view_offset, take))
+            {
+                is_full = true;
+                break;
+            }
+            payload -= take;
+            view_offset += take;
+            if (view_offset == view_it->size())
+            {
+                ++view_it;
+                view_offset = 0;
+            }
+        }
+        if (is_full || payload > 0)
+            break;
+
+        if (chunk.framed)
+        {
+            const size_t crlf_sent = chunk.sent > prefix_size + chunk.size ? chunk.sent - prefix_size - chunk.size : 0;
+            if (!addIov(crlf + crlf_sent, CRLF - crlf_sent))
+                break;
+        }
+    }
+
+    ssize_t write_bytes = writev(fd, iov, iov_count);
+    if (write_bytes < 0)
+        return RW_ERROR;
+    if (write_bytes == 0)
+    {
+        is_eof_ = true;
+        return EOF_REACHED;
+    }
+
+    size_t left = write_bytes;
+    while (left > 0)
+    {
+        t_out_chunk &chunk = out_chunks_.front();
+        const size_t prefix_size = chunkPrefixSize(chunk);
+        const size_t wire_size = chunkWireSize(chunk);
+        const size_t take = std::min(left, wire_size - chunk.sent);
+
+        // The payload is at [prefix_size, prefix_size + size) of the chunk on the wire.
+        const size_t payload_from = std::max(chunk.sent, prefix_size);
+        const size_t payload_to = std::min(chunk.sent + take, prefix_size + chunk.size);
+        if (payload_to > payload_from)
+            consumeFront(payload_to - payload_from);
+
+        chunk.sent += take;
+        left -= take;
+        if (chunk.sent == wire_size)
+            out_chunks_.pop_front();
+    }
 
-    size_ -= write_bytes;
     return write_bytes;
 }
 
 /**
  * @details
- * Since NON-BLOCKING does not apply to regular files,
- * we can simply drain all data in the buffer to the file.
- *
- * Extra copy here since we are not allowed to call `write` in a loop
- * in this project.
+ * Since NON-BLOCKING does not apply to regular files, all data in the buffer is drained to the file.
+ * The views are written in place with `writev`, up to `MAX_WRITE_IOV` per call, a short write is retried.
+ * The rule of one `write` per readiness event is for the fds of the event loop:
+ * the files are written by the I/O pool, where a retry holds no other connection.
  */
 ssize_t Buffer::writeFile(int fd)
 {
     if (isEmpty())
         return BUFFER_EMPTY;
 
-    ssize_t write_bytes = 0;
-
-    if (data_view_.size() > 1)
+    ssize_t total = 0;
+    while (size_ > 0)
     {
-        std::string block;
-        block.reserve(size_);
-        while (!data_view_.empty())
+        struct iovec iov[MAX_WRITE_IOV];
+        int iov_count = 0;
+        for (auto it = data_view_.begin(); it != data_view_.end() && iov_count < MAX_WRITE_IOV; ++it, ++iov_count)
         {
-            block.append(data_view_.front());
-            data_view_.pop_front();
+            iov[iov_count].iov_base = const_cast<char *>(it->data());
+            iov[iov_count].iov_len = it->size();
         }
 
-        write_bytes = write(fd, block.data(), block.size());
-        if (write_bytes < 0 || write_bytes != static_cast<ssize_t>(block.size()))
-            write_bytes = RW_ERROR;
-    }
-    else
-    {
-        write_bytes = write(fd, data_view_.front().data(), data_view_.front().size());
-        if (write_bytes < 0 || write_bytes != static_cast<ssize_t>(data_view_.front().size()))
-            write_bytes = RW_ERROR;
-        data_view_.clear();
+        const ssize_t write_bytes = writev(fd, iov, iov_count);
+        if (write_bytes <= 0)
+            return RW_ERROR;
+        consumeFront(write_bytes);
+        total += write_bytes;
     }
 
-    data_.clear();
-    ref_.clear();
-    size_ = 0;
+    releaseBlocks();
     write_pos_ = 0;
 
-    return write_bytes;
+    return total;
 }
 
 bool Buffer::isFull() const
@@ -344,7 +470,7 @@ bool Buffer::isFull() const
 
 bool Buffer::isEmpty() const
 {
-    return size_ == 0;
+    return size_ == 0 && out_chunks_.empty();
 }
 
 bool Buffer::isEOF() const
@@ -357,6 +483,28 @@ size_t Buffer::size() const
     return size_;
 }
 
+size_t Buffer::outputSize() const
+{
+    if (!is_chunked_output_)
+        return size_;
+
+    size_t size = 0;
+    for (const auto &chunk : out_chunks_)
+        size += chunkWireSize(chunk) - chunk.sent;
+    return size;
+}
+
+void Buffer::startChunkedOutput(size_t head_size)
+{
+    is_chunked_output_ = true;
+    out_chunks_.clear();
+    out_chunks_.push_back(t_out_chunk{head_size, 0, false});
+    if (size_ > head_size)
+        addOutChunk(size_ - head_size);
+    if (is_eof_)
+        addOutChunk(0);
+}
+
 const std::string_view Buffer::peek() const
 {
     if (data_view_.empty())
@@ -364,58 +512,232 @@ const std::string_view Buffer::peek() const
     return data_view_.front();
 }
 
-bool Buffer::removeHeaderAndSetChunked(const std::size_t size, bool is_chunked)
+/**
+ * @details
+ * The common case is a head in the first view, returned as is.
+ * Otherwise all the bytes are copied once into a block big enough for `max_size`,
+ * so the rest of the head is read into that block, and it is not copied again.
+ */
+const std::string_view Buffer::peekHead(size_t max_size)
 {
-    is_chunked_ = is_chunked;
-
-    if (data_.size() != 1 || data_view_.size() != 1 || size > data_view_.front().size())
-        throw WebServErr::ShouldNotBeHereException("Buffer::removeHeader: invalid state");
+    if (data_view_.size() > 1)
+        linearize(std::min(std::max(max_size, block_size_), capacity_));
+    return peek();
+}
 
-    // Remove the header
-    auto front = data_view_.front();
-    front.remove_prefix(size);
-    if (front.empty())
+void Buffer::popFrontView()
+{
+    data_view_.pop_front();
+    auto &ref = ref_.front();
+    if (ref == 1)
     {
+        recycleBlock(std::move(data_.front()));
         data_.pop_front();
-        data_view_.pop_front();
         ref_.pop_front();
     }
     else
-        data_view_.front() = front;
+        --ref;
+}
+
+void Buffer::popBackView()
+{
+    data_view_.pop_back();
+    auto &ref = ref_.back();
+    if (ref == 1)
+    {
+        recycleBlock(std::move(data_.back()));
+        data_.pop_back();
+        ref_.pop_back();
+    }
+    else
+        --ref;
+}
+
+void Buffer::linearize(size_t min_block_size)
+{
+    std::string block = acquireBlock(std::max(size_, min_block_size));
+    size_t pos = 0;
+    for (const auto &view : data_view_)
+    {
+        std::memcpy(&block[pos], view.data(), view.size());
+        pos += view.size();
+    }
+
+    releaseBlocks();
+    data_.push_back(std::move(block));
+    ref_.push_back(1);
+    data_view_.push_back(std::string_view(data_.back().data(), size_));
+    write_pos_ = size_;
+}
+
+size_t Buffer::discard(size_t size)
+{
+    const size_t dropped = std::min(size, size_);
+    consumeFront(dropped);
+    return dropped;
+}
+
+/**
+ * @details
+ * Bytes after `size` belong to the next pipelined request. They are copied
+ * to the overflow, which is usually a small part of a request head.
+ * The write position is moved to the end of the last block,
+ * so the next read starts a new block instead of extending a trimmed view.
+ */
+void Buffer::trimTo(size_t size)
+{
+    if (size >= size_)
+        return;
+
+    size_t keep = size;
+    size_t i = 0;
+    while (keep > data_view_[i].size())
+        keep -= data_view_[i++].size();
+
+    std::string excess(data_view_[i].substr(keep));
+    for (size_t j = i + 1; j < data_view_.size(); ++j)
+        excess.append(data_view_[j]);
+    overflow_.insert(0, excess);
+
+    while (data_view_.size() > i + 1)
+        popBackView();
+    if (keep == 0)
+        popBackView();
+    else
+        data_view_.back() = data_view_.back().substr(0, keep);
+
+    size_ = size;
+    write_pos_ = data_.empty() ? 0 : data_.back().size();
+}
+
+/**
+ * @details
+ * The bytes left in the views (after a request without body) come first,
+ * then the overflow (after a request with body), both are the input of the next request.
+ */
+void Buffer::startNextMessage()
+{
+    is_chunked_ = false;
+    is_eof_ = false;
+    chunked_decoder_.reset();
+
+    // In chunked mode the last block may have no views, drop it.
+    if (data_view_.empty())
+    {
+        releaseBlocks();
+        write_pos_ = 0;
+    }
+
+    if (overflow_.empty())
+        return;
+
+    std::string block = std::move(overflow_);
+    overflow_.clear();
+    const size_t block_used = block.size();
+    block.resize(std::max(block_used, block_size_), '\0');
+    data_.push_back(std::move(block));
+    ref_.push_back(1);
+    data_view_.push_back(std::string_view(data_.back().data(), block_used));
+    write_pos_ = block_used;
+    size_ += block_used;
+}
+
+/**
+ * @details
+ * Views are rebuilt from their offsets, since a moved small string may not keep its data pointer.
+ * The views of a block are contiguous in `data_view_`, and `ref_` tells how many there are.
+ */
+void Buffer::append(Buffer &other)
+{
+    size_t view_idx = 0;
+    for (size_t block_idx = 0; block_idx < other.data_.size(); ++block_idx)
+    {
+        const char *old_data = other.data_[block_idx].data();
+        const size_t ref = other.ref_[block_idx];
+        data_.push_back(std::move(other.data_[block_idx]));
+        ref_.push_back(ref);
+        for (size_t k = 0; k < ref; ++k, ++view_idx)
+        {
+            const std::string_view view = other.data_view_[view_idx];
+            data_view_.push_back(std::string_view(data_.back().data() + (view.data() - old_data), view.size()));
+        }
+    }
+    size_ += other.size_;
+    write_pos_ = data_.empty() ? 0 : data_.back().size();
+
+    other.data_.clear();
+    other.ref_.clear();
+    other.data_view_.clear();
+    other.size_ = 0;
+    other.write_pos_ = 0;
+}
+
+bool Buffer::removeHeaderAndSetChunked(const std::size_t size, bool is_chunked)
+{
+    is_chunked_ = is_chunked;
+
+    if (data_view_.empty() || size > data_view_.front().size())
+        throw WebServErr::ShouldNotBeHereException("Buffer::removeHeader: invalid state");
+
+    // Remove the header
+    data_view_.front().remove_prefix(size);
+    if (data_view_.front().empty())
+        popFrontView();
     size_ -= size;
 
     // Also process the rest body if in chunked mode,
     // bc if the buffer contains all the chunked data, we have no chance to handle it again.
     if (is_chunked_ && !data_view_.empty())
     {
-        std::string_view rest = data_view_.front();
+        // The decoder works in place in a single block, the rest may have been read into several.
+        if (data_view_.size() > 1)
+            linearize(block_size_);
+
+        const std::string_view rest = data_view_.front();
+        const size_t from = rest.data() - data_.back().data();
         data_view_.pop_front();
         ref_.front() = 0;
+        size_ = 0;
+        write_pos_ = 0; // The header bytes are not needed anymore, the body is compacted over them.
 
-        // The good thing is that we can be sure we can start from a new chunk header.
-        ssize_t chunk_size = handleNextHeader(rest, 0, 0);
-        if (chunk_size == CHUNKED_ERROR)
+        if (decodeChunked(from, from + rest.size()) == CHUNKED_ERR)
             return false;
-        size_ = chunk_size;
     }
 
     return true;
 }
 
-bool Buffer::replaceHeader(std::string str)
+/**
+ * @details
+ * The new head gets its own block in front. When the old header was all the buffer,
+ * the next read starts a new block, so the body never extends the head view.
+ */
+bool Buffer::replaceHeader(size_t old_size, std::string str)
 {
-    if (data_.size() == 0 || data_view_.size() != data_.size())
+    if (data_view_.empty() || old_size > data_view_.front().size())
         return false;
 
-    data_.pop_front();
-    size_ -= data_view_.front().size();
-    data_view_.pop_front();
-    data_.push_front(str);
-    data_view_.push_front(std::string_view(data_.front().data(), str.size()));
-    size_ += str.size();
+    data_view_.front().remove_prefix(old_size);
+    size_ -= old_size;
+    if (data_view_.front().empty())
+        popFrontView();
+
+    const bool is_only_block = data_.empty();
+    const size_t write_size = str.size();
+    data_.push_front(std::move(str));
+    ref_.push_front(1);
+    data_view_.push_front(std::string_view(data_.front().data(), write_size));
+    size_ += write_size;
+    if (is_only_block)
+        write_pos_ = data_.front().size();
     return true;
 }
 
+/**
+ * @details
+ * The header is appended after the bytes already in the buffer,
+ * which are the responses queued before it, if any.
+ */
 bool Buffer::insertHeader(std::string str)
 {
     if (str.size() + size_ > capacity_)
@@ -424,16 +746,14 @@ bool Buffer::insertHeader(std::string str)
     size_t write_size = str.size();
 
     if (write_size < block_size_)
-    {
         str.resize(block_size_, '\0');
-        write_pos_ = write_size;
-    }
 
-    data_.push_front(str);
-    data_view_.push_front(std::string_view(data_.front().data(), write_size));
-    ref_.push_front(1);
+    data_.push_back(std::move(str));
+    data_view_.push_back(std::string_view(data_.back().data(), write_size));
+    ref_.push_back(1);
+    write_pos_ = write_size;
     size_ += write_size;
     return true;
 }
 
-Buffer::Buffer() : data_(), ref_(), data_view_(), capacity_(163840), write_pos_(0), size_(0), block_size_(16384), scratch_type_(None), scratched_(), remain_chunk_size_(0), is_chunked_(false), is_eof_(false) {}
+Buffer::Buffer() : data_(), ref_(), data_view_(), capacity_(163840), write_pos_(0), size_(0), block_size_(DEFAULT_BLOCK_SIZE), chunked_decoder_(), is_chunked_(false), is_eof_(false), overflow_(), is_chunked_output_(false), out_chunks_() {}
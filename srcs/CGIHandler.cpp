@@ -1,6 +1,6 @@
 #include "../includes/CGIHandler.hpp"
 
-CGIHandler::CGIHandler(EpollHelper &epoll_helper)
+CGIHandler::CGIHandler(EpollHelper &epoll_helper) : epoll_helper_(epoll_helper)
 {
 	result.FD_handler_IN = std::make_shared<RaiiFd>(epoll_helper);
 	result.FD_handler_OUT = std::make_shared<RaiiFd>(epoll_helper);
@@ -10,90 +10,117 @@ CGIHandler::CGIHandler(EpollHelper &epoll_helper)
 	result.pid = -1;
 }
 
-CGIHandler::~CGIHandler()
+CGIHandler::~CGIHandler() {}
+
+/**
+ * @brief Asks for a larger output pipe, fewer wake-ups per CGI byte. The default size is kept on failure.
+ */
+static void growPipe(int fd)
 {
-	for (char* ptr : envp)
-	{
-		if (ptr) {
-            delete [] ptr;
-			ptr = nullptr;
-        }
-	}
-	envp.clear();
+	(void)fcntl(fd, F_SETPIPE_SZ, CGI_PIPE_SIZE);
 }
 
+/**
+ * @brief Maps a header name character to its CGI meta-variable form: uppercase, '-' as '_'.
+ */
+static constexpr std::array<char, 256> ENV_KEY_CHARS = []
+{
+	std::array<char, 256> table{};
+	for (size_t c = 0; c < table.size(); ++c)
+		table[c] = static_cast<char>(c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c == '-' ? '_' : c);
+	return table;
+}();
+
+/**
+ * @details
+ * The entries are appended to one arena, "NAME=value\0" each, starting with the template of the config.
+ * `envp` points into the arena once it is complete, so no entry is allocated on its own.
+ */
 void CGIHandler::setENVP(
+    const t_cgi_config &cgi,
     const std::unordered_map<std::string, std::string> &requestLine,
-    const std::unordered_map<std::string, std::string> &requestHeader
+    const HttpHeaders &requestHeader
 ) {
+    env_arena_.reserve(cgi.env_template.size() + requestHeader.size() * 64 + 256);
+    env_arena_.assign(cgi.env_template);
 
-	// Clear previous envp if any
-	for (char* p : envp) if (p) delete [] p;
-    envp.clear();
-
-    auto addToENVP = [this](const std::string &key, const std::string &value) {
-        std::string temp = key + "=" + value;
-        char *cstr = new char[temp.size() + 1];
-        std::strcpy(cstr, temp.c_str());
-        envp.push_back(cstr);
+    auto addToENVP = [this](std::string_view prefix, std::string_view key, std::string_view value) {
+        env_arena_.append(prefix);
+        for (char c : key)
+            env_arena_.push_back(ENV_KEY_CHARS[static_cast<unsigned char>(c)]);
+        env_arena_.push_back('=');
+        env_arena_.append(value);
+        env_arena_.push_back('\0');
     };
 
     for (const auto &kv : requestLine) {
         if (kv.first == "Method")
-            addToENVP("REQUEST_METHOD", kv.second);
-        else {
-            std::string upper;
-            for (char c : kv.first)
-                upper.push_back(std::toupper((unsigned char)c));
-            addToENVP(upper, kv.second);
-        }
+            addToENVP("", "REQUEST_METHOD", kv.second);
+        else
+            addToENVP("", kv.first, kv.second);
     }
 
-    for (const auto &kv : requestHeader) {
-        std::string keyUpper;
-        keyUpper.reserve(kv.first.size());
-        for (char c : kv.first) {
-            if (c == '-') keyUpper.push_back('_');
-            else keyUpper.push_back(std::toupper((unsigned char)c));
+    requestHeader.forEach([&addToENVP](std::string_view name, const std::string &value) {
+        switch (headerIdOf(name))
+        {
+        case HDR_CONTENT_TYPE:
+            addToENVP("", "CONTENT_TYPE", value);
+            return;
+        case HDR_CONTENT_LENGTH:
+            addToENVP("", "CONTENT_LENGTH", value);
+            return;
+        case HDR_HOST:
+        case HDR_SERVERNAME:
+        case HDR_REQUESTPORT:
+            return;
+        default:
+            break;
         }
+        addToENVP("HTTP_", name, value);
+    });
 
-        if (keyUpper == "CONTENT_TYPE")
-            addToENVP("CONTENT_TYPE", kv.second);
-        else if (keyUpper == "CONTENT_LENGTH")
-            addToENVP("CONTENT_LENGTH", kv.second);
-        else if (keyUpper == "HOST")
-            continue;
-        else if (keyUpper == "SERVERNAME" || keyUpper == "REQUESTPORT")
-            continue;
-        else
-            addToENVP("HTTP_" + keyUpper, kv.second);
-    }
-
-    if (requestHeader.count("servername"))
-        addToENVP("SERVER_NAME", requestHeader.at("servername"));
-    if (requestHeader.count("requestport"))
-        addToENVP("SERVER_PORT", requestHeader.at("requestport"));
+    if (const std::string *servername = requestHeader.find(HDR_SERVERNAME))
+        addToENVP("", "SERVER_NAME", *servername);
+    if (const std::string *requestport = requestHeader.find(HDR_REQUESTPORT))
+        addToENVP("", "SERVER_PORT", *requestport);
 
+    envp.clear();
+    for (size_t pos = 0; pos < env_arena_.size(); pos = env_arena_.find('\0', pos) + 1)
+        envp.push_back(env_arena_.data() + pos);
     envp.push_back(nullptr);
 }
 
-void CGIHandler::handleCGIProcess( std::filesystem::path &path, std::string &cmd, int inPipe[2], int outPipe[2])
+/**
+ * @details
+ * `posix_spawn` does not copy the page tables of the server (vfork semantics),
+ * so the launch cost does not grow with its memory.
+ * In the child: the pipes become stdin and stdout, every other fd of the server is closed,
+ * and the working directory is the root of the CGI.
+ * Returns -1 with `errno` set if the program could not be started.
+ */
+pid_t CGIHandler::spawnCGI(const std::filesystem::path &path, const std::string &cmd, int inPipe[2], int outPipe[2])
 {
-	char **final_envp = envp.data();
-
-	if (chdir(path.c_str()) == -1)
-        return; // We cannot exit bc of the assignment
-	close(inPipe[WRITE]);
-    close(outPipe[READ]);
-	if (dup2(inPipe[READ], STDIN_FILENO) == -1)
-		return;
-	if (dup2(outPipe[WRITE], STDOUT_FILENO) == -1)
-		return;
-
-	close(inPipe[READ]);
-    close(outPipe[WRITE]);
-	if (execve(cmd.c_str(), argv.data(), final_envp) == -1)
-		return;
+	posix_spawn_file_actions_t actions;
+	if (posix_spawn_file_actions_init(&actions) != 0)
+		return -1;
+
+	pid_t pid = -1;
+	int error = posix_spawn_file_actions_adddup2(&actions, inPipe[READ], STDIN_FILENO);
+	if (!error)
+		error = posix_spawn_file_actions_adddup2(&actions, outPipe[WRITE], STDOUT_FILENO);
+	if (!error)
+		error = posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+	if (!error)
+		error = posix_spawn_file_actions_addchdir_np(&actions, path.c_str());
+	if (!error)
+		error = posix_spawn(&pid, cmd.c_str(), &actions, nullptr, argv.data(), envp.data());
+	posix_spawn_file_actions_destroy(&actions);
+	if (error)
+	{
+		errno = error;
+		return -1;
+	}
+	return pid;
 }
 
 std::string getProgName(std::string &targetRef)
@@ -112,7 +139,7 @@ std::string getExtName(std::string &prog_name)
 	return prog_name.substr(pos);
 }
 
-t_file CGIHandler::getCGIOutput(std::string &targetRef, std::unordered_map<std::string, std::string> requestLine, std::unordered_map<std::string, std::string> requestHeader, t_server_config &server)
+t_file CGIHandler::getCGIOutput(std::string &targetRef, std::unordered_map<std::string, std::string> requestLine, const HttpHeaders &requestHeader, t_server_config &server)
 {
 	auto prog_name = getProgName(targetRef);
 	auto ext_name = getExtName(prog_name);
@@ -120,6 +147,11 @@ t_file CGIHandler::getCGIOutput(std::string &targetRef, std::unordered_map<std::
 	if (!server.cgi_paths.contains(ext_name))
 		throw WebServErr::MethodException(ERR_501_NOT_IMPLEMENTED, "CGI extension not supported");
 
+	if (!server.cgi_paths.at(ext_name).fastcgi.empty())
+		return getFastCgiJob(server.cgi_paths.at(ext_name), prog_name, requestLine, requestHeader);
+	if (server.cgi_paths.at(ext_name).prefork.max_workers > 0)
+		return getPreforkJob(server.cgi_paths.at(ext_name), prog_name, requestLine, requestHeader, server.max_request_timeout);
+
 	const std::string interpreter = server.cgi_paths.at(ext_name).interpreter;
 	const std::string root = server.cgi_paths.at(ext_name).root;
 
@@ -128,34 +160,36 @@ t_file CGIHandler::getCGIOutput(std::string &targetRef, std::unordered_map<std::
 	//Check Root Validity
 	std::filesystem::path rootPath(root);
 	checkRootValidity(rootPath);
+
+	// Checked before the spawn: an interpreter starts fine, then exits on a missing script.
+	if (faccessat(AT_FDCWD, (rootPath / prog_name).c_str(), isInterpreter ? R_OK : X_OK, 0) == -1)
+	{
+		if (errno == EACCES)
+			throw WebServErr::MethodException(ERR_403_FORBIDDEN, "CGI script is not accessible");
+		throw WebServErr::MethodException(ERR_404_NOT_FOUND, "CGI script does not exist.");
+	}
 	
 	//Set up ENVP and ARGV
-	setENVP(requestLine, requestHeader);
+	setENVP(server.cgi_paths.at(ext_name), requestLine, requestHeader);
 	setARGV(isInterpreter, interpreter, prog_name);
 	
+	// The child ends stay blocking, the server ends are made non-blocking when they are registered.
 	int inPipe[2] = {-1, -1};
 	int outPipe[2] = {-1, -1};
-	if (pipe(inPipe) == -1)
+	if (pipe2(inPipe, O_CLOEXEC) == -1)
 		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "inPipe failed to initialize");
-	if (pipe(outPipe) == -1)
-		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "outPipe failed to initialize");
 	result.FD_handler_IN->setFd(inPipe[WRITE]);
+	RaiiFd childIn(epoll_helper_, inPipe[READ]);
+	if (pipe2(outPipe, O_CLOEXEC) == -1)
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "outPipe failed to initialize");
 	result.FD_handler_OUT->setFd(outPipe[READ]);
-	result.pid = fork();
-	if (result.pid == -1)
-		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "CGI Failed to fork");
+	growPipe(outPipe[READ]);
+	RaiiFd childOut(epoll_helper_, outPipe[WRITE]);
 
-	std::string cmd = isInterpreter ? interpreter : prog_name;
-	if (result.pid == 0)
-	{
-		handleCGIProcess(rootPath, cmd, inPipe, outPipe);
-		return {}; // We cannot throw or exit in child process
-	}
-		
-	int status;
-	waitpid(result.pid, &status, WNOHANG);
-	close(inPipe[READ]);
-	close(outPipe[WRITE]);
+	const std::string cmd = isInterpreter ? interpreter : prog_name;
+	result.pid = spawnCGI(rootPath, cmd, inPipe, outPipe);
+	if (result.pid == -1)
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "CGI Failed to spawn");
 	return (result);
 }
 
@@ -176,4 +210,89 @@ void	CGIHandler::checkRootValidity(const std::filesystem::path &root)
 		throw WebServErr::MethodException(ERR_403_FORBIDDEN, "CGI script is not a directory");
 	if (access(root.c_str(), R_OK | X_OK) == -1)
 		throw WebServErr::MethodException(ERR_403_FORBIDDEN, "CGI script is not executable");
-}
\ No newline at end of file
+}
+
+t_file CGIHandler::getFastCgiJob(const t_cgi_config &cgi, std::string &prog_name, const std::unordered_map<std::string, std::string> &requestLine, const HttpHeaders &requestHeader)
+{
+	setENVP(cgi, requestLine, requestHeader);
+
+	auto job = std::make_shared<t_fcgi_job>();
+	for (const char *entry : envp)
+	{
+		if (!entry)
+			continue;
+		const std::string_view pair(entry);
+		const size_t eq = pair.find('=');
+		fcgiAppendParam(job->params, pair.substr(0, eq), pair.substr(eq + 1));
+	}
+	// The application resolves the script, it may run on another host.
+	fcgiAppendParam(job->params, "SCRIPT_FILENAME", (std::filesystem::path(cgi.root) / prog_name).string());
+
+	job->address = cgi.fastcgi;
+	job->content_length = 0;
+	if (const std::string *length = requestHeader.find(HDR_CONTENT_LENGTH))
+		job->content_length = std::stoull(*length);
+	else if (requestHeader.contains(HDR_TRANSFER_ENCODING))
+		job->content_length = SIZE_MAX; // Chunked, the body ends with the pipe
+	job->body = -1;
+	job->output = -1;
+	job->conn_fd = -1;
+	job->request_id = 0;
+	job->body_sent = 0;
+	job->output_started = false;
+	job->is_ended = false;
+	job->is_aborted = false;
+
+	int inPipe[2] = {-1, -1};
+	int outPipe[2] = {-1, -1};
+	if (pipe2(inPipe, O_NONBLOCK | O_CLOEXEC) == -1)
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "inPipe failed to initialize");
+	result.FD_handler_IN->setFd(inPipe[WRITE]);
+	job->body_fd = std::make_shared<RaiiFd>(epoll_helper_, inPipe[READ]);
+	if (pipe2(outPipe, O_NONBLOCK | O_CLOEXEC) == -1)
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "outPipe failed to initialize");
+	result.FD_handler_OUT->setFd(outPipe[READ]);
+	growPipe(outPipe[READ]);
+	job->output_fd = std::make_shared<RaiiFd>(epoll_helper_, outPipe[WRITE]);
+
+	result.fcgi = std::move(job);
+	return (result);
+}
+
+t_file CGIHandler::getPreforkJob(const t_cgi_config &cgi, std::string &prog_name, const std::unordered_map<std::string, std::string> &requestLine, const HttpHeaders &requestHeader, time_t max_duration)
+{
+	checkRootValidity(std::filesystem::path(cgi.root));
+	setENVP(cgi, requestLine, requestHeader);
+
+	auto job = std::make_shared<t_cgi_job>();
+	job->group = CgiWorkerPool::groupKey(cgi);
+	job->max_duration = max_duration;
+	job->message = "Q" + cgi.root + '\0' + prog_name;
+	for (const char *entry : envp)
+	{
+		if (!entry)
+			continue;
+		job->message += '\0';
+		job->message += entry;
+	}
+	if (job->message.size() > CGI_WORKER_MAX_MESSAGE)
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "CGI environment too large");
+
+	// The worker ends stay blocking, the script reads and writes them as a forked CGI would.
+	int inPipe[2] = {-1, -1};
+	int outPipe[2] = {-1, -1};
+	if (pipe2(inPipe, O_CLOEXEC) == -1)
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "inPipe failed to initialize");
+	result.FD_handler_IN->setFd(inPipe[WRITE]);
+	job->stdin_fd = std::make_shared<RaiiFd>(epoll_helper_, inPipe[READ]);
+	if (pipe2(outPipe, O_CLOEXEC) == -1)
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "outPipe failed to initialize");
+	result.FD_handler_OUT->setFd(outPipe[READ]);
+	growPipe(outPipe[READ]);
+	job->stdout_fd = std::make_shared<RaiiFd>(epoll_helper_, outPipe[WRITE]);
+	fcntl(inPipe[WRITE], F_SETFL, O_NONBLOCK);
+	fcntl(outPipe[READ], F_SETFL, O_NONBLOCK);
+
+	result.job = std::move(job);
+	return (result);
+}
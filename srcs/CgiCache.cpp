@@ -0,0 +1,341 @@
+#include "CgiCache.hpp"
+#include "LogSys.hpp"
+#include "WebServErr.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <fcntl.h>
+#include <unistd.h>
+
+CgiCache::CgiCache(EpollHelper &epoll, ChildReaper &children)
+    : epoll_(epoll), children_(children), flights_(), entries_(), entry_order_(), stored_bytes_(0), sources_(), readers_() {}
+
+std::string CgiCache::key(size_t config_idx, std::string_view method, std::string_view target)
+{
+    std::string result = std::to_string(config_idx);
+    result.append(" ").append(method).append(" ").append(target);
+    return result;
+}
+
+bool CgiCache::owns(int fd) const
+{
+    return sources_.contains(fd) || readers_.contains(fd);
+}
+
+//
+// Policy
+//
+
+static std::string_view trim(std::string_view value)
+{
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+        value.remove_prefix(1);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+        value.remove_suffix(1);
+    return value;
+}
+
+time_t cgiCacheTtl(std::string_view output, time_t ttl)
+{
+    size_t pos = 0;
+    while (true)
+    {
+        const size_t eol = output.find('\n', pos);
+        if (eol == std::string_view::npos)
+            return 0; // No complete header
+        std::string_view line = output.substr(pos, eol - pos);
+        pos = eol + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (line.empty())
+            return ttl;
+
+        const size_t colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos)
+            return 0;
+        const std::string name = toLower(std::string(line.substr(0, colon)));
+        const std::string_view value = trim(line.substr(colon + 1));
+
+        if (name == "status" && !value.starts_with("200"))
+            return 0;
+        if (name == "set-cookie")
+            return 0;
+        if (name != "cache-control")
+            continue;
+
+        const std::string directives = toLower(std::string(value));
+        if (hasToken(directives, "no-store") || hasToken(directives, "no-cache") || hasToken(directives, "private"))
+            return 0;
+        const size_t max_age = directives.find("max-age=");
+        if (max_age != std::string::npos)
+        {
+            time_t seconds = 0;
+            const char *begin = directives.data() + max_age + 8;
+            const auto result = std::from_chars(begin, directives.data() + directives.size(), seconds);
+            if (result.ec != std::errc() || result.ptr == begin)
+                return 0;
+            ttl = std::min(ttl, seconds);
+        }
+    }
+}
+
+//
+// Readers
+//
+
+t_file CgiCache::addReader(const std::shared_ptr<t_cgi_flight> &flight, t_msg_from_serv &msg)
+{
+    int out[2];
+    if (pipe2(out, O_NONBLOCK | O_CLOEXEC) == -1)
+        throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "cache pipe failed to initialize");
+    (void)fcntl(out[1], F_SETPIPE_SZ, CGI_PIPE_SIZE);
+
+    t_file res = {nullptr, std::make_shared<RaiiFd>(epoll_, out[0]), 0, 0, false, "", "", -1, nullptr, nullptr, nullptr, nullptr};
+    msg.fds_to_register.push_back(std::make_shared<RaiiFd>(epoll_, out[1]));
+    flight->readers.push_back(out[1]);
+    t_cgi_cache_reader &reader = readers_[out[1]] = t_cgi_cache_reader{out[1], flight, flight->base};
+    flushReader(reader, msg);
+    return res;
+}
+
+void CgiCache::flushReader(t_cgi_cache_reader &reader, t_msg_from_serv &msg)
+{
+    t_cgi_flight &flight = *reader.flight;
+    const size_t end = flight.base + flight.output.size();
+    if (reader.offset < end)
+    {
+        const ssize_t n = write(reader.fd, flight.output.data() + (reader.offset - flight.base), end - reader.offset);
+        if (n == -1 && errno != EAGAIN)
+        {
+            closeReader(reader.fd, msg);
+            return;
+        }
+        if (n > 0)
+            reader.offset += n;
+    }
+    if (reader.offset == end && flight.is_done)
+        closeReader(reader.fd, msg);
+}
+
+void CgiCache::flushReaders(t_cgi_flight &flight, t_msg_from_serv &msg)
+{
+    const std::vector<int> readers = flight.readers;
+    for (const int fd : readers)
+    {
+        if (readers_.contains(fd))
+            flushReader(readers_.at(fd), msg);
+    }
+}
+
+void CgiCache::closeReader(int fd, t_msg_from_serv &msg)
+{
+    std::shared_ptr<t_cgi_flight> flight = readers_.at(fd).flight;
+    std::erase(flight->readers, fd);
+    readers_.erase(fd);
+    msg.fds_to_unregister.push_back(fd);
+
+    // Nobody reads an output that will not be stored.
+    if (!flight->is_done && !flight->is_storable && flight->readers.empty())
+        endFlight(*flight, msg);
+}
+
+//
+// Flights
+//
+
+void CgiCache::endFlight(t_cgi_flight &flight, t_msg_from_serv &msg)
+{
+    if (flight.source != -1)
+    {
+        msg.fds_to_unregister.push_back(flight.source);
+        sources_.erase(flight.source);
+        flight.source = -1;
+    }
+    if (flight.pid > 0)
+        children_.stop(flight.pid, time(NULL));
+    flight.pid = -1;
+    flight.is_done = true;
+
+    auto it = flights_.find(flight.key);
+    if (it != flights_.end() && it->second.get() == &flight)
+        flights_.erase(it);
+}
+
+void CgiCache::trim(t_cgi_flight &flight)
+{
+    if (flight.is_storable || flight.readers.empty())
+        return;
+    size_t lowest = flight.base + flight.output.size();
+    for (const int fd : flight.readers)
+        lowest = std::min(lowest, readers_.at(fd).offset);
+    if (lowest - flight.base < CGI_CACHE_IO_SIZE)
+        return;
+    flight.output.erase(0, lowest - flight.base);
+    flight.base = lowest;
+}
+
+void CgiCache::dropEntry(const std::string &key)
+{
+    const auto it = entries_.find(key);
+    stored_bytes_ -= it->second->output.size();
+    entry_order_.erase(it->second->expiry);
+    entries_.erase(it);
+}
+
+/**
+ * @details
+ * Entries of the same expiry are evicted in the order they were stored.
+ */
+void CgiCache::store(const std::shared_ptr<t_cgi_flight> &flight, time_t now)
+{
+    const time_t ttl = cgiCacheTtl(flight->output, flight->config.ttl);
+    if (ttl <= 0 || flight->output.size() > CGI_CACHE_MAX_BYTES)
+        return;
+
+    if (entries_.contains(flight->key))
+        dropEntry(flight->key);
+    while (stored_bytes_ + flight->output.size() > CGI_CACHE_MAX_BYTES && !entry_order_.empty())
+        dropEntry(entry_order_.begin()->second);
+
+    flight->expires = now + ttl;
+    flight->expiry = entry_order_.emplace(flight->expires, flight->key);
+    entries_[flight->key] = flight;
+    stored_bytes_ += flight->output.size();
+}
+
+/**
+ * @details
+ * The CGI is not read while a reader lags by `CGI_CACHE_MAX_LAG`, the slowest client paces it.
+ * At the EOF the output is stored if it is complete and the CGI allows it, and the readers get the rest.
+ */
+void CgiCache::onSourceEvent(t_cgi_flight &flight, t_msg_from_serv &msg)
+{
+    const size_t end = flight.base + flight.output.size();
+    for (const int fd : flight.readers)
+    {
+        if (end - readers_.at(fd).offset > CGI_CACHE_MAX_LAG)
+            return;
+    }
+
+    char buf[CGI_CACHE_IO_SIZE];
+    const ssize_t n = read(flight.source, buf, sizeof(buf));
+    if (n == -1 && errno == EAGAIN)
+        return;
+
+    std::shared_ptr<t_cgi_flight> self = sources_.at(flight.source);
+    if (n > 0)
+    {
+        flight.output.append(buf, n);
+        if (flight.is_storable && flight.output.size() > flight.config.max_size)
+        {
+            flight.is_storable = false;
+            auto it = flights_.find(flight.key);
+            if (it != flights_.end() && it->second == self)
+                flights_.erase(it);
+        }
+    }
+    else
+    {
+        // The exit of a forked CGI is reaped by the `ChildReaper`.
+        flight.pid = -1;
+        endFlight(flight, msg);
+        if (n == 0 && flight.is_storable)
+            store(self, time(NULL));
+    }
+
+    flushReaders(flight, msg);
+    trim(flight);
+    if (!flight.is_done && !flight.is_storable && flight.readers.empty())
+        endFlight(flight, msg);
+}
+
+//
+// Interface
+//
+
+bool CgiCache::join(const std::string &key, t_file &res, t_msg_from_serv &msg)
+{
+    std::shared_ptr<t_cgi_flight> flight;
+    auto entry = entries_.find(key);
+    if (entry != entries_.end() && entry->second->expires > time(NULL))
+        flight = entry->second;
+    else if (auto running = flights_.find(key); running != flights_.end())
+        flight = running->second;
+    if (!flight)
+        return false;
+
+    // No CGI reads the body, the input pipe only looks like one.
+    int in[2];
+    if (pipe2(in, O_NONBLOCK | O_CLOEXEC) == -1)
+        throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "cache pipe failed to initialize");
+    close(in[0]);
+    res = addReader(flight, msg);
+    res.FD_handler_IN = std::make_shared<RaiiFd>(epoll_, in[1]);
+    return true;
+}
+
+t_msg_from_serv CgiCache::startFlight(const std::string &key, const t_cgi_cache_config &config, t_file &res, time_t max_duration)
+{
+    t_msg_from_serv msg;
+    auto flight = std::make_shared<t_cgi_flight>();
+    flight->key = key;
+    flight->base = 0;
+    flight->source = res.FD_handler_OUT->get();
+    flight->pid = res.pid;
+    flight->deadline = time(NULL) + max_duration;
+    flight->config = config;
+    flight->is_storable = true;
+    flight->is_done = false;
+    flight->expires = 0;
+
+    msg.fds_to_register.push_back(std::move(res.FD_handler_OUT));
+    sources_[flight->source] = flight;
+    flights_[key] = flight;
+    res.FD_handler_OUT = addReader(flight, msg).FD_handler_OUT;
+    return msg;
+}
+
+t_msg_from_serv CgiCache::handleEvent(int fd, t_event_type event_type)
+{
+    t_msg_from_serv msg;
+    if (sources_.contains(fd))
+    {
+        if (event_type != WRITE_EVENT)
+            onSourceEvent(*sources_.at(fd), msg);
+        return msg;
+    }
+
+    if (event_type == ERROR_EVENT) // The connection closed its end
+        closeReader(fd, msg);
+    else if (event_type == WRITE_EVENT)
+    {
+        t_cgi_cache_reader &reader = readers_.at(fd);
+        std::shared_ptr<t_cgi_flight> flight = reader.flight;
+        flushReader(reader, msg);
+        trim(*flight);
+    }
+    return msg;
+}
+
+void CgiCache::tick(time_t now)
+{
+    for (auto &[fd, flight] : sources_)
+    {
+        if (flight->pid > 0 && now > flight->deadline)
+        {
+            // A stopped CGI leaves a truncated output.
+            children_.stop(flight->pid, now);
+            flight->pid = -1;
+            flight->is_storable = false;
+        }
+    }
+
+    while (!entry_order_.empty() && entry_order_.begin()->first <= now)
+        dropEntry(entry_order_.begin()->second);
+}
+
+size_t CgiCache::storedBytes() const
+{
+    return stored_bytes_;
+}
@@ -0,0 +1,379 @@
+#include "CgiWorkerPool.hpp"
+#include "LogSys.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static constexpr int WORKER_CONTROL_FD = 3;
+static constexpr std::string_view BAD_GATEWAY = "Status: 502 Bad Gateway\r\nContent-Length: 0\r\n\r\n";
+
+/**
+ * The worker side: parks on the control socket (fd 3), and runs one script per request message,
+ * with the received pipes as fd 0 and 1. Fd 0 and 1 point to /dev/null in between,
+ * so the connection sees the EOF of the output as soon as the script is done.
+ */
+static constexpr const char *BOOTSTRAP = R"PY(
+import io, os, runpy, socket, sys, traceback
+ctl = socket.socket(fileno=3)
+null = os.open(os.devnull, os.O_RDWR)
+os.dup2(null, 0)
+os.dup2(null, 1)
+base_env = dict(os.environb)
+base_path = list(sys.path)
+ctl.send(b'R')
+while True:
+    try:
+        msg, fds, _, _ = socket.recv_fds(ctl, 1 << 20, 2)
+    except (OSError, KeyboardInterrupt):
+        break
+    if not msg:
+        break
+    if msg == b'P':
+        ctl.send(b'O')
+        continue
+    fields = msg[1:].split(b'\0')
+    os.dup2(fds[0], 0)
+    os.dup2(fds[1], 1)
+    for fd in fds:
+        os.close(fd)
+    os.environb.clear()
+    os.environb.update(base_env)
+    for field in fields[2:]:
+        name, _, value = field.partition(b'=')
+        if name:
+            os.environb[name] = value
+    cwd = os.fsdecode(fields[0])
+    script = os.fsdecode(fields[1])
+    sys.stdin = io.TextIOWrapper(io.BufferedReader(io.FileIO(0, 'r', closefd=False)))
+    sys.stdout = io.TextIOWrapper(io.BufferedWriter(io.FileIO(1, 'w', closefd=False)))
+    sys.argv = [script]
+    sys.path[:] = [cwd] + base_path
+    try:
+        os.chdir(cwd)
+        runpy.run_path(script, run_name='__main__')
+    except SystemExit:
+        pass
+    except BaseException:
+        traceback.print_exc()
+    try:
+        sys.stdout.flush()
+    except BaseException:
+        pass
+    os.dup2(null, 0)
+    os.dup2(null, 1)
+    ctl.send(b'D')
+)PY";
+
+CgiWorkerPool::CgiWorkerPool(EpollHelper &epoll, const std::vector<t_server_config> &configs) : epoll_(epoll), groups_(), workers_(), reaping_()
+{
+    for (const t_server_config &server : configs)
+    {
+        for (const auto &[ext, cgi] : server.cgi_paths)
+        {
+            if (cgi.prefork.max_workers == 0 || groups_.contains(groupKey(cgi)))
+                continue;
+            t_cgi_worker_group &group = groups_[groupKey(cgi)];
+            group.interpreter = cgi.interpreter;
+            group.config = cgi.prefork;
+            group.retry_after = 0;
+        }
+    }
+}
+
+CgiWorkerPool::~CgiWorkerPool()
+{
+    for (const auto &[fd, worker] : workers_)
+        reaping_.push_back(worker.pid);
+    for (const pid_t pid : reaping_)
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+std::string CgiWorkerPool::groupKey(const t_cgi_config &cgi)
+{
+    return cgi.interpreter;
+}
+
+bool CgiWorkerPool::owns(int fd) const
+{
+    return workers_.contains(fd);
+}
+
+//
+// Workers
+//
+
+bool CgiWorkerPool::spawn(const std::string &group_key, t_msg_from_serv &msg)
+{
+    const std::string &interpreter = groups_.at(group_key).interpreter;
+    if (time(NULL) < groups_.at(group_key).retry_after)
+        return false;
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == -1)
+        return false;
+
+    const pid_t pid = fork();
+    if (pid == -1)
+    {
+        close(pair[0]);
+        close(pair[1]);
+        return false;
+    }
+    if (pid == 0)
+    {
+        if (pair[1] == WORKER_CONTROL_FD)
+            fcntl(WORKER_CONTROL_FD, F_SETFD, 0);
+        else if (dup2(pair[1], WORKER_CONTROL_FD) == -1)
+            _exit(127);
+        close_range(WORKER_CONTROL_FD + 1, ~0U, 0); // Nothing of the server leaks into the interpreter
+        char *const argv[] = {const_cast<char *>(interpreter.c_str()), const_cast<char *>("-c"), const_cast<char *>(BOOTSTRAP), nullptr};
+        char *const envp[] = {nullptr};
+        execve(interpreter.c_str(), argv, envp);
+        _exit(127);
+    }
+
+    close(pair[1]);
+    fcntl(pair[0], F_SETFL, O_NONBLOCK);
+    msg.fds_to_register.push_back(std::make_shared<RaiiFd>(epoll_, pair[0]));
+
+    const time_t now = time(NULL);
+    workers_[pair[0]] = t_cgi_worker{pid, pair[0], group_key, WORKER_STARTING, now, now, 0, 0};
+    LOG_INFO("CGI worker spawned, pid: ", pid);
+    return true;
+}
+
+void CgiWorkerPool::removeWorker(int fd, bool kill_it, t_msg_from_serv &msg)
+{
+    const t_cgi_worker &worker = workers_.at(fd);
+    if (kill_it)
+    {
+        LOG_WARN("CGI worker killed, pid: ", worker.pid);
+        kill(worker.pid, SIGKILL);
+    }
+    reaping_.push_back(worker.pid);
+    msg.fds_to_unregister.push_back(fd); // A live worker reads the EOF and exits
+    workers_.erase(fd);
+}
+
+/**
+ * @brief A request whose connection closed its end of the output is dropped.
+ */
+static bool isAbandoned(const t_cgi_job &job)
+{
+    pollfd pfd = {job.stdout_fd->get(), POLLOUT, 0};
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLERR);
+}
+
+bool CgiWorkerPool::sendJob(t_cgi_worker &worker, t_cgi_job &job)
+{
+    iovec iov = {job.message.data(), job.message.size()};
+    char control[CMSG_SPACE(2 * sizeof(int))] = {};
+    msghdr header{};
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    const int fds[2] = {job.stdin_fd->get(), job.stdout_fd->get()};
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(worker.fd, &header, MSG_NOSIGNAL) != static_cast<ssize_t>(job.message.size()))
+        return false;
+
+    // The worker holds the pipes now, the output ends with the script.
+    job.stdin_fd = nullptr;
+    job.stdout_fd = nullptr;
+    const time_t now = time(NULL);
+    worker.state = WORKER_BUSY;
+    worker.state_since = now;
+    worker.deadline = now + job.max_duration;
+    return true;
+}
+
+/**
+ * @details
+ * Queued requests go to the idle workers, in order.
+ * Missing workers are spawned, one per queued request, up to `max_workers`.
+ */
+void CgiWorkerPool::dispatch(const std::string &group_key, t_msg_from_serv &msg)
+{
+    t_cgi_worker_group &group = groups_.at(group_key);
+
+    while (!group.waiting.empty())
+    {
+        if (isAbandoned(*group.waiting.front()))
+        {
+            group.waiting.pop_front();
+            continue;
+        }
+
+        auto idle = std::find_if(workers_.begin(), workers_.end(), [&group_key](const auto &entry)
+                                 { return entry.second.group == group_key && entry.second.state == WORKER_IDLE; });
+        if (idle == workers_.end())
+            break;
+
+        if (!sendJob(idle->second, *group.waiting.front()))
+        {
+            removeWorker(idle->first, true, msg);
+            continue;
+        }
+        group.waiting.pop_front();
+    }
+
+    size_t total = 0;
+    size_t starting = 0;
+    for (const auto &[fd, worker] : workers_)
+    {
+        if (worker.group != group_key)
+            continue;
+        ++total;
+        starting += worker.state == WORKER_STARTING;
+    }
+    while (starting < group.waiting.size() && total < group.config.max_workers && spawn(group_key, msg))
+    {
+        ++starting;
+        ++total;
+    }
+
+    // No worker will come, the CGI header of a 502 answers the queued requests.
+    if (total == 0)
+    {
+        for (const auto &job : group.waiting)
+            (void)!write(job->stdout_fd->get(), BAD_GATEWAY.data(), BAD_GATEWAY.size());
+        group.waiting.clear();
+    }
+}
+
+//
+// Interface
+//
+
+t_msg_from_serv CgiWorkerPool::submit(std::shared_ptr<t_cgi_job> job)
+{
+    t_msg_from_serv msg;
+    const std::string group_key = job->group;
+    groups_.at(group_key).waiting.push_back(std::move(job));
+    dispatch(group_key, msg);
+    return msg;
+}
+
+t_msg_from_serv CgiWorkerPool::handleEvent(int fd, t_event_type event_type)
+{
+    t_msg_from_serv msg;
+    if (event_type == WRITE_EVENT)
+        return msg;
+
+    t_cgi_worker &worker = workers_.at(fd);
+    const std::string group_key = worker.group;
+    char buf[16];
+    const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n == -1 && errno == EAGAIN && event_type == READ_EVENT)
+        return msg;
+
+    if (n <= 0)
+    {
+        // An interpreter failing to start is not respawned at once.
+        if (worker.state == WORKER_STARTING)
+            groups_.at(group_key).retry_after = time(NULL) + CGI_WORKER_START_TIMEOUT;
+        LOG_WARN("CGI worker exited, pid: ", worker.pid);
+        removeWorker(fd, false, msg);
+    }
+    else
+    {
+        const time_t now = time(NULL);
+        if (buf[0] == 'D')
+            ++worker.served;
+        if (buf[0] == 'D' || buf[0] == 'R')
+            worker.idle_since = now;
+        worker.state = WORKER_IDLE;
+        worker.state_since = now;
+        if (worker.served >= groups_.at(group_key).config.max_requests)
+            removeWorker(fd, false, msg);
+    }
+
+    dispatch(group_key, msg);
+    return msg;
+}
+
+/**
+ * @details
+ * - A worker not ready in time, not answering its ping, or past the deadline of its request is killed.
+ * - An idle worker is retired after `idle_timeout` if the group keeps `min_workers` without it,
+ *   else it is pinged every `CGI_WORKER_PING_INTERVAL`.
+ * - Each group is topped up to `min_workers`.
+ */
+t_msg_from_serv CgiWorkerPool::tick(time_t now)
+{
+    t_msg_from_serv msg;
+    std::unordered_map<std::string, size_t> counts;
+    std::vector<std::pair<int, bool>> to_remove; // fd, whether it is killed
+
+    for (const auto &[fd, worker] : workers_)
+        ++counts[worker.group];
+
+    for (auto &[fd, worker] : workers_)
+    {
+        const t_prefork_config &config = groups_.at(worker.group).config;
+        switch (worker.state)
+        {
+        case WORKER_STARTING:
+            if (now - worker.state_since > CGI_WORKER_START_TIMEOUT)
+                to_remove.emplace_back(fd, true);
+            break;
+        case WORKER_PINGING:
+            if (now - worker.state_since > CGI_WORKER_PING_TIMEOUT)
+                to_remove.emplace_back(fd, true);
+            break;
+        case WORKER_BUSY:
+            if (now > worker.deadline)
+                to_remove.emplace_back(fd, true);
+            break;
+        case WORKER_IDLE:
+            if (counts[worker.group] > config.min_workers && now - worker.idle_since > static_cast<time_t>(config.idle_timeout))
+            {
+                --counts[worker.group];
+                to_remove.emplace_back(fd, false);
+            }
+            else if (now - worker.state_since >= CGI_WORKER_PING_INTERVAL)
+            {
+                if (send(fd, "P", 1, MSG_NOSIGNAL) == 1)
+                {
+                    worker.state = WORKER_PINGING;
+                    worker.state_since = now;
+                }
+                else
+                    to_remove.emplace_back(fd, true);
+            }
+            break;
+        }
+    }
+    for (const auto &[fd, kill_it] : to_remove)
+        removeWorker(fd, kill_it, msg);
+
+    for (auto &[key, group] : groups_)
+    {
+        size_t total = 0;
+        for (const auto &[fd, worker] : workers_)
+            total += worker.group == key;
+        while (total < group.config.min_workers && spawn(key, msg))
+            ++total;
+        if (!group.waiting.empty())
+            dispatch(key, msg);
+    }
+
+    std::erase_if(reaping_, [](pid_t pid)
+                  { return waitpid(pid, NULL, WNOHANG) != 0; });
+    return msg;
+}
@@ -0,0 +1,101 @@
+#include "ChildReaper.hpp"
+#include "LogSys.hpp"
+#include <cerrno>
+#include <csignal>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Raw syscalls, the glibc wrappers are missing or unusable from C++ on older versions.
+static int pidfdOpen(pid_t pid)
+{
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+}
+
+static int pidfdSignal(int pidfd, int sig)
+{
+    return static_cast<int>(syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0));
+}
+
+ChildReaper::ChildReaper(EpollHelper &epoll) : epoll_(epoll), children_(), pidfds_(), stopping_() {}
+
+ChildReaper::~ChildReaper()
+{
+    for (const auto &[fd, child] : children_)
+    {
+        pidfdSignal(fd, SIGKILL);
+        waitpid(child.pid, NULL, 0);
+    }
+}
+
+bool ChildReaper::owns(int fd) const
+{
+    return children_.contains(fd);
+}
+
+t_msg_from_serv ChildReaper::watch(pid_t pid)
+{
+    t_msg_from_serv msg;
+    const int fd = pidfdOpen(pid);
+    if (fd == -1)
+    {
+        // No pidfd, the child is waited for now rather than left a zombie.
+        LOG_WARN("pidfd_open failed, pid: ", pid);
+        waitpid(pid, NULL, 0);
+        return msg;
+    }
+    children_[fd] = t_child{pid, fd};
+    pidfds_[pid] = fd;
+    msg.fds_to_register.push_back(std::make_shared<RaiiFd>(epoll_, fd));
+    return msg;
+}
+
+void ChildReaper::stop(pid_t pid, time_t now)
+{
+    auto it = pidfds_.find(pid);
+    if (it == pidfds_.end() || stopping_.contains(it->second))
+        return;
+    LOG_INFO("Stopping CGI, pid: ", pid);
+    pidfdSignal(it->second, SIGTERM);
+    stopping_[it->second] = now + CGI_KILL_GRACE;
+}
+
+t_msg_from_serv ChildReaper::handleEvent(int fd, t_event_type event_type)
+{
+    t_msg_from_serv msg;
+    if (event_type == WRITE_EVENT)
+        return msg;
+
+    siginfo_t info{};
+    if (waitid(P_PIDFD, fd, &info, WEXITED | WNOHANG) == -1)
+    {
+        if (errno != ECHILD)
+            return msg;
+    }
+    else if (info.si_pid == 0)
+        return msg; // Not exited yet
+
+    const pid_t pid = children_.at(fd).pid;
+    if (info.si_code == CLD_EXITED && info.si_status != 0)
+        LOG_WARN("CGI exited with status ", info.si_status, ", pid: ", pid);
+    else if (info.si_code == CLD_KILLED || info.si_code == CLD_DUMPED)
+        LOG_WARN("CGI killed by signal ", info.si_status, ", pid: ", pid);
+
+    pidfds_.erase(pid);
+    stopping_.erase(fd);
+    children_.erase(fd);
+    msg.fds_to_unregister.push_back(fd);
+    return msg;
+}
+
+void ChildReaper::tick(time_t now)
+{
+    for (auto &[fd, kill_at] : stopping_)
+    {
+        if (kill_at == 0 || now < kill_at)
+            continue;
+        LOG_WARN("Killing CGI, pid: ", children_.at(fd).pid);
+        pidfdSignal(fd, SIGKILL);
+        kill_at = 0; // The exit event reaps it
+    }
+}
@@ -0,0 +1,137 @@
+#include "ChunkedDecoder.hpp"
+#include "ScanKernels.hpp"
+#include <algorithm>
+#include <cstdint>
+
+ChunkedDecoder::ChunkedDecoder() : state_(CHUNK_SIZE_FIRST), remain_(0), line_size_(0), trailer_size_(0) {}
+
+void ChunkedDecoder::fail()
+{
+    state_ = CHUNK_ERROR;
+}
+
+/**
+ * @details
+ * Framing bytes are consumed one by one, they are only a few per chunk.
+ * Chunk data is consumed as a whole span, then the function returns,
+ * so the caller handles each span before asking for the next one.
+ */
+size_t ChunkedDecoder::next(std::string_view data, std::string_view &body)
+{
+    body = std::string_view();
+    size_t i = 0;
+
+    while (i < data.size() && state_ != CHUNK_DONE && state_ != CHUNK_ERROR)
+    {
+        if (state_ == CHUNK_DATA)
+        {
+            const size_t take = std::min(remain_, data.size() - i);
+            body = data.substr(i, take);
+            remain_ -= take;
+            if (remain_ == 0)
+                state_ = CHUNK_DATA_CR;
+            return i + take;
+        }
+
+        const char c = data[i++];
+        switch (state_)
+        {
+        case CHUNK_SIZE_FIRST:
+        case CHUNK_SIZE:
+        {
+            if (++line_size_ > MAX_CHUNK_LINE_SIZE)
+            {
+                fail();
+                return i;
+            }
+            const int digit = hexDigitValue(c);
+            if (digit >= 0)
+            {
+                if (remain_ > (SIZE_MAX >> 4)) // The size would overflow
+                {
+                    fail();
+                    return i;
+                }
+                remain_ = (remain_ << 4) | static_cast<size_t>(digit);
+                state_ = CHUNK_SIZE;
+            }
+            else if (state_ == CHUNK_SIZE_FIRST)
+                fail();
+            else if (c == ';' || c == ' ' || c == '\t')
+                state_ = CHUNK_EXT;
+            else if (c == '\r')
+                state_ = CHUNK_SIZE_LF;
+            else
+                fail();
+            break;
+        }
+        case CHUNK_EXT:
+            if (++line_size_ > MAX_CHUNK_LINE_SIZE)
+            {
+                fail();
+                return i;
+            }
+            if (c == '\r')
+                state_ = CHUNK_SIZE_LF;
+            else if (static_cast<unsigned char>(c) < 0x20 && c != '\t')
+                fail();
+            break;
+        case CHUNK_SIZE_LF:
+            if (c != '\n')
+                fail();
+            else
+            {
+                line_size_ = 0;
+                state_ = remain_ == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+            }
+            break;
+        case CHUNK_DATA_CR:
+            state_ = c == '\r' ? CHUNK_DATA_LF : CHUNK_ERROR;
+            break;
+        case CHUNK_DATA_LF:
+            state_ = c == '\n' ? CHUNK_SIZE_FIRST : CHUNK_ERROR;
+            break;
+        case CHUNK_TRAILER:
+        case CHUNK_TRAILER_LINE:
+            if (++trailer_size_ > MAX_TRAILER_SIZE)
+            {
+                fail();
+                return i;
+            }
+            if (c == '\r')
+                state_ = state_ == CHUNK_TRAILER ? CHUNK_FINAL_LF : CHUNK_TRAILER_LF;
+            else if (c == '\n')
+                fail();
+            else
+                state_ = CHUNK_TRAILER_LINE;
+            break;
+        case CHUNK_TRAILER_LF:
+            state_ = c == '\n' ? CHUNK_TRAILER : CHUNK_ERROR;
+            break;
+        case CHUNK_FINAL_LF:
+            state_ = c == '\n' ? CHUNK_DONE : CHUNK_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+    return i;
+}
+
+bool ChunkedDecoder::isDone() const
+{
+    return state_ == CHUNK_DONE;
+}
+
+bool ChunkedDecoder::isError() const
+{
+    return state_ == CHUNK_ERROR;
+}
+
+void ChunkedDecoder::reset()
+{
+    state_ = CHUNK_SIZE_FIRST;
+    remain_ = 0;
+    line_size_ = 0;
+    trailer_size_ = 0;
+}
@@ -7,6 +7,18 @@ const std::string randomServerName()
     return "server_" + std::to_string(counter++);
 }
 
+/**
+ * @brief Whether `address` is "unix:<path>" or "<host>:<port>".
+ */
+static bool isSocketAddress(const std::string &address)
+{
+    const size_t colon = address.rfind(':');
+    const bool is_unix = address.starts_with("unix:") && address.size() > 5;
+    const bool is_tcp = colon != std::string::npos && colon > 0 && colon + 1 < address.size()
+        && address.find_first_not_of("0123456789", colon + 1) == std::string::npos;
+    return is_unix || is_tcp;
+}
+
 t_status_error_codes stringToErrCode(std::string str)
 {
     if (str == "301")
@@ -23,6 +35,8 @@ t_status_error_codes stringToErrCode(std::string str)
         return ERR_405_METHOD_NOT_ALLOWED;
     if (str == "409")
         return ERR_409_CONFLICT;
+    if (str == "413")
+        return ERR_413_CONTENT_TOO_LARGE;
     if (str == "500")
         return ERR_500_INTERNAL_SERVER_ERROR;
     if (str == "501")
@@ -75,6 +89,13 @@ void Config::fromJson(const std::string &json_string)
         const unsigned int max_headers_size = server_obj.contains("max_headers_size") ? TinyJson::as<unsigned int>(*server_obj.at("max_headers_size")) : global_config_.max_headers_size;
         server_config.max_headers_size = std::min(max_headers_size, global_config_.max_headers_size);
 
+        server_config.upload_sync_size = server_obj.contains("upload_sync_size") ? TinyJson::as<unsigned int>(*server_obj.at("upload_sync_size")) : 0;
+
+        server_config.max_sessions = server_obj.contains("max_sessions") ? TinyJson::as<unsigned int>(*server_obj.at("max_sessions")) : SESSION_MAX_COUNT;
+        if (server_config.max_sessions == 0)
+            throw std::invalid_argument("max_sessions cannot be 0 for server: " + server_config.server_name);
+        server_config.session_file = server_obj.contains("session_file") ? TinyJson::as<std::string>(*server_obj.at("session_file")) : "";
+
         server_config.is_cgi = server_obj.contains("is_cgi") ? TinyJson::as<bool>(*server_obj.at("is_cgi")) : false;
 
         if (server_config.is_cgi)
@@ -93,6 +114,41 @@ void Config::fromJson(const std::string &json_string)
                 cgi_config.root = TinyJson::as<std::string>(*cgi_detail_obj.at("root"));
                 if (cgi_config.root.empty())
                     throw std::invalid_argument("cgi root cannot be empty for extension: " + extension);
+                if (cgi_detail_obj.contains("fastcgi"))
+                {
+                    cgi_config.fastcgi = TinyJson::as<std::string>(*cgi_detail_obj.at("fastcgi"));
+                    if (!isSocketAddress(cgi_config.fastcgi))
+                        throw std::invalid_argument("invalid fastcgi address for extension: " + extension);
+                }
+                cgi_config.prefork = {0, 0, 0, 0};
+                if (cgi_detail_obj.contains("prefork"))
+                {
+                    const JsonObject &prefork_obj = TinyJson::as<JsonObject>(*cgi_detail_obj.at("prefork"));
+                    t_prefork_config &prefork = cgi_config.prefork;
+                    prefork.min_workers = prefork_obj.contains("min_workers") ? TinyJson::as<unsigned int>(*prefork_obj.at("min_workers")) : CGI_MIN_WORKERS;
+                    prefork.max_workers = prefork_obj.contains("max_workers") ? TinyJson::as<unsigned int>(*prefork_obj.at("max_workers")) : CGI_MAX_WORKERS;
+                    prefork.max_requests = prefork_obj.contains("max_requests") ? TinyJson::as<unsigned int>(*prefork_obj.at("max_requests")) : CGI_WORKER_MAX_REQUESTS;
+                    prefork.idle_timeout = prefork_obj.contains("idle_timeout") ? TinyJson::as<unsigned int>(*prefork_obj.at("idle_timeout")) : CGI_WORKER_IDLE_TIMEOUT;
+                    const std::string interpreter_name = cgi_config.interpreter.substr(cgi_config.interpreter.rfind('/') + 1);
+                    if (!interpreter_name.starts_with("python"))
+                        throw std::invalid_argument("prefork requires a python interpreter for extension: " + extension);
+                    if (!cgi_config.fastcgi.empty())
+                        throw std::invalid_argument("prefork and fastcgi are exclusive for extension: " + extension);
+                    if (prefork.max_workers == 0 || prefork.min_workers > prefork.max_workers || prefork.max_requests == 0)
+                        throw std::invalid_argument("invalid prefork sizes for extension: " + extension);
+                }
+                cgi_config.cache = {0, 0};
+                if (cgi_detail_obj.contains("cache"))
+                {
+                    const JsonObject &cache_obj = TinyJson::as<JsonObject>(*cgi_detail_obj.at("cache"));
+                    t_cgi_cache_config &cache = cgi_config.cache;
+                    cache.ttl = TinyJson::as<unsigned int>(*cache_obj.at("ttl"));
+                    cache.max_size = cache_obj.contains("max_size") ? TinyJson::as<size_t>(*cache_obj.at("max_size")) : CGI_CACHE_MAX_ENTRY;
+                    if (cache.ttl == 0 || cache.max_size == 0)
+                        throw std::invalid_argument("invalid cache settings for extension: " + extension);
+                }
+                cgi_config.env_template = std::string("GATEWAY_INTERFACE=CGI/1.1") + '\0' + "SERVER_SOFTWARE=webserv" + '\0'
+                    + "DOCUMENT_ROOT=" + cgi_config.root + '\0';
                 server_config.cgi_paths[extension] = std::move(cgi_config);
             }
         }
@@ -106,8 +162,32 @@ void Config::fromJson(const std::string &json_string)
                     throw std::invalid_argument("invalid location path: " + location_path);
                 const JsonObject location_obj = TinyJson::as<JsonObject>(*location_pair.second);
                 t_location_config location_config;
-                location_config.root = TinyJson::as<std::string>(*location_obj.at("root"));
+                location_config.proxy = {{}, PROXY_ROUND_ROBIN, PROXY_MAX_FAILS, PROXY_FAIL_TIMEOUT};
+                if (location_obj.contains("proxy"))
+                {
+                    const JsonObject &proxy_obj = TinyJson::as<JsonObject>(*location_obj.at("proxy"));
+                    t_proxy_config &proxy = location_config.proxy;
+                    for (const auto &upstream_ptr : TinyJson::as<JsonArray>(*proxy_obj.at("upstreams")))
+                    {
+                        proxy.upstreams.push_back(TinyJson::as<std::string>(*upstream_ptr));
+                        if (!isSocketAddress(proxy.upstreams.back()))
+                            throw std::invalid_argument("invalid upstream address in location: " + location_path);
+                    }
+                    if (proxy.upstreams.empty())
+                        throw std::invalid_argument("proxy without upstreams in location: " + location_path);
+                    const std::string balance = proxy_obj.contains("balance") ? TinyJson::as<std::string>(*proxy_obj.at("balance")) : "round_robin";
+                    if (balance != "round_robin" && balance != "least_conn")
+                        throw std::invalid_argument("invalid proxy balance in location: " + location_path);
+                    proxy.balance = balance == "least_conn" ? PROXY_LEAST_CONN : PROXY_ROUND_ROBIN;
+                    proxy.max_fails = proxy_obj.contains("max_fails") ? TinyJson::as<unsigned int>(*proxy_obj.at("max_fails")) : PROXY_MAX_FAILS;
+                    proxy.fail_timeout = proxy_obj.contains("fail_timeout") ? TinyJson::as<unsigned int>(*proxy_obj.at("fail_timeout")) : PROXY_FAIL_TIMEOUT;
+                }
+                // A proxy location serves nothing from the file system.
+                location_config.root = location_config.proxy.upstreams.empty() || location_obj.contains("root") ? TinyJson::as<std::string>(*location_obj.at("root")) : "";
                 location_config.index = location_obj.contains("index") ? TinyJson::as<std::string>(*location_obj.at("index")) : "";
+                location_config.max_files = location_obj.contains("max_files") ? TinyJson::as<size_t>(*location_obj.at("max_files")) : UPLOAD_MAX_FILES;
+                location_config.max_bytes = location_obj.contains("max_bytes") ? TinyJson::as<size_t>(*location_obj.at("max_bytes")) : 0;
+                location_config.root_fd = -1;
 
                 JsonArray methods_array = TinyJson::as<JsonArray>(*location_obj.at("methods"));
                 for (const auto &method_value_ptr : methods_array)
@@ -1,48 +1,37 @@
 # include "../includes/Cookie.hpp"
 
-Cookie::Cookie() : cookies_() {}
+Cookie::Cookie(size_t max_sessions, const std::string &session_file) : sessions_(max_sessions, MAX_COOKIE_AGE, session_file) {}
 Cookie::~Cookie() {}
 
-bool Cookie::checkValidAndExtendCookie(const std::string &cookie)
+std::string_view Cookie::sessionId(std::string_view header)
 {
-    if (!cookies_.contains(cookie))
-        return false;
-    time_t current_time = time(nullptr);
-    time_t cookie_time = cookies_[cookie];
-    double seconds_diff = difftime(current_time, cookie_time);
-    if (seconds_diff > MAX_COOKIE_AGE) // 1 hour expiration
+    while (!header.empty())
     {
-        cookies_.erase(cookie);
-        return false;
+        const size_t end = header.find(';');
+        std::string_view pair = header.substr(0, end);
+        header = end == std::string_view::npos ? std::string_view() : header.substr(end + 1);
+        pair.remove_prefix(std::min(pair.find_first_not_of(' '), pair.size()));
+        if (pair.starts_with("session_id="))
+            return pair.substr(11);
     }
-
-    cookies_[cookie] = current_time;
-    return true;
+    return std::string_view();
 }
 
-std::string Cookie::setCookie(std::string &cookie, time_t ts)
+std::string Cookie::setCookie(const t_session_id &id) const
 {
-    if (ts == 0) {
-        ts = time(nullptr);
-        cookies_.insert(std::make_pair(cookie, ts));
-    }
-    std::string cookie_str = "Set-Cookie: " + cookie + "; Max-Age=" + std::to_string(MAX_COOKIE_AGE) + "; HttpOnly\r\n";
-    return (cookie_str);
+    return "Set-Cookie: session_id=" + SessionStore::format(id) + "; Max-Age=" + std::to_string(MAX_COOKIE_AGE) + "; HttpOnly\r\n";
 }
 
+/**
+ * @details
+ * A request without a known session gets a new one, the oldest is evicted once the store is full.
+ */
 std::string Cookie::set(HttpRequests &request)
 {
-    const auto headers = request.getrequestHeaderMap();
-    const auto has_cookie = headers.contains("Cookie");
-    const auto has_valid_cookie = has_cookie && checkValidAndExtendCookie(headers.at("Cookie"));
-    if (has_valid_cookie)
-    {
-        auto cookie = headers.at("Cookie");
-        return setCookie(cookie, cookies_[cookie]);
-    }
-    else
-    {
-        std::string new_cookie = "session_id=" + std::to_string(rand());
-        return setCookie(new_cookie, 0);
-    }
-}
\ No newline at end of file
+    const time_t now = time(nullptr);
+    const std::string *header = request.getrequestHeaderMap().find(HDR_COOKIE);
+    t_session_id id;
+    if (header && SessionStore::parse(sessionId(*header), id) && sessions_.touch(id, now))
+        return setCookie(id);
+    return setCookie(sessions_.create(now));
+}
@@ -2,7 +2,7 @@
 
 EpollHelper::EpollHelper()
 {
-    epollFd_ = epoll_create(1);
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
     if (epollFd_ == -1)
         throw WebServErr::SysCallErrException("epoll_create failed");
 }
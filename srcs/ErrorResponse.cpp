@@ -1,12 +1,20 @@
 #include "../includes/ErrorResponse.hpp"
+#include <fstream>
+#include <iterator>
 
-ErrorResponse::ErrorResponse(EpollHelper &epoll_helper)
+ErrorResponse::ErrorResponse(const std::unordered_map<t_status_error_codes, std::string> &errPages) : pages_()
 {
-    response_.FD_handler_IN = std::make_shared<RaiiFd>(epoll_helper);
-    response_.FD_handler_OUT = std::make_shared<RaiiFd>(epoll_helper);
-    response_.expectedSize = 0;
-    response_.fileSize = 0;
-    response_.isDynamic = false;
+    for (const auto &[code, path] : errPages)
+    {
+        std::ifstream page_file(path, std::ios::binary);
+        std::string page{std::istreambuf_iterator<char>(page_file), std::istreambuf_iterator<char>()};
+        if (!page_file.is_open() || page_file.bad())
+            LOG_WARN("Cannot read the error response page: ", path);
+        else if (page.size() > ERROR_PAGE_MAX_SIZE)
+            LOG_WARN("Error response page too large: ", path, " ", page.size());
+        else
+            pages_.emplace(code, std::move(page));
+    }
     LOG_TRACE("Error Reponse created ", "Go team go!");
 }
 
@@ -15,18 +23,11 @@ ErrorResponse::~ErrorResponse()
     LOG_TRACE("Error Response ", "Deconstructed");
 }
 
-t_file  ErrorResponse::getErrorPage(std::unordered_map<t_status_error_codes, std::string> &errPages, t_status_error_codes &code)
+const std::string &ErrorResponse::getErrorPage(t_status_error_codes code) const
 {
     LOG_TRACE("Getting Error Response page for code: ", code);
-    if (errPages.find(code) == errPages.end())
+    const auto it = pages_.find(code);
+    if (it == pages_.end())
         throw WebServErr::ErrorResponseException("Error Page does not exist");
-    std::filesystem::path errorFilename(errPages.find(code)->second);
-    if (access(errorFilename.c_str(), R_OK) == -1)
-        throw WebServErr::ErrorResponseException("Cannot access the error response page");
-    response_.FD_handler_OUT->setFd(open(errorFilename.c_str(), O_RDONLY | O_NONBLOCK));
-    if (response_.FD_handler_OUT.get()->get() == -1)
-        throw WebServErr::ErrorResponseException("Failed to open the error response page");
-    response_.fileSize = static_cast<int>(std::filesystem::file_size(errorFilename));
-    LOG_TRACE("Returning Error Response via FD: ", response_.FD_handler_OUT);
-    return (std::move(response_));
+    return it->second;
 }
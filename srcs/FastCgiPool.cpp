@@ -0,0 +1,528 @@
+#include "FastCgiPool.hpp"
+#include "LogSys.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static constexpr uint8_t FCGI_VERSION_1 = 1;
+static constexpr uint16_t FCGI_RESPONDER = 1;
+static constexpr uint8_t FCGI_KEEP_CONN = 1;
+static constexpr uint8_t FCGI_REQUEST_COMPLETE = 0;
+
+//
+// Records
+//
+
+void fcgiAppendRecord(std::string &out, t_fcgi_record_type type, uint16_t request_id, std::string_view content)
+{
+    const char header[FCGI_HEADER_SIZE] = {
+        static_cast<char>(FCGI_VERSION_1), static_cast<char>(type),
+        static_cast<char>(request_id >> 8), static_cast<char>(request_id),
+        static_cast<char>(content.size() >> 8), static_cast<char>(content.size()),
+        0, 0};
+    out.append(header, FCGI_HEADER_SIZE);
+    out.append(content);
+}
+
+static void appendLength(std::string &out, size_t length)
+{
+    if (length < 128)
+    {
+        out.push_back(static_cast<char>(length));
+        return;
+    }
+    out.push_back(static_cast<char>((length >> 24) | 0x80));
+    out.push_back(static_cast<char>(length >> 16));
+    out.push_back(static_cast<char>(length >> 8));
+    out.push_back(static_cast<char>(length));
+}
+
+void fcgiAppendParam(std::string &out, std::string_view name, std::string_view value)
+{
+    appendLength(out, name.size());
+    appendLength(out, value.size());
+    out.append(name);
+    out.append(value);
+}
+
+static bool readLength(std::string_view &in, size_t &length)
+{
+    if (in.empty())
+        return false;
+    if (!(static_cast<uint8_t>(in[0]) & 0x80))
+    {
+        length = static_cast<uint8_t>(in[0]);
+        in.remove_prefix(1);
+        return true;
+    }
+    if (in.size() < 4)
+        return false;
+    length = (size_t(uint8_t(in[0]) & 0x7f) << 24) | (size_t(uint8_t(in[1])) << 16) | (size_t(uint8_t(in[2])) << 8) | uint8_t(in[3]);
+    in.remove_prefix(4);
+    return true;
+}
+
+bool fcgiParseParams(std::string_view in, std::unordered_map<std::string, std::string> &params)
+{
+    while (!in.empty())
+    {
+        size_t name_length;
+        size_t value_length;
+        if (!readLength(in, name_length) || !readLength(in, value_length) || in.size() < name_length + value_length)
+            return false;
+        params[std::string(in.substr(0, name_length))] = std::string(in.substr(name_length, value_length));
+        in.remove_prefix(name_length + value_length);
+    }
+    return true;
+}
+
+int connectTo(const std::string &address, bool &is_connected)
+{
+    int fd = -1;
+    int result = -1;
+
+    if (address.starts_with("unix:"))
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        const std::string path = address.substr(5);
+        if (path.size() >= sizeof(addr.sun_path))
+            return -1;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            return -1;
+        result = connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    }
+    else
+    {
+        const size_t colon = address.rfind(':');
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_NUMERICSERV;
+        addrinfo *info = nullptr;
+        if (colon == std::string::npos || getaddrinfo(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str(), &hints, &info) != 0)
+            return -1;
+        fd = socket(info->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd != -1)
+            result = connect(fd, info->ai_addr, info->ai_addrlen);
+        freeaddrinfo(info);
+        if (fd == -1)
+            return -1;
+    }
+
+    if (result == -1 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+    is_connected = result == 0;
+    return fd;
+}
+
+FastCgiPool::FastCgiPool(EpollHelper &epoll) : epoll_(epoll), conns_(), job_fds_(), waiting_() {}
+
+bool FastCgiPool::owns(int fd) const
+{
+    return conns_.contains(fd) || job_fds_.contains(fd);
+}
+
+//
+// Requests
+//
+
+t_msg_from_serv FastCgiPool::submit(std::shared_ptr<t_fcgi_job> job)
+{
+    t_msg_from_serv msg;
+
+    job->body = job->body_fd->get();
+    job->output = job->output_fd->get();
+    msg.fds_to_register.push_back(std::move(job->body_fd));
+    msg.fds_to_register.push_back(std::move(job->output_fd));
+    job_fds_[job->body] = job;
+    job_fds_[job->output] = job;
+
+    waiting_[job->address].push_back(job);
+    dispatch(job->address, msg);
+    return msg;
+}
+
+/**
+ * @details
+ * A request goes to a connection with room for it, else to a new connection.
+ * When the application has no connection and none can be opened, its queue answers `502`.
+ */
+void FastCgiPool::dispatch(const std::string &address, t_msg_from_serv &msg)
+{
+    auto &queue = waiting_[address];
+
+    while (!queue.empty())
+    {
+        t_fcgi_conn *available = nullptr;
+        size_t count = 0;
+        for (auto &[fd, conn] : conns_)
+        {
+            if (conn.address != address)
+                continue;
+            ++count;
+            if (conn.requests.size() < (conn.can_multiplex ? conn.max_requests : 1))
+            {
+                available = &conn;
+                break;
+            }
+        }
+
+        if (!available)
+        {
+            if (count < FCGI_MAX_CONNS_PER_APP && openConn(address, msg))
+                continue;
+            if (count == 0)
+            {
+                for (const auto &job : queue)
+                    failJob(*job, msg);
+                queue.clear();
+            }
+            break;
+        }
+
+        std::shared_ptr<t_fcgi_job> job = std::move(queue.front());
+        queue.pop_front();
+        startRequest(*available, std::move(job), msg);
+    }
+}
+
+bool FastCgiPool::openConn(const std::string &address, t_msg_from_serv &msg)
+{
+    bool is_connected = false;
+    const int fd = connectTo(address, is_connected);
+    if (fd == -1)
+    {
+        LOG_WARN("Failed to connect to the FastCGI application: ", address);
+        return false;
+    }
+
+    msg.fds_to_register.push_back(std::make_shared<RaiiFd>(epoll_, fd));
+    t_fcgi_conn &conn = conns_[fd];
+    conn.fd = fd;
+    conn.address = address;
+    conn.is_connected = is_connected;
+    conn.can_multiplex = false;
+    conn.max_requests = 1;
+    conn.out_pos = 0;
+
+    std::string values;
+    fcgiAppendParam(values, "FCGI_MAX_REQS", "");
+    fcgiAppendParam(values, "FCGI_MPXS_CONNS", "");
+    fcgiAppendRecord(conn.out, FCGI_GET_VALUES, 0, values);
+    return true;
+}
+
+void FastCgiPool::startRequest(t_fcgi_conn &conn, std::shared_ptr<t_fcgi_job> job, t_msg_from_serv &msg)
+{
+    uint16_t id = 1;
+    while (conn.requests.contains(id))
+        ++id;
+    job->conn_fd = conn.fd;
+    job->request_id = id;
+    conn.requests[id] = job;
+
+    const char begin[8] = {0, static_cast<char>(FCGI_RESPONDER), static_cast<char>(FCGI_KEEP_CONN), 0, 0, 0, 0, 0};
+    fcgiAppendRecord(conn.out, FCGI_BEGIN_REQUEST, id, std::string_view(begin, sizeof(begin)));
+    for (size_t pos = 0; pos < job->params.size(); pos += FCGI_MAX_CONTENT)
+        fcgiAppendRecord(conn.out, FCGI_PARAMS, id, std::string_view(job->params).substr(pos, FCGI_MAX_CONTENT));
+    fcgiAppendRecord(conn.out, FCGI_PARAMS, id, "");
+    job->params.clear();
+
+    if (job->content_length == 0)
+    {
+        fcgiAppendRecord(conn.out, FCGI_STDIN, id, "");
+        closeBody(*job, msg);
+    }
+}
+
+void FastCgiPool::failJob(t_fcgi_job &job, t_msg_from_serv &msg)
+{
+    job.is_ended = true;
+    job.conn_fd = -1;
+    closeBody(job, msg);
+    if (!job.output_started)
+        job.pending.assign(FCGI_BAD_GATEWAY);
+    flushOutput(job, msg);
+}
+
+void FastCgiPool::closeBody(t_fcgi_job &job, t_msg_from_serv &msg)
+{
+    if (job.body == -1)
+        return;
+    job_fds_.erase(job.body);
+    msg.fds_to_unregister.push_back(job.body);
+    job.body = -1;
+}
+
+void FastCgiPool::closeOutput(t_fcgi_job &job, t_msg_from_serv &msg)
+{
+    if (job.output == -1)
+        return;
+    job_fds_.erase(job.output);
+    msg.fds_to_unregister.push_back(job.output);
+    job.output = -1;
+}
+
+void FastCgiPool::flushOutput(t_fcgi_job &job, t_msg_from_serv &msg)
+{
+    if (job.output == -1)
+    {
+        job.pending.clear();
+        return;
+    }
+
+    size_t written = 0;
+    while (written < job.pending.size())
+    {
+        const ssize_t n = write(job.output, job.pending.data() + written, job.pending.size() - written);
+        if (n <= 0)
+            break;
+        written += n;
+        job.output_started = true;
+    }
+    job.pending.erase(0, written);
+
+    if (job.is_ended && job.pending.empty())
+        closeOutput(job, msg);
+}
+
+void FastCgiPool::closeConn(int fd, t_msg_from_serv &msg)
+{
+    t_fcgi_conn &conn = conns_.at(fd);
+    const std::string address = conn.address;
+
+    for (auto &[id, job] : conn.requests)
+        failJob(*job, msg);
+    msg.fds_to_unregister.push_back(fd);
+    conns_.erase(fd);
+
+    dispatch(address, msg);
+}
+
+//
+// Events
+//
+
+t_msg_from_serv FastCgiPool::handleEvent(int fd, t_event_type event_type)
+{
+    t_msg_from_serv msg;
+
+    const auto conn = conns_.find(fd);
+    if (conn != conns_.end())
+    {
+        onConnEvent(conn->second, event_type, msg);
+        return msg;
+    }
+
+    const std::shared_ptr<t_fcgi_job> job = job_fds_.at(fd); // Kept alive while its fds close.
+    if (fd == job->body && event_type != WRITE_EVENT)
+        onBodyEvent(*job, msg);
+    else if (fd == job->output && event_type != READ_EVENT)
+        onOutputEvent(*job, event_type, msg);
+    return msg;
+}
+
+/**
+ * @details
+ * - Write: completes the connect, then sends the queued records.
+ * - Read: parses the records, unless an output pipe of the connection is full.
+ * - Error: the rest of the input is read, then the requests of the connection fail.
+ */
+void FastCgiPool::onConnEvent(t_fcgi_conn &conn, t_event_type event_type, t_msg_from_serv &msg)
+{
+    if (event_type == WRITE_EVENT)
+    {
+        if (!conn.is_connected)
+        {
+            int error = 0;
+            socklen_t size = sizeof(error);
+            if (getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &size) == -1 || error != 0)
+                return closeConn(conn.fd, msg);
+            conn.is_connected = true;
+        }
+        if (conn.out_pos == conn.out.size())
+            return;
+
+        const ssize_t n = write(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos);
+        if (n == -1 && errno != EAGAIN)
+            return closeConn(conn.fd, msg);
+        if (n > 0)
+            conn.out_pos += n;
+        if (conn.out_pos == conn.out.size())
+        {
+            conn.out.clear();
+            conn.out_pos = 0;
+        }
+        return;
+    }
+
+    if (!conn.is_connected)
+    {
+        if (event_type == ERROR_EVENT)
+            closeConn(conn.fd, msg);
+        return;
+    }
+
+    const bool is_blocked = std::any_of(conn.requests.begin(), conn.requests.end(), [](const auto &request)
+                                        { return request.second->pending.size() > FCGI_MAX_PENDING; });
+    if (is_blocked && event_type == READ_EVENT)
+        return; // The output pipes drain first
+
+    char buf[FCGI_IO_SIZE];
+    const ssize_t n = read(conn.fd, buf, sizeof(buf));
+    if (n == 0 || (n == -1 && event_type == ERROR_EVENT))
+        return closeConn(conn.fd, msg);
+    if (n == -1)
+        return;
+
+    conn.in.append(buf, n);
+    if (!processRecords(conn, msg))
+    {
+        LOG_WARN("Malformed FastCGI record from: ", conn.address);
+        return closeConn(conn.fd, msg);
+    }
+}
+
+bool FastCgiPool::processRecords(t_fcgi_conn &conn, t_msg_from_serv &msg)
+{
+    std::string_view in(conn.in);
+    bool has_room = false;
+
+    while (in.size() >= FCGI_HEADER_SIZE)
+    {
+        if (static_cast<uint8_t>(in[0]) != FCGI_VERSION_1)
+            return false;
+        const uint8_t type = static_cast<uint8_t>(in[1]);
+        const uint16_t id = (uint16_t(uint8_t(in[2])) << 8) | uint8_t(in[3]);
+        const size_t content_length = (size_t(uint8_t(in[4])) << 8) | uint8_t(in[5]);
+        const size_t padding_length = static_cast<uint8_t>(in[6]);
+        if (in.size() < FCGI_HEADER_SIZE + content_length + padding_length)
+            break;
+        const std::string_view content = in.substr(FCGI_HEADER_SIZE, content_length);
+        in.remove_prefix(FCGI_HEADER_SIZE + content_length + padding_length);
+
+        if (type == FCGI_GET_VALUES_RESULT)
+        {
+            std::unordered_map<std::string, std::string> values;
+            if (!fcgiParseParams(content, values))
+                return false;
+            conn.can_multiplex = values["FCGI_MPXS_CONNS"] == "1";
+            size_t max_requests = FCGI_MAX_REQS_PER_CONN;
+            const std::string &str = values["FCGI_MAX_REQS"];
+            std::from_chars(str.data(), str.data() + str.size(), max_requests);
+            conn.max_requests = std::clamp<size_t>(max_requests, 1, FCGI_MAX_REQS_PER_CONN);
+            has_room = conn.can_multiplex;
+            continue;
+        }
+
+        const auto request = conn.requests.find(id);
+        if (request == conn.requests.end())
+            continue; // A management record, or a request we gave up.
+        t_fcgi_job &job = *request->second;
+
+        switch (type)
+        {
+        case FCGI_STDOUT:
+            if (!job.is_aborted)
+            {
+                job.pending.append(content);
+                flushOutput(job, msg);
+            }
+            break;
+        case FCGI_STDERR:
+            LOG_WARN("FastCGI stderr: ", content);
+            break;
+        case FCGI_END_REQUEST:
+            if (content_length >= 5 && static_cast<uint8_t>(content[4]) != FCGI_REQUEST_COMPLETE)
+            {
+                LOG_WARN("FastCGI request rejected, protocol status: ", static_cast<int>(static_cast<uint8_t>(content[4])));
+                if (!job.output_started)
+                    job.pending.assign(FCGI_BAD_GATEWAY);
+            }
+            job.is_ended = true;
+            job.conn_fd = -1;
+            closeBody(job, msg);
+            flushOutput(job, msg);
+            conn.requests.erase(request);
+            has_room = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    conn.in.erase(0, conn.in.size() - in.size());
+    if (has_room)
+        dispatch(conn.address, msg);
+    return true;
+}
+
+/**
+ * @details
+ * The body is read only once the request has a connection, and while that connection is not backed up.
+ * STDIN ends at the Content-Length, or at the EOF when the body is chunked.
+ */
+void FastCgiPool::onBodyEvent(t_fcgi_job &job, t_msg_from_serv &msg)
+{
+    if (job.conn_fd == -1)
+        return;
+    t_fcgi_conn &conn = conns_.at(job.conn_fd);
+    if (conn.out.size() - conn.out_pos > FCGI_MAX_PENDING)
+        return;
+
+    char buf[FCGI_MAX_CONTENT];
+    const size_t size = std::min(sizeof(buf), job.content_length - job.body_sent);
+    const ssize_t n = read(job.body, buf, size);
+    if (n == -1)
+        return;
+
+    if (n > 0)
+    {
+        fcgiAppendRecord(conn.out, FCGI_STDIN, job.request_id, std::string_view(buf, n));
+        job.body_sent += n;
+    }
+    if (n == 0 || job.body_sent == job.content_length)
+    {
+        fcgiAppendRecord(conn.out, FCGI_STDIN, job.request_id, "");
+        closeBody(job, msg);
+    }
+}
+
+/**
+ * @details
+ * An error on the output pipe means the client is gone:
+ * a running request is aborted, a queued one is dropped.
+ */
+void FastCgiPool::onOutputEvent(t_fcgi_job &job, t_event_type event_type, t_msg_from_serv &msg)
+{
+    if (event_type == WRITE_EVENT)
+    {
+        if (!job.pending.empty())
+            flushOutput(job, msg);
+        return;
+    }
+
+    if (!job.is_ended)
+    {
+        if (job.conn_fd != -1)
+            fcgiAppendRecord(conns_.at(job.conn_fd).out, FCGI_ABORT_REQUEST, job.request_id, "");
+        else
+            std::erase_if(waiting_[job.address], [&job](const auto &queued)
+                          { return queued.get() == &job; });
+    }
+    job.is_aborted = true;
+    job.pending.clear();
+    closeBody(job, msg);
+    closeOutput(job, msg);
+}
@@ -0,0 +1,536 @@
+#include "Hpack.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+static constexpr uint32_t HUFFMAN_EOS_CODE = 0x3fffffff; // EOS symbol, only valid as padding.
+static constexpr uint8_t HUFFMAN_EOS_LENGTH = 30;
+static constexpr size_t HUFFMAN_SYMBOLS = 257;            // 256 octets and EOS.
+static constexpr unsigned MAX_INT_CONTINUATIONS = 4;      // Bytes after the prefix of an integer, up to 2^28.
+
+static constexpr uint32_t HUFFMAN_CODES[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+
+static constexpr uint8_t HUFFMAN_CODE_LENGTHS[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+static constexpr t_hpack_field STATIC_TABLE[HPACK_STATIC_TABLE_SIZE] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+//
+// Huffman coding
+//
+
+typedef std::array<int16_t, 2> t_huffman_node; // Children per bit: a node index, a leaf `-(symbol + 1)`, or 0 if none.
+
+/**
+ * @brief Returns the decoding tree of the Huffman code, built once, the root is node 0.
+ */
+static const std::vector<t_huffman_node> &huffmanTree()
+{
+    static const std::vector<t_huffman_node> tree = []()
+    {
+        std::vector<t_huffman_node> nodes(1, t_huffman_node{0, 0});
+        for (size_t sym = 0; sym < HUFFMAN_SYMBOLS; ++sym)
+        {
+            const uint32_t code = sym < 256 ? HUFFMAN_CODES[sym] : HUFFMAN_EOS_CODE;
+            const uint8_t length = sym < 256 ? HUFFMAN_CODE_LENGTHS[sym] : HUFFMAN_EOS_LENGTH;
+            size_t node = 0;
+            for (int bit = length - 1; bit > 0; --bit)
+            {
+                const int b = (code >> bit) & 1;
+                if (nodes[node][b] == 0)
+                {
+                    nodes[node][b] = static_cast<int16_t>(nodes.size());
+                    nodes.push_back(t_huffman_node{0, 0});
+                }
+                node = nodes[node][b];
+            }
+            nodes[node][code & 1] = static_cast<int16_t>(-(static_cast<int>(sym) + 1));
+        }
+        return nodes;
+    }();
+    return tree;
+}
+
+/**
+ * @details
+ * The padding must be the most significant bits of EOS, all ones, and shorter than a byte.
+ * A decoded EOS is an error.
+ */
+bool huffmanDecode(std::string_view in, std::string &out)
+{
+    const std::vector<t_huffman_node> &tree = huffmanTree();
+    size_t node = 0;
+    unsigned pending_bits = 0; // Bits read since the last symbol.
+    bool all_ones = true;
+
+    for (const unsigned char byte : in)
+    {
+        for (int bit = 7; bit >= 0; --bit)
+        {
+            const int b = (byte >> bit) & 1;
+            const int16_t next = tree[node][b];
+            if (next == 0)
+                return false;
+            if (next < 0)
+            {
+                const int sym = -next - 1;
+                if (sym == 256)
+                    return false;
+                out.push_back(static_cast<char>(sym));
+                node = 0;
+                pending_bits = 0;
+                all_ones = true;
+                continue;
+            }
+            node = next;
+            ++pending_bits;
+            all_ones = all_ones && b;
+        }
+    }
+    return pending_bits <= 7 && all_ones;
+}
+
+size_t huffmanEncodedSize(std::string_view in)
+{
+    size_t bits = 0;
+    for (const unsigned char c : in)
+        bits += HUFFMAN_CODE_LENGTHS[c];
+    return (bits + 7) / 8;
+}
+
+void huffmanEncode(std::string_view in, std::string &out)
+{
+    uint64_t acc = 0;
+    unsigned bits = 0;
+
+    for (const unsigned char c : in)
+    {
+        acc = (acc << HUFFMAN_CODE_LENGTHS[c]) | HUFFMAN_CODES[c];
+        bits += HUFFMAN_CODE_LENGTHS[c];
+        while (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back(static_cast<char>(acc >> bits));
+        }
+        acc &= (uint64_t(1) << bits) - 1;
+    }
+    if (bits > 0)
+        out.push_back(static_cast<char>((acc << (8 - bits)) | (0xff >> bits)));
+}
+
+//
+// Primitives
+//
+
+void hpackEncodeInt(std::string &out, size_t value, uint8_t prefix_bits, uint8_t first)
+{
+    const size_t max_prefix = (size_t(1) << prefix_bits) - 1;
+    if (value < max_prefix)
+    {
+        out.push_back(static_cast<char>(first | value));
+        return;
+    }
+    out.push_back(static_cast<char>(first | max_prefix));
+    value -= max_prefix;
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static bool decodeInt(std::string_view &in, uint8_t prefix_bits, size_t &value)
+{
+    if (in.empty())
+        return false;
+
+    const size_t max_prefix = (size_t(1) << prefix_bits) - 1;
+    value = static_cast<unsigned char>(in[0]) & max_prefix;
+    in.remove_prefix(1);
+    if (value < max_prefix)
+        return true;
+
+    for (unsigned i = 0; i < MAX_INT_CONTINUATIONS && !in.empty(); ++i)
+    {
+        const unsigned char byte = in[0];
+        in.remove_prefix(1);
+        value += size_t(byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static bool decodeString(std::string_view &in, std::string &out)
+{
+    if (in.empty())
+        return false;
+
+    const bool is_huffman = static_cast<unsigned char>(in[0]) & 0x80;
+    size_t length;
+    if (!decodeInt(in, 7, length) || length > in.size())
+        return false;
+
+    const std::string_view str = in.substr(0, length);
+    in.remove_prefix(length);
+    if (is_huffman)
+        return huffmanDecode(str, out);
+    out.assign(str);
+    return true;
+}
+
+//
+// HpackTable
+//
+
+HpackTable::HpackTable(size_t max_size) : dynamic_(), size_(0), max_size_(max_size) {}
+
+void HpackTable::evictTo(size_t max_size)
+{
+    while (size_ > max_size && !dynamic_.empty())
+    {
+        size_ -= dynamic_.back().first.size() + dynamic_.back().second.size() + HPACK_ENTRY_OVERHEAD;
+        dynamic_.pop_back();
+    }
+}
+
+bool HpackTable::get(size_t index, std::string_view &name, std::string_view &value) const
+{
+    if (index == 0)
+        return false;
+    if (index <= HPACK_STATIC_TABLE_SIZE)
+    {
+        name = STATIC_TABLE[index - 1].name;
+        value = STATIC_TABLE[index - 1].value;
+        return true;
+    }
+    index -= HPACK_STATIC_TABLE_SIZE + 1;
+    if (index >= dynamic_.size())
+        return false;
+    name = dynamic_[index].first;
+    value = dynamic_[index].second;
+    return true;
+}
+
+void HpackTable::add(std::string_view name, std::string_view value)
+{
+    const size_t entry_size = name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+    if (entry_size > max_size_)
+    {
+        evictTo(0);
+        return;
+    }
+    evictTo(max_size_ - entry_size);
+    dynamic_.emplace_front(std::string(name), std::string(value));
+    size_ += entry_size;
+}
+
+void HpackTable::setMaxSize(size_t max_size)
+{
+    max_size_ = max_size;
+    evictTo(max_size_);
+}
+
+size_t HpackTable::maxSize() const { return max_size_; }
+
+size_t HpackTable::size() const { return size_; }
+
+size_t HpackTable::find(std::string_view name, std::string_view value, bool &name_only) const
+{
+    size_t name_index = 0;
+
+    for (size_t i = 0; i < HPACK_STATIC_TABLE_SIZE; ++i)
+    {
+        if (STATIC_TABLE[i].name != name)
+            continue;
+        if (STATIC_TABLE[i].value == value)
+        {
+            name_only = false;
+            return i + 1;
+        }
+        if (name_index == 0)
+            name_index = i + 1;
+    }
+    for (size_t i = 0; i < dynamic_.size(); ++i)
+    {
+        if (dynamic_[i].first != name)
+            continue;
+        if (dynamic_[i].second == value)
+        {
+            name_only = false;
+            return HPACK_STATIC_TABLE_SIZE + 1 + i;
+        }
+        if (name_index == 0)
+            name_index = HPACK_STATIC_TABLE_SIZE + 1 + i;
+    }
+    name_only = true;
+    return name_index;
+}
+
+//
+// HpackDecoder
+//
+
+HpackDecoder::HpackDecoder(size_t max_table_size) : table_(max_table_size), max_table_size_(max_table_size) {}
+
+/**
+ * @details
+ * The representations, by their first bits (RFC 7541 section 6):
+ * - `1xxxxxxx` An indexed field.
+ * - `01xxxxxx` A literal field, added to the dynamic table.
+ * - `001xxxxx` A dynamic table size update, only before the first field.
+ * - `0000xxxx`, `0001xxxx` A literal field, not indexed, or never indexed.
+ *
+ * A few bytes of indexes can expand to megabytes of fields: once the list passes `max_list_size`,
+ * its fields are dropped, and the rest of the block only updates the dynamic table, which must stay in sync.
+ */
+t_hpack_status HpackDecoder::decode(std::string_view block, t_header_list &fields, size_t max_list_size)
+{
+    bool field_seen = false;
+    size_t list_size = 0;
+    bool is_too_large = false;
+    // Counts a field, whether it is kept.
+    const auto admit = [&](std::string_view name, std::string_view value)
+    {
+        field_seen = true;
+        if (is_too_large)
+            return false;
+        list_size += name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+        if (list_size <= max_list_size)
+            return true;
+        is_too_large = true;
+        t_header_list().swap(fields);
+        return false;
+    };
+
+    while (!block.empty())
+    {
+        const unsigned char first = block[0];
+        size_t index;
+
+        if (first & 0x80)
+        {
+            std::string_view name, value;
+            if (!decodeInt(block, 7, index) || !table_.get(index, name, value))
+                return HPACK_MALFORMED;
+            if (admit(name, value))
+                fields.emplace_back(std::string(name), std::string(value));
+            continue;
+        }
+
+        if ((first & 0xe0) == 0x20)
+        {
+            if (field_seen || !decodeInt(block, 5, index) || index > max_table_size_)
+                return HPACK_MALFORMED;
+            table_.setMaxSize(index);
+            continue;
+        }
+
+        const bool is_indexing = first & 0x40;
+        if (!decodeInt(block, is_indexing ? 6 : 4, index))
+            return HPACK_MALFORMED;
+
+        t_header_field field;
+        if (index != 0)
+        {
+            std::string_view name, value;
+            if (!table_.get(index, name, value))
+                return HPACK_MALFORMED;
+            field.first.assign(name);
+        }
+        else if (!decodeString(block, field.first))
+            return HPACK_MALFORMED;
+        if (!decodeString(block, field.second))
+            return HPACK_MALFORMED;
+
+        if (is_indexing)
+            table_.add(field.first, field.second);
+        if (admit(field.first, field.second))
+            fields.push_back(std::move(field));
+    }
+    return is_too_large ? HPACK_TOO_LARGE : HPACK_OK;
+}
+
+//
+// HpackEncoder
+//
+
+/**
+ * @brief Whether a field changes with every response, so it is not worth a dynamic table entry.
+ */
+static bool isVolatileField(std::string_view name)
+{
+    return name == "content-length" || name == "date" || name == "location" || name == "last-modified" || name == "etag" || name == "set-cookie";
+}
+
+HpackEncoder::HpackEncoder() : table_(HPACK_DEFAULT_TABLE_SIZE), min_size_update_(SIZE_MAX), size_update_(false) {}
+
+/**
+ * @details
+ * The table never grows past the default size, a larger table would only cost memory.
+ * When the size changed several times between two blocks, the smallest one is announced first,
+ * so the peer evicts the same entries (RFC 7541 section 4.2).
+ */
+void HpackEncoder::setMaxTableSize(size_t max_size)
+{
+    max_size = std::min(max_size, HPACK_DEFAULT_TABLE_SIZE);
+    min_size_update_ = std::min(min_size_update_, max_size);
+    table_.setMaxSize(max_size);
+    size_update_ = true;
+}
+
+void HpackEncoder::encodeString(std::string &out, std::string_view str)
+{
+    const size_t huffman_size = huffmanEncodedSize(str);
+    if (huffman_size < str.size())
+    {
+        hpackEncodeInt(out, huffman_size, 7, 0x80);
+        huffmanEncode(str, out);
+        return;
+    }
+    hpackEncodeInt(out, str.size(), 7, 0x00);
+    out.append(str);
+}
+
+void HpackEncoder::encode(std::string &out, std::string_view name, std::string_view value)
+{
+    if (size_update_)
+    {
+        if (min_size_update_ < table_.maxSize())
+            hpackEncodeInt(out, min_size_update_, 5, 0x20);
+        hpackEncodeInt(out, table_.maxSize(), 5, 0x20);
+        min_size_update_ = SIZE_MAX;
+        size_update_ = false;
+    }
+
+    bool name_only;
+    const size_t index = table_.find(name, value, name_only);
+    if (index != 0 && !name_only)
+    {
+        hpackEncodeInt(out, index, 7, 0x80);
+        return;
+    }
+
+    const bool is_indexing = !isVolatileField(name);
+    if (is_indexing)
+        hpackEncodeInt(out, index, 6, 0x40);
+    else
+        hpackEncodeInt(out, index, 4, 0x00);
+    if (index == 0)
+        encodeString(out, name);
+    encodeString(out, value);
+    if (is_indexing)
+        table_.add(name, value);
+}
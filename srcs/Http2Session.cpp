@@ -0,0 +1,1141 @@
+#include "Http2Session.hpp"
+#include "SharedTypes.hpp"
+#include "LogSys.hpp"
+#include <algorithm>
+#include <charconv>
+#include <unistd.h>
+
+static constexpr std::string_view SWITCHING_PROTOCOLS = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+static constexpr size_t SETTING_SIZE = 6;
+
+//
+// Helpers
+//
+
+static uint32_t readUint32(std::string_view p)
+{
+    return (uint32_t(uint8_t(p[0])) << 24) | (uint32_t(uint8_t(p[1])) << 16) | (uint32_t(uint8_t(p[2])) << 8) | uint32_t(uint8_t(p[3]));
+}
+
+static void appendUint32(std::string &out, uint32_t value)
+{
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+static void appendSetting(std::string &out, uint16_t id, uint32_t value)
+{
+    out.push_back(static_cast<char>(id >> 8));
+    out.push_back(static_cast<char>(id));
+    appendUint32(out, value);
+}
+
+/**
+ * @brief Removes the padding of a DATA or HEADERS payload, returns false if it is longer than the payload.
+ */
+static bool stripPadding(uint8_t flags, std::string_view &payload)
+{
+    if (!(flags & H2_FLAG_PADDED))
+        return true;
+    if (payload.empty())
+        return false;
+
+    const size_t pad_size = static_cast<uint8_t>(payload[0]);
+    payload.remove_prefix(1);
+    if (pad_size > payload.size())
+        return false;
+    payload.remove_suffix(pad_size);
+    return true;
+}
+
+static bool decodeBase64Url(std::string_view in, std::string &out)
+{
+    uint32_t acc = 0;
+    unsigned bits = 0;
+
+    while (!in.empty() && in.back() == '=')
+        in.remove_suffix(1);
+    for (const char c : in)
+    {
+        unsigned value;
+        if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            value = c - '0' + 52;
+        else if (c == '-' || c == '+')
+            value = 62;
+        else if (c == '_' || c == '/')
+            value = 63;
+        else
+            return false;
+        acc = (acc << 6) | value;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back(static_cast<char>(acc >> bits));
+        }
+    }
+    return true;
+}
+
+static bool isTokenChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || std::string_view("!#$%&'*+-.^_`|~").find(c) != std::string_view::npos;
+}
+
+/**
+ * @brief Field names are lowercase tokens in HTTP/2.
+ */
+static bool isFieldName(std::string_view name)
+{
+    return !name.empty() && std::all_of(name.begin(), name.end(), [](char c)
+                                        { return isTokenChar(c) && !(c >= 'A' && c <= 'Z'); });
+}
+
+/**
+ * @brief Values are copied into an HTTP/1.1 head, so a CR, LF or NUL would split it.
+ */
+static bool isFieldValue(std::string_view value)
+{
+    return value.find_first_of(std::string_view("\r\n\0", 3)) == std::string_view::npos;
+}
+
+/**
+ * @brief Connection-specific fields, forbidden in HTTP/2, and dropped from the gateway responses.
+ */
+static bool isConnectionField(std::string_view name)
+{
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "transfer-encoding" || name == "upgrade";
+}
+
+static bool parseSize(std::string_view str, size_t &value)
+{
+    const auto result = std::from_chars(str.data(), str.data() + str.size(), value);
+    return !str.empty() && result.ec == std::errc() && result.ptr == str.data() + str.size();
+}
+
+static t_h2_stream makeStream(uint32_t id, int64_t send_window)
+{
+    t_h2_stream stream;
+    stream.id = id;
+    stream.gateway_fd = -1;
+    stream.end_stream_received = false;
+    stream.is_chunked_request = false;
+    stream.expected_length = SIZE_MAX;
+    stream.data_received = 0;
+    stream.uncredited = 0;
+    stream.recv_window = H2_DEFAULT_WINDOW;
+    stream.send_window = send_window;
+    stream.res_state = H2_RES_HEAD;
+    stream.res_remaining = 0;
+    stream.res_head_ready = false;
+    stream.headers_sent = false;
+    stream.res_body_pos = 0;
+    stream.res_end = false;
+    return stream;
+}
+
+Http2Session::Http2Session(size_t max_header_list_size)
+    : in_(), in_pos_(0), out_(), out_pos_(0), preface_received_(false), is_closing_(false), peer_goaway_(false),
+      decoder_(), encoder_(), streams_(), gateways_(), last_stream_id_(0), last_sent_stream_(0), header_stream_(0),
+      header_flags_(0), header_block_(), max_header_list_size_(max_header_list_size), conn_recv_window_(H2_DEFAULT_WINDOW),
+      conn_send_window_(H2_DEFAULT_WINDOW), conn_uncredited_(0), peer_initial_window_(H2_DEFAULT_WINDOW),
+      peer_max_frame_size_(H2_DEFAULT_FRAME_SIZE), opened_(), closed_gateways_()
+{
+}
+
+//
+// Frames
+//
+
+void Http2Session::appendFrameHeader(size_t length, uint8_t type, uint8_t flags, uint32_t stream_id)
+{
+    out_.push_back(static_cast<char>(length >> 16));
+    out_.push_back(static_cast<char>(length >> 8));
+    out_.push_back(static_cast<char>(length));
+    out_.push_back(static_cast<char>(type));
+    out_.push_back(static_cast<char>(flags));
+    appendUint32(out_, stream_id & 0x7fffffff);
+}
+
+void Http2Session::appendFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    appendFrameHeader(payload.size(), type, flags, stream_id);
+    out_.append(payload);
+}
+
+void Http2Session::appendWindowUpdate(uint32_t stream_id, size_t increment)
+{
+    appendFrameHeader(4, H2_WINDOW_UPDATE, 0, stream_id);
+    appendUint32(out_, static_cast<uint32_t>(increment));
+}
+
+bool Http2Session::connectionError(t_h2_error code)
+{
+    LOG_WARN("HTTP/2 connection error: ", static_cast<int>(code));
+
+    std::string payload;
+    appendUint32(payload, last_stream_id_);
+    appendUint32(payload, code);
+    appendFrame(H2_GOAWAY, 0, 0, payload);
+    is_closing_ = true;
+
+    while (!streams_.empty())
+        closeStream(streams_.begin()->first);
+    return false;
+}
+
+void Http2Session::resetStream(uint32_t stream_id, t_h2_error code)
+{
+    std::string payload;
+    appendUint32(payload, code);
+    appendFrame(H2_RST_STREAM, 0, stream_id, payload);
+    closeStream(stream_id);
+}
+
+void Http2Session::closeStream(uint32_t stream_id)
+{
+    const auto it = streams_.find(stream_id);
+    if (it == streams_.end())
+        return;
+
+    conn_uncredited_ += it->second.uncredited;
+    if (it->second.gateway_fd != -1)
+    {
+        gateways_.erase(it->second.gateway_fd);
+        closed_gateways_.push_back(it->second.gateway_fd);
+    }
+    streams_.erase(it);
+    std::erase(opened_, stream_id);
+}
+
+//
+// Input
+//
+
+void Http2Session::start()
+{
+    std::string settings;
+    appendSetting(settings, H2_SETTINGS_MAX_CONCURRENT_STREAMS, H2_MAX_CONCURRENT_STREAMS);
+    appendSetting(settings, H2_SETTINGS_MAX_HEADER_LIST_SIZE, static_cast<uint32_t>(max_header_list_size_));
+    appendFrame(H2_SETTINGS, 0, 0, settings);
+
+    appendWindowUpdate(0, H2_CONNECTION_WINDOW - H2_DEFAULT_WINDOW);
+    conn_recv_window_ = H2_CONNECTION_WINDOW;
+}
+
+/**
+ * @details
+ * RFC 7540 section 3.2: the server answers `101 Switching Protocols`, sends its preface,
+ * and answers the upgrading request on stream 1, which is half-closed.
+ * Then the client sends its preface.
+ */
+bool Http2Session::upgrade(std::string_view settings, std::string request)
+{
+    std::string payload;
+    if (!decodeBase64Url(settings, payload) || payload.size() % SETTING_SIZE != 0 || applySettings(payload) != H2_NO_ERROR)
+        return false;
+
+    out_.append(SWITCHING_PROTOCOLS);
+    start();
+
+    t_h2_stream stream = makeStream(1, peer_initial_window_);
+    stream.end_stream_received = true;
+    stream.to_gateway = std::move(request);
+    streams_.emplace(1, std::move(stream));
+    last_stream_id_ = 1;
+    opened_.push_back(1);
+    return true;
+}
+
+/**
+ * @details
+ * The input is held while the output is full, see `processInput`.
+ * Flow control bounds the DATA a client sends meanwhile, more than that is a flood of other frames.
+ */
+void Http2Session::feed(std::string_view bytes)
+{
+    in_.append(bytes);
+    processInput();
+    flushStreams();
+    if (in_.size() - in_pos_ > H2_MAX_INPUT)
+        connectionError(H2_ENHANCE_YOUR_CALM);
+}
+
+/**
+ * @details
+ * Every PING and SETTINGS frame queues its ACK, whatever the output holds:
+ * a client which does not read its ACKs gets no more frames processed, the next ones wait in the input.
+ * `writeSocket` resumes them once the output drains.
+ */
+void Http2Session::processInput()
+{
+    while (!is_closing_ && out_.size() - out_pos_ < H2_MAX_OUTPUT)
+    {
+        const std::string_view input = std::string_view(in_).substr(in_pos_);
+
+        if (!preface_received_)
+        {
+            const size_t size = std::min(input.size(), H2_PREFACE.size());
+            if (input.substr(0, size) != H2_PREFACE.substr(0, size))
+            {
+                connectionError(H2_PROTOCOL_ERROR);
+                break;
+            }
+            if (size < H2_PREFACE.size())
+                break;
+            in_pos_ += size;
+            preface_received_ = true;
+            continue;
+        }
+
+        if (input.size() < H2_FRAME_HEADER_SIZE)
+            break;
+        const size_t length = readUint32(input) >> 8;
+        if (length > H2_DEFAULT_FRAME_SIZE)
+        {
+            connectionError(H2_FRAME_SIZE_ERROR);
+            break;
+        }
+        if (input.size() < H2_FRAME_HEADER_SIZE + length)
+            break;
+
+        const uint8_t type = input[3];
+        const uint8_t flags = input[4];
+        const uint32_t stream_id = readUint32(input.substr(5)) & 0x7fffffff;
+        in_pos_ += H2_FRAME_HEADER_SIZE + length;
+        if (!processFrame(type, flags, stream_id, input.substr(H2_FRAME_HEADER_SIZE, length)))
+            break;
+    }
+
+    if (in_pos_ == in_.size())
+    {
+        in_.clear();
+        in_pos_ = 0;
+    }
+    else if (in_pos_ > H2_IO_SIZE)
+    {
+        in_.erase(0, in_pos_);
+        in_pos_ = 0;
+    }
+    sendCredits(nullptr);
+}
+
+bool Http2Session::processFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    // A header block is not interleaved with any other frame.
+    if (header_stream_ != 0 && type != H2_CONTINUATION)
+        return connectionError(H2_PROTOCOL_ERROR);
+
+    switch (type)
+    {
+    case H2_DATA:
+        return onData(flags, stream_id, payload);
+    case H2_HEADERS:
+        return onHeaders(flags, stream_id, payload);
+    case H2_CONTINUATION:
+        return onContinuation(flags, stream_id, payload);
+    case H2_PRIORITY:
+        if (stream_id == 0)
+            return connectionError(H2_PROTOCOL_ERROR);
+        if (payload.size() != 5)
+            resetStream(stream_id, H2_FRAME_SIZE_ERROR);
+        return true;
+    case H2_RST_STREAM:
+        if (stream_id == 0 || stream_id > last_stream_id_)
+            return connectionError(H2_PROTOCOL_ERROR);
+        if (payload.size() != 4)
+            return connectionError(H2_FRAME_SIZE_ERROR);
+        closeStream(stream_id);
+        return true;
+    case H2_SETTINGS:
+        return onSettings(flags, stream_id, payload);
+    case H2_PING:
+        if (stream_id != 0)
+            return connectionError(H2_PROTOCOL_ERROR);
+        if (payload.size() != 8)
+            return connectionError(H2_FRAME_SIZE_ERROR);
+        if (!(flags & H2_FLAG_ACK))
+            appendFrame(H2_PING, H2_FLAG_ACK, 0, payload);
+        return true;
+    case H2_GOAWAY:
+        if (stream_id != 0)
+            return connectionError(H2_PROTOCOL_ERROR);
+        peer_goaway_ = true;
+        return true;
+    case H2_WINDOW_UPDATE:
+        return onWindowUpdate(stream_id, payload);
+    case H2_PUSH_PROMISE: // Only servers push
+        return connectionError(H2_PROTOCOL_ERROR);
+    default: // Unknown frame types are ignored
+        return true;
+    }
+}
+
+bool Http2Session::onData(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (stream_id == 0)
+        return connectionError(H2_PROTOCOL_ERROR);
+
+    // The whole payload counts against the windows, padding included.
+    const size_t flow_size = payload.size();
+    conn_recv_window_ -= flow_size;
+    if (conn_recv_window_ < 0)
+        return connectionError(H2_FLOW_CONTROL_ERROR);
+    if (!stripPadding(flags, payload))
+        return connectionError(H2_PROTOCOL_ERROR);
+
+    const auto it = streams_.find(stream_id);
+    if (it == streams_.end() || it->second.end_stream_received)
+    {
+        conn_uncredited_ += flow_size;
+        if (stream_id > last_stream_id_)
+            return connectionError(H2_PROTOCOL_ERROR);
+        if (it != streams_.end())
+            resetStream(stream_id, H2_STREAM_CLOSED);
+        return true; // A stream we reset, the client may not know yet
+    }
+
+    t_h2_stream &stream = it->second;
+    stream.recv_window -= flow_size;
+    stream.uncredited += flow_size;
+    stream.data_received += payload.size();
+    if (stream.recv_window < 0)
+    {
+        resetStream(stream_id, H2_FLOW_CONTROL_ERROR);
+        return true;
+    }
+    if (stream.expected_length != SIZE_MAX && stream.data_received > stream.expected_length)
+    {
+        resetStream(stream_id, H2_PROTOCOL_ERROR);
+        return true;
+    }
+
+    if (!payload.empty() && stream.is_chunked_request)
+    {
+        char digits[16];
+        const auto result = std::to_chars(digits, digits + sizeof(digits), payload.size(), 16);
+        stream.to_gateway.append(digits, result.ptr).append("\r\n").append(payload).append("\r\n");
+    }
+    else
+        stream.to_gateway.append(payload);
+
+    if (flags & H2_FLAG_END_STREAM)
+        endRequest(stream); // The rest is given back to the connection once written
+    else
+        sendCredits(&stream);
+    return true;
+}
+
+bool Http2Session::onHeaders(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (stream_id == 0 || !stripPadding(flags, payload))
+        return connectionError(H2_PROTOCOL_ERROR);
+    if (flags & H2_FLAG_PRIORITY) // Priorities are not used, the streams are served round-robin.
+    {
+        if (payload.size() < 5)
+            return connectionError(H2_FRAME_SIZE_ERROR);
+        payload.remove_prefix(5);
+    }
+
+    header_stream_ = stream_id;
+    header_flags_ = flags;
+    header_block_.assign(payload);
+    if (flags & H2_FLAG_END_HEADERS)
+        return finishHeaderBlock();
+    return true;
+}
+
+bool Http2Session::onContinuation(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (header_stream_ == 0 || stream_id != header_stream_)
+        return connectionError(H2_PROTOCOL_ERROR);
+    // The block is held till it is complete, an endless one is a flood.
+    if (header_block_.size() + payload.size() > max_header_list_size_ + H2_DEFAULT_FRAME_SIZE)
+        return connectionError(H2_ENHANCE_YOUR_CALM);
+
+    header_block_.append(payload);
+    if (flags & H2_FLAG_END_HEADERS)
+        return finishHeaderBlock();
+    return true;
+}
+
+/**
+ * @details
+ * The block is decoded even for a refused stream, the decoder must see every block.
+ * A block on an open stream is a trailer section, its fields are dropped.
+ * A block decoding past our SETTINGS_MAX_HEADER_LIST_SIZE resets its stream with ENHANCE_YOUR_CALM,
+ * its fields were dropped by the decoder as soon as the limit was passed.
+ */
+bool Http2Session::finishHeaderBlock()
+{
+    const uint32_t stream_id = header_stream_;
+    const bool end_stream = header_flags_ & H2_FLAG_END_STREAM;
+    header_stream_ = 0;
+
+    t_header_list fields;
+    const t_hpack_status status = decoder_.decode(header_block_, fields, max_header_list_size_);
+    header_block_.clear();
+    if (status == HPACK_MALFORMED)
+        return connectionError(H2_COMPRESSION_ERROR);
+
+    const auto it = streams_.find(stream_id);
+    if (it != streams_.end())
+    {
+        if (status == HPACK_TOO_LARGE)
+            resetStream(stream_id, H2_ENHANCE_YOUR_CALM);
+        else if (it->second.end_stream_received)
+            resetStream(stream_id, H2_STREAM_CLOSED);
+        else if (!end_stream)
+            resetStream(stream_id, H2_PROTOCOL_ERROR);
+        else
+            endRequest(it->second);
+        return true;
+    }
+    if (stream_id % 2 == 0)
+        return connectionError(H2_PROTOCOL_ERROR);
+    if (stream_id <= last_stream_id_)
+    {
+        resetStream(stream_id, H2_STREAM_CLOSED);
+        return true;
+    }
+
+    last_stream_id_ = stream_id;
+    if (peer_goaway_ || streams_.size() >= H2_MAX_CONCURRENT_STREAMS)
+    {
+        resetStream(stream_id, H2_REFUSED_STREAM);
+        return true;
+    }
+    if (status == HPACK_TOO_LARGE)
+    {
+        resetStream(stream_id, H2_ENHANCE_YOUR_CALM);
+        return true;
+    }
+
+    t_h2_stream stream = makeStream(stream_id, peer_initial_window_);
+    if (!buildRequest(fields, end_stream, stream))
+    {
+        resetStream(stream_id, H2_PROTOCOL_ERROR);
+        return true;
+    }
+    streams_.emplace(stream_id, std::move(stream));
+    opened_.push_back(stream_id);
+    return true;
+}
+
+bool Http2Session::onSettings(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (stream_id != 0)
+        return connectionError(H2_PROTOCOL_ERROR);
+    if (flags & H2_FLAG_ACK)
+        return payload.empty() ? true : connectionError(H2_FRAME_SIZE_ERROR);
+    if (payload.size() % SETTING_SIZE != 0)
+        return connectionError(H2_FRAME_SIZE_ERROR);
+
+    const t_h2_error error = applySettings(payload);
+    if (error != H2_NO_ERROR)
+        return connectionError(error);
+    appendFrame(H2_SETTINGS, H2_FLAG_ACK, 0, "");
+    return true;
+}
+
+t_h2_error Http2Session::applySettings(std::string_view payload)
+{
+    for (; payload.size() >= SETTING_SIZE; payload.remove_prefix(SETTING_SIZE))
+    {
+        const uint16_t id = (uint16_t(uint8_t(payload[0])) << 8) | uint8_t(payload[1]);
+        const uint32_t value = readUint32(payload.substr(2));
+
+        switch (id)
+        {
+        case H2_SETTINGS_HEADER_TABLE_SIZE:
+            encoder_.setMaxTableSize(value);
+            break;
+        case H2_SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+                return H2_PROTOCOL_ERROR;
+            break;
+        case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+        {
+            if (value > H2_MAX_WINDOW)
+                return H2_FLOW_CONTROL_ERROR;
+            // The change applies to the windows of the open streams too.
+            const int64_t delta = static_cast<int64_t>(value) - peer_initial_window_;
+            for (auto &[id, stream] : streams_)
+            {
+                stream.send_window += delta;
+                if (stream.send_window > H2_MAX_WINDOW)
+                    return H2_FLOW_CONTROL_ERROR;
+            }
+            peer_initial_window_ = value;
+            break;
+        }
+        case H2_SETTINGS_MAX_FRAME_SIZE:
+            if (value < H2_DEFAULT_FRAME_SIZE || value > 0xffffff)
+                return H2_PROTOCOL_ERROR;
+            peer_max_frame_size_ = value;
+            break;
+        default: // Unknown settings are ignored
+            break;
+        }
+    }
+    return H2_NO_ERROR;
+}
+
+bool Http2Session::onWindowUpdate(uint32_t stream_id, std::string_view payload)
+{
+    if (payload.size() != 4)
+        return connectionError(H2_FRAME_SIZE_ERROR);
+
+    const uint32_t increment = readUint32(payload) & 0x7fffffff;
+    if (stream_id == 0)
+    {
+        if (increment == 0)
+            return connectionError(H2_PROTOCOL_ERROR);
+        conn_send_window_ += increment;
+        if (conn_send_window_ > H2_MAX_WINDOW)
+            return connectionError(H2_FLOW_CONTROL_ERROR);
+        return true;
+    }
+
+    const auto it = streams_.find(stream_id);
+    if (it == streams_.end())
+        return stream_id > last_stream_id_ ? connectionError(H2_PROTOCOL_ERROR) : true;
+    if (increment == 0)
+    {
+        resetStream(stream_id, H2_PROTOCOL_ERROR);
+        return true;
+    }
+    it->second.send_window += increment;
+    if (it->second.send_window > H2_MAX_WINDOW)
+        resetStream(stream_id, H2_FLOW_CONTROL_ERROR);
+    return true;
+}
+
+/**
+ * @details
+ * RFC 9113 section 8.3.1: the pseudo-header fields come first, once each;
+ * `:method`, `:scheme` and `:path` are required, CONNECT is not supported.
+ * Cookie crumbs are joined back into one field.
+ * Without a Content-Length, a body is forwarded with the chunked coding.
+ */
+bool Http2Session::buildRequest(const t_header_list &fields, bool end_stream, t_h2_stream &stream)
+{
+    std::string_view method, scheme, authority, path;
+    std::string head_fields, cookie;
+    bool is_regular_seen = false;
+
+    for (const auto &[name, value] : fields)
+    {
+        if (name.empty() || !isFieldValue(value))
+            return false;
+
+        if (name[0] == ':')
+        {
+            std::string_view *pseudo = name == ":method" ? &method : name == ":scheme" ? &scheme : name == ":authority" ? &authority : name == ":path" ? &path : nullptr;
+            if (is_regular_seen || !pseudo || !pseudo->empty())
+                return false;
+            *pseudo = value;
+            continue;
+        }
+
+        is_regular_seen = true;
+        if (!isFieldName(name) || isConnectionField(name))
+            return false;
+        if (name == "te")
+        {
+            if (value != "trailers")
+                return false;
+            continue;
+        }
+        if (name == "host")
+        {
+            if (authority.empty())
+                authority = value;
+            continue;
+        }
+        if (name == "expect" || name == "http2-settings")
+            continue;
+        if (name == "cookie")
+        {
+            cookie.append(cookie.empty() ? "" : "; ").append(value);
+            continue;
+        }
+        if (name == "content-length")
+        {
+            size_t length;
+            if (!parseSize(value, length) || (stream.expected_length != SIZE_MAX && stream.expected_length != length))
+                return false;
+            stream.expected_length = length;
+        }
+        head_fields.append(name).append(": ").append(value).append("\r\n");
+    }
+
+    if (method.empty() || scheme.empty() || path.empty() || path.find(' ') != std::string_view::npos ||
+        !std::all_of(method.begin(), method.end(), isTokenChar))
+        return false;
+    if (end_stream && stream.expected_length != SIZE_MAX && stream.expected_length != 0)
+        return false;
+
+    std::string &request = stream.to_gateway;
+    request.append(method).append(" ").append(path).append(" HTTP/1.1\r\n");
+    if (!authority.empty())
+        request.append("Host: ").append(authority).append("\r\n");
+    request.append(head_fields);
+    if (!cookie.empty())
+        request.append("Cookie: ").append(cookie).append("\r\n");
+    if (stream.expected_length == SIZE_MAX)
+    {
+        if (!end_stream)
+        {
+            stream.is_chunked_request = true;
+            request.append("Transfer-Encoding: chunked\r\n");
+        }
+        else if (method == "POST")
+            request.append("Content-Length: 0\r\n");
+    }
+    request.append("Connection: close\r\n\r\n");
+    stream.end_stream_received = end_stream;
+    return true;
+}
+
+void Http2Session::endRequest(t_h2_stream &stream)
+{
+    stream.end_stream_received = true;
+    if (stream.is_chunked_request)
+        stream.to_gateway.append("0\r\n\r\n");
+    if (stream.expected_length != SIZE_MAX && stream.data_received != stream.expected_length)
+        resetStream(stream.id, H2_PROTOCOL_ERROR);
+}
+
+/**
+ * @details
+ * A stream is credited once its pending request bytes drop to half a window,
+ * so each stream buffers at most about 1.5 windows for a slow gateway.
+ * The connection is credited with every stream credit, and for the DATA dropped.
+ */
+void Http2Session::sendCredits(t_h2_stream *stream)
+{
+    if (stream && stream->uncredited > 0 && stream->to_gateway.size() <= H2_DEFAULT_WINDOW / 2)
+    {
+        if (!stream->end_stream_received)
+        {
+            appendWindowUpdate(stream->id, stream->uncredited);
+            stream->recv_window += stream->uncredited;
+        }
+        conn_uncredited_ += stream->uncredited;
+        stream->uncredited = 0;
+    }
+    if (conn_uncredited_ > 0 && !is_closing_)
+    {
+        appendWindowUpdate(0, conn_uncredited_);
+        conn_recv_window_ += conn_uncredited_;
+        conn_uncredited_ = 0;
+    }
+}
+
+//
+// Gateways
+//
+
+void Http2Session::readGateway(int fd)
+{
+    const auto it = gateways_.find(fd);
+    if (it == gateways_.end())
+        return;
+
+    // The client's window is closed, the gateway waits.
+    const t_h2_stream &stream = streams_.at(it->second);
+    if (stream.res_body.size() - stream.res_body_pos >= H2_MAX_RESPONSE_BUFFER)
+        return;
+
+    char buf[H2_IO_SIZE];
+    const ssize_t bytes_read = read(fd, buf, sizeof(buf));
+    onGatewayData(fd, std::string_view(buf, bytes_read > 0 ? bytes_read : 0));
+}
+
+void Http2Session::writeGateway(int fd)
+{
+    const auto it = gateways_.find(fd);
+    if (it == gateways_.end())
+        return;
+
+    t_h2_stream &stream = streams_.at(it->second);
+    if (stream.to_gateway.empty())
+        return;
+
+    const ssize_t bytes_written = write(fd, stream.to_gateway.data(), stream.to_gateway.size());
+    if (bytes_written <= 0)
+        stream.to_gateway.clear(); // The handler closed, e.g. after rejecting the request, its response is still read
+    else
+        stream.to_gateway.erase(0, bytes_written);
+    sendCredits(&stream);
+}
+
+/**
+ * @details
+ * The end of the body is found by its framing; at EOF, a body which is not complete
+ * resets the stream, the client must not take a truncated response for a whole one.
+ */
+void Http2Session::onGatewayData(int fd, std::string_view data)
+{
+    const auto it = gateways_.find(fd);
+    if (it == gateways_.end())
+        return;
+    t_h2_stream &stream = streams_.at(it->second);
+
+    if (data.empty())
+    {
+        gateways_.erase(it);
+        closed_gateways_.push_back(fd);
+        stream.gateway_fd = -1;
+        if (stream.res_state == H2_RES_UNTIL_EOF)
+        {
+            stream.res_state = H2_RES_DONE;
+            stream.res_end = true;
+        }
+        else if (stream.res_state != H2_RES_DONE)
+            return resetStream(stream.id, H2_INTERNAL_ERROR);
+        return flushStreams();
+    }
+
+    if (stream.res_state == H2_RES_HEAD)
+    {
+        stream.res_head.append(data);
+        const size_t head_end = stream.res_head.find("\r\n\r\n");
+        if (head_end == std::string::npos)
+        {
+            if (stream.res_head.size() > H2_MAX_RESPONSE_HEAD)
+                resetStream(stream.id, H2_INTERNAL_ERROR);
+            return;
+        }
+
+        const std::string head = std::move(stream.res_head);
+        stream.res_head.clear();
+        if (!parseResponseHead(stream, std::string_view(head).substr(0, head_end + 2)))
+            return resetStream(stream.id, H2_INTERNAL_ERROR);
+        appendResponseBody(stream, std::string_view(head).substr(head_end + 4));
+    }
+    else
+        appendResponseBody(stream, data);
+
+    if (stream.res_state == H2_RES_CHUNKED && stream.res_decoder.isError())
+        return resetStream(stream.id, H2_INTERNAL_ERROR);
+    flushStreams();
+}
+
+/**
+ * @details
+ * The status line gives `:status`, the names are lowercased,
+ * and the connection-specific fields are dropped.
+ */
+bool Http2Session::parseResponseHead(t_h2_stream &stream, std::string_view head)
+{
+    size_t line_end = head.find("\r\n");
+    const std::string_view status_line = head.substr(0, line_end);
+    if (status_line.size() < 12 || !status_line.starts_with("HTTP/1.") || status_line[8] != ' ')
+        return false;
+
+    const std::string_view code = status_line.substr(9, 3);
+    size_t status;
+    if (!parseSize(code, status) || status < 200)
+        return false;
+    stream.res_fields.emplace_back(":status", std::string(code));
+
+    bool is_chunked = false;
+    size_t length = SIZE_MAX;
+    for (head.remove_prefix(line_end + 2); !head.empty(); head.remove_prefix(line_end + 2))
+    {
+        line_end = head.find("\r\n");
+        const std::string_view line = head.substr(0, line_end);
+        const size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0)
+            return false;
+
+        std::string name(line.substr(0, colon));
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c)
+                       { return std::tolower(c); });
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            value.remove_suffix(1);
+
+        if (name == "transfer-encoding")
+            is_chunked = value.find("chunked") != std::string_view::npos;
+        if (isConnectionField(name))
+            continue;
+        if (name == "content-length" && !parseSize(value, length))
+            return false;
+        stream.res_fields.emplace_back(std::move(name), std::string(value));
+    }
+
+    stream.res_head_ready = true;
+    if (status == 204 || status == 304)
+        stream.res_state = H2_RES_DONE;
+    else if (is_chunked)
+        stream.res_state = H2_RES_CHUNKED;
+    else if (length != SIZE_MAX)
+    {
+        stream.res_remaining = length;
+        stream.res_state = length > 0 ? H2_RES_LENGTH : H2_RES_DONE;
+    }
+    else
+        stream.res_state = H2_RES_UNTIL_EOF;
+    stream.res_end = stream.res_state == H2_RES_DONE;
+    return true;
+}
+
+void Http2Session::appendResponseBody(t_h2_stream &stream, std::string_view data)
+{
+    switch (stream.res_state)
+    {
+    case H2_RES_LENGTH:
+    {
+        const size_t take = std::min(stream.res_remaining, data.size());
+        stream.res_body.append(data.substr(0, take));
+        stream.res_remaining -= take;
+        if (stream.res_remaining == 0)
+        {
+            stream.res_state = H2_RES_DONE;
+            stream.res_end = true;
+        }
+        break;
+    }
+    case H2_RES_CHUNKED:
+        while (!data.empty() && !stream.res_decoder.isDone() && !stream.res_decoder.isError())
+        {
+            std::string_view body;
+            data.remove_prefix(stream.res_decoder.next(data, body));
+            stream.res_body.append(body);
+        }
+        if (stream.res_decoder.isDone())
+        {
+            stream.res_state = H2_RES_DONE;
+            stream.res_end = true;
+        }
+        break;
+    case H2_RES_UNTIL_EOF:
+        stream.res_body.append(data);
+        break;
+    default:
+        break;
+    }
+}
+
+//
+// Output
+//
+
+/**
+ * @details
+ * The block is split into HEADERS and CONTINUATION frames, sent back to back.
+ * It is encoded now, not when the head is parsed: the peer's decoder
+ * sees the blocks in the order they are sent.
+ */
+void Http2Session::sendHeaders(t_h2_stream &stream)
+{
+    std::string block;
+    for (const auto &[name, value] : stream.res_fields)
+        encoder_.encode(block, name, value);
+    stream.res_fields.clear();
+
+    const bool end_stream = stream.res_end && stream.res_body.size() == stream.res_body_pos;
+    size_t pos = 0;
+    do
+    {
+        const size_t size = std::min(block.size() - pos, peer_max_frame_size_);
+        uint8_t flags = pos + size == block.size() ? H2_FLAG_END_HEADERS : 0;
+        if (pos == 0 && end_stream)
+            flags |= H2_FLAG_END_STREAM;
+        appendFrame(pos == 0 ? H2_HEADERS : H2_CONTINUATION, flags, stream.id, std::string_view(block).substr(pos, size));
+        pos += size;
+    } while (pos < block.size());
+    stream.headers_sent = true;
+}
+
+/**
+ * @details
+ * One DATA frame is sent per stream in turn, so the streams share the connection window.
+ * Frames are queued till the output holds `H2_MAX_OUTPUT` bytes, the rest waits for the socket.
+ */
+void Http2Session::flushStreams()
+{
+    if (is_closing_)
+        return;
+
+    std::vector<uint32_t> finished;
+    for (auto &[id, stream] : streams_)
+    {
+        if (!stream.res_head_ready || stream.headers_sent)
+            continue;
+        sendHeaders(stream);
+        if (stream.res_end && stream.res_body.size() == stream.res_body_pos)
+            finished.push_back(id);
+    }
+    for (const uint32_t id : finished)
+        finishResponse(id);
+
+    while (out_.size() - out_pos_ < H2_MAX_OUTPUT && !streams_.empty())
+    {
+        t_h2_stream *next = nullptr;
+        auto it = streams_.upper_bound(last_sent_stream_);
+        for (size_t i = 0; i < streams_.size() && !next; ++i, ++it)
+        {
+            if (it == streams_.end())
+                it = streams_.begin();
+            t_h2_stream &stream = it->second;
+            const size_t pending = stream.res_body.size() - stream.res_body_pos;
+            if (stream.headers_sent && ((pending == 0 && stream.res_end) || (pending > 0 && stream.send_window > 0 && conn_send_window_ > 0)))
+                next = &stream;
+        }
+        if (!next)
+            break;
+
+        const size_t pending = next->res_body.size() - next->res_body_pos;
+        const size_t size = std::min({pending, peer_max_frame_size_, static_cast<size_t>(std::max<int64_t>(0, std::min(next->send_window, conn_send_window_)))});
+        const bool end_stream = next->res_end && size == pending;
+        appendFrame(H2_DATA, end_stream ? H2_FLAG_END_STREAM : 0, next->id, std::string_view(next->res_body).substr(next->res_body_pos, size));
+
+        next->res_body_pos += size;
+        next->send_window -= size;
+        conn_send_window_ -= size;
+        if (next->res_body_pos == next->res_body.size())
+        {
+            next->res_body.clear();
+            next->res_body_pos = 0;
+        }
+        last_sent_stream_ = next->id;
+        if (end_stream)
+            finishResponse(next->id);
+    }
+}
+
+/**
+ * @details
+ * A response may end before its request, e.g. an upload rejected by a 405:
+ * the stream is then reset with NO_ERROR, the client stops sending (RFC 9113 section 8.1).
+ */
+void Http2Session::finishResponse(uint32_t stream_id)
+{
+    const auto it = streams_.find(stream_id);
+    if (it == streams_.end())
+        return;
+    if (!it->second.end_stream_received)
+        return resetStream(stream_id, H2_NO_ERROR);
+    closeStream(stream_id);
+}
+
+//
+// Socket
+//
+
+ssize_t Http2Session::readSocket(int fd)
+{
+    char buf[H2_IO_SIZE];
+    const ssize_t bytes_read = read(fd, buf, sizeof(buf));
+    if (bytes_read < 0)
+        return RW_ERROR;
+    if (bytes_read == 0)
+        return EOF_REACHED;
+
+    if (!is_closing_)
+        feed(std::string_view(buf, bytes_read));
+    return bytes_read;
+}
+
+ssize_t Http2Session::writeSocket(int fd)
+{
+    flushStreams();
+    if (out_pos_ == out_.size())
+        return 0;
+
+    const ssize_t bytes_written = write(fd, out_.data() + out_pos_, out_.size() - out_pos_);
+    if (bytes_written < 0)
+        return RW_ERROR;
+    consumeOutput(bytes_written);
+    if (in_pos_ < in_.size() && !is_closing_)
+        processInput();
+    return bytes_written;
+}
+
+std::string_view Http2Session::output() const
+{
+    return std::string_view(out_).substr(out_pos_);
+}
+
+void Http2Session::consumeOutput(size_t size)
+{
+    out_pos_ += size;
+    if (out_pos_ == out_.size())
+    {
+        out_.clear();
+        out_pos_ = 0;
+    }
+    else if (out_pos_ > H2_MAX_OUTPUT)
+    {
+        out_.erase(0, out_pos_);
+        out_pos_ = 0;
+    }
+}
+
+//
+// Server interface
+//
+
+std::string_view Http2Session::gatewayOutput(int fd) const
+{
+    const auto it = gateways_.find(fd);
+    if (it == gateways_.end())
+        return std::string_view();
+    return streams_.at(it->second).to_gateway;
+}
+
+std::vector<uint32_t> Http2Session::takeOpenedStreams()
+{
+    std::vector<uint32_t> opened;
+    opened.swap(opened_);
+    return opened;
+}
+
+void Http2Session::attachGateway(uint32_t stream_id, int fd)
+{
+    const auto it = streams_.find(stream_id);
+    if (it == streams_.end())
+    {
+        closed_gateways_.push_back(fd);
+        return;
+    }
+    it->second.gateway_fd = fd;
+    gateways_[fd] = stream_id;
+}
+
+void Http2Session::refuseStream(uint32_t stream_id)
+{
+    resetStream(stream_id, H2_REFUSED_STREAM);
+}
+
+std::vector<int> Http2Session::takeClosedGateways()
+{
+    std::vector<int> closed;
+    closed.swap(closed_gateways_);
+    return closed;
+}
+
+std::vector<int> Http2Session::gatewayFds() const
+{
+    std::vector<int> fds(closed_gateways_);
+    for (const auto &kv : gateways_)
+        fds.push_back(kv.first);
+    return fds;
+}
+
+bool Http2Session::isDone() const
+{
+    return (is_closing_ || (peer_goaway_ && streams_.empty())) && out_pos_ == out_.size();
+}
@@ -0,0 +1,114 @@
+#include "../includes/HttpHeaders.hpp"
+#include <stdexcept>
+
+std::string *HttpHeaders::findUnknown(std::string_view name)
+{
+    for (auto &kv : unknown_)
+    {
+        if (kv.first == name)
+            return &kv.second;
+    }
+    return nullptr;
+}
+
+const std::string *HttpHeaders::findUnknown(std::string_view name) const
+{
+    for (const auto &kv : unknown_)
+    {
+        if (kv.first == name)
+            return &kv.second;
+    }
+    return nullptr;
+}
+
+const std::string *HttpHeaders::find(t_header_id id) const
+{
+    if (id >= HDR_COUNT || !present_[id])
+        return nullptr;
+    return &known_[id];
+}
+
+const std::string *HttpHeaders::find(std::string_view name) const
+{
+    const t_header_id id = headerIdOf(name);
+    if (id != HDR_UNKNOWN)
+        return find(id);
+    return findUnknown(name);
+}
+
+bool HttpHeaders::contains(t_header_id id) const
+{
+    return find(id) != nullptr;
+}
+
+bool HttpHeaders::contains(std::string_view name) const
+{
+    return find(name) != nullptr;
+}
+
+const std::string &HttpHeaders::at(t_header_id id) const
+{
+    const std::string *value = find(id);
+    if (!value)
+        throw std::out_of_range("HttpHeaders::at: header not found");
+    return *value;
+}
+
+const std::string &HttpHeaders::at(std::string_view name) const
+{
+    const std::string *value = find(name);
+    if (!value)
+        throw std::out_of_range("HttpHeaders::at: header not found");
+    return *value;
+}
+
+std::string &HttpHeaders::operator[](t_header_id id)
+{
+    if (id >= HDR_COUNT)
+        throw std::out_of_range("HttpHeaders::operator[]: invalid header id");
+    if (!present_[id])
+    {
+        present_[id] = true;
+        known_[id].clear();
+    }
+    return known_[id];
+}
+
+std::string &HttpHeaders::operator[](std::string_view name)
+{
+    const t_header_id id = headerIdOf(name);
+    if (id != HDR_UNKNOWN)
+        return (*this)[id];
+
+    std::string *value = findUnknown(name);
+    if (value)
+        return *value;
+    unknown_.emplace_back(std::string(name), std::string());
+    return unknown_.back().second;
+}
+
+void HttpHeaders::set(std::string_view name, std::string value)
+{
+    (*this)[name] = std::move(value);
+}
+
+void HttpHeaders::erase(t_header_id id)
+{
+    if (id >= HDR_COUNT)
+        return;
+    present_[id] = false;
+    known_[id].clear();
+}
+
+size_t HttpHeaders::size() const
+{
+    return present_.count() + unknown_.size();
+}
+
+void HttpHeaders::clear()
+{
+    for (size_t id = 0; id < HDR_COUNT; ++id)
+        known_[id].clear();
+    present_.reset();
+    unknown_.clear();
+}
@@ -1,4 +1,5 @@
 #include "../includes/HttpRequests.hpp"
+#include "../includes/ScanKernels.hpp"
 
 
 HttpRequests::HttpRequests() : upToBodyCounter(0), requestHeaderMap(),
@@ -45,15 +46,11 @@ void HttpRequests::extractRequestLine(size_t &i, size_t requestLength,
 	std::string httpVersion;
 	std::string requestLine;
 	size_t j = 0;
-	for (; i <= requestLength; i++)
-	{
-		if (request[i] == '\r' && request[i + 1] == '\n')
-		{
-			i = i + 2;
-			break;
-		}
-		requestLine += request[i];
-	}
+	size_t lineEnd = scanFindCRLF(request.substr(0, std::min(requestLength, upToBodyCounter)), i);
+	if (lineEnd == std::string_view::npos)
+		lineEnd = std::min(requestLength, upToBodyCounter);
+	requestLine = request.substr(i, lineEnd - i);
+	i = lineEnd + 2;
 	j = 0;
 	for (; j < requestLine.size(); j++)
 	{
@@ -99,32 +96,8 @@ std::string HttpRequests::httpTargetDecoder(std::string &target)
 {
 	std::string result;
 
-	for (size_t i = 0; i < target.size(); i++)
-	{
-		if (target[i] == '%')
-		{
-			if (target[i + 1] && target[i + 1] != ' ' && target[i + 2] && target[i + 2] != ' ')
-			{
-				std::string hex;
-				if (isxdigit(target[i + 1]) && (isxdigit(target[i + 2])))
-				{
-					hex.push_back(target[i + 1]);
-					hex.push_back(target[i + 2]);
-				}
-				else
-					throw WebServErr::BadRequestException("invalid values after %");
-				char ch = stoi(hex, nullptr, 16);
-				result.push_back(ch);
-				i = i + 2;
-			}
-			else
-				throw WebServErr::BadRequestException("invalid values after %");
-		}
-		else
-		{
-			result += target[i];
-		}
-	}
+	if (!scanPercentDecode(target, result))
+		throw WebServErr::BadRequestException("invalid values after %");
 	return (result);
 }
 
@@ -140,34 +113,21 @@ bool check_dupl_backslash(std::string &target)
 
 void HttpRequests::validateTarget()
 {
-	bool encoded = false;
-	if (!check_dupl_backslash(requestLineMap["Target"]))
+	static constexpr CharClass invalidCharactersUri(" <>\"{}|\\^`");
+	static constexpr CharClass invalidDecodedCharactersUri("<>\"{}|\\^`");
+
+	std::string &target = requestLineMap["Target"];
+	if (!check_dupl_backslash(target))
 		throw WebServErr::BadRequestException("target has duplicated slash");
-	if (requestLineMap["Target"].empty())
+	if (target.empty())
 		throw WebServErr::BadRequestException("target cannot be empty");
-	std::string invalidCharactersUri = " <>\"{}|\\^`";
-	for (char j : requestLineMap["Target"])
-	{
-		if (j == '%')
-			encoded = true;
-		for (char i : invalidCharactersUri)
-		{
-			if (i == j)
-				throw WebServErr::BadRequestException("target cannot has invalid characters");
-		}
-	}
-	if (encoded)
+	if (scanFindFirstOf(target, invalidCharactersUri) != std::string::npos)
+		throw WebServErr::BadRequestException("target cannot has invalid characters");
+	if (scanFindByte(target, '%') != std::string::npos)
 	{
-		requestLineMap["Target"] = httpTargetDecoder(requestLineMap["Target"]);
-		std::string invalidCharactersUri = "<>\"{}|\\^`";
-		for (char j : requestLineMap["Target"])
-		{
-			for (char i : invalidCharactersUri)
-			{
-				if (i == j)
-					throw WebServErr::BadRequestException("target cannot has invalid characters");
-			}
-		}
+		target = httpTargetDecoder(target);
+		if (scanFindFirstOf(target, invalidDecodedCharactersUri) != std::string::npos)
+			throw WebServErr::BadRequestException("target cannot has invalid characters");
 	}
 }
 
@@ -218,15 +178,10 @@ void HttpRequests::extractRequestHeader(size_t &i, size_t requestLength,
 	std::string firstPart;
 	std::string secondPart;
 	std::string requestHeader;
-	for (; i <= requestLength; i++)
-	{
-		if (request[i] == '\r' && request[i + 1] && request[i + 1] == '\n' && request[i + 2] && request[i + 2] == '\r' && request[i + 3] && request[i + 3] == '\n')
-		{
-			i += 4;
-			break;
-		}
-		requestHeader += request[i];
-	}
+	const size_t headerEnd = std::min(requestLength, upToBodyCounter - 4);
+	if (i < headerEnd)
+		requestHeader = request.substr(i, headerEnd - i);
+	i = upToBodyCounter;
 	requestHeader.append("\r\n");
 	j = 0;
 	for (; j < requestHeader.length(); j++)
@@ -235,7 +190,7 @@ void HttpRequests::extractRequestHeader(size_t &i, size_t requestLength,
 		{
 			j += 2;
 			secondPartBool = false;
-			if ((requestHeaderMap.contains("host") && firstPart == "host") || (requestHeaderMap.contains("content-length") && firstPart == "content-length"))
+			if ((requestHeaderMap.contains(HDR_HOST) && firstPart == "host") || (requestHeaderMap.contains(HDR_CONTENT_LENGTH) && firstPart == "content-length"))
 			{
 				std::cerr << "Error: we have host before" << std::endl;
 				break;
@@ -269,9 +224,9 @@ void HttpRequests::host_validator(void)
 	std::string firstPart;
 	std::string secondPart;
 	secondPartBool = false;
-	if (!requestHeaderMap.contains("host"))
+	if (!requestHeaderMap.contains(HDR_HOST))
 		throw WebServErr::BadRequestException("host is required");
-	host_str = requestHeaderMap["host"];
+	host_str = requestHeaderMap[HDR_HOST];
 	for (size_t i = 0; i < host_str.length(); i++)
 	{
 		if (host_str[i] == ':')
@@ -284,12 +239,12 @@ void HttpRequests::host_validator(void)
 		else
 			secondPart += host_str[i];
 	}
-	requestHeaderMap["servername"] = firstPart;
+	requestHeaderMap[HDR_SERVERNAME] = firstPart;
 	if (secondPartBool)
 	{
 		if ((std::stoi(secondPart) < 1 || std::stoi(secondPart) > 65535))
 			throw WebServErr::BadRequestException("post is out of allowed range from 1 to 655535");
-		requestHeaderMap["requestport"] = secondPart;
+		requestHeaderMap[HDR_REQUESTPORT] = secondPart;
 	}
 }
 
@@ -302,20 +257,20 @@ void HttpRequests::content_length_validator(void)
 {
 	if (requestLineMap["Method"] == "POST")
 	{
-		if (!requestHeaderMap.contains("content-length") && !requestHeaderMap.contains("transfer-encoding"))
+		if (!requestHeaderMap.contains(HDR_CONTENT_LENGTH) && !requestHeaderMap.contains(HDR_TRANSFER_ENCODING))
 			throw WebServErr::BadRequestException("content-length is needed");
-		if (requestHeaderMap.contains("content-length"))
+		if (requestHeaderMap.contains(HDR_CONTENT_LENGTH))
 		{
-			if (requestHeaderMap["content-length"].empty() || !is_digit_str(requestHeaderMap["content-length"]))
+			if (requestHeaderMap[HDR_CONTENT_LENGTH].empty() || !is_digit_str(requestHeaderMap[HDR_CONTENT_LENGTH]))
 				throw WebServErr::BadRequestException("content-length must bee number only");
 			else
 			{
-				static_cast<size_t>(stoull(requestHeaderMap["content-length"]));
+				static_cast<size_t>(stoull(requestHeaderMap[HDR_CONTENT_LENGTH]));
 			}
 		}
 	}
 	else if (requestLineMap["Method"] == "GET")
-		if (requestHeaderMap.contains("content-length"))
+		if (requestHeaderMap.contains(HDR_CONTENT_LENGTH))
 			throw WebServErr::BadRequestException("GET must have no content-length");
 }
 
@@ -326,10 +281,12 @@ void HttpRequests::content_length_validator(void)
  */
 void HttpRequests::header_connection_validator(void)
 {
-	if (requestHeaderMap.contains("connection"))
+	if (requestHeaderMap.contains(HDR_CONNECTION))
 	{
-		if (!(requestHeaderMap["connection"] == "keep-alive" || requestHeaderMap["connection"] == "close"))
-			throw WebServErr::BadRequestException("Incrorrect connection value,	must be keep-alive or close");
+		// A list of options, e.g. `Upgrade, HTTP2-Settings` for an h2c upgrade.
+		const std::string &connection = requestHeaderMap[HDR_CONNECTION];
+		if (connection.empty() || connection.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789-, \t") != std::string::npos)
+			throw WebServErr::BadRequestException("Incorrect connection value, must be a list of options");
 	}
 }
 
@@ -370,7 +327,7 @@ void HttpRequests::header_contenttype_validator()
 	if (requestLineMap["Method"] == "POST")
 	{
 		has_semicolon = false;
-		std::string type = requestHeaderMap["content-type"];
+		std::string type = requestHeaderMap[HDR_CONTENT_TYPE];
 		for (size_t i = 0; i < type.length(); i++)
 		{
 			if (type[i] == ';')
@@ -380,9 +337,9 @@ void HttpRequests::header_contenttype_validator()
 		}
 		if (has_semicolon)
 		{
-			std::vector<std::string> type = stov(requestHeaderMap["content-type"], ';');
-			requestHeaderMap["content-type"] = type[0];
-			requestHeaderMap["boundary"] = type[1].substr(9);
+			std::vector<std::string> type = stov(requestHeaderMap[HDR_CONTENT_TYPE], ';');
+			requestHeaderMap[HDR_CONTENT_TYPE] = type[0];
+			requestHeaderMap[HDR_BOUNDARY] = type[1].substr(9);
 		}
 	}
 }
@@ -401,13 +358,13 @@ void HttpRequests::header_transfer_encoding_validator()
 {
 	if (requestLineMap["Method"] == "POST")
 	{
-		if (requestHeaderMap.contains("content-length") && requestHeaderMap.contains("transfer-encoding"))
+		if (requestHeaderMap.contains(HDR_CONTENT_LENGTH) && requestHeaderMap.contains(HDR_TRANSFER_ENCODING))
 		{
 			throw WebServErr::BadRequestException("content-length & transfer-encoding in the same request.");
 		}
-		else if (requestHeaderMap.contains("transfer-encoding"))
+		else if (requestHeaderMap.contains(HDR_TRANSFER_ENCODING))
 		{
-			if (requestHeaderMap["transfer-encoding"] == "chunked")
+			if (requestHeaderMap[HDR_TRANSFER_ENCODING] == "chunked")
 				is_chunked = true;
 			else
 				throw WebServErr::BadRequestException("only chunked is supported");
@@ -438,19 +395,11 @@ void HttpRequests::validateRequestHeader(void)
 void HttpRequests::tillBodyCounter(size_t requestLength,
 								   const std::string_view &request)
 {
-	bool found = false;
-	for (size_t i = 0; i <= requestLength; i++)
-	{
-		if (request[i] == '\r' && request[i + 1] == '\n' && request[i + 2] == '\r' && request[i + 3] == '\n')
-		{
-			found = true;
-			break;
-		}
-		upToBodyCounter++;
-	}
-	upToBodyCounter += 4;
-	if (!found)
-		throw WebServErr::BadRequestException("Invalid request header");
+	(void)requestLength;
+	size_t pos = scanFindDoubleCRLF(request);
+	if (pos == std::string_view::npos) // The head is not fully received yet
+		throw WebServErr::InvalidRequestHeader("Incomplete request header");
+	upToBodyCounter = pos + 4;
 }
 /**
  * @brief validate the reauest before start extraction.
@@ -461,11 +410,8 @@ void HttpRequests::pre_validator(size_t requestLength,
 								 const std::string_view &request)
 {
 	(void)requestLength;
-	for (size_t i = 0; i <= upToBodyCounter; i++)
-	{
-		if (request[i] == ',' && request[i + 1] && request[i + 1] == ',')
-			throw WebServErr::BadRequestException("Invalid Http request,it has extra (,).");
-	}
+	if (scanFindPair(request.substr(0, upToBodyCounter), ',', ',') != std::string_view::npos)
+		throw WebServErr::BadRequestException("Invalid Http request,it has extra (,).");
 }
 
 void HttpRequests::parse_body_header(std::string_view requestBodyHeader)
@@ -520,8 +466,8 @@ void HttpRequests::extractRequestBody(size_t &i, size_t requestLength,
 	posToRawFile = request.find("\r\n\r\n");
 	if (posToRawFile == std::string::npos)
 		throw WebServErr::BadRequestException("no end for the header part of the body");
-	boundarySize = requestHeaderMap.contains("boundary") ? requestHeaderMap["boundary"].size() : 0;
-	if (requestHeaderMap.contains("boundary") && (boundarySize == 0 || boundarySize > requestBody.size()))
+	boundarySize = requestHeaderMap.contains(HDR_BOUNDARY) ? requestHeaderMap[HDR_BOUNDARY].size() : 0;
+	if (requestHeaderMap.contains(HDR_BOUNDARY) && (boundarySize == 0 || boundarySize > requestBody.size()))
 		throw WebServErr::BadRequestException("must have boundary");
 	requestBodyHeader = requestBody.substr(boundarySize + 4, requestLength);
 	pos = requestBodyHeader.find("\r\n\r\n");
@@ -616,11 +562,11 @@ size_t HttpRequests::getupToBodyCounter()
 }
 
 /**
- * @brief Return the parsed map.
+ * @brief Return the parsed headers.
  * @param void.
- * @return std::unordered_map<std::string, std::string>.
+ * @return const HttpHeaders &.
  */
-std::unordered_map<std::string, std::string> HttpRequests::getrequestHeaderMap()
+const HttpHeaders &HttpRequests::getrequestHeaderMap() const
 {
 	return (requestHeaderMap);
 }
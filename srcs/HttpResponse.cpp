@@ -1,111 +1,64 @@
 #include "HttpResponse.hpp"
 #include "HttpRequests.hpp"
+#include "ResponseHead.hpp"
+#include "Buffer.hpp"
+#include "ScanKernels.hpp"
+#include "utils.hpp"
+#include <charconv>
 
+/**
+ * @details
+ * The head is serialized into a pooled block, see `ResponseHead`.
+ * A generated page (autoindex) is appended after the head.
+ */
 std::string HttpResponse::successResponse(t_conn *conn, Cookie &cookie)
 {
     if (conn->is_cgi)
         return("");
 
-    std::string cookieStr = cookie.set(*conn->request);
-    std::string connection = conn->request->getrequestHeaderMap()["connection"];
-    std::string res_target = conn->request->getrequestLineMap()["Target"];
-    std::string content_type;
-    if (!conn->res.isDynamic && res_target.find(".") != std::string::npos)
-    {
-        if (res_target.find(".png") != std::string::npos)
-            content_type = "image/png";
-        else if (res_target.find(".jpeg") != std::string::npos)
-            content_type = "image/jpeg";
-        else if (res_target.find(".jpg") != std::string::npos)
-            content_type = "image/jpg";
-        else if (res_target.find(".txt") != std::string::npos)
-            content_type = "text/plain";
-        else if (res_target.find(".html") != std::string::npos)
-            content_type = "text/html";
-        else
-            content_type = "application/octet-stream";
-    }
-    else
-        content_type = "text/html";
+    const std::string cookieStr = cookie.set(*conn->request);
+    const std::string_view content_type = conn->res.isDynamic
+                                              ? FIELD_CONTENT_TYPE_HTML
+                                              : ResponseHead::contentTypeField(conn->request->getrequestLineMap()["Target"]);
 
-    std::string result;
+    std::string result = Buffer::acquireBlock(0);
+    ResponseHead head(result);
     auto request = conn->request;
     if (request->getHttpRequestMethod() == "GET")
     {
-        result.append("HTTP/1.1").append(" 200 OK\r\n");
-        result.append("Content-Type: ").append(content_type).append("\r\n");
-        if (connection == "close")
-            result.append("Connection: ").append(connection).append("\r\n");
-        result.append(cookieStr);
-        result.append("Content-Length: ").append(std::to_string(conn->res.fileSize)).append("\r\n\r\n");
+        head.status(200).date().raw(content_type);
+        if (conn->must_close)
+            head.raw(FIELD_CONNECTION_CLOSE);
+        head.raw(cookieStr).field("Content-Length", conn->res.fileSize).end();
         if (conn->res.isDynamic)
             result.append(conn->res.dynamicPage);
     }
     else if (request->getHttpRequestMethod() == "POST")
     {
-        result.append("HTTP/1.1").append(" 201 Created\r\n");
-        result.append("Content-Type: ").append(content_type).append("\r\n");
-        result.append("Location: ").append(conn->res.postFilename).append("\r\n");
-        if (connection == "close")
-            result.append("Connection: ").append(connection).append("\r\n");
-        result.append(cookieStr);
-        result.append("Content-Length: 0").append("\r\n\r\n");
+        head.status(201).date().raw(content_type).field("Location", conn->res.postFilename);
+        if (conn->must_close)
+            head.raw(FIELD_CONNECTION_CLOSE);
+        head.raw(cookieStr).field("Content-Length", "0").end();
     }
     else if (request->getHttpRequestMethod() == "DELETE")
     {
-        std::string deleteSuccess = "<!DOCTYPE html>"
-                                    "<html>"
-                                    "<head><title>204 OK</title></head>"
-                                    "<body>"
-                                    "<h1>DELETE Success</h1>"
-                                    "<p>The requested resource has been deleted.</p>"
-                                    "</body>"
-                                    "</html>";
-        result.append("HTTP/1.1").append(" 204 OK\r\n");
-        result.append("Content-Type: text/html\r\n");
-        if (connection == "close")
-            result.append("Connection: ").append(connection).append("\r\n");
-        result.append(cookieStr);
-        result.append("Content-Length: ").append(std::to_string(deleteSuccess.size())).append("\r\n\r\n");
-        result.append(deleteSuccess);
+        // A 204 response has no body, and no Content-Length.
+        head.status(204).date();
+        if (conn->must_close)
+            head.raw(FIELD_CONNECTION_CLOSE);
+        head.raw(cookieStr).end();
     }
-    std::cout << result << std::endl;
     return (result);
 }
 
 std::string HttpResponse::failedResponse(t_conn *conn, t_status_error_codes error_code, const std::string &error_message, size_t errPageSize, Cookie &cookie)
 {
-    std::string result;
-    std::string status;
-    auto request = conn->request;
-    std::string cookieStr = cookie.set(*conn->request);
+    const std::string cookieStr = cookie.set(*conn->request);
+    const std::string_view status = ResponseHead::statusText(error_code);
 
-    switch (error_code)
-    {
-    case ERR_301_REDIRECT:
-        status = "301 Moved Permanently";
-        break;
-    case ERR_400_BAD_REQUEST:
-        status = "400 Bad Request";
-        break;
-    case ERR_401_UNAUTHORIZED:
-        status = "401 Unauthorized";
-        break;
-    case ERR_403_FORBIDDEN:
-        status = "403 Forbidden";
-        break;
-    case ERR_404_NOT_FOUND:
-        status = "404 Not Found";
-        break;
-    case ERR_405_METHOD_NOT_ALLOWED:
-        status = "405 METHOD NOT ALLOWED";
-        break;
-    case ERR_409_CONFLICT:
-        status = "409 Conflict";
-        break;
-    default:
-        status = "500 Internal Server Error";
-    }
+    std::string result = Buffer::acquireBlock(0);
+    ResponseHead head(result);
+    head.status(error_code).date();
 
     if (errPageSize == 0)
     {
@@ -113,8 +66,10 @@ std::string HttpResponse::failedResponse(t_conn *conn, t_status_error_codes erro
         {
             std::string redirected = error_message;
 
-            result.append("HTTP/1.1").append(" ").append(status).append("\r\n");
-            result.append("Location: ").append(redirected.erase(0, 12)).append("\r\n");
+            head.field("Location", redirected.erase(0, redirected.find_first_not_of(" ", 12)));
+            if (conn->must_close)
+                head.raw(FIELD_CONNECTION_CLOSE);
+            head.field("Content-Length", "0").end();
             return (result);
         }
 
@@ -125,49 +80,132 @@ std::string HttpResponse::failedResponse(t_conn *conn, t_status_error_codes erro
         htmlPage.append(status).append("</title></head><body><h1>");
         htmlPage.append(status).append("</h1><p>").append(error_message);
         htmlPage.append("</p></body></html>");
-        result.append("HTTP/1.1").append(" ").append(status).append("\r\n");
-        result.append("Content-Type: text/html\r\n");
-        result.append("Connection: close\r\n");
-        result.append(cookieStr);
-        result.append("Content-Length: ").append(std::to_string(htmlPage.size())).append("\r\n\r\n");
+        head.raw(FIELD_CONTENT_TYPE_HTML);
+        if (conn->must_close)
+            head.raw(FIELD_CONNECTION_CLOSE);
+        head.raw(cookieStr).field("Content-Length", htmlPage.size()).end();
         result.append(htmlPage);
     }
     else
     {
-        result.append("HTTP/1.1").append(" ").append(status).append("\r\n");
-        result.append("Content-Type: text/html\r\n");
-        result.append("Connection: close\r\n");
-        result.append(cookieStr);
-        result.append("Content-Length: ").append(std::to_string(errPageSize)).append("\r\n\r\n");
+        head.raw(FIELD_CONTENT_TYPE_HTML);
+        if (conn->must_close)
+            head.raw(FIELD_CONNECTION_CLOSE);
+        head.raw(cookieStr).field("Content-Length", errPageSize).end();
     }
     return (result);
 }
 
 
 
-std::string HttpResponse::CGIResponse(std::string_view cgiString)
+/**
+ * @details
+ * The CGI header (RFC 3875) ends with an empty line, its lines may end with LF only.
+ * - `Status` becomes the status line, 200 by default, 302 for a `Location` alone.
+ * - `Content-Length` is kept, the length of the body is known.
+ *   Otherwise the body is sent chunked, or close-delimited to an HTTP/1.0 client.
+ * - A 1xx, 204 or 304 has no body and no framing field (RFC 9112 §6.3), the `output_length` is the head alone.
+ * - The fields about the connection are dropped, the server decides them.
+ * - Other fields are passed through.
+ */
+std::string HttpResponse::CGIResponse(t_conn *conn, std::string_view cgi_output, size_t max_size, size_t &cgi_head_size)
 {
-    std::string result;
-    std::string cleanStatus;
+    std::string status = "200 OK";
+    std::string fields;
     bool has_status = false;
+    bool has_location = false;
+    bool has_length = false;
+    size_t length = 0;
 
-    if (cgiString.empty() || (cgiString.size() < 8))
-        throw WebServErr::CgiHeaderNotFound("CGI header is not correct");
-
-    std::string_view status = cgiString.substr(0, 8);
-    if (status == "Status: ")
-        has_status = true;
-    if (has_status)
+    size_t pos = 0;
+    while (true)
     {
-        cleanStatus = cgiString.substr(8);
-        if(!cleanStatus.empty()){
-            result.append("HTTP/1.1").append(" ").append(cleanStatus).append("\r\n");
+        const size_t eol = scanFindByte(cgi_output, '\n', pos);
+        if (eol == std::string_view::npos)
+        {
+            if (cgi_output.size() >= max_size)
+                throw WebServErr::InvalidCgiHeader("CGI header is too large");
+            throw WebServErr::CgiHeaderNotFound("CGI header is not complete");
+        }
+
+        std::string_view line = cgi_output.substr(pos, eol - pos);
+        pos = eol + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (line.empty())
+            break;
+
+        const size_t colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos)
+            throw WebServErr::InvalidCgiHeader("Malformed CGI header field");
+        const std::string name = toLower(std::string(line.substr(0, colon)));
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            value.remove_suffix(1);
+
+        if (name == "status")
+        {
+            if (value.size() < 3 || value.substr(0, 3).find_first_not_of("0123456789") != std::string_view::npos)
+                throw WebServErr::InvalidCgiHeader("Malformed CGI status");
+            status = value;
+            has_status = true;
+            continue;
         }
-        else
-            throw WebServErr::CgiHeaderNotFound("CGI header is correct");
+        switch (headerIdOf(name))
+        {
+        case HDR_CONTENT_LENGTH:
+        {
+            const auto result = std::from_chars(value.data(), value.data() + value.size(), length);
+            if (value.empty() || result.ec != std::errc() || result.ptr != value.data() + value.size())
+                throw WebServErr::InvalidCgiHeader("Malformed CGI Content-Length");
+            has_length = true;
+            break;
+        }
+        case HDR_CONNECTION:
+        case HDR_TRANSFER_ENCODING:
+            break;
+        default:
+            if (name == "keep-alive" || name == "date")
+                break;
+            has_location = has_location || name == "location";
+            fields.append(line).append("\r\n");
+        }
+    }
+    cgi_head_size = pos;
+    if (!has_status && has_location)
+        status = "302 Found";
+    const int code = (status[0] - '0') * 100 + (status[1] - '0') * 10 + (status[2] - '0');
+    const bool has_body = code >= 200 && code != 204 && code != 304;
+
+    std::string result = Buffer::acquireBlock(0);
+    ResponseHead head(result);
+    head.status(status).date().raw(fields);
+    if (!has_body)
+        conn->res_framing = FRAMING_LENGTH;
+    else if (has_length)
+    {
+        conn->res_framing = FRAMING_LENGTH;
+        head.field("Content-Length", length);
+    }
+    else if (conn->request->getrequestLineMap()["HttpVersion"] == "HTTP/1.0")
+    {
+        conn->res_framing = FRAMING_CLOSE;
+        conn->must_close = true;
     }
     else
-        throw WebServErr::InvalidCgiHeader("CGI has no status");
+    {
+        conn->res_framing = FRAMING_CHUNKED;
+        head.raw(FIELD_TRANSFER_ENCODING_CHUNKED);
+    }
+    if (conn->must_close)
+        head.raw(FIELD_CONNECTION_CLOSE);
+    head.end();
 
+    if (!has_body)
+        conn->output_length = result.size();
+    else if (has_length)
+        conn->output_length = result.size() + length;
     return (result);
-}
\ No newline at end of file
+}
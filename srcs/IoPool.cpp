@@ -0,0 +1,105 @@
+#include "IoPool.hpp"
+#include "WebServErr.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+
+IoPool::IoPool(EpollHelper &epoll, unsigned int size)
+    : epoll_(epoll), size_(size), queue_(std::make_unique<t_io_queue>()), threads_(), wake_in_(), wake_out_()
+{
+    queue_->wake = -1;
+    queue_->idle = 0;
+    queue_->is_stopping = false;
+}
+
+IoPool::~IoPool()
+{
+    if (threads_.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(queue_->mutex);
+        queue_->is_stopping = true;
+    }
+    queue_->ready.notify_all();
+    for (std::thread &thread : threads_)
+        thread.join();
+}
+
+bool IoPool::owns(int fd) const
+{
+    return wake_in_ && wake_in_->get() == fd;
+}
+
+void IoPool::run(t_io_queue &queue)
+{
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    while (true)
+    {
+        ++queue.idle;
+        queue.ready.wait(lock, [&queue]
+                         { return queue.is_stopping || !queue.tasks.empty(); });
+        --queue.idle;
+        if (queue.is_stopping)
+            return;
+
+        t_io_task task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        lock.unlock();
+        task.work();
+        task.work = nullptr; // Its captures are released here, the `done` ones on the event loop.
+        lock.lock();
+
+        queue.completed.push_back(std::move(task));
+        if (queue.completed.size() == 1) // Else the event loop is woken already.
+        {
+            const char byte = 0;
+            (void)!write(queue.wake, &byte, 1);
+        }
+    }
+}
+
+t_msg_from_serv IoPool::submit(t_io_task task)
+{
+    t_msg_from_serv msg;
+    if (threads_.empty())
+    {
+        int wake[2];
+        if (pipe2(wake, O_NONBLOCK | O_CLOEXEC) == -1)
+            throw WebServErr::SysCallErrException("I/O pool pipe failed to initialize");
+        wake_in_ = std::make_shared<RaiiFd>(epoll_, wake[0]);
+        wake_out_ = std::make_shared<RaiiFd>(epoll_, wake[1]);
+        queue_->wake = wake[1];
+        msg.fds_to_register.push_back(wake_in_);
+    }
+
+    bool is_starved = false;
+    {
+        std::lock_guard<std::mutex> lock(queue_->mutex);
+        queue_->tasks.push_back(std::move(task));
+        is_starved = queue_->tasks.size() > queue_->idle;
+    }
+    // A slow call holds its thread only, the next tasks get another one.
+    if (is_starved && threads_.size() < size_)
+        threads_.emplace_back(run, std::ref(*queue_));
+    queue_->ready.notify_one();
+    return msg;
+}
+
+t_msg_from_serv IoPool::handleEvent(int fd, t_event_type event_type)
+{
+    t_msg_from_serv msg;
+    if (event_type != READ_EVENT)
+        return msg;
+
+    char bytes[64];
+    while (read(fd, bytes, sizeof(bytes)) > 0)
+        ;
+
+    std::deque<t_io_task> completed;
+    {
+        std::lock_guard<std::mutex> lock(queue_->mutex);
+        completed.swap(queue_->completed);
+    }
+    for (t_io_task &task : completed)
+        task.done(msg);
+    return msg;
+}
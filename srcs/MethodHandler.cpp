@@ -3,7 +3,7 @@
 #include <cstddef>
 #include <filesystem>
 
-MethodHandler::MethodHandler(EpollHelper &epoll_helper)
+MethodHandler::MethodHandler(EpollHelper &epoll_helper, UploadQuota &quota) : quota_(quota), epoll_helper_(epoll_helper)
 {
 	requested_.FD_handler_IN = std::make_shared<RaiiFd>(epoll_helper);
 	requested_.FD_handler_OUT = std::make_shared<RaiiFd>(epoll_helper);
@@ -19,7 +19,7 @@ MethodHandler::~MethodHandler()
 	LOG_TRACE("Method Handler deconstructed", " Yay!");
 }
 
-t_file MethodHandler::handleRequest(t_server_config server, std::unordered_map<std::string, std::string> requestLine, std::unordered_map<std::string, std::string> requestHeader, EpollHelper &epoll_helper)
+t_file MethodHandler::handleRequest(t_server_config server, std::unordered_map<std::string, std::string> requestLine, const HttpHeaders &requestHeader, EpollHelper &epoll_helper)
 {
 	LOG_TRACE("Handle Request Started: ");
 	std::string targetRef;
@@ -29,7 +29,6 @@ t_file MethodHandler::handleRequest(t_server_config server, std::unordered_map<s
 	else
 		throw WebServErr::MethodException(ERR_400_BAD_REQUEST, "Http Target does not exist");
 	std::string chosenMethod;
-	std::cout << requestLine["Method"] << std::endl;
 
 	if (!requestLine.contains("Method"))
 		throw WebServErr::MethodException(ERR_400_BAD_REQUEST, "Http Method does not exist");
@@ -49,6 +48,9 @@ t_file MethodHandler::handleRequest(t_server_config server, std::unordered_map<s
 	if (std::find(server.locations[rootDestination].methods.begin(), server.locations[rootDestination].methods.end(), realMethod) == server.locations[rootDestination].methods.end())
 		throw WebServErr::MethodException(ERR_405_METHOD_NOT_ALLOWED, "Method not allowed or is unknown");
 
+	if (!server.locations[rootDestination].proxy.upstreams.empty())
+		return (callProxyMethod(server.locations[rootDestination].proxy, realMethod, targetRef, requestLine, requestHeader, epoll_helper));
+
 	// Clean target - removing overlap with root
 	std::string path = stripLocation(rootDestination, targetRef);
 
@@ -56,6 +58,10 @@ t_file MethodHandler::handleRequest(t_server_config server, std::unordered_map<s
 	if (path == "/" && !server.locations[rootDestination].index.empty())
 		path += server.locations[rootDestination].index;
 
+	// The root was opened at startup, the target is opened beneath it
+	if (server.locations[rootDestination].root_fd != -1)
+		return (handleBeneath(server.locations[rootDestination], realMethod, path, requestHeader, targetRef));
+
 	// Create realPath
 	std::filesystem::path realPath(root + path);
 
@@ -83,7 +89,7 @@ t_file MethodHandler::handleRequest(t_server_config server, std::unordered_map<s
 	case GET:
 		return (callGetMethod(useAutoIndex, canonical, targetRef));
 	case POST:
-		return (callPostMethod(canonical, requestHeader, targetRef, root));
+		return (callPostMethod(canonical, AT_FDCWD, requestHeader, targetRef, server.locations[rootDestination]));
 	case DELETE:
 	{
 		callDeleteMethod(canonical);
@@ -97,6 +103,84 @@ t_file MethodHandler::handleRequest(t_server_config server, std::unordered_map<s
 }
 
 
+/**
+ * One `openat2` opens the target beneath the root fd, where the path was made canonical, checked for a symlink
+ * and compared to the root: it fails on a `..` leaving the root, and on any symlink on the way.
+ * Its fd serves a GET, or is the directory of a POST.
+ */
+t_file MethodHandler::handleBeneath(const t_location_config &location, t_method method, const std::string &path, const HttpHeaders &requestHeader, std::string &targetRef)
+{
+	LOG_TRACE("Opening beneath ", location.root, ": ", path);
+	const size_t start = path.find_first_not_of('/');
+	const std::string relative = start == std::string::npos ? "." : path.substr(start);
+	std::filesystem::path realPath(location.root + path);
+
+	auto target = std::make_shared<RaiiFd>(epoll_helper_, openBeneath(location.root_fd, relative, method == GET ? O_RDONLY | O_NONBLOCK : O_PATH));
+	struct stat st;
+	if (fstat(target->get(), &st) == -1)
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "Failed to stat the target");
+	if (S_ISDIR(st.st_mode))
+	{
+		if (!targetRef.empty() && targetRef.back() != '/')
+			throw WebServErr::MethodException(ERR_301_REDIRECT, targetRef + '/');
+		if (method == GET)
+			return (callGetMethod(true, realPath, targetRef));
+		if (method == POST)
+			return (callPostMethod(realPath, target->get(), requestHeader, targetRef, location));
+		throw WebServErr::MethodException(ERR_403_FORBIDDEN, "Target is a directory, cannot DELETE");
+	}
+	if (!S_ISREG(st.st_mode))
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "File is not a regular file");
+
+	switch (method)
+	{
+	case GET:
+		requested_.FD_handler_OUT = std::move(target);
+		requested_.fileSize = st.st_size;
+		return (std::move(requested_));
+	case POST:
+		throw WebServErr::MethodException(ERR_403_FORBIDDEN, "Permission denied, cannout POST file");
+	case DELETE:
+	{
+		LOG_TRACE("Calling DELETE: ", realPath);
+		if (faccessat(target->get(), "", W_OK, AT_EMPTY_PATH) == -1 && errno != EINVAL)
+			throw WebServErr::MethodException(ERR_403_FORBIDDEN, "Permission Denied: cannot delete selected file");
+		const size_t slash = relative.find_last_of('/');
+		std::unique_ptr<RaiiFd> parent = slash == std::string::npos ? nullptr : std::make_unique<RaiiFd>(epoll_helper_, openBeneath(location.root_fd, relative.substr(0, slash), O_PATH | O_DIRECTORY));
+		if (unlinkat(parent ? parent->get() : location.root_fd, relative.substr(slash + 1).c_str(), 0) == -1)
+			throw WebServErr::SysCallErrException("Failed to delete selected file");
+		quota_.removeFile(realPath.string(), st.st_size);
+		return (requested_);
+	}
+	default:
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "Method not allowed or is unknown");
+	}
+}
+
+int MethodHandler::openBeneath(int rootFd, const std::string &relative, uint64_t flags)
+{
+	struct open_how how = {};
+	how.flags = flags | O_CLOEXEC;
+	how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS;
+	const int fd = static_cast<int>(syscall(SYS_openat2, rootFd, relative.c_str(), &how, sizeof(how)));
+	if (fd != -1)
+		return (fd);
+	switch (errno)
+	{
+	case ENOENT:
+	case ENOTDIR:
+		throw WebServErr::MethodException(ERR_404_NOT_FOUND, "Location does not exist");
+	case EXDEV:
+		throw WebServErr::MethodException(ERR_403_FORBIDDEN, "Path goes beyond root");
+	case ELOOP:
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "Destination is a symlink");
+	case EACCES:
+		throw WebServErr::MethodException(ERR_403_FORBIDDEN, "Permission denied");
+	default:
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "Failed to open the target");
+	}
+}
+
 t_file MethodHandler::callGetMethod(bool useAutoIndex, std::filesystem::path &path, std::string &targetRef)
 {
 	LOG_TRACE("Calling GET: ", path);
@@ -121,15 +205,14 @@ t_file MethodHandler::callGetMethod(bool useAutoIndex, std::filesystem::path &pa
 	return (std::move(requested_));
 }
 
-t_file MethodHandler::callPostMethod(std::filesystem::path &path, std::unordered_map<std::string, std::string> requestHeader, std::string &targetRef, const std::string &root)
+t_file MethodHandler::callPostMethod(std::filesystem::path &path, int dirFd, const HttpHeaders &requestHeader, std::string &targetRef, const t_location_config &location)
 {
 	LOG_TRACE("Calling POST: ", path);
-	if (checkFileCount(root) > 20000)
-		throw WebServErr::MethodException(ERR_403_FORBIDDEN, "Too Many Files, Delete Some");
 	if (requestHeader.contains("multipart/form"))
 		throw WebServErr::MethodException(ERR_400_BAD_REQUEST, "Bad Requet, Multipart/Form Not Found");
 	std::string extension;
-	std::string fileType = requestHeader["content-type"];
+	const std::string *contentType = requestHeader.find(HDR_CONTENT_TYPE);
+	std::string fileType = contentType ? *contentType : "";
 	if (fileType == "image/png")
 		extension = ".png";
 	else if (fileType == "image/jpeg" || fileType == "image/jpg")
@@ -138,30 +221,49 @@ t_file MethodHandler::callPostMethod(std::filesystem::path &path, std::unordered
 		extension = ".txt";
 	else
 		throw WebServErr::MethodException(ERR_400_BAD_REQUEST, "Wrong File Type");
-	std::filesystem::path filename = createRandomFilename(path, extension);
-	std::string result = targetRef.back() == '/' ? targetRef + filename.filename().string() : targetRef + '/' + filename.filename().string();
-	requested_.postFilename = result;
-	requested_.FD_handler_OUT->setFd(open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK, 0644));
+	// The declared length must fit, the bytes are counted once published: a chunked body only needs some room left.
+	const std::string *length = requestHeader.find(HDR_CONTENT_LENGTH);
+	t_dir_usage *usage = quota_.addFile(location, length ? std::stoull(*length) : 0);
+	auto upload = std::make_shared<t_upload>(t_upload{nullptr, 0, 0, 0, 0, 0, 0, false, usage, "", false, false});
+	requested_.FD_handler_OUT->setFd(createUploadFile(path, dirFd, extension, *upload));
 	if (requested_.FD_handler_OUT.get()->get() == -1)
+	{
+		quota_.release(usage);
 		throw WebServErr::MethodException(ERR_403_FORBIDDEN, "Permission denied, cannout POST file");
-	requested_.fileSize = static_cast<int>(std::filesystem::file_size(filename));
+	}
+	std::string filename = std::filesystem::path(upload->path).filename().string();
+	requested_.postFilename = targetRef.back() == '/' ? targetRef + filename : targetRef + '/' + filename;
+	requested_.fileSize = 0;
+	upload->file = requested_.FD_handler_OUT;
+	requested_.upload = std::move(upload);
 	return (std::move(requested_));
 }
 
-std::filesystem::path MethodHandler::createRandomFilename(std::filesystem::path &path, std::string &extension)
+/**
+ * An `O_TMPFILE` has no name till the server links it, once the body is complete: an aborted upload leaves nothing.
+ * Without `O_TMPFILE` in the file system, the file is created at its name; a taken name is found by `O_EXCL`, not a stat.
+ * The directory is `dirFd` when it was opened beneath the root, else `path`.
+ */
+int MethodHandler::createUploadFile(std::filesystem::path &path, int dirFd, std::string &extension, t_upload &upload)
 {
-	std::string result = path.string();
-	static const std::string chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-	static std::mt19937 rng{static_cast<unsigned long>(std::chrono::high_resolution_clock::now().time_since_epoch().count())};
-	std::uniform_int_distribution<size_t> dist(0, chars.size() - 1);
-	std::string code = "upload_";
-	for (size_t i = 0; i < 12; i++)
-		code.push_back(chars[dist(rng)]);
-	code += extension;
-	std::filesystem::path uploadCheck = std::filesystem::path(result) / std::filesystem::path(code);
-	if (std::filesystem::exists(uploadCheck))
-		createRandomFilename(path, extension);
-	return (uploadCheck);
+	std::string name = randomUploadName(extension);
+	upload.path = (path / name).string();
+	int fd = openat(dirFd, dirFd == AT_FDCWD ? path.c_str() : ".", O_TMPFILE | O_WRONLY | O_NONBLOCK | O_CLOEXEC, 0644);
+	upload.is_tmpfile = fd != -1;
+	if (fd != -1 || (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL))
+		return (fd);
+	for (unsigned int i = 0; i < UPLOAD_NAME_ATTEMPTS; i++)
+	{
+		if (i > 0)
+		{
+			name = randomUploadName(extension);
+			upload.path = (path / name).string();
+		}
+		fd = openat(dirFd, dirFd == AT_FDCWD ? upload.path.c_str() : name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NONBLOCK | O_CLOEXEC, 0644);
+		if (fd != -1 || errno != EEXIST)
+			break;
+	}
+	return (fd);
 }
 
 // Only throw if something is wrong, otherwise success is assumed
@@ -172,11 +274,14 @@ void MethodHandler::callDeleteMethod(std::filesystem::path &path)
 		throw WebServErr::MethodException(ERR_403_FORBIDDEN, "Permission Denied: cannot delete selected file");
 	if (std::filesystem::is_directory(path))
 		throw WebServErr::MethodException(ERR_403_FORBIDDEN, "Target is a directory, cannot DELETE");
+	std::error_code ec;
+	const uintmax_t size = std::filesystem::file_size(path, ec);
 	if (!std::filesystem::remove(path))
 		throw WebServErr::SysCallErrException("Failed to delete selected file");
+	quota_.removeFile(path.string(), ec ? 0 : size);
 }
 
-t_file MethodHandler::callCGIMethod(std::string &targetRef, std::unordered_map<std::string, std::string> requestLine, std::unordered_map<std::string, std::string> requestHeader, EpollHelper &epoll_helper, t_server_config &server)
+t_file MethodHandler::callCGIMethod(std::string &targetRef, std::unordered_map<std::string, std::string> requestLine, const HttpHeaders &requestHeader, EpollHelper &epoll_helper, t_server_config &server)
 {
 	LOG_TRACE("Calling CGI targetRef: ", targetRef);
 	CGIHandler cgi(epoll_helper);
@@ -184,12 +289,53 @@ t_file MethodHandler::callCGIMethod(std::string &targetRef, std::unordered_map<s
 	return (std::move(requested_));
 }
 
-void MethodHandler::setContentLength(std::unordered_map<std::string, std::string> requestHeader)
+t_file MethodHandler::callProxyMethod(const t_proxy_config &proxy, t_method method, std::string &targetRef, std::unordered_map<std::string, std::string> &requestLine, const HttpHeaders &requestHeader, EpollHelper &epoll_helper)
+{
+	LOG_TRACE("Proxying targetRef: ", targetRef);
+	auto job = std::make_shared<t_proxy_job>();
+	job->config = proxy;
+	for (const std::string &upstream : proxy.upstreams)
+		job->group.append(upstream).append(" ");
+	job->content_length = 0;
+	if (method == POST)
+	{
+		if (const std::string *length = requestHeader.find(HDR_CONTENT_LENGTH))
+			job->content_length = std::stoull(*length);
+		else
+			job->content_length = SIZE_MAX; // Chunked, the body ends with the pipe
+	}
+	job->head = proxyRequestHead(requestLine["Method"], targetRef, requestHeader, job->content_length);
+	job->is_idempotent = method != POST;
+	job->body = -1;
+	job->output = -1;
+	job->conn_fd = -1;
+	job->body_sent = 0;
+	job->output_started = false;
+	job->is_ended = false;
+	job->is_aborted = false;
+
+	int inPipe[2] = {-1, -1};
+	int outPipe[2] = {-1, -1};
+	if (pipe2(inPipe, O_NONBLOCK | O_CLOEXEC) == -1)
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "inPipe failed to initialize");
+	requested_.FD_handler_IN->setFd(inPipe[1]);
+	job->body_fd = std::make_shared<RaiiFd>(epoll_helper, inPipe[0]);
+	if (pipe2(outPipe, O_NONBLOCK | O_CLOEXEC) == -1)
+		throw WebServErr::MethodException(ERR_500_INTERNAL_SERVER_ERROR, "outPipe failed to initialize");
+	requested_.FD_handler_OUT->setFd(outPipe[0]);
+	(void)fcntl(outPipe[0], F_SETPIPE_SZ, CGI_PIPE_SIZE);
+	job->output_fd = std::make_shared<RaiiFd>(epoll_helper, outPipe[1]);
+
+	requested_.proxy = std::move(job);
+	return (std::move(requested_));
+}
+
+void MethodHandler::setContentLength(const HttpHeaders &requestHeader)
 {
 	LOG_TRACE("Setting Content Length");
-	if (!requestHeader.contains("content-length"))
+	if (!requestHeader.contains(HDR_CONTENT_LENGTH))
 		throw WebServErr::MethodException(ERR_400_BAD_REQUEST, "Failed to get content length.");
-	std::stringstream length(requestHeader["content-length"]);
+	std::stringstream length(requestHeader.at(HDR_CONTENT_LENGTH));
 	length >> requested_.expectedSize;
 	if (length.fail())
 		throw WebServErr::MethodException(ERR_400_BAD_REQUEST, "Bad Request, content length not found.");
@@ -289,7 +435,7 @@ std::string MethodHandler::generateDynamicPage(std::filesystem::path &path, std:
 	}
 
 	page.append("</ul>\n</body>\n</html>\n");
-	std::cout << "Page Size: " << page.size() << std::endl;
+	LOG_TRACE("Page Size: ", page.size());
 	return (page);
 }
 
@@ -308,15 +454,3 @@ bool MethodHandler::checkIfSafe(const std::filesystem::path &root, const std::fi
 		return (false);
 	}
 }
-
-size_t MethodHandler::checkFileCount(const std::string &root)
-{
-	size_t fileCount = 0;
-	for (const auto &entry : std::filesystem::directory_iterator(root))
-	{
-		if (std::filesystem::is_regular_file(entry.path()))
-			fileCount++;
-	}
-	LOG_TRACE("Directory File Count for: ", root, " Files: ", fileCount);
-	return (fileCount);
-}
@@ -0,0 +1,611 @@
+#include "ProxyPool.hpp"
+#include "FastCgiPool.hpp"
+#include "LogSys.hpp"
+#include "ResponseHead.hpp"
+#include "ScanKernels.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <sys/socket.h>
+#include <unistd.h>
+
+//
+// Messages
+//
+
+std::string proxyRequestHead(std::string_view method, std::string_view target, const HttpHeaders &headers, size_t content_length)
+{
+    static constexpr CharClass uri_chars("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-._~!$&'()*+,;=:@/?");
+    static constexpr char hex[] = "0123456789ABCDEF";
+
+    std::string head;
+    head.append(method).append(" ");
+    for (const char ch : target)
+    {
+        const unsigned char c = static_cast<unsigned char>(ch);
+        if (uri_chars.contains(c))
+            head.push_back(ch);
+        else
+            head.append({'%', hex[c >> 4], hex[c & 15]});
+    }
+    head.append(" HTTP/1.1\r\n");
+
+    headers.forEach([&head](std::string_view name, const std::string &value)
+                    {
+        const std::string lower = toLower(std::string(name));
+        switch (headerIdOf(lower))
+        {
+        case HDR_CONNECTION:
+        case HDR_CONTENT_LENGTH:
+        case HDR_TRANSFER_ENCODING:
+        case HDR_EXPECT:
+        case HDR_UPGRADE:
+        case HDR_HTTP2_SETTINGS:
+        case HDR_TE:
+        case HDR_SERVERNAME:
+        case HDR_REQUESTPORT:
+        case HDR_BOUNDARY:
+            return;
+        default:
+            break;
+        }
+        if (lower == "keep-alive" || lower == "proxy-connection" || lower == "trailer" || lower == "x-forwarded-for")
+            return;
+        head.append(name).append(": ").append(value).append("\r\n"); });
+
+    if (content_length == SIZE_MAX)
+        head.append(FIELD_TRANSFER_ENCODING_CHUNKED);
+    else if (content_length > 0)
+        head.append("Content-Length: ").append(std::to_string(content_length)).append("\r\n");
+    return head;
+}
+
+bool proxyResponseHead(std::string_view head, int &status, std::string &cgi_header, t_proxy_framing &framing, size_t &remaining, bool &keep_alive)
+{
+    size_t eol = head.find("\r\n");
+    const std::string_view status_line = head.substr(0, eol);
+    if (eol == std::string_view::npos || status_line.size() < 12 || !status_line.starts_with("HTTP/1.")
+        || (status_line[7] != '0' && status_line[7] != '1') || status_line[8] != ' ')
+        return false;
+    const auto result = std::from_chars(status_line.data() + 9, status_line.data() + 12, status);
+    if (result.ec != std::errc() || result.ptr != status_line.data() + 12 || status < 100
+        || (status_line.size() > 12 && status_line[12] != ' '))
+        return false;
+    keep_alive = status_line[7] == '1';
+
+    std::string fields;
+    std::string length_field;
+    bool is_chunked = false;
+    bool has_length = false;
+    size_t pos = eol + 2;
+    while (true)
+    {
+        eol = head.find("\r\n", pos);
+        if (eol == std::string_view::npos)
+            return false;
+        const std::string_view line = head.substr(pos, eol - pos);
+        pos = eol + 2;
+        if (line.empty())
+            break;
+
+        const size_t colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos || line.front() == ' ' || line.front() == '\t')
+            return false;
+        const std::string name = toLower(std::string(line.substr(0, colon)));
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            value.remove_suffix(1);
+
+        if (name == "content-length")
+        {
+            const auto length = std::from_chars(value.data(), value.data() + value.size(), remaining);
+            if (value.empty() || length.ec != std::errc() || length.ptr != value.data() + value.size())
+                return false;
+            has_length = true;
+            length_field.assign(line).append("\r\n");
+        }
+        else if (name == "transfer-encoding")
+            is_chunked = hasToken(toLower(std::string(value)), "chunked");
+        else if (name == "connection")
+        {
+            const std::string options = toLower(std::string(value));
+            keep_alive = (keep_alive || hasToken(options, "keep-alive")) && !hasToken(options, "close");
+        }
+        else if (name != "keep-alive" && name != "proxy-connection" && name != "upgrade" && name != "trailer" && name != "status")
+            fields.append(line).append("\r\n");
+    }
+
+    if (status < 200 || status == 204 || status == 304)
+        framing = PROXY_BODY_NONE;
+    else if (is_chunked)
+        framing = PROXY_BODY_CHUNKED;
+    else if (has_length)
+        framing = PROXY_BODY_LENGTH;
+    else
+    {
+        framing = PROXY_BODY_CLOSE;
+        keep_alive = false;
+    }
+
+    cgi_header.assign("Status: ").append(status_line.substr(9)).append("\r\n").append(fields);
+    if (framing == PROXY_BODY_LENGTH)
+        cgi_header.append(length_field);
+    cgi_header.append("\r\n");
+    return true;
+}
+
+ProxyPool::ProxyPool(EpollHelper &epoll) : epoll_(epoll), conns_(), job_fds_(), upstreams_(), next_() {}
+
+bool ProxyPool::owns(int fd) const
+{
+    return conns_.contains(fd) || job_fds_.contains(fd);
+}
+
+//
+// Upstreams
+//
+
+/**
+ * @details
+ * The upstreams not tried yet by the request are the candidates, the skipped ones are left out
+ * unless every upstream of the location is skipped and the request has not been sent yet.
+ */
+const std::string *ProxyPool::pick(const t_proxy_job &job, time_t now)
+{
+    const std::vector<std::string> &upstreams = job.config.upstreams;
+    auto isCandidate = [&](const std::string &address, bool skip_down)
+    {
+        return std::find(job.tried.begin(), job.tried.end(), address) == job.tried.end()
+            && (!skip_down || upstreams_[address].down_until <= now);
+    };
+    bool skip_down = std::any_of(upstreams.begin(), upstreams.end(), [&](const std::string &address)
+                                 { return isCandidate(address, true); });
+    if (!skip_down && !job.tried.empty())
+        return nullptr;
+
+    size_t &next = next_[job.group];
+    const std::string *chosen = nullptr;
+    size_t chosen_idx = 0;
+    for (size_t i = 0; i < upstreams.size(); ++i)
+    {
+        const size_t idx = (next + i) % upstreams.size();
+        if (!isCandidate(upstreams[idx], skip_down))
+            continue;
+        if (chosen && (job.config.balance == PROXY_ROUND_ROBIN || upstreams_[upstreams[idx]].active >= upstreams_[*chosen].active))
+            continue;
+        chosen = &upstreams[idx];
+        chosen_idx = idx;
+    }
+    if (chosen)
+        next = chosen_idx + 1;
+    return chosen;
+}
+
+void ProxyPool::markFailure(const std::string &address, const t_proxy_config &config, time_t now)
+{
+    t_upstream &upstream = upstreams_[address];
+    if (config.max_fails == 0 || ++upstream.fails < config.max_fails)
+        return;
+    LOG_WARN("Upstream skipped for ", config.fail_timeout, "s: ", address);
+    upstream.fails = 0;
+    upstream.down_until = now + config.fail_timeout;
+}
+
+//
+// Requests
+//
+
+t_msg_from_serv ProxyPool::submit(std::shared_ptr<t_proxy_job> job)
+{
+    t_msg_from_serv msg;
+
+    job->body = job->body_fd->get();
+    job->output = job->output_fd->get();
+    msg.fds_to_register.push_back(std::move(job->body_fd));
+    msg.fds_to_register.push_back(std::move(job->output_fd));
+    job_fds_[job->body] = job;
+    job_fds_[job->output] = job;
+
+    if (!dispatch(job, msg))
+        failJob(*job, msg);
+    return msg;
+}
+
+bool ProxyPool::dispatch(const std::shared_ptr<t_proxy_job> &job, t_msg_from_serv &msg)
+{
+    const time_t now = time(NULL);
+    while (const std::string *address = pick(*job, now))
+    {
+        job->tried.push_back(*address);
+        t_upstream &upstream = upstreams_[*address];
+        while (!upstream.idle.empty())
+        {
+            const int fd = upstream.idle.back();
+            upstream.idle.pop_back();
+            char probe;
+            if (recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT) == -1 && errno == EAGAIN)
+            {
+                epoll_.addFd(fd);
+                startRequest(conns_.at(fd), job, msg);
+                return true;
+            }
+            closeConn(fd, msg); // Closed by the upstream while idle
+        }
+
+        bool is_connected = false;
+        const int fd = connectTo(*address, is_connected);
+        if (fd == -1)
+        {
+            LOG_WARN("Failed to connect to the upstream: ", *address);
+            markFailure(*address, job->config, now);
+            continue;
+        }
+        msg.fds_to_register.push_back(std::make_shared<RaiiFd>(epoll_, fd));
+        t_proxy_conn &conn = conns_[fd];
+        conn.fd = fd;
+        conn.address = *address;
+        conn.is_connected = is_connected;
+        conn.since = now;
+        conn.out_pos = 0;
+        startRequest(conn, job, msg);
+        return true;
+    }
+    return false;
+}
+
+void ProxyPool::startRequest(t_proxy_conn &conn, const std::shared_ptr<t_proxy_job> &job, t_msg_from_serv &msg)
+{
+    job->conn_fd = conn.fd;
+    ++upstreams_[conn.address].active;
+
+    conn.job = job;
+    conn.in.clear();
+    conn.is_head_done = false;
+    conn.framing = PROXY_BODY_NONE;
+    conn.remaining = 0;
+    conn.decoder.reset();
+    conn.keep_alive = true;
+    conn.out.append(job->head).append("\r\n");
+
+    if (job->content_length == 0)
+        closeBody(*job, msg);
+}
+
+/**
+ * @details
+ * The connection goes back to the idle ones of its upstream, if it may carry another request.
+ * An idle connection leaves the epoll, it would be reported writable on every wait.
+ */
+void ProxyPool::endResponse(t_proxy_conn &conn, t_msg_from_serv &msg)
+{
+    t_proxy_job &job = *conn.job;
+    job.is_ended = true;
+    job.conn_fd = -1;
+    closeBody(job, msg);
+    flushOutput(job, msg);
+
+    t_upstream &upstream = upstreams_[conn.address];
+    --upstream.active;
+    upstream.fails = 0;
+    conn.job = nullptr;
+    if (!conn.keep_alive || !conn.in.empty() || conn.out_pos != conn.out.size() || upstream.idle.size() >= PROXY_MAX_IDLE)
+        return closeConn(conn.fd, msg);
+    conn.out.clear();
+    conn.out_pos = 0;
+    conn.since = time(NULL);
+    upstream.idle.push_back(conn.fd);
+    epoll_.removeFd(conn.fd);
+}
+
+void ProxyPool::closeConn(int fd, t_msg_from_serv &msg)
+{
+    t_proxy_conn &conn = conns_.at(fd);
+    t_upstream &upstream = upstreams_[conn.address];
+    if (conn.job)
+    {
+        --upstream.active;
+        conn.job->conn_fd = -1;
+    }
+    else
+        std::erase(upstream.idle, fd);
+    msg.fds_to_unregister.push_back(fd);
+    conns_.erase(fd);
+}
+
+void ProxyPool::failConn(int fd, t_msg_from_serv &msg)
+{
+    t_proxy_conn &conn = conns_.at(fd);
+    const std::shared_ptr<t_proxy_job> job = conn.job;
+    if (!job)
+        return closeConn(fd, msg);
+
+    LOG_WARN("Upstream request failed: ", conn.address);
+    markFailure(conn.address, job->config, time(NULL));
+    closeConn(fd, msg);
+    if (job->is_ended || job->is_aborted)
+        return;
+    if (!job->output_started && job->is_idempotent && dispatch(job, msg))
+        return;
+    failJob(*job, msg);
+}
+
+void ProxyPool::failJob(t_proxy_job &job, t_msg_from_serv &msg)
+{
+    job.is_ended = true;
+    job.conn_fd = -1;
+    closeBody(job, msg);
+    if (!job.output_started)
+        job.pending.assign(PROXY_BAD_GATEWAY);
+    flushOutput(job, msg);
+}
+
+void ProxyPool::closeBody(t_proxy_job &job, t_msg_from_serv &msg)
+{
+    if (job.body == -1)
+        return;
+    job_fds_.erase(job.body);
+    msg.fds_to_unregister.push_back(job.body);
+    job.body = -1;
+}
+
+void ProxyPool::closeOutput(t_proxy_job &job, t_msg_from_serv &msg)
+{
+    if (job.output == -1)
+        return;
+    job_fds_.erase(job.output);
+    msg.fds_to_unregister.push_back(job.output);
+    job.output = -1;
+}
+
+void ProxyPool::flushOutput(t_proxy_job &job, t_msg_from_serv &msg)
+{
+    if (job.output == -1)
+    {
+        job.pending.clear();
+        return;
+    }
+
+    size_t written = 0;
+    while (written < job.pending.size())
+    {
+        const ssize_t n = write(job.output, job.pending.data() + written, job.pending.size() - written);
+        if (n <= 0)
+            break;
+        written += n;
+    }
+    job.pending.erase(0, written);
+
+    if (job.is_ended && job.pending.empty())
+        closeOutput(job, msg);
+}
+
+//
+// Events
+//
+
+t_msg_from_serv ProxyPool::handleEvent(int fd, t_event_type event_type)
+{
+    t_msg_from_serv msg;
+
+    const auto conn = conns_.find(fd);
+    if (conn != conns_.end())
+    {
+        onConnEvent(conn->second, event_type, msg);
+        return msg;
+    }
+
+    const std::shared_ptr<t_proxy_job> job = job_fds_.at(fd); // Kept alive while its fds close.
+    if (fd == job->body && event_type != WRITE_EVENT)
+        onBodyEvent(*job, msg);
+    else if (fd == job->output && event_type != READ_EVENT)
+        onOutputEvent(*job, event_type, msg);
+    return msg;
+}
+
+/**
+ * @details
+ * - Write: completes the connect, then sends the request.
+ * - Read: parses the response, unless the output pipe is full.
+ * - Error: the rest of the input is read, then the request fails.
+ */
+void ProxyPool::onConnEvent(t_proxy_conn &conn, t_event_type event_type, t_msg_from_serv &msg)
+{
+    if (event_type == WRITE_EVENT)
+    {
+        if (!conn.is_connected)
+        {
+            int error = 0;
+            socklen_t size = sizeof(error);
+            if (getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &size) == -1 || error != 0)
+                return failConn(conn.fd, msg);
+            conn.is_connected = true;
+        }
+        if (conn.out_pos == conn.out.size())
+            return;
+
+        const ssize_t n = send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+        if (n == -1 && errno != EAGAIN)
+            return failConn(conn.fd, msg);
+        if (n > 0)
+            conn.out_pos += n;
+        if (conn.out_pos == conn.out.size())
+        {
+            conn.out.clear();
+            conn.out_pos = 0;
+        }
+        return;
+    }
+
+    if (!conn.is_connected)
+    {
+        if (event_type == ERROR_EVENT)
+            failConn(conn.fd, msg);
+        return;
+    }
+    if (!conn.job)
+        return; // Idle, an event of the same wait
+    if (conn.job->pending.size() > PROXY_MAX_PENDING && event_type == READ_EVENT)
+        return; // The output pipe drains first
+
+    char buf[PROXY_IO_SIZE];
+    const ssize_t n = read(conn.fd, buf, sizeof(buf));
+    if (n == 0 && conn.is_head_done && conn.framing == PROXY_BODY_CLOSE)
+        return endResponse(conn, msg);
+    if (n == 0 || (n == -1 && event_type == ERROR_EVENT))
+        return failConn(conn.fd, msg);
+    if (n == -1)
+        return;
+
+    conn.in.append(buf, n);
+    if (!processResponse(conn, msg))
+    {
+        LOG_WARN("Malformed response from the upstream: ", conn.address);
+        return failConn(conn.fd, msg);
+    }
+}
+
+/**
+ * @details
+ * Interim responses are dropped. The head is sent as a CGI header, then the body is decoded from
+ * its framing, so the end of the response is known and the connection can be reused.
+ */
+bool ProxyPool::processResponse(t_proxy_conn &conn, t_msg_from_serv &msg)
+{
+    t_proxy_job &job = *conn.job;
+    while (!conn.is_head_done)
+    {
+        const size_t end = conn.in.find("\r\n\r\n");
+        if (end == std::string::npos)
+            return conn.in.size() <= PROXY_MAX_HEAD;
+
+        int status = 0;
+        std::string cgi_header;
+        if (!proxyResponseHead(std::string_view(conn.in).substr(0, end + 4), status, cgi_header, conn.framing, conn.remaining, conn.keep_alive))
+            return false;
+        conn.in.erase(0, end + 4);
+        if (status < 200)
+            continue;
+        conn.is_head_done = true;
+        job.output_started = true;
+        job.pending.append(cgi_header);
+    }
+
+    std::string_view in(conn.in);
+    bool is_done = false;
+    switch (conn.framing)
+    {
+    case PROXY_BODY_NONE:
+        is_done = true;
+        break;
+    case PROXY_BODY_LENGTH:
+    {
+        const size_t size = std::min(conn.remaining, in.size());
+        job.pending.append(in.substr(0, size));
+        in.remove_prefix(size);
+        conn.remaining -= size;
+        is_done = conn.remaining == 0;
+        break;
+    }
+    case PROXY_BODY_CHUNKED:
+        while (!in.empty() && !conn.decoder.isDone() && !conn.decoder.isError())
+        {
+            std::string_view body;
+            in.remove_prefix(conn.decoder.next(in, body));
+            job.pending.append(body);
+        }
+        if (conn.decoder.isError())
+            return false;
+        is_done = conn.decoder.isDone();
+        break;
+    case PROXY_BODY_CLOSE:
+        job.pending.append(in);
+        in = std::string_view();
+        break;
+    }
+    conn.in.erase(0, conn.in.size() - in.size());
+
+    if (is_done)
+        endResponse(conn, msg);
+    else
+        flushOutput(job, msg);
+    return true;
+}
+
+/**
+ * @details
+ * The body is read only while the connection is not backed up.
+ * It ends at the Content-Length, or at the EOF when it is sent chunked.
+ */
+void ProxyPool::onBodyEvent(t_proxy_job &job, t_msg_from_serv &msg)
+{
+    if (job.conn_fd == -1)
+        return;
+    t_proxy_conn &conn = conns_.at(job.conn_fd);
+    if (conn.out.size() - conn.out_pos > PROXY_MAX_PENDING)
+        return;
+
+    char buf[PROXY_IO_SIZE];
+    const size_t size = std::min(sizeof(buf), job.content_length - job.body_sent);
+    const ssize_t n = read(job.body, buf, size);
+    if (n == -1)
+        return;
+
+    const bool is_chunked = job.content_length == SIZE_MAX;
+    if (n > 0)
+    {
+        if (is_chunked)
+        {
+            char size_line[20];
+            const auto result = std::to_chars(size_line, size_line + sizeof(size_line), static_cast<size_t>(n), 16);
+            conn.out.append(size_line, result.ptr).append("\r\n").append(buf, n).append("\r\n");
+        }
+        else
+            conn.out.append(buf, n);
+        job.body_sent += n;
+    }
+    if (n == 0 || job.body_sent == job.content_length)
+    {
+        if (is_chunked)
+            conn.out.append("0\r\n\r\n");
+        closeBody(job, msg);
+    }
+}
+
+/**
+ * @details
+ * An error on the output pipe means the client is gone, the connection is closed mid-response.
+ */
+void ProxyPool::onOutputEvent(t_proxy_job &job, t_event_type event_type, t_msg_from_serv &msg)
+{
+    if (event_type == WRITE_EVENT)
+    {
+        if (!job.pending.empty())
+            flushOutput(job, msg);
+        return;
+    }
+
+    job.is_aborted = true;
+    job.pending.clear();
+    if (job.conn_fd != -1)
+        closeConn(job.conn_fd, msg);
+    closeBody(job, msg);
+    closeOutput(job, msg);
+}
+
+t_msg_from_serv ProxyPool::tick(time_t now)
+{
+    t_msg_from_serv msg;
+
+    std::vector<int> expired;
+    for (const auto &[fd, conn] : conns_)
+    {
+        if ((!conn.is_connected && now - conn.since >= PROXY_CONNECT_TIMEOUT) || (!conn.job && now - conn.since >= PROXY_IDLE_TIMEOUT))
+            expired.push_back(fd);
+    }
+    for (const int fd : expired)
+        failConn(fd, msg);
+    return msg;
+}
@@ -0,0 +1,132 @@
+#include "ResponseHead.hpp"
+#include <charconv>
+
+static constexpr std::string_view STATUS_PREFIX = "HTTP/1.1 ";
+
+ResponseHead::ResponseHead(std::string &out) : out_(out) {}
+
+std::string_view ResponseHead::statusLine(int code)
+{
+    switch (code)
+    {
+    case 100:
+        return "HTTP/1.1 100 Continue\r\n";
+    case 200:
+        return "HTTP/1.1 200 OK\r\n";
+    case 201:
+        return "HTTP/1.1 201 Created\r\n";
+    case 204:
+        return "HTTP/1.1 204 No Content\r\n";
+    case 301:
+        return "HTTP/1.1 301 Moved Permanently\r\n";
+    case 400:
+        return "HTTP/1.1 400 Bad Request\r\n";
+    case 401:
+        return "HTTP/1.1 401 Unauthorized\r\n";
+    case 403:
+        return "HTTP/1.1 403 Forbidden\r\n";
+    case 404:
+        return "HTTP/1.1 404 Not Found\r\n";
+    case 405:
+        return "HTTP/1.1 405 Method Not Allowed\r\n";
+    case 409:
+        return "HTTP/1.1 409 Conflict\r\n";
+    case 413:
+        return "HTTP/1.1 413 Content Too Large\r\n";
+    case 501:
+        return "HTTP/1.1 501 Not Implemented\r\n";
+    default:
+        return "HTTP/1.1 500 Internal Server Error\r\n";
+    }
+}
+
+std::string_view ResponseHead::statusText(int code)
+{
+    std::string_view line = statusLine(code);
+    line.remove_prefix(STATUS_PREFIX.size());
+    line.remove_suffix(2);
+    return line;
+}
+
+/**
+ * @details
+ * The cache is per thread: the heads are built on the event loop, and on the `IoPool` threads running the methods.
+ * The returned view is only valid on the calling thread, until its next call.
+ * `strftime` uses the "C" locale, the server never calls `setlocale`.
+ */
+std::string_view ResponseHead::dateField(time_t now)
+{
+    thread_local time_t cached_at = -1;
+    thread_local char cached[64];
+    thread_local size_t cached_size = 0;
+
+    if (now != cached_at)
+    {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        cached_size = strftime(cached, sizeof(cached), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        cached_at = now;
+    }
+    return std::string_view(cached, cached_size);
+}
+
+std::string_view ResponseHead::contentTypeField(std::string_view path)
+{
+    const size_t dot = path.rfind('.');
+    if (dot == std::string_view::npos || path.find('/', dot) != std::string_view::npos)
+        return FIELD_CONTENT_TYPE_HTML;
+
+    const std::string_view ext = path.substr(dot + 1);
+    if (ext == "html")
+        return FIELD_CONTENT_TYPE_HTML;
+    if (ext == "txt")
+        return "Content-Type: text/plain\r\n";
+    if (ext == "png")
+        return "Content-Type: image/png\r\n";
+    if (ext == "jpg" || ext == "jpeg")
+        return "Content-Type: image/jpeg\r\n";
+    return "Content-Type: application/octet-stream\r\n";
+}
+
+ResponseHead &ResponseHead::status(int code)
+{
+    out_.append(statusLine(code));
+    return *this;
+}
+
+ResponseHead &ResponseHead::status(std::string_view status_text)
+{
+    out_.append(STATUS_PREFIX).append(status_text).append("\r\n");
+    return *this;
+}
+
+ResponseHead &ResponseHead::date()
+{
+    out_.append(dateField());
+    return *this;
+}
+
+ResponseHead &ResponseHead::field(std::string_view name, std::string_view value)
+{
+    out_.append(name).append(": ").append(value).append("\r\n");
+    return *this;
+}
+
+ResponseHead &ResponseHead::field(std::string_view name, size_t value)
+{
+    char digits[24];
+    const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    return field(name, std::string_view(digits, result.ptr - digits));
+}
+
+ResponseHead &ResponseHead::raw(std::string_view fields)
+{
+    out_.append(fields);
+    return *this;
+}
+
+ResponseHead &ResponseHead::end()
+{
+    out_.append("\r\n");
+    return *this;
+}
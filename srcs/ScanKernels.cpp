@@ -0,0 +1,344 @@
+#include "../includes/ScanKernels.hpp"
+#include <cstring>
+
+#if defined(__x86_64__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+//
+// Scalar kernels, the reference and the fallback for the tails.
+//
+
+/**
+ * @brief Single byte search, shared by every level.
+ * @details glibc's `memchr` is already vectorized and dispatched by the CPU, a hand-written
+ * loop only loses to it.
+ */
+static size_t scalarFindByte(const char *data, size_t size, char c)
+{
+    const void *found = std::memchr(data, c, size);
+    return found ? static_cast<const char *>(found) - data : size;
+}
+
+static size_t scalarFindPair(const char *data, size_t size, char a, char b)
+{
+    for (size_t i = 0; i + 1 < size; ++i)
+    {
+        if (data[i] == a && data[i + 1] == b)
+            return i;
+    }
+    return size;
+}
+
+static size_t scalarFindQuad(const char *data, size_t size, const char *quad)
+{
+    for (size_t i = 0; i + 3 < size; ++i)
+    {
+        if (data[i] == quad[0] && data[i + 1] == quad[1] && data[i + 2] == quad[2] && data[i + 3] == quad[3])
+            return i;
+    }
+    return size;
+}
+
+static size_t scalarFindFirstOf(const char *data, size_t size, const CharClass &cls)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (cls.contains(static_cast<unsigned char>(data[i])))
+            return i;
+    }
+    return size;
+}
+
+#ifdef SCAN_X86
+
+//
+// SSE2 kernels, 16 bytes per step.
+// The multi-byte searches compare shifted unaligned loads, so a match is found
+// wherever it starts, without crossing-boundary bookkeeping.
+//
+
+static size_t sse2FindPair(const char *data, size_t size, char a, char b)
+{
+    const __m128i first = _mm_set1_epi8(a);
+    const __m128i second = _mm_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 17 <= size; i += 16)
+    {
+        const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 1));
+        const __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(v0, first), _mm_cmpeq_epi8(v1, second));
+        const int mask = _mm_movemask_epi8(eq);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scalarFindPair(data + i, size - i, a, b);
+}
+
+static size_t sse2FindQuad(const char *data, size_t size, const char *quad)
+{
+    const __m128i q0 = _mm_set1_epi8(quad[0]);
+    const __m128i q1 = _mm_set1_epi8(quad[1]);
+    const __m128i q2 = _mm_set1_epi8(quad[2]);
+    const __m128i q3 = _mm_set1_epi8(quad[3]);
+    size_t i = 0;
+    for (; i + 19 <= size; i += 16)
+    {
+        const char *p = data + i;
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), q0);
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1)), q1));
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 2)), q2));
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 3)), q3));
+        const int mask = _mm_movemask_epi8(eq);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scalarFindQuad(data + i, size - i, quad);
+}
+
+/**
+ * @details SSE2 has no byte shuffle, so each member of the class is compared in turn.
+ */
+static size_t sse2FindFirstOf(const char *data, size_t size, const CharClass &cls)
+{
+    if (!cls.simd_ok)
+        return scalarFindFirstOf(data, size, cls);
+
+    __m128i members[CharClass::MAX_SIMD_MEMBERS];
+    for (size_t m = 0; m < cls.member_count; ++m)
+        members[m] = _mm_set1_epi8(cls.members[m]);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i eq = _mm_setzero_si128();
+        for (size_t m = 0; m < cls.member_count; ++m)
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, members[m]));
+        const int mask = _mm_movemask_epi8(eq);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scalarFindFirstOf(data + i, size - i, cls);
+}
+
+//
+// AVX2 kernels, 32 bytes per step.
+//
+
+__attribute__((target("avx2"))) static size_t avx2FindPair(const char *data, size_t size, char a, char b)
+{
+    const __m256i first = _mm256_set1_epi8(a);
+    const __m256i second = _mm256_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 33 <= size; i += 32)
+    {
+        const __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        const __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + 1));
+        const __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(v0, first), _mm256_cmpeq_epi8(v1, second));
+        const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + sse2FindPair(data + i, size - i, a, b);
+}
+
+__attribute__((target("avx2"))) static size_t avx2FindQuad(const char *data, size_t size, const char *quad)
+{
+    const __m256i q0 = _mm256_set1_epi8(quad[0]);
+    const __m256i q1 = _mm256_set1_epi8(quad[1]);
+    const __m256i q2 = _mm256_set1_epi8(quad[2]);
+    const __m256i q3 = _mm256_set1_epi8(quad[3]);
+    size_t i = 0;
+    for (; i + 35 <= size; i += 32)
+    {
+        const char *p = data + i;
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)), q0);
+        eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1)), q1));
+        eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 2)), q2));
+        eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 3)), q3));
+        const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + sse2FindQuad(data + i, size - i, quad);
+}
+
+/**
+ * @details
+ * Classic nibble lookup: each byte is split into its low and high nibbles,
+ * both are looked up with a byte shuffle, and the byte is a member when the results intersect.
+ * `hi_nibble` is 0 for 8..15, so non-ASCII bytes never match.
+ */
+__attribute__((target("avx2"))) static size_t avx2FindFirstOf(const char *data, size_t size, const CharClass &cls)
+{
+    if (!cls.simd_ok)
+        return scalarFindFirstOf(data, size, cls);
+
+    const __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(cls.lo_nibble.data())));
+    const __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(cls.hi_nibble.data())));
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        const __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, low_mask));
+        const __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask));
+        const __m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero);
+        const uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(miss));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + sse2FindFirstOf(data + i, size - i, cls);
+}
+
+#endif
+
+static const t_scan_kernels SCALAR_KERNELS = {scalarFindByte, scalarFindPair, scalarFindQuad, scalarFindFirstOf};
+#ifdef SCAN_X86
+static const t_scan_kernels SSE2_KERNELS = {scalarFindByte, sse2FindPair, sse2FindQuad, sse2FindFirstOf};
+static const t_scan_kernels AVX2_KERNELS = {scalarFindByte, avx2FindPair, avx2FindQuad, avx2FindFirstOf};
+#endif
+
+t_scan_level scanBestLevel()
+{
+#ifdef SCAN_X86
+    static const t_scan_level level = []()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return SCAN_AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return SCAN_SSE2;
+        return SCAN_SCALAR;
+    }();
+    return level;
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+const t_scan_kernels &scanKernels(t_scan_level level)
+{
+#ifdef SCAN_X86
+    if (level > scanBestLevel())
+        level = scanBestLevel();
+    switch (level)
+    {
+    case SCAN_AVX2:
+        return AVX2_KERNELS;
+    case SCAN_SSE2:
+        return SSE2_KERNELS;
+    default:
+        return SCALAR_KERNELS;
+    }
+#else
+    (void)level;
+    return SCALAR_KERNELS;
+#endif
+}
+
+/**
+ * @brief The kernels used by the hot path, resolved once.
+ */
+static const t_scan_kernels &activeKernels()
+{
+    static const t_scan_kernels &kernels = scanKernels(scanBestLevel());
+    return kernels;
+}
+
+static size_t toNpos(size_t found, size_t size)
+{
+    return found >= size ? std::string_view::npos : found;
+}
+
+size_t scanFindByte(std::string_view data, char c, size_t from)
+{
+    if (from >= data.size())
+        return std::string_view::npos;
+    return toNpos(from + activeKernels().find_byte(data.data() + from, data.size() - from, c), data.size());
+}
+
+size_t scanFindPair(std::string_view data, char a, char b, size_t from)
+{
+    if (from >= data.size())
+        return std::string_view::npos;
+    const size_t found = from + activeKernels().find_pair(data.data() + from, data.size() - from, a, b);
+    return found + 1 >= data.size() ? std::string_view::npos : found;
+}
+
+size_t scanFindCRLF(std::string_view data, size_t from)
+{
+    return scanFindPair(data, '\r', '\n', from);
+}
+
+size_t scanFindDoubleCRLF(std::string_view data, size_t from)
+{
+    if (from >= data.size())
+        return std::string_view::npos;
+    const size_t found = from + activeKernels().find_quad(data.data() + from, data.size() - from, "\r\n\r\n");
+    return found + 3 >= data.size() ? std::string_view::npos : found;
+}
+
+size_t scanFindFirstOf(std::string_view data, const CharClass &cls, size_t from)
+{
+    if (from >= data.size())
+        return std::string_view::npos;
+    return toNpos(from + activeKernels().find_first_of(data.data() + from, data.size() - from, cls), data.size());
+}
+
+static constexpr std::array<int8_t, 256> buildHexTable()
+{
+    std::array<int8_t, 256> table{};
+    for (auto &v : table)
+        v = -1;
+    for (int c = '0'; c <= '9'; ++c)
+        table[c] = static_cast<int8_t>(c - '0');
+    for (int c = 'a'; c <= 'f'; ++c)
+        table[c] = static_cast<int8_t>(c - 'a' + 10);
+    for (int c = 'A'; c <= 'F'; ++c)
+        table[c] = static_cast<int8_t>(c - 'A' + 10);
+    return table;
+}
+
+static constexpr std::array<int8_t, 256> HEX_TABLE = buildHexTable();
+
+int hexDigitValue(char c)
+{
+    return HEX_TABLE[static_cast<unsigned char>(c)];
+}
+
+/**
+ * @details
+ * The runs between two `%` are located by the byte search kernel and appended in one go,
+ * only the escapes themselves are decoded byte by byte, through the lookup table.
+ */
+bool scanPercentDecode(std::string_view in, std::string &out)
+{
+    out.clear();
+    out.reserve(in.size());
+
+    size_t pos = 0;
+    while (pos < in.size())
+    {
+        size_t pct = scanFindByte(in, '%', pos);
+        if (pct == std::string_view::npos)
+        {
+            out.append(in.substr(pos));
+            break;
+        }
+        out.append(in.substr(pos, pct - pos));
+        if (pct + 2 >= in.size())
+            return false;
+        const int hi = hexDigitValue(in[pct + 1]);
+        const int lo = hexDigitValue(in[pct + 2]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out.push_back(static_cast<char>((hi << 4) | lo));
+        pos = pct + 3;
+    }
+    return true;
+}
@@ -1,5 +1,9 @@
 #include "../includes/Server.hpp"
 #include "../includes/WebServ.hpp"
+#include "../includes/ResponseHead.hpp"
+#include <charconv>
+#include <fcntl.h>
+#include <arpa/inet.h>
 
 void resetConn(t_conn *conn, int socket_fd, size_t max_request_size)
 {
@@ -9,19 +13,37 @@ void resetConn(t_conn *conn, int socket_fd, size_t max_request_size)
     conn->config_idx = -1;
     conn->is_cgi = false;
     conn->cgi_header_ready = false;
+    conn->res_framing = FRAMING_LENGTH;
+    conn->cgi_splice = false;
+    conn->body_pipe_in = nullptr;
+    conn->body_pipe_out = nullptr;
+    conn->upload = nullptr;
+    conn->fs_request = nullptr;
+    conn->must_close = false;
+    conn->body_to_discard = 0;
     conn->status = REQ_HEADER_PARSING;
     conn->start_timestamp = time(NULL);
     conn->last_heartbeat = conn->start_timestamp;
     conn->content_length = max_request_size;
-    conn->bytes_received = 0;
     conn->output_length = max_request_size;
     conn->bytes_sent = 0;
-    conn->res = t_file{nullptr, nullptr, 0, 0, false, "", "", -1};
-    conn->read_buf = std::make_unique<Buffer>();
+    conn->res = t_file{nullptr, nullptr, 0, 0, false, "", "", -1, nullptr, nullptr, nullptr, nullptr};
     conn->write_buf = std::make_unique<Buffer>();
     conn->request = std::make_shared<HttpRequests>();
     conn->response = std::make_shared<HttpResponse>();
     conn->error_code = ERR_NO_ERROR;
+    conn->error_message.clear();
+    conn->h2 = nullptr;
+
+    // The read buffer and the queued responses survive a keep-alive reset,
+    // they hold the pipelined requests and the responses not sent yet.
+    if (!conn->read_buf)
+        conn->read_buf = std::make_unique<Buffer>();
+    else
+        conn->read_buf->startNextMessage();
+    if (!conn->queued_out)
+        conn->queued_out = std::make_unique<Buffer>();
+    conn->bytes_received = conn->read_buf->size();
 }
 
 /**
@@ -39,10 +61,69 @@ t_msg_from_serv defaultMsg()
     return {std::vector<std::shared_ptr<RaiiFd>>{}, std::vector<int>{}};
 }
 
-Server::Server(WebServ &webserv, EpollHelper &epoll, const std::vector<t_server_config> &configs) : webserv_(webserv), epoll_(epoll), configs_(configs), cookies_(), conns_(), conn_map_(), inner_fd_map_()
+/**
+ * @brief Appends the fds of `from` to `into`, when a handler chains another one.
+ */
+void mergeMsg(t_msg_from_serv &into, const t_msg_from_serv &from)
+{
+    into.fds_to_register.insert(into.fds_to_register.end(), from.fds_to_register.begin(), from.fds_to_register.end());
+    into.fds_to_unregister.insert(into.fds_to_unregister.end(), from.fds_to_unregister.begin(), from.fds_to_unregister.end());
+}
+
+/**
+ * @brief HTTP/1.1 connections persist unless closed, HTTP/1.0 ones only when asked.
+ */
+static bool isKeepAlive(const t_conn *conn)
+{
+    if (conn->must_close)
+        return false;
+    const std::string *connection = conn->request->getrequestHeaderMap().find(HDR_CONNECTION);
+    if (conn->request->getrequestLineMap()["HttpVersion"] == "HTTP/1.0")
+        return connection && hasToken(*connection, "keep-alive");
+    return !connection || !hasToken(*connection, "close");
+}
+
+/**
+ * @brief Opens the root of a location for `openat2`, -1 if it cannot be: its paths are resolved from `/` then.
+ * @details
+ * E.g. a root created after the start, a redirect target, or a kernel before 5.6.
+ */
+static int openRoot(EpollHelper &epoll, const std::string &root, std::vector<std::shared_ptr<RaiiFd>> &root_fds)
+{
+    const int fd = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    struct open_how how = {};
+    how.flags = O_PATH | O_CLOEXEC;
+    how.resolve = RESOLVE_BENEATH;
+    const int probe = static_cast<int>(syscall(SYS_openat2, fd, ".", &how, sizeof(how)));
+    if (probe == -1)
+    {
+        LOG_WARN("Root resolved from /, no openat2: ", root, " ", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    close(probe);
+    root_fds.push_back(std::make_shared<RaiiFd>(epoll, fd));
+    return fd;
+}
+
+Server::Server(WebServ &webserv, EpollHelper &epoll, const std::vector<t_server_config> &configs) : webserv_(webserv), epoll_(epoll), configs_(configs), cookies_(), error_pages_(), conns_(), conn_map_(), inner_fd_map_(), max_headers_size_(0), root_fds_(), fcgi_(epoll), proxy_(epoll), cgi_workers_(epoll, configs_), children_(epoll), cgi_cache_(epoll, children_), upload_quota_(), io_pool_(epoll, IO_POOL_THREADS)
 {
     for (size_t i = 0; i < configs_.size(); ++i)
-        cookies_.emplace_back();
+    {
+        cookies_.emplace_back(configs_[i].max_sessions, configs_[i].session_file);
+        error_pages_.emplace_back(configs_[i].err_pages);
+        max_headers_size_ = std::max<size_t>(max_headers_size_, configs_[i].max_headers_size);
+        for (auto &[path, location] : configs_[i].locations)
+        {
+            // The upload roots are scanned by the I/O pool on the first tick, not by the first request.
+            if (!location.root.empty() && std::find(location.methods.begin(), location.methods.end(), POST) != location.methods.end())
+                upload_quota_.track(location.root);
+            if (!configs_[i].is_cgi && location.proxy.upstreams.empty())
+                location.root_fd = openRoot(epoll_, location.root, root_fds_);
+        }
+    }
 }
 
 const std::vector<t_server_config> &Server::getConfigs() const { return configs_; }
@@ -98,16 +179,239 @@ t_msg_from_serv Server::closeConn(t_conn *conn)
 {
     t_msg_from_serv msg = resetConnMap(conn);
 
+    if (conn->h2)
+    {
+        for (int fd : conn->h2->gatewayFds())
+        {
+            conn_map_.erase(fd);
+            msg.fds_to_unregister.push_back(fd);
+        }
+    }
+
     if (conn->socket_fd != -1)
     {
         conn_map_.erase(conn->socket_fd);
         msg.fds_to_unregister.push_back(conn->socket_fd);
     }
 
+    discardUpload(conn->upload);
+    conn->upload = nullptr;
     conn->status = TERMINATED;
     return msg;
 }
 
+/**
+ * @brief Whether the client waits for `100 Continue` before sending the body, HTTP/1.0 clients never do.
+ * An empty body is not waited for.
+ */
+static bool expectsContinue(const t_conn *conn)
+{
+    const auto &headers = conn->request->getrequestHeaderMap();
+    const std::string *expect = headers.find(HDR_EXPECT);
+    const std::string *content_length = headers.find(HDR_CONTENT_LENGTH);
+    const bool has_body = conn->request->isChunked()
+                          || (content_length && content_length->find_first_not_of('0') != std::string::npos);
+    return expect && *expect == "100-continue" && has_body
+           && conn->request->getrequestLineMap()["HttpVersion"] != "HTTP/1.0";
+}
+
+/**
+ * @brief The `X-Forwarded-For` field of a proxied request: the one of the client, with the client address appended.
+ * Streams of HTTP/2 connections come from a socket pair, they add no address.
+ */
+static std::string forwardedForField(const t_conn *conn)
+{
+    const std::string *forwarded = conn->request->getrequestHeaderMap().find("x-forwarded-for");
+    std::string chain = forwarded ? *forwarded : "";
+
+    sockaddr_storage addr{};
+    socklen_t size = sizeof(addr);
+    char host[INET6_ADDRSTRLEN] = {};
+    if (getpeername(conn->socket_fd, reinterpret_cast<sockaddr *>(&addr), &size) == 0
+        && (addr.ss_family == AF_INET || addr.ss_family == AF_INET6))
+    {
+        const void *ip = addr.ss_family == AF_INET ? static_cast<const void *>(&reinterpret_cast<sockaddr_in *>(&addr)->sin_addr)
+                                                   : static_cast<const void *>(&reinterpret_cast<sockaddr_in6 *>(&addr)->sin6_addr);
+        if (inet_ntop(addr.ss_family, ip, host, sizeof(host)))
+            chain.append(chain.empty() ? "" : ", ").append(host);
+    }
+    return chain.empty() ? "" : "X-Forwarded-For: " + chain + "\r\n";
+}
+
+/**
+ * @details
+ * Only routine errors keep the connection: redirects, and rejected targets, methods or permissions.
+ * Their request is well framed, so its body is dropped: the buffered part now,
+ * the rest when it arrives, up to `MAX_DISCARD_SIZE`.
+ * A chunked body, or a body already being processed, closes the connection.
+ */
+bool Server::discardRequestBody(t_conn *conn, t_status prev_status)
+{
+    switch (conn->error_code)
+    {
+    case ERR_301_REDIRECT:
+    case ERR_401_UNAUTHORIZED:
+    case ERR_403_FORBIDDEN:
+    case ERR_404_NOT_FOUND:
+    case ERR_405_METHOD_NOT_ALLOWED:
+    case ERR_409_CONFLICT:
+        break;
+    default:
+        return false;
+    }
+    if (prev_status == REQ_BODY_PROCESSING || conn->request->isChunked())
+        return false;
+
+    size_t length = 0;
+    const std::string *content_length = conn->request->getrequestHeaderMap().find(HDR_CONTENT_LENGTH);
+    if (content_length)
+    {
+        const auto result = std::from_chars(content_length->data(), content_length->data() + content_length->size(), length);
+        if (result.ec != std::errc() || result.ptr != content_length->data() + content_length->size())
+            return false;
+    }
+
+    if (prev_status == REQ_HEADER_PARSING) // The head is still in the buffer, e.g. a redirect
+        conn->read_buf->discard(conn->request->getupToBodyCounter());
+    const size_t unread = length - conn->read_buf->discard(length);
+    if (unread > MAX_DISCARD_SIZE || (unread > 0 && expectsContinue(conn))) // The client may never send it
+        return false;
+    conn->body_to_discard = unread;
+    return true;
+}
+
+bool Server::flushQueuedOut(t_conn *conn)
+{
+    if (conn->queued_out->isEmpty())
+        return true;
+
+    conn->last_heartbeat = time(NULL);
+    const ssize_t bytes_written = conn->queued_out->writeSocket(conn->socket_fd);
+    return bytes_written != RW_ERROR && bytes_written != EOF_REACHED;
+}
+
+/**
+ * @brief Whether the request asks for HTTP/2 with `Upgrade: h2c`.
+ * @details
+ * Only a request without a body is upgraded, otherwise the body would have to be
+ * read in HTTP/1.1 before the switch; such a request is just served in HTTP/1.1.
+ */
+static bool wantsH2cUpgrade(const t_conn *conn)
+{
+    const auto &headers = conn->request->getrequestHeaderMap();
+    const std::string *upgrade = headers.find(HDR_UPGRADE);
+    if (!upgrade || !headers.find(HDR_HTTP2_SETTINGS) || conn->request->getrequestLineMap()["HttpVersion"] != "HTTP/1.1")
+        return false;
+
+    const std::string *content_length = headers.find(HDR_CONTENT_LENGTH);
+    return hasToken(*upgrade, "h2c") && !conn->request->isChunked() && (!content_length || *content_length == "0");
+}
+
+/**
+ * @brief Copies the head of an upgrading request for its gateway, without the upgrade fields.
+ * @details
+ * The raw head is used, since the parser lowercases the values, and `HTTP2-Settings` is base64url.
+ * @param settings Set to the raw `HTTP2-Settings` value.
+ */
+static std::string upgradeRequestHead(std::string_view head, std::string &settings)
+{
+    std::string request;
+
+    for (bool is_request_line = true; !head.empty(); is_request_line = false)
+    {
+        const size_t line_end = head.find("\r\n");
+        const std::string_view line = head.substr(0, line_end);
+        head.remove_prefix(line_end == std::string_view::npos ? head.size() : line_end + 2);
+        if (line.empty())
+            break;
+
+        const std::string name = toLower(std::string(line.substr(0, line.find(':'))));
+        if (!is_request_line && name == "http2-settings")
+        {
+            settings.assign(line.substr(name.size() + 1));
+            while (!settings.empty() && settings.front() == ' ')
+                settings.erase(0, 1);
+            while (!settings.empty() && settings.back() == ' ')
+                settings.pop_back();
+        }
+        if (!is_request_line && (name == "connection" || name == "upgrade" || name == "http2-settings" || name == "keep-alive"))
+            continue;
+        request.append(line).append("\r\n");
+    }
+    return request.append(FIELD_CONNECTION_CLOSE).append("\r\n");
+}
+
+t_msg_from_serv Server::startHttp2(t_conn *conn, std::shared_ptr<Http2Session> session, std::string_view input)
+{
+    LOG_INFO("HTTP/2 session started: ", conn->socket_fd);
+    conn->status = H2_SESSION;
+    conn->h2 = session;
+
+    // The input views the read buffer, which is not used anymore.
+    session->feed(input);
+    conn->read_buf = std::make_unique<Buffer>();
+    conn->request = std::make_shared<HttpRequests>();
+    return syncHttp2(conn);
+}
+
+/**
+ * @details
+ * A gateway is a socket pair: one end is added as a regular connection of this server,
+ * the other end is mapped to the HTTP/2 connection, and carries the stream.
+ */
+t_msg_from_serv Server::syncHttp2(t_conn *conn)
+{
+    t_msg_from_serv msg = defaultMsg();
+    Http2Session &session = *conn->h2;
+
+    for (uint32_t stream_id : session.takeOpenedStreams())
+    {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) == -1)
+        {
+            LOG_ERROR("socketpair failed for HTTP/2 stream: ", stream_id);
+            session.refuseStream(stream_id);
+            continue;
+        }
+
+        msg.fds_to_register.push_back(std::make_shared<RaiiFd>(epoll_, pair[0]));
+        msg.fds_to_register.push_back(std::make_shared<RaiiFd>(epoll_, pair[1]));
+        addConn(pair[0]);
+        conn_map_[pair[1]] = conn;
+        session.attachGateway(stream_id, pair[1]);
+        conn->start_timestamp = time(NULL);
+    }
+
+    for (int fd : session.takeClosedGateways())
+    {
+        conn_map_.erase(fd);
+        msg.fds_to_unregister.push_back(fd);
+    }
+
+    if (session.isDone())
+        mergeMsg(msg, terminatedHandler(conn->socket_fd, conn));
+    return msg;
+}
+
+void Server::closeCgiInput(t_conn *conn, t_msg_from_serv &msg)
+{
+    if (!conn->is_cgi || conn->inner_fd_in == -1)
+        return;
+    conn_map_.erase(conn->inner_fd_in);
+    msg.fds_to_unregister.push_back(conn->inner_fd_in);
+    conn->inner_fd_in = -1;
+}
+
+const t_cgi_cache_config *Server::cgiCacheConfig(t_conn *conn)
+{
+    std::string target = conn->request->getrequestLineMap().at("Target");
+    std::string prog_name = getProgName(target);
+    const auto it = configs_[conn->config_idx].cgi_paths.find(getExtName(prog_name));
+    if (it == configs_[conn->config_idx].cgi_paths.end() || it->second.cache.ttl == 0)
+        return nullptr;
+    return &it->second.cache;
+}
+
 t_msg_from_serv Server::timeoutKiller()
 {
     auto now = time(NULL);
@@ -121,13 +425,9 @@ t_msg_from_serv Server::timeoutKiller()
         bool timeout = difftime(now, it->last_heartbeat) > max_heartbeat_timeout || difftime(now, it->start_timestamp) > max_request_timeout;
         if (timeout)
         {
-            // Kill CGI process if exists
+            // Stop the CGI process if exists, its exit event reaps it
             if (it->res.pid > 0)
-            {
-                kill(it->res.pid, SIGKILL);
-                waitpid(it->res.pid, NULL, 0); // Prevent zombie process
-                it->res.pid = -1;
-            }
+                children_.stop(it->res.pid, now);
 
             t_msg_from_serv temp = closeConn(&(*it));
             msg.fds_to_unregister.insert(
@@ -138,20 +438,14 @@ t_msg_from_serv Server::timeoutKiller()
             it = conns_.erase(it);
         }
         else
-        {
-            if (it->res.pid > 0)
-            {
-                int status;
-                pid_t result = waitpid(it->res.pid, &status, WNOHANG);
-                if (result != 0)
-                    it->res.pid = -1; // Process ended
-            }
             ++it;
-        }
-
-
     }
 
+    children_.tick(now);
+    cgi_cache_.tick(now);
+    mergeMsg(msg, cgi_workers_.tick(now));
+    mergeMsg(msg, proxy_.tick(now));
+    mergeMsg(msg, upload_quota_.tick(now, io_pool_));
     return msg;
 }
 
@@ -176,51 +470,79 @@ t_msg_from_serv Server::timeoutKiller()
  *    - On invalid or malformed headers, sets error code 400.
  *    - On unexpected exceptions, sets error code 500.
  */
-t_msg_from_serv Server::reqHeaderParsingHandler(int fd, t_conn *conn)
+t_msg_from_serv Server::reqHeaderParsingHandler(int fd, t_conn *conn, bool is_initial)
 {
     if (fd != conn->socket_fd)
     {
         return defaultMsg();
     }
 
-    const ssize_t bytes_read = conn->read_buf->readFd(fd);
-
-    if (bytes_read == RW_ERROR)
+    // Initially the buffer already holds pipelined bytes, parse them before reading.
+    if (!is_initial)
     {
-        conn->error_code = ERR_500_INTERNAL_SERVER_ERROR;
-        return resheaderProcessingHandler(conn);
-    }
+        const ssize_t bytes_read = conn->read_buf->readFd(fd);
 
-    // Buffer full, wait for the next read event
-    if (bytes_read == BUFFER_FULL)
-        return defaultMsg(); // Wait for the next read event.
+        if (bytes_read == RW_ERROR)
+        {
+            conn->error_code = ERR_500_INTERNAL_SERVER_ERROR;
+            return resheaderProcessingHandler(conn);
+        }
 
-    // EOF reached, should not be here since header has not been parsed yet.
-    if (bytes_read == EOF_REACHED)
-    {
-        if (conn->bytes_received == 0)
+        // Buffer full, wait for the next read event
+        if (bytes_read == BUFFER_FULL)
+            return defaultMsg(); // Wait for the next read event.
+
+        // EOF reached, should not be here since header has not been parsed yet.
+        if (bytes_read == EOF_REACHED)
         {
-            return terminatedHandler(fd, conn);
+            if (conn->bytes_received == 0)
+            {
+                return terminatedHandler(fd, conn);
+            }
+            conn->error_code = ERR_400_BAD_REQUEST;
+            return resheaderProcessingHandler(conn);
         }
-        conn->error_code = ERR_400_BAD_REQUEST;
-        return resheaderProcessingHandler(conn);
+
+        conn->bytes_received += bytes_read;
     }
 
-    conn->bytes_received += bytes_read;
+    // The rest of the body of a rejected request comes first.
+    if (conn->body_to_discard > 0)
+    {
+        conn->body_to_discard -= conn->read_buf->discard(conn->body_to_discard);
+        conn->bytes_received = conn->read_buf->size();
+        if (conn->read_buf->isEmpty())
+            return defaultMsg();
+    }
+
+    // The server is unknown till the host header is parsed, so the largest limit applies.
+    const size_t max_header_size = conn->config_idx == -1 ? max_headers_size_ : configs_[conn->config_idx].max_headers_size;
 
     try
     {
-        std::string_view buf = conn->read_buf->peek();
+        std::string_view buf = conn->read_buf->peekHead(max_header_size);
+
+        // HTTP/2 with prior knowledge, the client starts with the connection preface.
+        const size_t preface_size = std::min(buf.size(), H2_PREFACE.size());
+        if (conn->queued_out->isEmpty() && buf.substr(0, preface_size) == H2_PREFACE.substr(0, preface_size))
+        {
+            if (preface_size < H2_PREFACE.size())
+                return defaultMsg();
+            auto session = std::make_shared<Http2Session>(max_header_size);
+            session->start();
+            return startHttp2(conn, session, buf);
+        }
+
         conn->request->httpParser(buf);
 
         if (conn->config_idx == -1)
         {
-            if (conn->request->getrequestHeaderMap().contains("servername"))
+            const std::string *host = conn->request->getrequestHeaderMap().find(HDR_SERVERNAME);
+            if (host)
             {
-                std::string host = conn->request->getrequestHeaderMap().at("servername");
                 for (size_t i = 0; i < configs_.size(); ++i)
                 {
-                    if (configs_[i].server_name == toLower(host))
+                    if (configs_[i].server_name == toLower(*host))
                     {
                         conn->config_idx = i;
                         break;
@@ -232,6 +554,23 @@ t_msg_from_serv Server::reqHeaderParsingHandler(int fd, t_conn *conn)
                 conn->config_idx = 0;
         }
 
+        if (conn->request->getupToBodyCounter() > configs_[conn->config_idx].max_headers_size)
+        {
+            conn->error_code = ERR_400_BAD_REQUEST;
+            conn->error_message = "Request header is too large";
+            return resheaderProcessingHandler(conn);
+        }
+
+        if (conn->queued_out->isEmpty() && wantsH2cUpgrade(conn))
+        {
+            const size_t head_size = conn->request->getupToBodyCounter();
+            std::string settings;
+            std::string request = upgradeRequestHead(buf.substr(0, head_size), settings);
+            auto session = std::make_shared<Http2Session>(configs_[conn->config_idx].max_headers_size);
+            if (session->upgrade(settings, std::move(request)))
+                return startHttp2(conn, session, buf.substr(head_size));
+        }
+
         try
         {
             auto lineMap = conn->request->getrequestLineMap();
@@ -248,12 +587,13 @@ t_msg_from_serv Server::reqHeaderParsingHandler(int fd, t_conn *conn)
         conn->output_length = configs_[conn->config_idx].max_request_size;
 
         t_method method = convertMethod(conn->request->getrequestLineMap().at("Method"));
-        if (conn->request->getrequestHeaderMap().contains("content-length"))
+        const std::string *content_length = conn->request->getrequestHeaderMap().find(HDR_CONTENT_LENGTH);
+        if (content_length)
         {
-            conn->content_length = static_cast<size_t>(stoull(conn->request->getrequestHeaderMap().at("content-length")));
+            conn->content_length = static_cast<size_t>(stoull(*content_length));
             if (conn->content_length > configs_[conn->config_idx].max_request_size)
             {
-                conn->error_code = ERR_400_BAD_REQUEST;
+                conn->error_code = ERR_413_CONTENT_TOO_LARGE;
                 conn->error_message = "Content length is too big";
                 return resheaderProcessingHandler(conn);
             }
@@ -271,14 +611,18 @@ t_msg_from_serv Server::reqHeaderParsingHandler(int fd, t_conn *conn)
         }
 
         bool ok = conn->read_buf->removeHeaderAndSetChunked(conn->request->getupToBodyCounter(), conn->request->isChunked());
-        if (!ok)
+        if (!ok) // Malformed chunked body
         {
-            conn->error_code = ERR_500_INTERNAL_SERVER_ERROR;
+            conn->error_code = ERR_400_BAD_REQUEST;
             return resheaderProcessingHandler(conn);
         }
 
-        // Remove the header size from bytes_received
-        conn->bytes_received -= conn->request->getupToBodyCounter(); // Adjust bytes_received after removing header
+        // Bytes beyond the body belong to the next pipelined request.
+        if (!conn->request->isChunked() && method == POST)
+            conn->read_buf->trimTo(conn->content_length);
+
+        // Only the body is left in the buffer, decoded in chunked mode.
+        conn->bytes_received = conn->read_buf->size();
         return reqHeaderProcessingHandler(fd, conn);
     }
     catch (const WebServErr::InvalidRequestHeader &e) // Incomplete header
@@ -291,7 +635,6 @@ t_msg_from_serv Server::reqHeaderParsingHandler(int fd, t_conn *conn)
         }
 
         // Check if max header size is exceeded
-        const size_t max_header_size = conn->config_idx == -1 ? MAX_HEADERS_SIZE : configs_[conn->config_idx].max_headers_size;
         const bool is_max_length_reached = (conn->bytes_received >= max_header_size);
         if (is_max_length_reached)
         {
@@ -345,61 +688,185 @@ t_msg_from_serv Server::reqHeaderProcessingHandler(int fd, t_conn *conn)
     conn->status = REQ_HEADER_PROCESSING;
     try
     {
-        conn->res = MethodHandler(epoll_).handleRequest(configs_[conn->config_idx], conn->request->getrequestLineMap(), conn->request->getrequestHeaderMap(), epoll_);
         t_method method = convertMethod(conn->request->getrequestLineMap().at("Method"));
         conn->is_cgi = configs_[conn->config_idx].is_cgi;
-        if (conn->is_cgi)
+        if (!conn->is_cgi)
+            return waitFileSystem(conn); // The target is looked up in the file system, which may block
+        t_msg_from_serv cache_msg = defaultMsg();
+        const t_cgi_cache_config *cache = conn->is_cgi && method == GET ? cgiCacheConfig(conn) : nullptr;
+        const std::string cache_key = cache ? CgiCache::key(conn->config_idx, "GET", conn->request->getrequestLineMap().at("Target")) : "";
+        if (!cache || !cgi_cache_.join(cache_key, conn->res, cache_msg))
         {
-            conn->inner_fd_in = conn->res.FD_handler_IN.get()->get();
-            webserv_.addFdToEpoll(std::move(conn->res.FD_handler_IN), this);
-            conn_map_.emplace(conn->inner_fd_in, conn);
-            conn->inner_fd_out = conn->res.FD_handler_OUT.get()->get();
-            webserv_.addFdToEpoll(std::move(conn->res.FD_handler_OUT), this);
-            conn_map_.emplace(conn->inner_fd_out, conn);
-            switch (method)
-            {
-                case GET:
-                case DELETE:
-                    conn->status = RES_HEADER_PROCESSING;
-                    return resheaderProcessingHandler(conn);
-                case POST:
-                    conn->status = REQ_BODY_PROCESSING;
-                    return reqBodyProcessingInHandler(conn->socket_fd, conn, true);
-                default:
-                    throw WebServErr::ShouldNotBeHereException("Unhandled method after parsing header");
-            }
+            conn->res = MethodHandler(epoll_, upload_quota_).handleRequest(configs_[conn->config_idx], conn->request->getrequestLineMap(), conn->request->getrequestHeaderMap(), epoll_);
+            if (cache)
+                cache_msg = cgi_cache_.startFlight(cache_key, *cache, conn->res, configs_[conn->config_idx].max_request_timeout);
         }
+        return reqHandledHandler(fd, conn, std::move(cache_msg), cache != nullptr);
+    }
+    catch (const WebServErr::MethodException &e)
+    {
+        // The server stays the one of the Host, the connection may be kept after the error.
+        // The error is answered by the server, not by a CGI.
+        conn->is_cgi = false;
+        conn->error_code = e.code();
+        conn->error_message = e.what();
+        return resheaderProcessingHandler(conn);
+    }
+}
 
-        switch (method)
-        {
-        case GET:
-            if (conn->res.isDynamic)
-                return resheaderProcessingHandler(conn);
-            inner_fd_map_.emplace(conn->res.FD_handler_OUT.get()->get(), conn->res.FD_handler_OUT);
-            conn->inner_fd_out = conn->res.FD_handler_OUT.get()->get();
-            return resheaderProcessingHandler(conn);
-        case DELETE:
-            return resheaderProcessingHandler(conn);
-        case POST:
+/**
+ * @details
+ * The method handler runs in the I/O pool with a copy of the request line, the request itself is not touched
+ * by the event loop meanwhile. The config is shared by reference: `configs_` is never changed after the start.
+ * The socket leaves the epoll till it returns, as for the upload writes.
+ */
+t_msg_from_serv Server::waitFileSystem(t_conn *conn)
+{
+    auto request = std::make_shared<t_fs_request>();
+    request->error_code = ERR_NO_ERROR;
+    conn->fs_request = request;
+    conn->status = REQ_WAITING_FS;
+    epoll_.removeFd(conn->socket_fd);
+
+    const int socket_fd = conn->socket_fd;
+    const t_server_config &config = configs_[conn->config_idx];
+    std::unordered_map<std::string, std::string> requestLine = conn->request->getrequestLineMap();
+    std::shared_ptr<HttpRequests> http_request = conn->request;
+    return io_pool_.submit(t_io_task{
+        [this, request, &config, requestLine, http_request]()
         {
-            inner_fd_map_.emplace(conn->res.FD_handler_OUT.get()->get(), conn->res.FD_handler_OUT);
-            conn->inner_fd_in = conn->res.FD_handler_OUT.get()->get();
-            conn->status = REQ_BODY_PROCESSING;
-            return reqBodyProcessingInHandler(fd, conn, true);
-        }
-        default:
-            throw WebServErr::ShouldNotBeHereException("Unhandled method after parsing header");
-        }
+            try
+            {
+                request->res = MethodHandler(epoll_, upload_quota_).handleRequest(config, requestLine, http_request->getrequestHeaderMap(), epoll_);
+            }
+            catch (const WebServErr::MethodException &e)
+            {
+                request->error_code = e.code();
+                request->error_message = e.what();
+            }
+            catch (const std::exception &e) // e.g. a file-system error, it would end the worker
+            {
+                request->error_code = ERR_500_INTERNAL_SERVER_ERROR;
+                request->error_message = e.what();
+            }
+        },
+        [this, socket_fd, request](t_msg_from_serv &msg)
+        { mergeMsg(msg, fileSystemHandler(socket_fd, request)); }});
+}
+
+/**
+ * @details
+ * The connection may be closed, or serving another request, when the handler returns: its result is dropped then.
+ */
+t_msg_from_serv Server::fileSystemHandler(int socket_fd, const std::shared_ptr<t_fs_request> &request)
+{
+    const auto it = conn_map_.find(socket_fd);
+    if (it == conn_map_.end() || it->second->fs_request != request)
+    {
+        discardUpload(request->res.upload);
+        return defaultMsg();
+    }
+
+    t_conn *conn = it->second;
+    conn->fs_request = nullptr;
+    conn->status = REQ_HEADER_PROCESSING;
+    epoll_.addFd(socket_fd);
+    if (request->error_code != ERR_NO_ERROR)
+    {
+        conn->error_code = request->error_code;
+        conn->error_message = request->error_message;
+        return resheaderProcessingHandler(conn);
+    }
+    try
+    {
+        conn->res = std::move(request->res);
+        return reqHandledHandler(socket_fd, conn, defaultMsg(), false);
     }
     catch (const WebServErr::MethodException &e)
     {
-        conn->config_idx = 0;
         conn->error_code = e.code();
         conn->error_message = e.what();
         return resheaderProcessingHandler(conn);
     }
 }
 
+t_msg_from_serv Server::reqHandledHandler(int fd, t_conn *conn, t_msg_from_serv cache_msg, bool is_shared)
+{
+    t_method method = convertMethod(conn->request->getrequestLineMap().at("Method"));
+
+    // A proxy location is served as a CGI, its upstream answers through the pipes.
+    if (conn->res.proxy)
+    {
+        conn->is_cgi = true;
+        conn->res.proxy->head.append(forwardedForField(conn));
+    }
+
+    // The head is accepted (size, location and method), the waiting client may send the body now.
+    // The interim response is queued, so it goes out before the final one.
+    if (method == POST && expectsContinue(conn) && conn->read_buf->isEmpty())
+        conn->queued_out->insertHeader(std::string(ResponseHead::statusLine(100)) + "\r\n");
+    if (conn->is_cgi)
+    {
+        conn->inner_fd_in = conn->res.FD_handler_IN.get()->get();
+        webserv_.addFdToEpoll(std::move(conn->res.FD_handler_IN), this);
+        conn_map_.emplace(conn->inner_fd_in, conn);
+        conn->inner_fd_out = conn->res.FD_handler_OUT.get()->get();
+        webserv_.addFdToEpoll(std::move(conn->res.FD_handler_OUT), this);
+        conn_map_.emplace(conn->inner_fd_out, conn);
+        t_msg_from_serv msg = conn->res.fcgi ? fcgi_.submit(std::move(conn->res.fcgi)) : defaultMsg();
+        mergeMsg(msg, cache_msg);
+        if (conn->res.job)
+            mergeMsg(msg, cgi_workers_.submit(std::move(conn->res.job)));
+        if (conn->res.proxy)
+            mergeMsg(msg, proxy_.submit(std::move(conn->res.proxy)));
+        if (conn->res.pid > 0)
+            mergeMsg(msg, children_.watch(conn->res.pid));
+        // A shared CGI is stopped by the cache, not by the connection which started it.
+        if (is_shared)
+            conn->res.pid = -1;
+        switch (method)
+        {
+            case GET:
+            case DELETE:
+                closeCgiInput(conn, msg);
+                conn->status = RES_HEADER_PROCESSING;
+                mergeMsg(msg, resheaderProcessingHandler(conn));
+                return msg;
+            case POST:
+                conn->status = REQ_BODY_PROCESSING;
+                mergeMsg(msg, reqBodyProcessingInHandler(conn->socket_fd, conn, true));
+                return msg;
+            default:
+                throw WebServErr::ShouldNotBeHereException("Unhandled method after parsing header");
+        }
+    }
+
+    switch (method)
+    {
+    case GET:
+        if (conn->res.isDynamic)
+            return resheaderProcessingHandler(conn);
+        inner_fd_map_.emplace(conn->res.FD_handler_OUT.get()->get(), conn->res.FD_handler_OUT);
+        conn->inner_fd_out = conn->res.FD_handler_OUT.get()->get();
+        return resheaderProcessingHandler(conn);
+    case DELETE:
+        return resheaderProcessingHandler(conn);
+    case POST:
+    {
+        inner_fd_map_.emplace(conn->res.FD_handler_OUT.get()->get(), conn->res.FD_handler_OUT);
+        conn->inner_fd_in = conn->res.FD_handler_OUT.get()->get();
+        // A body of known length gets its blocks at once, not extent by extent.
+        conn->upload = std::move(conn->res.upload);
+        conn->upload->reserve = conn->request->isChunked() ? 0 : conn->content_length;
+        conn->upload->sync_size = configs_[conn->config_idx].upload_sync_size;
+        conn->status = REQ_BODY_PROCESSING;
+        return reqBodyProcessingInHandler(fd, conn, true);
+    }
+    default:
+        throw WebServErr::ShouldNotBeHereException("Unhandled method after parsing header");
+    }
+}
+
 /**
  * @details
  * Reads data from the client socket into the request read buffer.
@@ -422,10 +889,18 @@ t_msg_from_serv Server::reqBodyProcessingInHandler(int fd, t_conn *conn, bool is
 
     if (!is_initial)
     {
+        // The body is complete, what is left on the socket is the next request.
+        if (conn->bytes_received == conn->content_length || (conn->request->isChunked() && conn->read_buf->isEOF()))
+            return defaultMsg();
+
+        // A body of known length bypasses the buffer, once the bytes read with the head are written.
+        if (!conn->request->isChunked() && conn->read_buf->isEmpty())
+            return spliceRequestBody(conn);
+
         // Update heartbeat
         conn->last_heartbeat = time(NULL);
 
-        const ssize_t bytes_read = conn->read_buf->readFd(fd);
+        const ssize_t bytes_read = conn->read_buf->readFd(fd, conn->content_length - conn->bytes_received);
 
         // Handle read errors and special conditions
         if (bytes_read == RW_ERROR)
@@ -434,6 +909,12 @@ t_msg_from_serv Server::reqBodyProcessingInHandler(int fd, t_conn *conn, bool is
             return resheaderProcessingHandler(conn);
         }
 
+        if (bytes_read == CHUNKED_ERR)
+        {
+            conn->error_code = ERR_400_BAD_REQUEST;
+            return resheaderProcessingHandler(conn);
+        }
+
         // Buffer full, wait for the next read event
         if (bytes_read == BUFFER_FULL)
             return defaultMsg(); // Wait for the next read event.
@@ -447,20 +928,79 @@ t_msg_from_serv Server::reqBodyProcessingInHandler(int fd, t_conn *conn, bool is
             return resheaderProcessingHandler(conn);
         }
 
-        conn->bytes_received += bytes_read;
+        // Only chunk framing was read, but the last chunk may have been reached.
+        if (bytes_read != CHUNKED_NO_BODY)
+            conn->bytes_received += bytes_read;
     }
 
-    if (!conn->is_cgi)
+    if (!conn->is_cgi && !conn->read_buf->isEmpty())
+        return writeUpload(conn, 0);
+
+    return reqBodyWrittenHandler(conn);
+}
+
+/**
+ * @details
+ * An `O_TMPFILE` vanishes with its last fd, a write still running in the I/O pool holds it till then.
+ */
+void Server::discardUpload(const std::shared_ptr<t_upload> &upload)
+{
+    if (!upload || upload->is_published)
+        return;
+    if (!upload->is_tmpfile)
+        (void)unlink(upload->path.c_str());
+    if (upload->usage)
+        upload_quota_.release(upload->usage);
+}
+
+/**
+ * @details
+ * An `O_TMPFILE` is linked through its `/proc` entry; a taken name is found by the link, and another one is tried.
+ * The bytes count in the quota of the root from now on.
+ */
+bool Server::publishUpload(t_conn *conn)
+{
+    t_upload &upload = *conn->upload;
+    if (upload.is_tmpfile)
     {
-        ssize_t written_bytes = conn->read_buf->writeFile(conn->inner_fd_in);
-        if (written_bytes == RW_ERROR)
+        const std::string proc = "/proc/self/fd/" + std::to_string(upload.file->get());
+        const std::filesystem::path dir = std::filesystem::path(upload.path).parent_path();
+        const std::string extension = std::filesystem::path(upload.path).extension().string();
+        int linked = -1;
+        for (unsigned int i = 0; i < UPLOAD_NAME_ATTEMPTS && linked == -1; ++i)
         {
-            conn->error_code = ERR_500_INTERNAL_SERVER_ERROR;
-            return resheaderProcessingHandler(conn);
+            if (i > 0)
+                upload.path = (dir / randomUploadName(extension)).string();
+            linked = linkat(AT_FDCWD, proc.c_str(), AT_FDCWD, upload.path.c_str(), AT_SYMLINK_FOLLOW);
+            if (linked == -1 && errno != EEXIST)
+                break;
+        }
+        if (linked == -1)
+        {
+            LOG_ERROR("Upload not linked: ", upload.path, " ", strerror(errno));
+            return false;
         }
-        conn->bytes_sent += written_bytes;
+        std::string &location = conn->res.postFilename; // Follows a new name
+        location.replace(location.rfind('/') + 1, std::string::npos, std::filesystem::path(upload.path).filename().string());
     }
+    upload.is_published = true;
+    if (upload.usage)
+        upload_quota_.addBytes(upload.usage, upload.written);
+    return true;
+}
+
+void Server::finishUpload(t_conn *conn)
+{
+    if (!conn->upload)
+        return;
+    if (!publishUpload(conn))
+        conn->error_code = ERR_500_INTERNAL_SERVER_ERROR;
+    discardUpload(conn->upload);
+    conn->upload = nullptr;
+}
 
+t_msg_from_serv Server::reqBodyWrittenHandler(t_conn *conn)
+{
     const bool is_content_length_reached = conn->bytes_received == conn->content_length;
     const bool is_chunked_eof_reached = conn->request->isChunked() && conn->read_buf->isEOF();
 
@@ -470,6 +1010,7 @@ t_msg_from_serv Server::reqBodyProcessingInHandler(int fd, t_conn *conn, bool is
             return defaultMsg(); // Wait for the main loop to notify when inner fd is ready.
         inner_fd_map_.erase(conn->inner_fd_in);
         conn->inner_fd_in = -1;
+        finishUpload(conn);
         return resheaderProcessingHandler(conn);
     }
 
@@ -478,7 +1019,11 @@ t_msg_from_serv Server::reqBodyProcessingInHandler(int fd, t_conn *conn, bool is
         conn->content_length = conn->bytes_received;
         if (conn->read_buf.get()->isEmpty())
         {
-            return resheaderProcessingHandler(conn);
+            t_msg_from_serv msg = defaultMsg();
+            closeCgiInput(conn, msg);
+            finishUpload(conn);
+            mergeMsg(msg, resheaderProcessingHandler(conn));
+            return msg;
         }
         return defaultMsg(); // Wait for the main loop to notify when inner fd is ready.
     }
@@ -493,6 +1038,141 @@ t_msg_from_serv Server::reqBodyProcessingInHandler(int fd, t_conn *conn, bool is
     return defaultMsg(); // Continue reading
 }
 
+/**
+ * @details
+ * A CGI gets the body straight into its input pipe.
+ * An upload goes through a pipe of the connection, as splice needs a pipe on one side, then into the file.
+ * The pipe is drained into the file by the I/O pool, before the next splice.
+ * The socket is read up to the declared length, the next pipelined request stays there.
+ */
+t_msg_from_serv Server::spliceRequestBody(t_conn *conn)
+{
+    if (!conn->is_cgi && !conn->body_pipe_in)
+    {
+        int pipe_fds[2];
+        if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1)
+        {
+            conn->error_code = ERR_500_INTERNAL_SERVER_ERROR;
+            return resheaderProcessingHandler(conn);
+        }
+        conn->body_pipe_out = std::make_shared<RaiiFd>(epoll_, pipe_fds[0]);
+        conn->body_pipe_in = std::make_shared<RaiiFd>(epoll_, pipe_fds[1]);
+        (void)fcntl(pipe_fds[1], F_SETPIPE_SZ, static_cast<int>(BODY_SPLICE_SIZE));
+    }
+
+    const int target = conn->is_cgi ? conn->inner_fd_in : conn->body_pipe_in->get();
+    const size_t left = conn->content_length - conn->bytes_received;
+    const ssize_t moved = Buffer::spliceFd(conn->socket_fd, target, std::min(left, BODY_SPLICE_SIZE));
+    if (moved == SPLICE_AGAIN)
+        return defaultMsg(); // The socket is drained, or the CGI is behind
+    if (moved <= 0)
+    {
+        conn->error_code = moved == EOF_REACHED ? ERR_400_BAD_REQUEST : ERR_500_INTERNAL_SERVER_ERROR;
+        return resheaderProcessingHandler(conn);
+    }
+
+    conn->last_heartbeat = time(NULL);
+    conn->bytes_received += moved;
+    if (!conn->is_cgi)
+        return writeUpload(conn, moved);
+    conn->bytes_sent += moved;
+
+    if (conn->bytes_received != conn->content_length)
+        return defaultMsg();
+
+    t_msg_from_serv msg = defaultMsg();
+    closeCgiInput(conn, msg);
+    mergeMsg(msg, resheaderProcessingHandler(conn));
+    return msg;
+}
+
+/**
+ * @brief Writes the bytes to the upload file, on a thread of the I/O pool.
+ * @details
+ * The first write preallocates the declared length, the file keeps its size till the bytes are there.
+ * With a `sync_size`, the writeback of each window is started, and the window before it is waited for:
+ * an upload keeps at most two windows dirty, the kernel never has a burst of it to flush at once.
+ */
+static void writeUploadFile(t_upload &upload, Buffer *chunk, int pipe_fd, size_t size)
+{
+    const int fd = upload.file->get();
+    if (upload.reserve > 0)
+    {
+        (void)fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, upload.reserve); // Else the blocks are allocated by the writes
+        upload.reserve = 0;
+    }
+
+    const ssize_t written = chunk ? chunk->writeFile(fd) : Buffer::drainPipe(pipe_fd, fd, size);
+    upload.result = written;
+    if (written <= 0)
+        return;
+    upload.written += written;
+
+    if (upload.sync_size == 0 || upload.written - upload.synced < upload.sync_size)
+        return;
+    if (upload.flushed < upload.synced)
+    {
+        const size_t window = upload.synced - upload.flushed;
+        (void)sync_file_range(fd, upload.flushed, window, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        (void)posix_fadvise(fd, upload.flushed, window, POSIX_FADV_DONTNEED);
+        upload.flushed = upload.synced;
+    }
+    (void)sync_file_range(fd, upload.synced, upload.written - upload.synced, SYNC_FILE_RANGE_WRITE);
+    upload.synced = upload.written;
+}
+
+/**
+ * @details
+ * The socket leaves the epoll till the write completed: no more of the body is read meanwhile,
+ * and a slow disk holds this connection only.
+ * The read buffer is moved to the write without copying, or the bytes spliced to the body pipe are moved to the file.
+ * The file and the pipe are kept open by the task, even if the connection is closed meanwhile.
+ */
+t_msg_from_serv Server::writeUpload(t_conn *conn, size_t from_pipe)
+{
+    std::shared_ptr<t_upload> upload = conn->upload;
+    std::shared_ptr<RaiiFd> pipe = from_pipe > 0 ? conn->body_pipe_out : nullptr;
+    std::shared_ptr<Buffer> chunk = nullptr;
+    if (from_pipe == 0)
+    {
+        chunk = std::make_shared<Buffer>();
+        chunk->append(*conn->read_buf);
+    }
+
+    upload->is_writing = true;
+    epoll_.removeFd(conn->socket_fd);
+    const int socket_fd = conn->socket_fd;
+    const int pipe_fd = pipe ? pipe->get() : -1;
+    return io_pool_.submit(t_io_task{
+        [upload, chunk, pipe_fd, from_pipe]()
+        { writeUploadFile(*upload, chunk.get(), pipe_fd, from_pipe); },
+        [this, socket_fd, upload, chunk, pipe](t_msg_from_serv &msg)
+        { mergeMsg(msg, uploadWrittenHandler(socket_fd, upload)); }});
+}
+
+/**
+ * @details
+ * The connection may be closed, or serving another request, when the write completes: the result is dropped then.
+ */
+t_msg_from_serv Server::uploadWrittenHandler(int socket_fd, const std::shared_ptr<t_upload> &upload)
+{
+    const auto it = conn_map_.find(socket_fd);
+    if (it == conn_map_.end() || it->second->upload != upload)
+        return defaultMsg();
+
+    t_conn *conn = it->second;
+    upload->is_writing = false;
+    epoll_.addFd(socket_fd);
+    conn->last_heartbeat = time(NULL);
+    if (upload->result < 0)
+    {
+        conn->error_code = ERR_500_INTERNAL_SERVER_ERROR;
+        return resheaderProcessingHandler(conn);
+    }
+    conn->bytes_sent += upload->result;
+    return reqBodyWrittenHandler(conn);
+}
+
 /**
  * @details
  * Writes data from the request read buffer to the CGI input pipe.
@@ -542,7 +1222,10 @@ t_msg_from_serv Server::reqBodyProcessingOutHandler(int fd, t_conn *conn)
     // Check if content length is reached
     if (conn->bytes_sent == conn->content_length)
     {
-        return resheaderProcessingHandler(conn);
+        t_msg_from_serv msg = defaultMsg();
+        closeCgiInput(conn, msg);
+        mergeMsg(msg, resheaderProcessingHandler(conn));
+        return msg;
     }
 
     return defaultMsg();
@@ -554,40 +1237,47 @@ t_msg_from_serv Server::reqBodyProcessingOutHandler(int fd, t_conn *conn)
  * Sets the connection status to `RESPONSE`.
  * Initializes the output length based on the request method and response size.
  * For CGI, sets the inner fd for reading
+ * An error page is sent with the head, from the copy read at start.
  */
 t_msg_from_serv Server::resheaderProcessingHandler(t_conn *conn)
 {
+    const t_status prev_status = conn->status;
     conn->status = RES_HEADER_PROCESSING;
 
-    size_t size_error_page = 0;
+    // Protocol errors close the connection, routine ones keep it when the body can be dropped.
+    if (!isKeepAlive(conn) || (conn->error_code != ERR_NO_ERROR && !discardRequestBody(conn, prev_status)))
+        conn->must_close = true;
+
+    const std::string *error_page = nullptr;
 
     if (conn->error_code != ERR_NO_ERROR && conn->error_code != ERR_301_REDIRECT)
     {
         try
         {
-            t_file err_page = ErrorResponse(epoll_).getErrorPage(configs_[conn->config_idx].err_pages, conn->error_code);
-            inner_fd_map_.emplace(err_page.FD_handler_OUT.get()->get(), err_page.FD_handler_OUT);
-            conn->inner_fd_out = err_page.FD_handler_OUT.get()->get();
-            size_error_page += err_page.fileSize;
+            error_page = &error_pages_[conn->config_idx].getErrorPage(conn->error_code);
         }
         catch (const WebServErr::ErrorResponseException &)
         {
         }
     }
+    const size_t size_error_page = error_page ? error_page->size() : 0;
 
-    const std::string header = (conn->error_code == ERR_NO_ERROR)
-                                   ? conn->response->successResponse(conn, cookies_[conn->config_idx])
-                                   : conn->response->failedResponse(conn, conn->error_code, conn->error_message, size_error_page, cookies_[conn->config_idx]);
+    std::string header = (conn->error_code == ERR_NO_ERROR)
+                             ? conn->response->successResponse(conn, cookies_[conn->config_idx])
+                             : conn->response->failedResponse(conn, conn->error_code, conn->error_message, size_error_page, cookies_[conn->config_idx]);
+    const size_t header_size = header.size();
 
     conn->status = RESPONSE;
     conn->bytes_sent = 0;
 
+    if (error_page)
+        header.append(*error_page); // Sent with the head, from memory
     if (!conn->is_cgi || conn->error_code != ERR_NO_ERROR)
-        conn->write_buf->insertHeader(header);
+        conn->write_buf->insertHeader(std::move(header)); // The pooled block becomes the first block of the response
 
     if (conn->error_code != ERR_NO_ERROR)
     {
-        conn->output_length = header.size() + size_error_page;
+        conn->output_length = header_size + size_error_page;
         return defaultMsg();
     }
 
@@ -603,11 +1293,11 @@ t_msg_from_serv Server::resheaderProcessingHandler(t_conn *conn)
     switch (method)
     {
     case GET:
-        conn->output_length = conn->res.isDynamic ? header.size() : header.size() + conn->res.fileSize;
+        conn->output_length = conn->res.isDynamic ? header_size : header_size + conn->res.fileSize;
         break;
     case DELETE:
     case POST:
-        conn->output_length = header.size();
+        conn->output_length = header_size;
         break;
     default:
         throw WebServErr::ShouldNotBeHereException("Unhandled method in response header processing");
@@ -619,12 +1309,16 @@ t_msg_from_serv Server::resheaderProcessingHandler(t_conn *conn)
 /**
  * @details
  * Reads data from the pipe into the write buffer.
- * If the data is chunked, updates the `output_length` when eof is reached,
- * and transitions to the `response` state.
+ * Until the CGI header is complete, it is parsed on each read,
+ * then replaced by the HTTP response head, which decides the framing:
+ * - A `Content-Length` from the CGI sets the `output_length`.
+ * - Otherwise the body is chunked (or close-delimited for HTTP/1.0),
+ *   and the `output_length` is known when EOF is reached.
+ * - A response without a body, e.g. a 204 or 304, ends with its head.
  * If the entire response has been read, closes the pipe.
  * If buffer is full, waits for the next read event.
  * If an error occurs during reading, transitions to the terminated state.
- * Errors includes: size exceeds, read error.
+ * Errors includes: size exceeds, read error, malformed CGI header, CGI exiting early.
  */
 t_msg_from_serv Server::responseInHandler(int fd, t_conn *conn)
 {
@@ -635,8 +1329,8 @@ t_msg_from_serv Server::responseInHandler(int fd, t_conn *conn)
 
     conn->last_heartbeat = time(NULL);
 
-    if (conn->write_buf->isFull())
-        return defaultMsg();
+    if (conn->write_buf->isFull() || conn->cgi_splice)
+        return defaultMsg(); // A spliced body is moved when the socket is writable
 
     ssize_t bytes_read = conn->write_buf->readFd(fd);
 
@@ -645,43 +1339,63 @@ t_msg_from_serv Server::responseInHandler(int fd, t_conn *conn)
         return terminatedHandler(fd, conn);
     }
 
-    if (bytes_read == EOF_REACHED || conn->write_buf->isEOF())
-    {
-        conn->output_length = conn->write_buf->size();
-        t_msg_from_serv msg = defaultMsg();
-        if (conn->inner_fd_out != -1)
-        {
-            conn_map_.erase(conn->inner_fd_out);
-            msg.fds_to_unregister.push_back(conn->inner_fd_out);
-            conn->inner_fd_out = -1;
-        }
-        return msg;
-    }
-
     if (bytes_read == BUFFER_FULL)
         return defaultMsg();
 
-    if (conn->is_cgi && !conn->cgi_header_ready)
+    if (!conn->cgi_header_ready && bytes_read != EOF_REACHED)
     {
         try
         {
-            const std::string header = conn->response->CGIResponse(conn->write_buf->peek());
-            if (!conn->write_buf->replaceHeader(header))
+            const size_t max_size = configs_[conn->config_idx].max_headers_size;
+            size_t cgi_head_size = 0;
+            std::string header = conn->response->CGIResponse(conn, conn->write_buf->peekHead(max_size), max_size, cgi_head_size);
+            const size_t header_size = header.size();
+            if (!conn->write_buf->replaceHeader(cgi_head_size, std::move(header)))
             {
                 return terminatedHandler(fd, conn);
             }
+            if (conn->res_framing == FRAMING_CHUNKED)
+                conn->write_buf->startChunkedOutput(header_size);
             conn->cgi_header_ready = true;
+            // The rest of the body needs no framing, it can bypass the buffer.
+            conn->cgi_splice = conn->res_framing != FRAMING_CHUNKED;
+            // Without a body, e.g. a 204, the rest of the output is dropped and the pipe is closed.
+            if (conn->res_framing == FRAMING_LENGTH && conn->output_length == header_size)
+            {
+                conn->write_buf->trimTo(header_size);
+                bytes_read = EOF_REACHED;
+            }
         }
         catch (const WebServErr::CgiHeaderNotFound &e) {
             return defaultMsg(); // Wait for more data
         }
         catch (const WebServErr::InvalidCgiHeader &e) {
+            LOG_WARN("Invalid CGI header: ", e.what());
             return terminatedHandler(fd, conn);
         }
     }
 
-    // Check if done
-    if (conn->write_buf->size() > conn->output_length)
+    const size_t total_length = conn->bytes_sent + conn->write_buf->outputSize();
+
+    if (bytes_read == EOF_REACHED || conn->write_buf->isEOF())
+    {
+        // The CGI exited before its header, or before its declared length.
+        if (!conn->cgi_header_ready || (conn->res_framing == FRAMING_LENGTH && total_length != conn->output_length))
+            return terminatedHandler(fd, conn);
+
+        conn->output_length = total_length;
+        t_msg_from_serv msg = defaultMsg();
+        if (conn->inner_fd_out != -1)
+        {
+            conn_map_.erase(conn->inner_fd_out);
+            msg.fds_to_unregister.push_back(conn->inner_fd_out);
+            conn->inner_fd_out = -1;
+        }
+        return msg;
+    }
+
+    // Check if exceeded
+    if (total_length > conn->output_length)
     {
         return terminatedHandler(fd, conn);
     }
@@ -706,22 +1420,58 @@ t_msg_from_serv Server::responseOutHandler(int fd, t_conn *conn)
         return defaultMsg();
     }
 
-    if (conn->is_cgi && !conn->cgi_header_ready)
-        return defaultMsg(); // Skip until CGI header is ready
+    t_msg_from_serv msg = defaultMsg();
 
-    if (!conn->is_cgi && conn->inner_fd_out != -1)
+    while (!conn->is_cgi || conn->cgi_header_ready)
     {
-        ssize_t read_bytes = conn->write_buf->readFd(conn->inner_fd_out);
-        if (read_bytes == RW_ERROR)
+        if (!conn->is_cgi && conn->inner_fd_out != -1)
         {
-            return terminatedHandler(fd, conn);
+            ssize_t read_bytes = conn->write_buf->readFd(conn->inner_fd_out);
+            if (read_bytes == RW_ERROR)
+            {
+                mergeMsg(msg, terminatedHandler(fd, conn));
+                return msg;
+            }
         }
+
+        // A fully buffered response of a keep-alive request is queued,
+        // and the next pipelined request is processed right away.
+        const bool is_buffered = conn->bytes_sent + conn->write_buf->size() == conn->output_length;
+        if (!is_buffered || conn->is_cgi || !isKeepAlive(conn))
+            break;
+
+        conn->queued_out->append(*conn->write_buf);
+        if (conn->inner_fd_out != -1)
+        {
+            inner_fd_map_.erase(conn->inner_fd_out);
+            conn->inner_fd_out = -1;
+        }
+        mergeMsg(msg, doneHandler(fd, conn));
+        if (conn->status != RESPONSE)
+            break;
+    }
+
+    // Queued responses go first, all of them in one write.
+    if (!conn->queued_out->isEmpty())
+    {
+        if (!flushQueuedOut(conn))
+            mergeMsg(msg, terminatedHandler(fd, conn));
+        return msg;
     }
 
+    if (conn->status != RESPONSE || (conn->is_cgi && !conn->cgi_header_ready))
+        return msg; // Skip until CGI header is ready
+
+    if (conn->cgi_splice && conn->inner_fd_out != -1 && conn->write_buf->isEmpty())
+        return spliceCgiOutput(conn);
+
     // Skip when buffer is empty
     if (conn->write_buf->isEmpty())
     {
-        return defaultMsg();
+        // A close-delimited CGI body may end after everything was sent.
+        if (conn->is_cgi && conn->inner_fd_out == -1 && conn->bytes_sent == conn->output_length)
+            mergeMsg(msg, doneHandler(fd, conn));
+        return msg;
     }
 
     // Write data to socket
@@ -761,6 +1511,74 @@ t_msg_from_serv Server::responseOutHandler(int fd, t_conn *conn)
     return defaultMsg();
 }
 
+/**
+ * @details
+ * The head and the body bytes read with it are sent from the buffer first.
+ * Each call moves what the socket takes, so a slow client leaves the bytes in the pipe and blocks the CGI.
+ * The EOF of the pipe ends a close-delimited body, before the declared length it is an error.
+ * A socket which cannot be spliced gets the rest of the body copied through the buffer.
+ */
+t_msg_from_serv Server::spliceCgiOutput(t_conn *conn)
+{
+    const size_t left = conn->output_length - conn->bytes_sent;
+    const ssize_t moved = Buffer::spliceFd(conn->inner_fd_out, conn->socket_fd, std::min(left, CGI_SPLICE_SIZE));
+    if (moved == SPLICE_AGAIN)
+        return defaultMsg();
+    if (moved == SPLICE_UNSUPPORTED)
+    {
+        conn->cgi_splice = false;
+        return defaultMsg();
+    }
+    if (moved == RW_ERROR)
+        return terminatedHandler(conn->socket_fd, conn);
+
+    if (moved == EOF_REACHED)
+    {
+        if (conn->res_framing == FRAMING_LENGTH)
+            return terminatedHandler(conn->socket_fd, conn);
+        conn->output_length = conn->bytes_sent;
+        return doneHandler(conn->socket_fd, conn);
+    }
+
+    conn->last_heartbeat = time(NULL);
+    conn->bytes_sent += moved;
+    if (conn->bytes_sent == conn->output_length)
+        return doneHandler(conn->socket_fd, conn);
+    return defaultMsg();
+}
+
+/**
+ * @details
+ * Socket events go to the session, a closed or failed socket ends the connection with its streams.
+ * Gateway events move the request and response bytes of a stream;
+ * a hang-up is read like data, the rest of the response and the EOF are still there.
+ */
+t_msg_from_serv Server::http2Handler(int fd, t_conn *conn, t_event_type event_type)
+{
+    Http2Session &session = *conn->h2;
+
+    if (fd == conn->socket_fd)
+    {
+        if (event_type == ERROR_EVENT)
+            return terminatedHandler(fd, conn);
+
+        const ssize_t bytes = event_type == READ_EVENT ? session.readSocket(fd) : session.writeSocket(fd);
+        if (bytes == RW_ERROR || (event_type == READ_EVENT && bytes == EOF_REACHED))
+            return terminatedHandler(fd, conn);
+        if (bytes > 0)
+            conn->last_heartbeat = time(NULL);
+    }
+    else if (event_type == WRITE_EVENT)
+        session.writeGateway(fd);
+    else
+    {
+        session.readGateway(fd);
+        conn->last_heartbeat = time(NULL);
+    }
+
+    return syncHttp2(conn);
+}
+
 /**
  * @details
  * Closes and removes any internal fds.
@@ -771,10 +1589,9 @@ t_msg_from_serv Server::doneHandler(int fd, t_conn *conn)
 {
     LOG_INFO("Connection done: ", fd);
     conn->status = DONE;
-    const bool keep_alive = !conn->request->getrequestHeaderMap().contains("connection") || conn->request->getrequestHeaderMap().at("connection") != "close";
 
-    // Terminate the connection if error occurred or not keep-alive
-    if (conn->error_code != ERR_NO_ERROR || !keep_alive)
+    // Terminate the connection after a protocol error, or if not keep-alive
+    if (!isKeepAlive(conn))
     {
         conn->status = DONE;
         t_msg_from_serv msg = closeConn(conn);
@@ -787,8 +1604,15 @@ t_msg_from_serv Server::doneHandler(int fd, t_conn *conn)
     // Reset the connection for next request if keep-alive
     t_msg_from_serv msg = resetConnMap(conn);
     size_t config_idx = conn->config_idx;
+    const size_t body_to_discard = conn->body_to_discard;
+    discardUpload(conn->upload);
     resetConn(conn, conn->socket_fd, configs_[conn->config_idx].max_request_size);
     conn->config_idx = config_idx;
+    conn->body_to_discard = body_to_discard;
+
+    // Pipelined bytes are already there, no read event will come for them.
+    if (!conn->read_buf->isEmpty())
+        mergeMsg(msg, reqHeaderParsingHandler(conn->socket_fd, conn, true));
 
     return msg;
 }
@@ -804,6 +1628,10 @@ t_msg_from_serv Server::terminatedHandler(int fd, t_conn *conn)
     LOG_INFO("Connection terminated: ", fd);
     conn->status = TERMINATED;
 
+    // The response is dropped, the CGI has no reader left.
+    if (conn->res.pid > 0)
+        children_.stop(conn->res.pid, time(NULL));
+
     int sock_fd = conn->socket_fd;
     t_msg_from_serv msg = closeConn(conn);
     conns_.remove_if([sock_fd](const t_conn &c)
@@ -817,19 +1645,48 @@ t_msg_from_serv Server::terminatedHandler(int fd, t_conn *conn)
 
 t_msg_from_serv Server::scheduler(int fd, t_event_type event_type)
 {
+    if (fcgi_.owns(fd))
+        return fcgi_.handleEvent(fd, event_type);
+    if (proxy_.owns(fd))
+        return proxy_.handleEvent(fd, event_type);
+    if (cgi_workers_.owns(fd))
+        return cgi_workers_.handleEvent(fd, event_type);
+    if (children_.owns(fd))
+        return children_.handleEvent(fd, event_type);
+    if (cgi_cache_.owns(fd))
+        return cgi_cache_.handleEvent(fd, event_type);
+    if (io_pool_.owns(fd))
+        return io_pool_.handleEvent(fd, event_type);
+
     if (!conn_map_.contains(fd))
         return defaultMsg();
 
     t_conn *conn = conn_map_.at(fd);
     t_status status = conn->status;
 
+    if (status == H2_SESSION)
+        return http2Handler(fd, conn, event_type);
+
     if (event_type == ERROR_EVENT)
     {
-        if (!conn->is_cgi && fd != conn->inner_fd_out)
+        if (!conn->is_cgi || fd == conn->socket_fd)
             return terminatedHandler(fd, conn);
-        if (conn->write_buf->isEmpty())
-            return doneHandler(fd, conn);
-        return defaultMsg();
+
+        // The CGI closed its input, its output decides the response.
+        if (fd == conn->inner_fd_in && status != REQ_BODY_PROCESSING)
+        {
+            t_msg_from_serv msg = defaultMsg();
+            conn_map_.erase(fd);
+            msg.fds_to_unregister.push_back(fd);
+            conn->inner_fd_in = -1;
+            return msg;
+        }
+
+        // The CGI closed its output, the rest of it and the EOF are still to be read.
+        if (fd == conn->inner_fd_out && (status == RESPONSE || status == RES_HEADER_PROCESSING))
+            return responseInHandler(fd, conn);
+
+        return terminatedHandler(fd, conn);
     }
 
     switch (status)
@@ -844,7 +1701,9 @@ t_msg_from_serv Server::scheduler(int fd, t_event_type event_type)
         case READ_EVENT:
             return reqHeaderParsingHandler(fd, conn);
         case WRITE_EVENT:
-            return defaultMsg(); // Ignore write event in this state
+            if (!flushQueuedOut(conn)) // Responses of the previous pipelined requests
+                return terminatedHandler(fd, conn);
+            return defaultMsg();
         default:
             throw WebServErr::ShouldNotBeHereException("Invalid event type for REQ_HEADER_PARSING");
         }
@@ -858,6 +1717,8 @@ t_msg_from_serv Server::scheduler(int fd, t_event_type event_type)
             }
             return reqBodyProcessingInHandler(fd, conn);
         case WRITE_EVENT:
+            if (fd == conn->socket_fd && !flushQueuedOut(conn))
+                return terminatedHandler(fd, conn);
             if (fd != conn->inner_fd_in)
             {
                 return defaultMsg();
@@ -883,6 +1744,7 @@ t_msg_from_serv Server::scheduler(int fd, t_event_type event_type)
             throw WebServErr::ShouldNotBeHereException("Invalid event type for RESPONSE");
         }
     case REQ_HEADER_PROCESSING:
+    case REQ_WAITING_FS:
         return defaultMsg(); // Ignore events in these states
     case RES_HEADER_PROCESSING:
         if (event_type == READ_EVENT && fd == conn->inner_fd_out)
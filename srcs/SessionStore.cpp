@@ -0,0 +1,361 @@
+#include "SessionStore.hpp"
+#include "LogSys.hpp"
+#include "WebServErr.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static constexpr char SESSION_TABLE_MAGIC[8] = {'W', 'S', 'S', 'E', 'S', 'S', '\0', '\0'};
+
+/**
+ * @details
+ * The ids are random already, their first bytes are the hash.
+ */
+static size_t hashId(const t_session_id &id)
+{
+    uint64_t hash;
+    std::memcpy(&hash, id.data(), sizeof(hash));
+    return static_cast<size_t>(hash);
+}
+
+SessionStore::SessionStore(size_t capacity, time_t ttl, const std::string &path)
+    : table_(nullptr), sessions_(nullptr), index_(nullptr), map_size_(0), random_(), random_used_(SESSION_RANDOM_POOL)
+{
+    const uint32_t slots = static_cast<uint32_t>(std::clamp<size_t>(capacity, 1, SESSION_NONE / 4));
+    const uint32_t index_size = std::bit_ceil(slots * 2);
+    map_size_ = sizeof(t_session_table) + sizeof(t_session) * slots + sizeof(uint32_t) * index_size;
+
+    bool is_loaded = false;
+    if (path.empty() || !mapFile(path, is_loaded))
+    {
+        void *map = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+            throw WebServErr::SysCallErrException("mmap failed");
+        table_ = static_cast<t_session_table *>(map);
+    }
+    sessions_ = reinterpret_cast<t_session *>(table_ + 1);
+    index_ = reinterpret_cast<uint32_t *>(sessions_ + slots);
+
+    const t_session_table &table = *table_;
+    is_loaded = is_loaded && std::memcmp(table.magic, SESSION_TABLE_MAGIC, sizeof(table.magic)) == 0 &&
+                table.version == SESSION_TABLE_VERSION && table.capacity == slots && table.index_size == index_size &&
+                table.ttl == ttl && table.is_writing == 0 && table.size <= slots &&
+                (table.head < slots || table.head == SESSION_NONE) && (table.tail < slots || table.tail == SESSION_NONE) &&
+                (table.free < slots || table.free == SESSION_NONE) && isConsistent();
+    if (is_loaded)
+        LOG_INFO("Sessions resumed from: ", path, " ", table.size);
+    else
+        reset(slots, index_size, ttl);
+}
+
+SessionStore::SessionStore(SessionStore &&other) noexcept
+    : table_(other.table_), sessions_(other.sessions_), index_(other.index_), map_size_(other.map_size_),
+      random_(other.random_), random_used_(other.random_used_)
+{
+    other.table_ = nullptr;
+    other.sessions_ = nullptr;
+    other.index_ = nullptr;
+    other.map_size_ = 0;
+}
+
+SessionStore::~SessionStore()
+{
+    if (table_)
+        munmap(table_, map_size_);
+}
+
+/**
+ * @details
+ * The file is allocated to its full size, a write to the mapping cannot fail on a full disk.
+ * The fd is closed once mapped, the mapping keeps the file.
+ */
+bool SessionStore::mapFile(const std::string &path, bool &is_loaded)
+{
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        LOG_WARN("Sessions kept in memory, cannot open: ", path, " ", strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+    is_loaded = static_cast<size_t>(st.st_size) == map_size_;
+    int err = 0;
+    if (!is_loaded && ftruncate(fd, 0) == -1)
+        err = errno;
+    if (!is_loaded && err == 0)
+        err = posix_fallocate(fd, 0, static_cast<off_t>(map_size_));
+    void *map = err == 0 ? mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED && err == 0)
+        err = errno;
+    close(fd);
+    if (err != 0)
+    {
+        LOG_WARN("Sessions kept in memory, cannot map: ", path, " ", strerror(err));
+        is_loaded = false;
+        return false;
+    }
+    table_ = static_cast<t_session_table *>(map);
+    return true;
+}
+
+/**
+ * @details
+ * The slots of the LRU list and of the free list are marked as they are walked: a slot seen twice ends a cycle,
+ * and together the lists must hold every slot once. Each session of the list must then be found by its id,
+ * through an index holding exactly `size` entries.
+ */
+bool SessionStore::isConsistent() const
+{
+    const uint32_t slots = table_->capacity;
+    std::vector<uint8_t> seen(slots, 0); // 1 in the LRU list, 2 in the free list
+    uint32_t prev = SESSION_NONE;
+    uint64_t listed = 0;
+    for (uint32_t slot = table_->head; slot != SESSION_NONE; slot = sessions_[slot].next)
+    {
+        if (slot >= slots || seen[slot] || sessions_[slot].prev != prev || ++listed > table_->size)
+            return false;
+        seen[slot] = 1;
+        prev = slot;
+    }
+    if (prev != table_->tail || listed != table_->size)
+        return false;
+    for (uint32_t slot = table_->free; slot != SESSION_NONE; slot = sessions_[slot].next)
+    {
+        if (slot >= slots || seen[slot])
+            return false;
+        seen[slot] = 2;
+        ++listed;
+    }
+    if (listed != slots)
+        return false;
+
+    uint64_t indexed = 0;
+    for (uint32_t i = 0; i < table_->index_size; ++i)
+    {
+        if (index_[i] != SESSION_NONE && (index_[i] >= slots || seen[index_[i]] != 1 || ++indexed > table_->size))
+            return false;
+    }
+    if (indexed != table_->size)
+        return false;
+    for (uint32_t slot = table_->head; slot != SESSION_NONE; slot = sessions_[slot].next)
+    {
+        if (index_[find(sessions_[slot].id)] != slot)
+            return false;
+    }
+    return true;
+}
+
+void SessionStore::reset(uint32_t capacity, uint32_t index_size, time_t ttl)
+{
+    beginWrite();
+    std::memcpy(table_->magic, SESSION_TABLE_MAGIC, sizeof(table_->magic));
+    table_->version = SESSION_TABLE_VERSION;
+    table_->capacity = capacity;
+    table_->index_size = index_size;
+    table_->head = SESSION_NONE;
+    table_->tail = SESSION_NONE;
+    table_->free = 0;
+    table_->size = 0;
+    table_->ttl = ttl;
+    for (uint32_t i = 0; i < capacity; ++i)
+        sessions_[i].next = i + 1 < capacity ? i + 1 : SESSION_NONE;
+    std::fill(index_, index_ + index_size, SESSION_NONE);
+    endWrite();
+}
+
+void SessionStore::beginWrite()
+{
+    table_->is_writing = 1;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+void SessionStore::endWrite()
+{
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    table_->is_writing = 0;
+}
+
+size_t SessionStore::find(const t_session_id &id) const
+{
+    const size_t mask = table_->index_size - 1;
+    size_t pos = hashId(id) & mask;
+    while (index_[pos] != SESSION_NONE && sessions_[index_[pos]].id != id)
+        pos = (pos + 1) & mask;
+    return pos;
+}
+
+void SessionStore::unlink(uint32_t slot)
+{
+    t_session &session = sessions_[slot];
+    (session.prev == SESSION_NONE ? table_->head : sessions_[session.prev].next) = session.next;
+    (session.next == SESSION_NONE ? table_->tail : sessions_[session.next].prev) = session.prev;
+}
+
+void SessionStore::pushFront(uint32_t slot)
+{
+    t_session &session = sessions_[slot];
+    session.prev = SESSION_NONE;
+    session.next = table_->head;
+    (table_->head == SESSION_NONE ? table_->tail : sessions_[table_->head].prev) = slot;
+    table_->head = slot;
+}
+
+/**
+ * @details
+ * The entries after the hole, up to the next empty one, move back into it unless it is before their home.
+ */
+void SessionStore::erase(uint32_t slot)
+{
+    const size_t mask = table_->index_size - 1;
+    size_t hole = find(sessions_[slot].id);
+    for (size_t pos = (hole + 1) & mask; index_[pos] != SESSION_NONE; pos = (pos + 1) & mask)
+    {
+        const size_t home = hashId(sessions_[index_[pos]].id) & mask;
+        if (((pos - home) & mask) >= ((pos - hole) & mask))
+        {
+            index_[hole] = index_[pos];
+            hole = pos;
+        }
+    }
+    index_[hole] = SESSION_NONE;
+    unlink(slot);
+    sessions_[slot].next = table_->free;
+    table_->free = slot;
+    --table_->size;
+}
+
+void SessionStore::dropExpired(time_t now)
+{
+    while (table_->tail != SESSION_NONE && sessions_[table_->tail].expires_at <= now)
+        erase(table_->tail);
+}
+
+t_session_id SessionStore::randomId()
+{
+    if (random_used_ + SESSION_ID_SIZE > random_.size())
+    {
+        size_t filled = 0;
+        while (filled < random_.size())
+        {
+            const ssize_t n = getrandom(random_.data() + filled, random_.size() - filled, 0);
+            if (n == -1 && errno != EINTR)
+                throw WebServErr::SysCallErrException("getrandom failed");
+            if (n > 0)
+                filled += static_cast<size_t>(n);
+        }
+        random_used_ = 0;
+    }
+    t_session_id id;
+    std::memcpy(id.data(), random_.data() + random_used_, SESSION_ID_SIZE);
+    random_used_ += SESSION_ID_SIZE;
+    return id;
+}
+
+bool SessionStore::touch(const t_session_id &id, time_t now)
+{
+    const uint32_t slot = index_[find(id)];
+    if (slot == SESSION_NONE)
+        return false;
+    beginWrite();
+    const bool is_valid = sessions_[slot].expires_at > now;
+    if (is_valid)
+    {
+        sessions_[slot].expires_at = now + table_->ttl;
+        unlink(slot);
+        pushFront(slot);
+    }
+    else
+        erase(slot);
+    endWrite();
+    return is_valid;
+}
+
+t_session_id SessionStore::create(time_t now)
+{
+    t_session_id id = randomId();
+    beginWrite();
+    dropExpired(now);
+    if (table_->free == SESSION_NONE)
+        erase(table_->tail);
+
+    size_t pos = find(id);
+    while (index_[pos] != SESSION_NONE) // 2^-128, but an id must stay unique
+    {
+        id = randomId();
+        pos = find(id);
+    }
+    const uint32_t slot = table_->free;
+    table_->free = sessions_[slot].next;
+    sessions_[slot].id = id;
+    sessions_[slot].expires_at = now + table_->ttl;
+    pushFront(slot);
+    index_[pos] = slot;
+    ++table_->size;
+    endWrite();
+    return id;
+}
+
+void SessionStore::expire(time_t now)
+{
+    beginWrite();
+    dropExpired(now);
+    endWrite();
+}
+
+size_t SessionStore::size() const
+{
+    return table_->size;
+}
+
+size_t SessionStore::capacity() const
+{
+    return table_->capacity;
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+bool SessionStore::parse(std::string_view hex, t_session_id &id)
+{
+    if (hex.size() != SESSION_ID_SIZE * 2)
+        return false;
+    for (size_t i = 0; i < SESSION_ID_SIZE; ++i)
+    {
+        const int high = hexValue(hex[i * 2]);
+        const int low = hexValue(hex[i * 2 + 1]);
+        if (high < 0 || low < 0)
+            return false;
+        id[i] = static_cast<unsigned char>(high << 4 | low);
+    }
+    return true;
+}
+
+std::string SessionStore::format(const t_session_id &id)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string hex(SESSION_ID_SIZE * 2, '0');
+    for (size_t i = 0; i < SESSION_ID_SIZE; ++i)
+    {
+        hex[i * 2] = digits[id[i] >> 4];
+        hex[i * 2 + 1] = digits[id[i] & 0xf];
+    }
+    return hex;
+}
@@ -0,0 +1,172 @@
+#include "UploadQuota.hpp"
+#include "LogSys.hpp"
+#include "WebServErr.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <system_error>
+
+UploadQuota::UploadQuota() : mutex_(), roots_() {}
+
+/**
+ * @brief The root as a key of the `UploadQuota`: lexically normal, without a trailing slash.
+ */
+static std::string normalRoot(const std::string &path)
+{
+    std::string normal = std::filesystem::path(path).lexically_normal().string();
+    while (normal.size() > 1 && normal.back() == '/')
+        normal.pop_back();
+    return normal;
+}
+
+/**
+ * @brief Whether `path` is `root` or beneath it, both normal.
+ */
+static bool isUnder(const std::string &path, const std::string &root)
+{
+    return path.compare(0, root.size(), root) == 0
+           && (path.size() == root.size() || root == "/" || path[root.size()] == '/');
+}
+
+/**
+ * @details
+ * Subdirectories are counted too, symlinks are not followed.
+ * An entry which vanishes meanwhile, or cannot be read, is skipped.
+ */
+t_dir_usage UploadQuota::scan(const std::string &root, const std::vector<std::string> &skipped)
+{
+    t_dir_usage usage = {0, 0, time(NULL), false, false};
+    std::error_code ec;
+    auto it = std::filesystem::recursive_directory_iterator(root, std::filesystem::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+    {
+        std::error_code entry_ec;
+        if (it->is_directory(entry_ec) && !it->is_symlink(entry_ec)
+            && std::find(skipped.begin(), skipped.end(), it->path().string()) != skipped.end())
+        {
+            it.disable_recursion_pending();
+            continue;
+        }
+        if (!it->is_regular_file(entry_ec))
+            continue;
+        const uintmax_t size = it->file_size(entry_ec);
+        if (entry_ec)
+            continue;
+        ++usage.files;
+        usage.bytes += size;
+    }
+    if (ec)
+        LOG_WARN("Upload root not fully scanned: ", root, " ", ec.message());
+    return usage;
+}
+
+void UploadQuota::track(const std::string &root)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    roots_.try_emplace(normalRoot(root), t_dir_usage{0, 0, 0, true, false});
+}
+
+t_dir_usage *UploadQuota::rootOf(const std::string &path)
+{
+    const std::string normal = normalRoot(path);
+    t_dir_usage *usage = nullptr;
+    size_t length = 0;
+    for (auto &[root, dir] : roots_)
+    {
+        if ((!usage || root.size() > length) && isUnder(normal, root))
+        {
+            usage = &dir;
+            length = root.size();
+        }
+    }
+    return usage;
+}
+
+std::vector<std::string> UploadQuota::nestedRoots(const std::string &root) const
+{
+    std::vector<std::string> nested;
+    for (const auto &[other, dir] : roots_)
+    {
+        if (other != root && isUnder(other, root))
+            nested.push_back(other);
+    }
+    return nested;
+}
+
+/**
+ * @details
+ * A root no location tracked is tracked now, with its limits checked against empty counters till its first scan.
+ */
+t_dir_usage *UploadQuota::addFile(const t_location_config &location, size_t length)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    t_dir_usage &dir = roots_.try_emplace(normalRoot(location.root), t_dir_usage{0, 0, 0, true, false}).first->second;
+    if (dir.files >= location.max_files)
+        throw WebServErr::MethodException(ERR_403_FORBIDDEN, "Too Many Files, Delete Some");
+    if (location.max_bytes > 0 && (dir.bytes >= location.max_bytes || length > location.max_bytes - dir.bytes))
+        throw WebServErr::MethodException(ERR_413_CONTENT_TOO_LARGE, "Upload location is full");
+    ++dir.files;
+    dir.is_dirty = true;
+    return &dir;
+}
+
+void UploadQuota::removeFile(const std::string &path, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    t_dir_usage *dir = rootOf(path);
+    if (!dir)
+        return;
+    dir->files -= std::min<size_t>(dir->files, 1);
+    dir->bytes -= std::min(dir->bytes, size);
+    dir->is_dirty = true;
+}
+
+void UploadQuota::addBytes(t_dir_usage *usage, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    usage->bytes += bytes;
+}
+
+void UploadQuota::release(t_dir_usage *usage)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    usage->files -= std::min<size_t>(usage->files, 1);
+    usage->is_dirty = true;
+}
+
+/**
+ * @details
+ * A root tracked since the last tick is scanned now, the others when due.
+ * The counters are replaced by the result of the scan.
+ * A change made while it runs may be counted twice, or not at all: the root stays dirty, the next scan sets it right.
+ */
+t_msg_from_serv UploadQuota::tick(time_t now, IoPool &io_pool)
+{
+    t_msg_from_serv msg = {std::vector<std::shared_ptr<RaiiFd>>{}, std::vector<int>{}};
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &[root, dir] : roots_)
+    {
+        if (!dir.is_dirty || dir.is_scanning || now - dir.scanned_at < UPLOAD_RECONCILE_INTERVAL)
+            continue;
+        dir.is_dirty = false;
+        dir.is_scanning = true;
+        auto result = std::make_shared<t_dir_usage>();
+        t_dir_usage *target = &dir;
+        const std::string path = root;
+        t_msg_from_serv temp = io_pool.submit(t_io_task{
+            [result, path, skipped = nestedRoots(root)]()
+            { *result = scan(path, skipped); },
+            [this, target, result, path](t_msg_from_serv &)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (target->scanned_at == 0)
+                    LOG_INFO("Upload root: ", path, " files: ", result->files, " bytes: ", result->bytes);
+                target->files = result->files;
+                target->bytes = result->bytes;
+                target->scanned_at = result->scanned_at;
+                target->is_scanning = false;
+            }});
+        msg.fds_to_register.insert(msg.fds_to_register.end(), temp.fds_to_register.begin(), temp.fds_to_register.end());
+    }
+    return msg;
+}
@@ -21,7 +21,7 @@ void setNonBlocking(int fd)
 
 int listenToPort(unsigned int port)
 {
-    int serverFd = socket(AF_INET, SOCK_STREAM, 0);
+    int serverFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (serverFd < 0)
         throw WebServErr::SysCallErrException("socket creation failed");
 
@@ -50,7 +50,7 @@ int acceptNewConnection(int listenFd)
 {
     struct sockaddr_in clientAddress;
     socklen_t clientAddressLength = sizeof(clientAddress);
-    int connClientFd = accept(listenFd, (struct sockaddr *)&clientAddress, &clientAddressLength);
+    int connClientFd = accept4(listenFd, (struct sockaddr *)&clientAddress, &clientAddressLength, SOCK_CLOEXEC);
     if (connClientFd == -1)
     {
         if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -104,7 +104,7 @@ WebServ::WebServ(const std::string &conf_file) : epoll_(EpollHelper())
         }
 
         for (auto &kv : ports_map)
-            servers_.push_back(Server(*this, epoll_, kv.second));
+            servers_.emplace_back(*this, epoll_, kv.second); // In place, the cache refers to the reaper of its server
     }
     catch (...)
     {
@@ -163,24 +163,28 @@ void WebServ::eventLoop()
                     continue;
                 }
 
+                // A handler may unregister the fd, the next events of it are dropped then.
+                const int fd = connServer->first;
+                Server *serv = connServer->second;
                 if (events[i].events & EPOLLIN)
                 {
-                    auto msg = connServer->second->scheduler(connServer->first, READ_EVENT);
-                    handleServerMsg(msg, connServer->second);
+                    auto msg = serv->scheduler(fd, READ_EVENT);
+                    handleServerMsg(msg, serv);
                 }
-                if (events[i].events & EPOLLOUT)
+                if ((events[i].events & EPOLLOUT) && conn_map_.contains(fd))
                 {
-                    auto msg = connServer->second->scheduler(connServer->first, WRITE_EVENT);
-                    handleServerMsg(msg, connServer->second);
+                    auto msg = serv->scheduler(fd, WRITE_EVENT);
+                    handleServerMsg(msg, serv);
                 }
-                if (events[i].events & (EPOLLHUP | EPOLLERR))
+                if ((events[i].events & (EPOLLHUP | EPOLLERR)) && conn_map_.contains(fd))
                 {
-                    auto msg = connServer->second->scheduler(connServer->first, ERROR_EVENT);
-                    handleServerMsg(msg, connServer->second);
+                    auto msg = serv->scheduler(fd, ERROR_EVENT);
+                    handleServerMsg(msg, serv);
                 }
             }
         }
         timeoutKiller(server_map_);
+        closing_.clear();
     }
     LOG_INFO("Server shutting down gracefully.", "");
 }
@@ -195,8 +199,13 @@ void WebServ::handleServerMsg(const t_msg_from_serv &msg, Server *server)
     {
         server_map_.erase(fd);
         conn_map_.erase(fd);
-        fds_.remove_if([&fd](const std::shared_ptr<RaiiFd> &rfd)
-                       { return rfd->get() == fd; });
+        // Closing it now would let an accept of this batch reuse the number, and get the events left of it.
+        fds_.remove_if([&fd, this](const std::shared_ptr<RaiiFd> &rfd)
+                       {
+                           if (rfd->get() != fd)
+                               return false;
+                           closing_.push_back(rfd);
+                           return true; });
     }
 }
 
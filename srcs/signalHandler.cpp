@@ -1,16 +1,7 @@
 #include "signalHandler.hpp"
 
-void sigchld_handler(int) {
-    while (waitpid(-1, nullptr, WNOHANG) > 0);
-}
-
+// Children are reaped by their owners (`ChildReaper`, `CgiWorkerPool`), a SIGCHLD handler would steal their status.
 void setup_signal_handlers() {
-    struct sigaction sa_chld;
-    sa_chld.sa_handler = sigchld_handler;
-    sigemptyset(&sa_chld.sa_mask);
-    sa_chld.sa_flags = SA_RESTART;
-    sigaction(SIGCHLD, &sa_chld, nullptr);
-
     // Ignore SIGPIPE
     struct sigaction sa_pipe;
     sa_pipe.sa_handler = SIG_IGN;
@@ -1,4 +1,6 @@
 #include "../includes/utils.hpp"
+#include <chrono>
+#include <random>
 
 std::string toLower(const std::string &s)
 {
@@ -8,3 +10,31 @@ std::string toLower(const std::string &s)
                    { return std::tolower(c); });
     return result;
 }
+
+bool hasToken(std::string_view list, std::string_view token)
+{
+    while (!list.empty())
+    {
+        const size_t comma = list.find(',');
+        std::string_view item = list.substr(0, comma);
+        list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+            item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+            item.remove_suffix(1);
+        if (item == token)
+            return true;
+    }
+    return false;
+}
+
+std::string randomUploadName(const std::string &extension)
+{
+    static const std::string chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    thread_local std::mt19937 rng{static_cast<unsigned long>(std::chrono::high_resolution_clock::now().time_since_epoch().count())};
+    std::uniform_int_distribution<size_t> dist(0, chars.size() - 1);
+    std::string name = "upload_";
+    for (size_t i = 0; i < 12; i++)
+        name.push_back(chars[dist(rng)]);
+    return name + extension;
+}
@@ -0,0 +1,91 @@
+/**
+ * Micro-benchmarks of the scanning kernels, each level against the scalar one.
+ *
+ * Build (from the repo root):
+ *   g++ -std=c++20 -O2 -Iincludes test/bench/benchScanKernels.cpp srcs/ScanKernels.cpp -o bench_scan
+ */
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include "../../includes/ScanKernels.hpp"
+
+namespace
+{
+
+  volatile size_t sink;
+
+  template <typename F>
+  double nsPerByte(size_t bytes, F &&fn)
+  {
+    const int rounds = 2000;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r)
+      sink = fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / (static_cast<double>(bytes) * rounds);
+  }
+
+  const char *levelName(t_scan_level level)
+  {
+    switch (level)
+    {
+    case SCAN_AVX2:
+      return "avx2";
+    case SCAN_SSE2:
+      return "sse2";
+    default:
+      return "scalar";
+    }
+  }
+
+} // namespace
+
+int main()
+{
+  // A realistic-ish 8 KiB head: long cookie, the terminator at the very end.
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> dist('a', 'z');
+  std::string head = "GET /some/long/path/index.html?x=1 HTTP/1.1\r\nHost: localhost\r\nCookie: ";
+  while (head.size() < 8 * 1024 - 4)
+    head.push_back(static_cast<char>(dist(rng)));
+  head += "\r\n\r\n";
+
+  const CharClass cls("<>\"{}|\\^`"); // no space, the request line has some
+  const char quad[4] = {'\r', '\n', '\r', '\n'};
+
+  std::printf("kernel          level      ns/byte   speedup\n");
+  const t_scan_level levels[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+
+  auto report = [&](const char *name, auto &&run)
+  {
+    double scalar = 0;
+    for (t_scan_level level : levels)
+    {
+      if (level > scanBestLevel())
+        break;
+      const t_scan_kernels &k = scanKernels(level);
+      const double ns = nsPerByte(head.size(), [&]()
+                                  { return run(k); });
+      if (level == SCAN_SCALAR)
+        scalar = ns;
+      std::printf("%-15s %-8s %9.4f %8.2fx\n", name, levelName(level), ns, scalar / ns);
+    }
+  };
+
+  report("find_pair", [&](const t_scan_kernels &k)
+         { return k.find_pair(head.data(), head.size() - 2, '\r', '\r'); });
+  report("find_quad", [&](const t_scan_kernels &k)
+         { return k.find_quad(head.data(), head.size(), quad); });
+  report("find_first_of", [&](const t_scan_kernels &k)
+         { return k.find_first_of(head.data(), head.size(), cls); });
+  report("find_byte", [&](const t_scan_kernels &k)
+         { return k.find_byte(head.data(), head.size(), '%'); });
+
+  std::string decoded;
+  const std::string target = "/" + std::string(2000, 'a') + "%20" + std::string(2000, 'b') + "%2F";
+  const double ns = nsPerByte(target.size(), [&]()
+                              { scanPercentDecode(target, decoded); return decoded.size(); });
+  std::printf("%-15s %-8s %9.4f\n", "percent_decode", levelName(scanBestLevel()), ns);
+  return 0;
+}
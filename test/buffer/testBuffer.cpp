@@ -0,0 +1,248 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../includes/Buffer.hpp"
+
+namespace
+{
+
+  class PipeFixture : public ::testing::Test
+  {
+  protected:
+    int fds_[2];
+
+    void SetUp() override
+    {
+      ASSERT_EQ(pipe(fds_), 0);
+      fcntl(fds_[1], F_SETPIPE_SZ, 1 << 20);
+    }
+
+    void TearDown() override
+    {
+      close(fds_[0]);
+      close(fds_[1]);
+    }
+
+    void send(const std::string &data)
+    {
+      ASSERT_EQ(write(fds_[1], data.data(), data.size()), static_cast<ssize_t>(data.size()));
+    }
+
+    // Reads until the pipe is drained, one block at most per read.
+    void readAll(Buffer &buf)
+    {
+      fcntl(fds_[0], F_SETFL, O_NONBLOCK);
+      while (buf.readFd(fds_[0]) > 0)
+        ;
+    }
+  };
+
+} // namespace
+
+TEST_F(PipeFixture, SmallHeadStaysInFirstBlock)
+{
+  Buffer buf(1 << 16, 1024);
+  send("GET / HTTP/1.1\r\nHost: a\r\n\r\n");
+  readAll(buf);
+  const std::string_view head = buf.peekHead(8192);
+  EXPECT_EQ(head, "GET / HTTP/1.1\r\nHost: a\r\n\r\n");
+  EXPECT_EQ(head.data(), buf.peek().data());
+}
+
+// A 5 KiB cookie with 1 KiB blocks: the head is linearized, then the body is kept.
+TEST_F(PipeFixture, HeadSpanningBlocks)
+{
+  Buffer buf(1 << 16, 1024);
+  const std::string head = "POST / HTTP/1.1\r\nCookie: " + std::string(5000, 'c') + "\r\n\r\n";
+  const std::string body(3000, 'b');
+  send(head + body);
+  readAll(buf);
+
+  const std::string_view peeked = buf.peekHead(8192);
+  ASSERT_EQ(peeked.size(), head.size() + body.size());
+  EXPECT_EQ(peeked.substr(0, head.size()), head);
+
+  ASSERT_TRUE(buf.removeHeaderAndSetChunked(head.size(), false));
+  EXPECT_EQ(buf.size(), body.size());
+  EXPECT_EQ(buf.peek(), body);
+}
+
+// After linearizing, the rest of the head is read into the same block, without another copy.
+TEST_F(PipeFixture, LinearizedOnlyOnce)
+{
+  Buffer buf(1 << 16, 1024);
+  send(std::string(1500, 'x'));
+  readAll(buf);
+  const char *first = buf.peekHead(8192).data();
+
+  send(std::string(3000, 'y'));
+  readAll(buf);
+  const std::string_view head = buf.peekHead(8192);
+  EXPECT_EQ(head.data(), first);
+  EXPECT_EQ(head.size(), 4500u);
+}
+
+TEST_F(PipeFixture, ChunkedRestInSeveralBlocks)
+{
+  Buffer buf(1 << 16, 64);
+  const std::string head = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+  send(head + "a\r\n0123456789\r\n" + "20\r\n" + std::string(32, 'z') + "\r\n0\r\n\r\n");
+  readAll(buf);
+  ASSERT_TRUE(buf.removeHeaderAndSetChunked(buf.peekHead(1024).find("\r\n\r\n") + 4, true));
+  EXPECT_TRUE(buf.isEOF());
+  EXPECT_EQ(buf.peek(), "0123456789" + std::string(32, 'z'));
+}
+
+// A trimmed view must only grow at its end when more is read.
+TEST_F(PipeFixture, ReadAfterRemovingHeaderKeepsBodyOnly)
+{
+  Buffer buf(1 << 16, 1024);
+  send("PUT / HTTP/1.1\r\n\r\nab");
+  readAll(buf);
+  ASSERT_TRUE(buf.removeHeaderAndSetChunked(18, false));
+  send("cd");
+  readAll(buf);
+  EXPECT_EQ(buf.peek(), "abcd");
+}
+
+// Pipelining: the bytes beyond the body become the input of the next request.
+TEST_F(PipeFixture, OverflowCarriedToNextMessage)
+{
+  Buffer buf(1 << 16, 1024);
+  send("POST / HTTP/1.1\r\n\r\nhelloGET /next HTTP/1.1\r\n\r\n");
+  readAll(buf);
+  ASSERT_TRUE(buf.removeHeaderAndSetChunked(19, false));
+  buf.trimTo(5);
+  EXPECT_EQ(buf.peek(), "hello");
+
+  int out[2];
+  ASSERT_EQ(pipe(out), 0);
+  EXPECT_EQ(buf.writeSocket(out[1]), 5);
+  close(out[0]);
+  close(out[1]);
+
+  buf.startNextMessage();
+  EXPECT_EQ(buf.peekHead(1024), "GET /next HTTP/1.1\r\n\r\n");
+}
+
+TEST_F(PipeFixture, ChunkedOverflowCarriedToNextMessage)
+{
+  Buffer buf(1 << 16, 1024);
+  const std::string head = "POST / HTTP/1.1\r\n\r\n";
+  send(head + "3\r\nabc\r\n0\r\n\r\nGET / HTTP/1.1\r\n\r\n");
+  readAll(buf);
+  ASSERT_TRUE(buf.removeHeaderAndSetChunked(head.size(), true));
+  EXPECT_TRUE(buf.isEOF());
+  EXPECT_EQ(buf.peek(), "abc");
+
+  int out[2];
+  ASSERT_EQ(pipe(out), 0);
+  EXPECT_EQ(buf.writeSocket(out[1]), 3);
+  close(out[0]);
+  close(out[1]);
+
+  buf.startNextMessage();
+  EXPECT_FALSE(buf.isEOF());
+  EXPECT_EQ(buf.peekHead(1024), "GET / HTTP/1.1\r\n\r\n");
+}
+
+TEST(Buffer, AppendAndWriteInOneCall)
+{
+  Buffer queued;
+  for (int i = 0; i < 3; ++i)
+  {
+    Buffer response;
+    response.insertHeader("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n" + std::to_string(i));
+    queued.append(response);
+    EXPECT_TRUE(response.isEmpty());
+  }
+
+  int out[2];
+  ASSERT_EQ(pipe(out), 0);
+  const ssize_t total = queued.size();
+  EXPECT_EQ(queued.writeSocket(out[1]), total);
+  std::string result(total, '\0');
+  ASSERT_EQ(read(out[0], result.data(), total), total);
+  EXPECT_EQ(result.substr(result.size() - 1), "2");
+  EXPECT_EQ(result.find("0HTTP/1.1 200 OK"), 38u);
+  close(out[0]);
+  close(out[1]);
+}
+
+// Unknown-length output: the framing is added around the body, through partial writes.
+TEST_F(PipeFixture, ChunkedOutputFramesBody)
+{
+  Buffer buf(1 << 20, 1024);
+  const std::string head = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+  std::string body;
+  for (int i = 0; i < 30000; ++i)
+    body.push_back(static_cast<char>('a' + i % 26));
+  ASSERT_TRUE(buf.insertHeader(head));
+  buf.startChunkedOutput(head.size());
+
+  int out[2];
+  ASSERT_EQ(pipe(out), 0);
+  fcntl(out[1], F_SETPIPE_SZ, 4096);
+  fcntl(out[1], F_SETFL, O_NONBLOCK);
+  fcntl(out[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds_[0], F_SETFL, O_NONBLOCK);
+
+  std::string wire;
+  auto drain = [&]()
+  {
+    char tmp[4096];
+    ssize_t n;
+    while ((n = read(out[0], tmp, sizeof(tmp))) > 0)
+      wire.append(tmp, n);
+  };
+  for (size_t pos = 0; pos < body.size(); pos += 3001)
+  {
+    send(body.substr(pos, 3001));
+    while (buf.readFd(fds_[0]) > 0)
+      ;
+    while (buf.writeSocket(out[1]) > 0)
+      drain();
+    drain();
+  }
+  close(fds_[1]);
+  fds_[1] = open("/dev/null", O_WRONLY); // For TearDown
+  EXPECT_EQ(buf.readFd(fds_[0]), EOF_REACHED);
+  while (!buf.isEmpty())
+  {
+    ASSERT_GT(buf.writeSocket(out[1]), 0);
+    drain();
+  }
+  EXPECT_EQ(buf.outputSize(), 0u);
+  close(out[0]);
+  close(out[1]);
+
+  ASSERT_EQ(wire.substr(0, head.size()), head);
+  std::string decoded;
+  size_t pos = head.size();
+  while (true)
+  {
+    const size_t eol = wire.find("\r\n", pos);
+    ASSERT_NE(eol, std::string::npos);
+    const size_t size = std::stoul(wire.substr(pos, eol - pos), nullptr, 16);
+    pos = eol + 2;
+    ASSERT_EQ(wire.substr(pos + size, 2), "\r\n");
+    decoded.append(wire, pos, size);
+    pos += size + 2;
+    if (size == 0)
+      break;
+  }
+  EXPECT_EQ(pos, wire.size());
+  EXPECT_EQ(decoded, body);
+}
+
+// The body of a rejected request is dropped, the pipelined request after it is kept.
+TEST_F(PipeFixture, DiscardRejectedBody)
+{
+  Buffer buf(1 << 16, 16);
+  send("0123456789abcdefghijGET / HTTP/1.1\r\n\r\n");
+  readAll(buf);
+  EXPECT_EQ(buf.discard(20), 20u);
+  EXPECT_EQ(buf.peekHead(1024), "GET / HTTP/1.1\r\n\r\n");
+  EXPECT_EQ(buf.discard(100), 18u);
+  EXPECT_TRUE(buf.isEmpty());
+}
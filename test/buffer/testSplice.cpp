@@ -0,0 +1,245 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include "../../includes/Buffer.hpp"
+
+namespace
+{
+
+  // A body of `size` bytes which is not the same from one block to the next.
+  std::string pattern(size_t size)
+  {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+      data[i] = static_cast<char>('a' + (i * 7 + i / 4096) % 26);
+    return data;
+  }
+
+  // Both ends of a loopback TCP connection, as the server has them.
+  class TcpPair
+  {
+  public:
+    int server = -1;
+    int client = -1;
+
+    TcpPair()
+    {
+      const int listener = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      socklen_t size = sizeof(addr);
+      bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+      listen(listener, 1);
+      getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &size);
+      client = socket(AF_INET, SOCK_STREAM, 0);
+      connect(client, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+      server = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK);
+      close(listener);
+    }
+
+    ~TcpPair()
+    {
+      close(server);
+      close(client);
+    }
+  };
+
+  // Reads `fd` until its EOF.
+  std::string readAll(int fd)
+  {
+    std::string data;
+    char block[65536];
+    ssize_t n;
+    while ((n = read(fd, block, sizeof(block))) > 0)
+      data.append(block, n);
+    return data;
+  }
+
+  // Waits until `fd` is ready for `events`, as the event loop would.
+  void waitFor(int fd, short events)
+  {
+    pollfd pfd{fd, events, 0};
+    ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+  }
+
+} // namespace
+
+// 4 MiB through a 64 KiB pipe: the CGI blocks on the pipe until the socket takes the bytes, none is lost.
+TEST(Splice, CgiBodyLargerThanThePipeReachesTheSocket)
+{
+  const std::string body = pattern(4 << 20);
+  int out[2];
+  ASSERT_EQ(pipe2(out, O_NONBLOCK), 0);
+  fcntl(out[1], F_SETFL, 0);
+  fcntl(out[1], F_SETPIPE_SZ, 65536);
+  TcpPair tcp;
+  ASSERT_NE(tcp.server, -1);
+
+  std::thread cgi([&]
+                  { ASSERT_EQ(write(out[1], body.data(), body.size()), static_cast<ssize_t>(body.size())); close(out[1]); });
+  std::string received;
+  std::thread client([&]
+                     { received = readAll(tcp.client); });
+
+  size_t sent = 0;
+  while (true)
+  {
+    const ssize_t moved = Buffer::spliceFd(out[0], tcp.server, CGI_SPLICE_SIZE);
+    ASSERT_NE(moved, RW_ERROR);
+    ASSERT_NE(moved, SPLICE_UNSUPPORTED);
+    if (moved == EOF_REACHED)
+      break;
+    if (moved == SPLICE_AGAIN)
+    {
+      pollfd pfds[2] = {{out[0], POLLIN, 0}, {tcp.server, POLLOUT, 0}};
+      ASSERT_GT(poll(pfds, 2, 5000), 0);
+      continue;
+    }
+    sent += moved;
+  }
+  shutdown(tcp.server, SHUT_WR);
+  cgi.join();
+  client.join();
+  close(out[0]);
+
+  EXPECT_EQ(sent, body.size());
+  EXPECT_TRUE(received == body);
+}
+
+// `O_APPEND` makes `splice` fail with EINVAL: nothing leaves the pipe, and the buffered copy sends it all.
+TEST(Splice, UnsupportedFdFallsBackToTheBuffer)
+{
+  const std::string path = std::filesystem::temp_directory_path() / ("splice_" + std::to_string(getpid()));
+  const int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+  ASSERT_NE(file, -1);
+  int out[2];
+  ASSERT_EQ(pipe2(out, O_NONBLOCK), 0);
+  const std::string body = pattern(40000);
+  ASSERT_EQ(write(out[1], body.data(), body.size()), static_cast<ssize_t>(body.size()));
+  close(out[1]);
+
+  EXPECT_EQ(Buffer::spliceFd(out[0], file, CGI_SPLICE_SIZE), SPLICE_UNSUPPORTED);
+
+  Buffer buf;
+  ssize_t n;
+  while ((n = buf.readFd(out[0])) > 0 || n == BUFFER_FULL)
+  {
+    waitFor(file, POLLOUT);
+    while (!buf.isEmpty())
+      ASSERT_GT(buf.writeSocket(file), 0);
+  }
+  EXPECT_EQ(n, EOF_REACHED);
+  close(out[0]);
+  close(file);
+
+  std::ifstream in(path, std::ios::binary);
+  const std::string written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  EXPECT_TRUE(written == body);
+  std::filesystem::remove(path);
+}
+
+// An upload of known length: socket to pipe to file, as `spliceRequestBody` and the I/O pool do it.
+// The socket is empty first, then holds less than asked, and the next pipelined request stays in it.
+TEST(Splice, UploadBodyReachesTheFileThroughThePipe)
+{
+  const std::string path = std::filesystem::temp_directory_path() / ("upload_" + std::to_string(getpid()));
+  const int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  ASSERT_NE(file, -1);
+  int body_pipe[2];
+  ASSERT_EQ(pipe2(body_pipe, O_NONBLOCK), 0);
+  fcntl(body_pipe[1], F_SETPIPE_SZ, 65536);
+  TcpPair tcp;
+  ASSERT_NE(tcp.server, -1);
+  const std::string body = pattern(3 << 20);
+  const std::string next = "GET /next HTTP/1.1\r\n\r\n";
+
+  EXPECT_EQ(Buffer::spliceFd(tcp.server, body_pipe[1], BODY_SPLICE_SIZE), SPLICE_AGAIN);
+
+  ASSERT_EQ(write(tcp.client, body.data(), 1000), 1000);
+  waitFor(tcp.server, POLLIN);
+  ASSERT_EQ(Buffer::spliceFd(tcp.server, body_pipe[1], BODY_SPLICE_SIZE), 1000);
+  ASSERT_EQ(Buffer::drainPipe(body_pipe[0], file, 1000), 1000);
+
+  std::thread client([&]
+                     { const std::string rest = body.substr(1000) + next;
+                       ASSERT_EQ(write(tcp.client, rest.data(), rest.size()), static_cast<ssize_t>(rest.size())); });
+  size_t left = body.size() - 1000;
+  while (left > 0)
+  {
+    const ssize_t moved = Buffer::spliceFd(tcp.server, body_pipe[1], std::min(left, BODY_SPLICE_SIZE));
+    if (moved == SPLICE_AGAIN)
+    {
+      waitFor(tcp.server, POLLIN);
+      continue;
+    }
+    ASSERT_GT(moved, 0);
+    ASSERT_EQ(Buffer::drainPipe(body_pipe[0], file, moved), moved);
+    left -= moved;
+  }
+  client.join();
+  close(body_pipe[0]);
+  close(body_pipe[1]);
+  close(file);
+
+  std::ifstream in(path, std::ios::binary);
+  const std::string written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  EXPECT_TRUE(written == body);
+  std::filesystem::remove(path);
+
+  waitFor(tcp.server, POLLIN);
+  char rest[64];
+  EXPECT_EQ(std::string(rest, read(tcp.server, rest, sizeof(rest))), next);
+}
+
+// A CGI body goes from the socket straight into the input pipe, a CGI reading slowly makes the splice wait.
+TEST(Splice, CgiInputGetsTheBodyFromTheSocket)
+{
+  int in[2];
+  ASSERT_EQ(pipe2(in, O_NONBLOCK), 0);
+  fcntl(in[0], F_SETFL, 0);
+  fcntl(in[1], F_SETPIPE_SZ, 65536);
+  TcpPair tcp;
+  ASSERT_NE(tcp.server, -1);
+  const std::string body = pattern(2 << 20);
+
+  std::thread client([&]
+                     { ASSERT_EQ(write(tcp.client, body.data(), body.size()), static_cast<ssize_t>(body.size())); });
+  std::string received;
+  std::thread cgi([&]
+                  {
+                    char block[4096];
+                    ssize_t n;
+                    while ((n = read(in[0], block, sizeof(block))) > 0)
+                    {
+                      received.append(block, n);
+                      if (received.size() % (256 * 1024) < sizeof(block))
+                        usleep(1000);
+                    } });
+
+  size_t left = body.size();
+  while (left > 0)
+  {
+    const ssize_t moved = Buffer::spliceFd(tcp.server, in[1], std::min(left, BODY_SPLICE_SIZE));
+    if (moved == SPLICE_AGAIN)
+    {
+      pollfd pfds[2] = {{tcp.server, POLLIN, 0}, {in[1], POLLOUT, 0}};
+      ASSERT_GT(poll(pfds, 2, 5000), 0);
+      continue;
+    }
+    ASSERT_GT(moved, 0);
+    left -= moved;
+  }
+  close(in[1]);
+  client.join();
+  cgi.join();
+  close(in[0]);
+
+  EXPECT_TRUE(received == body);
+}
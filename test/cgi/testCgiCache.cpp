@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <map>
+#include <poll.h>
+#include <unistd.h>
+#include "../../includes/CgiCache.hpp"
+
+TEST(CgiCache, TtlFromHeader)
+{
+  EXPECT_EQ(cgiCacheTtl("Content-Type: text/plain\r\n\r\nbody", 10), 10);
+  EXPECT_EQ(cgiCacheTtl("Content-Type: text/plain\n\nbody", 10), 10);
+  EXPECT_EQ(cgiCacheTtl("Status: 200 OK\r\nCache-Control: public, max-age=3\r\n\r\n", 10), 3);
+  EXPECT_EQ(cgiCacheTtl("Cache-Control: max-age=60\r\n\r\n", 10), 10);
+}
+
+TEST(CgiCache, UncacheableOutputs)
+{
+  EXPECT_EQ(cgiCacheTtl("Content-Type: text/plain\r\n", 10), 0);
+  EXPECT_EQ(cgiCacheTtl("Status: 404 Not Found\r\n\r\n", 10), 0);
+  EXPECT_EQ(cgiCacheTtl("Cache-Control: No-Store\r\n\r\n", 10), 0);
+  EXPECT_EQ(cgiCacheTtl("Cache-Control: public, no-cache\r\n\r\n", 10), 0);
+  EXPECT_EQ(cgiCacheTtl("Cache-Control: private\r\n\r\n", 10), 0);
+  EXPECT_EQ(cgiCacheTtl("Set-Cookie: id=1\r\n\r\n", 10), 0);
+  EXPECT_EQ(cgiCacheTtl("Cache-Control: max-age=0\r\n\r\n", 10), 0);
+}
+
+/**
+ * @brief The output a fake CGI writes to its pipe, then it closes it.
+ */
+typedef struct s_fake_cgi
+{
+  int fd;
+  std::string output;
+  size_t sent;
+} t_fake_cgi;
+
+/**
+ * @brief A request served by the cache, its output read as the connection would.
+ */
+typedef struct s_cache_client
+{
+  t_file res;
+  std::string output;
+  bool is_done;
+} t_cache_client;
+
+/**
+ * @brief Keeps the fds the cache registers and drops the ones it unregisters, as the main loop would.
+ */
+class CacheLoop
+{
+public:
+  EpollHelper epoll;
+  ChildReaper children;
+  CgiCache cache;
+  std::map<int, std::shared_ptr<RaiiFd>> fds;
+
+  CacheLoop() : epoll(), children(epoll), cache(epoll, children), fds() {}
+
+  void apply(const t_msg_from_serv &msg)
+  {
+    for (const auto &fd : msg.fds_to_register)
+      fds[fd->get()] = fd;
+    for (int fd : msg.fds_to_unregister)
+      fds.erase(fd);
+  }
+
+  t_cache_client start(const std::string &key, t_fake_cgi &cgi, std::string output, size_t max_size = 1024 * 1024)
+  {
+    int out[2];
+    EXPECT_EQ(pipe2(out, O_NONBLOCK | O_CLOEXEC), 0);
+    cgi = {out[1], std::move(output), 0};
+    t_cache_client client = {{nullptr, std::make_shared<RaiiFd>(epoll, out[0]), 0, 0, false, "", "", -1, nullptr, nullptr, nullptr, nullptr}, "", false};
+    apply(cache.startFlight(key, t_cgi_cache_config{100, max_size}, client.res, 10));
+    return client;
+  }
+
+  bool join(const std::string &key, t_cache_client &client)
+  {
+    client = {};
+    t_msg_from_serv msg;
+    const bool joined = cache.join(key, client.res, msg);
+    apply(msg);
+    return joined;
+  }
+
+  /**
+   * @brief Runs the CGIs and the events of the cache till every client read its EOF.
+   */
+  void pump(std::vector<t_fake_cgi *> cgis, std::vector<t_cache_client *> clients)
+  {
+    char buf[65536];
+    for (int round = 0; round < 100000; ++round)
+    {
+      for (t_fake_cgi *cgi : cgis)
+      {
+        if (cgi->fd == -1)
+          continue;
+        const ssize_t n = write(cgi->fd, cgi->output.data() + cgi->sent, cgi->output.size() - cgi->sent);
+        if (n > 0)
+          cgi->sent += n;
+        if (cgi->sent == cgi->output.size())
+        {
+          close(cgi->fd);
+          cgi->fd = -1;
+        }
+      }
+
+      std::vector<int> owned;
+      for (const auto &[fd, raii] : fds)
+        owned.push_back(fd);
+      for (int fd : owned)
+      {
+        pollfd pfd = {fd, POLLIN | POLLOUT, 0};
+        if (!cache.owns(fd) || poll(&pfd, 1, 0) != 1)
+          continue;
+        const t_event_type event = (pfd.revents & POLLIN) ? READ_EVENT : (pfd.revents & POLLOUT) ? WRITE_EVENT : ERROR_EVENT;
+        apply(cache.handleEvent(fd, event));
+      }
+
+      bool is_done = true;
+      for (t_cache_client *client : clients)
+      {
+        ssize_t n;
+        while (!client->is_done && (n = read(client->res.FD_handler_OUT->get(), buf, sizeof(buf))) >= 0)
+        {
+          client->output.append(buf, n);
+          client->is_done = n == 0;
+        }
+        is_done = is_done && client->is_done;
+      }
+      if (is_done)
+        return;
+    }
+    FAIL() << "the clients did not get their EOF";
+  }
+};
+
+TEST(CgiCache, CollapsesIdenticalRequestsIntoOneFlight)
+{
+  CacheLoop loop;
+  const std::string output = "Content-Type: text/plain\r\n\r\n" + std::string(2 * 1024 * 1024, 'x'); // Past the lag of a reader
+  t_fake_cgi cgi;
+  t_cache_client first = loop.start("0 GET /a", cgi, output, 4 * 1024 * 1024);
+
+  t_cache_client second, third;
+  ASSERT_TRUE(loop.join("0 GET /a", second));
+  ASSERT_TRUE(loop.join("0 GET /a", third));
+  t_cache_client other;
+  EXPECT_FALSE(loop.join("0 GET /b", other));
+  loop.pump({&cgi}, {&first, &second, &third});
+  EXPECT_EQ(first.output, output);
+  EXPECT_EQ(second.output, output);
+  EXPECT_EQ(third.output, output);
+  EXPECT_EQ(loop.cache.storedBytes(), output.size());
+
+  // Stored, no CGI runs for the next one.
+  t_cache_client later;
+  ASSERT_TRUE(loop.join("0 GET /a", later));
+  loop.pump({}, {&later});
+  EXPECT_EQ(later.output, output);
+}
+
+TEST(CgiCache, EvictsTheEntriesExpiringFirst)
+{
+  CacheLoop loop;
+  const std::string body(CGI_CACHE_MAX_BYTES * 2 / 5, 'x');
+  t_fake_cgi a, b, c;
+  t_cache_client client_a = loop.start("0 GET /a", a, "Cache-Control: max-age=100\r\n\r\n" + body, CGI_CACHE_MAX_BYTES);
+  t_cache_client client_b = loop.start("0 GET /b", b, "Cache-Control: max-age=50\r\n\r\n" + body, CGI_CACHE_MAX_BYTES);
+  loop.pump({&a, &b}, {&client_a, &client_b});
+  t_cache_client client_c = loop.start("0 GET /c", c, "Cache-Control: max-age=100\r\n\r\n" + body, CGI_CACHE_MAX_BYTES);
+  loop.pump({&c}, {&client_c});
+
+  // /b is newer than /a, but goes stale first.
+  EXPECT_EQ(loop.cache.storedBytes(), a.output.size() + c.output.size());
+  t_cache_client joined;
+  EXPECT_FALSE(loop.join("0 GET /b", joined));
+  EXPECT_TRUE(loop.join("0 GET /a", joined));
+}
+
+TEST(CgiCache, SweepsExpiredEntriesBehindLongerLivedOnes)
+{
+  CacheLoop loop;
+  const time_t now = time(NULL);
+  t_fake_cgi a, b;
+  t_cache_client client_a = loop.start("0 GET /a", a, "Cache-Control: max-age=100\r\n\r\nlong");
+  loop.pump({&a}, {&client_a});
+  t_cache_client client_b = loop.start("0 GET /b", b, "Cache-Control: max-age=1\r\n\r\nshort");
+  loop.pump({&b}, {&client_b});
+  EXPECT_EQ(loop.cache.storedBytes(), a.output.size() + b.output.size());
+
+  loop.cache.tick(now + 10);
+  EXPECT_EQ(loop.cache.storedBytes(), a.output.size());
+  loop.cache.tick(now + 1000);
+  EXPECT_EQ(loop.cache.storedBytes(), 0u);
+}
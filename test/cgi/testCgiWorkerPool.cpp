@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <poll.h>
+#include <unistd.h>
+#include "../../includes/CgiWorkerPool.hpp"
+
+static std::vector<t_server_config> preforkConfig(const std::string &interpreter, const std::string &root)
+{
+  t_server_config server{};
+  server.is_cgi = true;
+  server.cgi_paths[".py"] = t_cgi_config{root, interpreter, "", {1, 2, 2, 60}, {0, 0}, ""};
+  return {server};
+}
+
+static std::shared_ptr<t_cgi_job> makeJob(EpollHelper &epoll, const std::string &root, const std::string &script, int *body_fd, int *output_fd)
+{
+  int in[2];
+  int out[2];
+  EXPECT_EQ(pipe(in), 0);
+  EXPECT_EQ(pipe(out), 0);
+  *body_fd = in[1];
+  *output_fd = out[0];
+
+  auto job = std::make_shared<t_cgi_job>();
+  job->group = "/usr/bin/python3";
+  job->message = "Q" + root + '\0' + script + '\0' + "REQUEST_METHOD=POST";
+  job->stdin_fd = std::make_shared<RaiiFd>(epoll, in[0]);
+  job->stdout_fd = std::make_shared<RaiiFd>(epoll, out[1]);
+  job->max_duration = 10;
+  return job;
+}
+
+static std::string readAll(int fd)
+{
+  std::string out;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    out.append(buf, n);
+  return out;
+}
+
+/**
+ * @brief Delivers the messages of a worker to the pool, as the main loop would, until `done`.
+ */
+static void pump(CgiWorkerPool &pool, t_msg_from_serv msg, const std::function<bool()> &done)
+{
+  std::vector<int> fds;
+  for (const auto &fd : msg.fds_to_register)
+    fds.push_back(fd->get());
+  for (int round = 0; round < 100 && !done(); ++round)
+  {
+    for (int fd : fds)
+    {
+      pollfd pfd = {fd, POLLIN, 0};
+      if (pool.owns(fd) && poll(&pfd, 1, 100) == 1)
+      {
+        t_msg_from_serv next = pool.handleEvent(fd, (pfd.revents & POLLIN) ? READ_EVENT : ERROR_EVENT);
+        for (const auto &new_fd : next.fds_to_register)
+          fds.push_back(new_fd->get());
+        msg.fds_to_register.insert(msg.fds_to_register.end(), next.fds_to_register.begin(), next.fds_to_register.end());
+      }
+    }
+  }
+}
+
+TEST(CgiWorkerPool, RunsScriptsInAWorker)
+{
+  if (access("/usr/bin/python3", X_OK) != 0)
+    GTEST_SKIP() << "no /usr/bin/python3";
+
+  const std::string root = std::filesystem::temp_directory_path() / "webserv-prefork-test";
+  std::filesystem::create_directories(root);
+  std::ofstream(root + "/echo.py") << "import os, sys\nprint('Content-Type: text/plain\\r\\n\\r\\n' + os.environ['REQUEST_METHOD'] + ':' + sys.stdin.read(), end='')\n";
+
+  EpollHelper epoll;
+  CgiWorkerPool pool(epoll, preforkConfig("/usr/bin/python3", root));
+  t_msg_from_serv msg = pool.tick(time(NULL));
+  ASSERT_EQ(msg.fds_to_register.size(), 1u); // `min_workers`
+  const int worker_fd = msg.fds_to_register.front()->get();
+
+  // The same worker serves the requests in turn, till `max_requests`.
+  for (int i = 0; i < 2; ++i)
+  {
+    int body_fd;
+    int output_fd;
+    t_msg_from_serv submitted = pool.submit(makeJob(epoll, root, "echo.py", &body_fd, &output_fd));
+    EXPECT_TRUE(submitted.fds_to_register.empty());
+    ASSERT_EQ(write(body_fd, "hi", 2), 2);
+    close(body_fd);
+    pump(pool, msg, [output_fd]
+         { pollfd pfd = {output_fd, POLLIN, 0}; return poll(&pfd, 1, 0) == 1; });
+    EXPECT_EQ(readAll(output_fd), "Content-Type: text/plain\r\n\r\nPOST:hi");
+    close(output_fd);
+  }
+  pump(pool, msg, [&pool, worker_fd]
+       { return !pool.owns(worker_fd); });
+  EXPECT_FALSE(pool.owns(worker_fd));
+
+  std::filesystem::remove_all(root);
+}
+
+TEST(CgiWorkerPool, MissingInterpreterAnswersBadGateway)
+{
+  EpollHelper epoll;
+  CgiWorkerPool pool(epoll, preforkConfig("/nonexistent/python3", "/tmp"));
+
+  int body_fd;
+  int output_fd;
+  auto job = makeJob(epoll, "/tmp", "echo.py", &body_fd, &output_fd);
+  job->group = "/nonexistent/python3";
+  t_msg_from_serv msg = pool.submit(job);
+  ASSERT_EQ(msg.fds_to_register.size(), 1u);
+  job = nullptr;
+
+  pump(pool, msg, [output_fd]
+       { pollfd pfd = {output_fd, POLLIN, 0}; return poll(&pfd, 1, 0) == 1; });
+  EXPECT_EQ(readAll(output_fd), "Status: 502 Bad Gateway\r\nContent-Length: 0\r\n\r\n");
+  close(body_fd);
+  close(output_fd);
+}
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <unistd.h>
+#include "../../includes/ChildReaper.hpp"
+
+// Returns once the child has set its signals up, so a stop never races them.
+static pid_t spawnSleeper(bool ignore_term)
+{
+  int ready[2];
+  if (pipe(ready) == -1)
+    return -1;
+  const pid_t pid = fork();
+  if (pid == 0)
+  {
+    if (ignore_term)
+      signal(SIGTERM, SIG_IGN);
+    close(ready[1]);
+    pause();
+    _exit(0);
+  }
+  close(ready[1]);
+  char c;
+  (void)!read(ready[0], &c, 1);
+  close(ready[0]);
+  return pid;
+}
+
+static bool waitExit(int pidfd, int timeout_ms)
+{
+  pollfd pfd = {pidfd, POLLIN, 0};
+  return poll(&pfd, 1, timeout_ms) == 1;
+}
+
+TEST(ChildReaper, StopEscalatesToKill)
+{
+  EpollHelper epoll;
+  ChildReaper reaper(epoll);
+
+  const pid_t pid = spawnSleeper(true);
+  ASSERT_GT(pid, 0);
+  t_msg_from_serv msg = reaper.watch(pid);
+  ASSERT_EQ(msg.fds_to_register.size(), 1u);
+  const int pidfd = msg.fds_to_register.front()->get();
+  EXPECT_TRUE(reaper.owns(pidfd));
+
+  const time_t now = time(NULL);
+  reaper.stop(pid, now);
+  EXPECT_FALSE(waitExit(pidfd, 200)); // SIGTERM is ignored
+  reaper.tick(now + CGI_KILL_GRACE - 1);
+  EXPECT_FALSE(waitExit(pidfd, 100));
+  reaper.tick(now + CGI_KILL_GRACE);
+  ASSERT_TRUE(waitExit(pidfd, 2000));
+
+  msg = reaper.handleEvent(pidfd, READ_EVENT);
+  ASSERT_EQ(msg.fds_to_unregister.size(), 1u);
+  EXPECT_FALSE(reaper.owns(pidfd));
+  EXPECT_EQ(waitpid(pid, NULL, WNOHANG), -1); // Reaped
+}
+
+TEST(ChildReaper, RunningChildIsKept)
+{
+  EpollHelper epoll;
+  ChildReaper reaper(epoll);
+
+  const pid_t pid = spawnSleeper(false);
+  ASSERT_GT(pid, 0);
+  t_msg_from_serv msg = reaper.watch(pid);
+  ASSERT_EQ(msg.fds_to_register.size(), 1u);
+  const int pidfd = msg.fds_to_register.front()->get();
+
+  EXPECT_TRUE(reaper.handleEvent(pidfd, READ_EVENT).fds_to_unregister.empty());
+  EXPECT_TRUE(reaper.owns(pidfd));
+  reaper.stop(pid, time(NULL)); // SIGTERM ends it, the destructor reaps it
+  ASSERT_TRUE(waitExit(pidfd, 2000));
+}
@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../includes/Buffer.hpp"
+#include "../../includes/ChunkedDecoder.hpp"
+
+namespace
+{
+
+  // Feeds `parts` one by one, returns the decoded body, or "<error>".
+  std::string decodeParts(const std::vector<std::string> &parts, std::string *rest = nullptr)
+  {
+    ChunkedDecoder decoder;
+    std::string body;
+    for (const auto &part : parts)
+    {
+      std::string_view input(part);
+      while (!input.empty() && !decoder.isDone())
+      {
+        std::string_view span;
+        input.remove_prefix(decoder.next(input, span));
+        if (decoder.isError())
+          return "<error>";
+        body.append(span);
+      }
+      if (rest)
+        rest->append(input);
+    }
+    return decoder.isDone() ? body : "<incomplete>";
+  }
+
+  const std::string ENCODED =
+      "5;name=value\r\nhello\r\n"
+      "1\r\n \r\n"
+      "0000000b\r\nhello world\r\n"
+      "0;last\r\n"
+      "Expires: never\r\n"
+      "X-Checksum: 42\r\n"
+      "\r\n";
+  const std::string DECODED = "hello hello world";
+
+} // namespace
+
+TEST(ChunkedDecoder, WholeInput)
+{
+  std::string rest;
+  EXPECT_EQ(decodeParts({ENCODED + "GET /"}, &rest), DECODED);
+  EXPECT_EQ(rest, "GET /");
+}
+
+TEST(ChunkedDecoder, EverySplitPoint)
+{
+  for (size_t i = 0; i <= ENCODED.size(); ++i)
+  {
+    for (size_t j = i; j <= ENCODED.size(); ++j)
+    {
+      ASSERT_EQ(decodeParts({ENCODED.substr(0, i), ENCODED.substr(i, j - i), ENCODED.substr(j)}), DECODED)
+          << "split at " << i << " and " << j;
+    }
+  }
+}
+
+TEST(ChunkedDecoder, ByteByByte)
+{
+  std::vector<std::string> parts;
+  for (char c : ENCODED)
+    parts.push_back(std::string(1, c));
+  EXPECT_EQ(decodeParts(parts), DECODED);
+}
+
+TEST(ChunkedDecoder, MalformedInput)
+{
+  EXPECT_EQ(decodeParts({"\r\n"}), "<error>");                          // no size
+  EXPECT_EQ(decodeParts({"g\r\n"}), "<error>");                         // not hex
+  EXPECT_EQ(decodeParts({"5\nhello\r\n0\r\n\r\n"}), "<error>");         // bare LF
+  EXPECT_EQ(decodeParts({"5\r\nhelloX\r\n0\r\n\r\n"}), "<error>");      // data longer than the size
+  EXPECT_EQ(decodeParts({"10000000000000000\r\n"}), "<error>");         // overflow
+  EXPECT_EQ(decodeParts({"1;\x01\r\n"}), "<error>");                    // control char in extension
+  EXPECT_EQ(decodeParts({"0\r\nbad\n\r\n"}), "<error>");                // bare LF in trailer
+  EXPECT_EQ(decodeParts({"1" + std::string(MAX_CHUNK_LINE_SIZE, ' ')}), "<error>");
+  EXPECT_EQ(decodeParts({"0\r\nX: " + std::string(MAX_TRAILER_SIZE, 'a')}), "<error>");
+  EXPECT_EQ(decodeParts({"5\r\nhel"}), "<incomplete>");
+}
+
+// A client sending 1-byte chunks: the body must be decoded in place, read after read.
+TEST(ChunkedDecoder, BufferWithTinyChunks)
+{
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+  const std::string head = "POST /upload HTTP/1.1\r\n\r\n";
+  std::string body;
+  std::string encoded;
+  for (int i = 0; i < 3000; ++i)
+  {
+    const char c = static_cast<char>('a' + i % 26);
+    body.push_back(c);
+    encoded += "1\r\n";
+    encoded.push_back(c);
+    encoded += "\r\n";
+  }
+  encoded += "0\r\n\r\n";
+
+  Buffer buf(1 << 20, 1024);
+  const std::string first = head + encoded.substr(0, 100);
+  ASSERT_EQ(write(fds[1], first.data(), first.size()), static_cast<ssize_t>(first.size()));
+  ASSERT_EQ(buf.readFd(fds[0]), static_cast<ssize_t>(first.size()));
+  ASSERT_TRUE(buf.removeHeaderAndSetChunked(head.size(), true));
+
+  // Odd-sized writes, so the framing is split everywhere across reads.
+  for (size_t pos = 100; pos < encoded.size(); pos += 97)
+  {
+    const std::string part = encoded.substr(pos, 97);
+    ASSERT_EQ(write(fds[1], part.data(), part.size()), static_cast<ssize_t>(part.size()));
+    const ssize_t decoded = buf.readFd(fds[0]);
+    ASSERT_TRUE(decoded > 0 || decoded == CHUNKED_NO_BODY);
+  }
+  EXPECT_TRUE(buf.isEOF());
+  EXPECT_EQ(buf.size(), body.size());
+
+  int out[2];
+  ASSERT_EQ(pipe(out), 0);
+  fcntl(out[1], F_SETPIPE_SZ, 1 << 16);
+  std::string result;
+  while (!buf.isEmpty())
+  {
+    ASSERT_GT(buf.writeSocket(out[1]), 0);
+    char tmp[4096];
+    ssize_t n = read(out[0], tmp, sizeof(tmp));
+    result.append(tmp, n);
+  }
+  EXPECT_EQ(result, body);
+
+  close(fds[0]);
+  close(fds[1]);
+  close(out[0]);
+  close(out[1]);
+}
+
+TEST(ChunkedDecoder, BufferRejectsMalformedBody)
+{
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  const std::string request = "POST / HTTP/1.1\r\n\r\nz\r\n";
+  ASSERT_EQ(write(fds[1], request.data(), request.size()), static_cast<ssize_t>(request.size()));
+
+  Buffer buf;
+  ASSERT_EQ(buf.readFd(fds[0]), static_cast<ssize_t>(request.size()));
+  EXPECT_FALSE(buf.removeHeaderAndSetChunked(request.size() - 3, true));
+  close(fds[0]);
+  close(fds[1]);
+}
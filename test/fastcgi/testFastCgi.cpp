@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../includes/FastCgiPool.hpp"
+
+TEST(FastCgi, RecordHeader)
+{
+  std::string out;
+  fcgiAppendRecord(out, FCGI_STDIN, 0x0102, "abc");
+  ASSERT_EQ(out.size(), FCGI_HEADER_SIZE + 3);
+  EXPECT_EQ(out.substr(0, FCGI_HEADER_SIZE), std::string("\x01\x05\x01\x02\x00\x03\x00\x00", 8));
+  EXPECT_EQ(out.substr(FCGI_HEADER_SIZE), "abc");
+}
+
+TEST(FastCgi, ParamsRoundTrip)
+{
+  const std::string long_value(300, 'v');
+  std::string encoded;
+  fcgiAppendParam(encoded, "REQUEST_METHOD", "GET");
+  fcgiAppendParam(encoded, "HTTP_X_LONG", long_value);
+  fcgiAppendParam(encoded, "EMPTY", "");
+
+  // Short lengths take one byte, long ones four with the high bit set.
+  EXPECT_EQ(encoded.substr(0, 2), std::string("\x0e\x03", 2));
+  EXPECT_EQ(static_cast<uint8_t>(encoded[2 + 14 + 3 + 1]), 0x80);
+
+  std::unordered_map<std::string, std::string> params;
+  ASSERT_TRUE(fcgiParseParams(encoded, params));
+  EXPECT_EQ(params.size(), 3u);
+  EXPECT_EQ(params["REQUEST_METHOD"], "GET");
+  EXPECT_EQ(params["HTTP_X_LONG"], long_value);
+  EXPECT_EQ(params["EMPTY"], "");
+
+  EXPECT_FALSE(fcgiParseParams(encoded.substr(0, encoded.size() - 1), params));
+}
+
+TEST(FastCgi, UnreachableApplicationAnswersBadGateway)
+{
+  EpollHelper epoll;
+  FastCgiPool pool(epoll);
+
+  int body[2];
+  int output[2];
+  ASSERT_EQ(pipe2(body, O_NONBLOCK), 0);
+  ASSERT_EQ(pipe2(output, O_NONBLOCK), 0);
+
+  auto job = std::make_shared<t_fcgi_job>();
+  job->address = "unix:/nonexistent/webserv-test.sock";
+  job->content_length = 0;
+  job->body_fd = std::make_shared<RaiiFd>(epoll, body[0]);
+  job->output_fd = std::make_shared<RaiiFd>(epoll, output[1]);
+  job->conn_fd = -1;
+  job->body_sent = 0;
+  job->output_started = false;
+  job->is_ended = false;
+  job->is_aborted = false;
+
+  t_msg_from_serv msg = pool.submit(job);
+  EXPECT_EQ(msg.fds_to_register.size(), 2u);
+  EXPECT_EQ(msg.fds_to_unregister.size(), 2u); // Both pipes are done with.
+  EXPECT_FALSE(pool.owns(body[0]));
+
+  char buf[128];
+  const ssize_t n = read(output[0], buf, sizeof(buf));
+  ASSERT_GT(n, 0);
+  EXPECT_EQ(std::string_view(buf, n), FCGI_BAD_GATEWAY);
+
+  close(body[1]);
+  close(output[0]);
+}
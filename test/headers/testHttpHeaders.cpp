@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include "../../includes/HttpHeaders.hpp"
+#include "../../includes/HttpRequests.hpp"
+
+TEST(HttpHeaders, EveryKnownNameMapsToItsId)
+{
+  for (size_t id = 0; id < HDR_COUNT; ++id)
+    EXPECT_EQ(headerIdOf(KNOWN_HEADER_NAMES[id]), static_cast<t_header_id>(id));
+}
+
+TEST(HttpHeaders, UnknownNamesAreRejected)
+{
+  EXPECT_EQ(headerIdOf(""), HDR_UNKNOWN);
+  EXPECT_EQ(headerIdOf("x-request-id"), HDR_UNKNOWN);
+  EXPECT_EQ(headerIdOf("Host"), HDR_UNKNOWN); // names are expected lowercase
+  EXPECT_EQ(headerIdOf("hostt"), HDR_UNKNOWN);
+}
+
+TEST(HttpHeaders, KnownAndUnknownStorage)
+{
+  HttpHeaders headers;
+  headers.set("content-length", "42");
+  headers.set("x-trace", "abc");
+
+  ASSERT_NE(headers.find(HDR_CONTENT_LENGTH), nullptr);
+  EXPECT_EQ(*headers.find(HDR_CONTENT_LENGTH), "42");
+  EXPECT_EQ(headers.at("content-length"), "42");
+  EXPECT_EQ(headers.at("x-trace"), "abc");
+  EXPECT_FALSE(headers.contains(HDR_HOST));
+  EXPECT_THROW(headers.at(HDR_HOST), std::out_of_range);
+  EXPECT_EQ(headers.size(), 2u);
+
+  headers["x-trace"] = "def";
+  EXPECT_EQ(headers.at("x-trace"), "def");
+  EXPECT_EQ(headers.size(), 2u);
+
+  headers.erase(HDR_CONTENT_LENGTH);
+  EXPECT_FALSE(headers.contains("content-length"));
+}
+
+TEST(HttpHeaders, ParserFillsKnownSlots)
+{
+  std::string request =
+      "GET /index.html HTTP/1.1\r\n"
+      "Host: example.com:8080\r\n"
+      "Connection: close\r\n"
+      "X-Custom: Value\r\n"
+      "\r\n";
+
+  HttpRequests parser;
+  parser.httpParser(request);
+  const HttpHeaders &headers = parser.getrequestHeaderMap();
+  EXPECT_EQ(headers.at(HDR_CONNECTION), "close");
+  EXPECT_EQ(headers.at(HDR_SERVERNAME), "example.com");
+  EXPECT_EQ(headers.at(HDR_REQUESTPORT), "8080");
+  EXPECT_EQ(headers.at("x-custom"), "value");
+}
@@ -0,0 +1,272 @@
+#include <gtest/gtest.h>
+#include "../../includes/Hpack.hpp"
+#include "../../includes/Http2Session.hpp"
+
+namespace
+{
+
+  std::string fromHex(std::string_view hex)
+  {
+    std::string out;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2)
+      out.push_back(static_cast<char>(std::stoi(std::string(hex.substr(i, 2)), nullptr, 16)));
+    return out;
+  }
+
+  std::string frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload)
+  {
+    std::string out;
+    out.push_back(static_cast<char>(payload.size() >> 16));
+    out.push_back(static_cast<char>(payload.size() >> 8));
+    out.push_back(static_cast<char>(payload.size()));
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(flags));
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out.push_back(static_cast<char>(stream_id >> shift));
+    return out.append(payload);
+  }
+
+  typedef struct s_frame
+  {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+    std::string payload;
+  } t_frame;
+
+  std::vector<t_frame> parseFrames(std::string_view in)
+  {
+    std::vector<t_frame> frames;
+    while (in.size() >= 9)
+    {
+      const size_t length = (size_t(uint8_t(in[0])) << 16) | (size_t(uint8_t(in[1])) << 8) | uint8_t(in[2]);
+      const uint32_t id = (uint32_t(uint8_t(in[5])) << 24) | (uint32_t(uint8_t(in[6])) << 16) | (uint32_t(uint8_t(in[7])) << 8) | uint8_t(in[8]);
+      frames.push_back({uint8_t(in[3]), uint8_t(in[4]), id, std::string(in.substr(9, length))});
+      in.remove_prefix(9 + length);
+    }
+    return frames;
+  }
+
+} // namespace
+
+TEST(Hpack, HuffmanRoundTrip)
+{
+  const std::string input = "custom-key: custom-value; Mon, 21 Oct 2013 20:13:21 GMT \x01\xff";
+  std::string encoded;
+  huffmanEncode(input, encoded);
+  EXPECT_EQ(encoded.size(), huffmanEncodedSize(input));
+
+  std::string decoded;
+  ASSERT_TRUE(huffmanDecode(encoded, decoded));
+  EXPECT_EQ(decoded, input);
+
+  // RFC 7541 C.4.1: "www.example.com".
+  decoded.clear();
+  ASSERT_TRUE(huffmanDecode(fromHex("f1e3c2e5f23a6ba0ab90f4ff"), decoded));
+  EXPECT_EQ(decoded, "www.example.com");
+}
+
+TEST(Hpack, HuffmanRejectsBadPadding)
+{
+  std::string decoded;
+  EXPECT_FALSE(huffmanDecode(fromHex("f1e3c2e5f23a6ba0ab90f4ffff"), decoded)); // More than 7 bits of padding.
+  EXPECT_FALSE(huffmanDecode(fromHex("00"), decoded));                         // Padding of zeros.
+}
+
+TEST(Hpack, DecodesRfcRequestExamples)
+{
+  HpackDecoder decoder;
+  t_header_list fields;
+
+  // RFC 7541 C.4.1 and C.4.2, the second block refers to the dynamic table filled by the first.
+  ASSERT_EQ(decoder.decode(fromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff"), fields), HPACK_OK);
+  ASSERT_EQ(decoder.decode(fromHex("828684be5886a8eb10649cbf"), fields), HPACK_OK);
+
+  const t_header_list expected = {
+      {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+      {":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+      {"cache-control", "no-cache"}};
+  EXPECT_EQ(fields, expected);
+}
+
+TEST(Hpack, RejectsMalformedBlocks)
+{
+  HpackDecoder decoder;
+  t_header_list fields;
+  EXPECT_EQ(decoder.decode(fromHex("80"), fields), HPACK_MALFORMED);     // Index 0.
+  EXPECT_EQ(decoder.decode(fromHex("ff00"), fields), HPACK_MALFORMED);   // Index past the tables.
+  EXPECT_EQ(decoder.decode(fromHex("3fe21f"), fields), HPACK_MALFORMED); // Size update above the limit.
+}
+
+TEST(Hpack, DropsAListPastTheLimit)
+{
+  HpackEncoder encoder;
+  HpackDecoder decoder;
+  std::string block;
+  encoder.encode(block, "x-big", std::string(4000, 'a')); // Added to the dynamic table, index 62.
+  block.append(1000, '\xbe');                              // About 4 MB once decoded.
+
+  t_header_list fields;
+  EXPECT_EQ(decoder.decode(block, fields, 64 * 1024), HPACK_TOO_LARGE);
+  EXPECT_TRUE(fields.empty());
+
+  // The table stayed in sync with the encoder.
+  ASSERT_EQ(decoder.decode(fromHex("be"), fields, 64 * 1024), HPACK_OK);
+  ASSERT_EQ(fields.size(), 1u);
+  EXPECT_EQ(fields[0].first, "x-big");
+}
+
+TEST(Hpack, DynamicTableEvictsOldestEntries)
+{
+  HpackTable table(100);
+  table.add("a", "1"); // 34 bytes each.
+  table.add("b", "2");
+  table.add("c", "3");
+  EXPECT_EQ(table.size(), 68u);
+
+  std::string_view name, value;
+  ASSERT_TRUE(table.get(HPACK_STATIC_TABLE_SIZE + 1, name, value));
+  EXPECT_EQ(name, "c");
+  ASSERT_TRUE(table.get(HPACK_STATIC_TABLE_SIZE + 2, name, value));
+  EXPECT_EQ(name, "b");
+  EXPECT_FALSE(table.get(HPACK_STATIC_TABLE_SIZE + 3, name, value));
+
+  table.add(std::string(200, 'x'), "y"); // Larger than the table.
+  EXPECT_EQ(table.size(), 0u);
+}
+
+TEST(Hpack, EncoderOutputDecodes)
+{
+  HpackEncoder encoder;
+  HpackDecoder decoder;
+  const t_header_list input = {{":status", "200"}, {"content-type", "text/html"}, {"content-length", "42"}, {"x-custom", "value"}};
+
+  for (int round = 0; round < 2; ++round)
+  {
+    std::string block;
+    for (const auto &[name, value] : input)
+      encoder.encode(block, name, value);
+
+    t_header_list fields;
+    ASSERT_EQ(decoder.decode(block, fields), HPACK_OK);
+    EXPECT_EQ(fields, input);
+  }
+}
+
+TEST(Http2Session, ServesAStreamThroughTheGateway)
+{
+  Http2Session session(8192);
+  session.start();
+
+  HpackEncoder encoder;
+  std::string block;
+  encoder.encode(block, ":method", "GET");
+  encoder.encode(block, ":scheme", "http");
+  encoder.encode(block, ":path", "/index.html");
+  encoder.encode(block, ":authority", "localhost");
+  session.feed(std::string(H2_PREFACE) + frame(H2_SETTINGS, 0, 0, "") + frame(H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, 1, block));
+
+  const std::vector<uint32_t> opened = session.takeOpenedStreams();
+  ASSERT_EQ(opened, std::vector<uint32_t>{1});
+  session.attachGateway(1, 42);
+
+  const std::string request(session.gatewayOutput(42));
+  EXPECT_EQ(request.rfind("GET /index.html HTTP/1.1\r\n", 0), 0u);
+  EXPECT_NE(request.find("Host: localhost\r\n"), std::string::npos);
+  EXPECT_NE(request.find("Connection: close\r\n"), std::string::npos);
+
+  session.onGatewayData(42, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nConnection: close\r\n\r\nhello");
+
+  HpackDecoder decoder;
+  t_header_list fields;
+  std::string body;
+  bool ended = false;
+  for (const t_frame &f : parseFrames(session.output()))
+  {
+    if (f.stream_id != 1)
+      continue;
+    if (f.type == H2_HEADERS)
+    {
+      ASSERT_EQ(decoder.decode(f.payload, fields), HPACK_OK);
+    }
+    if (f.type == H2_DATA)
+      body += f.payload;
+    ended |= (f.flags & H2_FLAG_END_STREAM) != 0;
+  }
+  const t_header_list expected = {{":status", "200"}, {"content-length", "5"}};
+  EXPECT_EQ(fields, expected);
+  EXPECT_EQ(body, "hello");
+  EXPECT_TRUE(ended);
+  EXPECT_EQ(session.takeClosedGateways(), std::vector<int>{42});
+}
+
+TEST(Http2Session, RejectsABadPreface)
+{
+  Http2Session session(8192);
+  session.start();
+  session.feed("GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+
+  const std::vector<t_frame> frames = parseFrames(session.output());
+  ASSERT_FALSE(frames.empty());
+  EXPECT_EQ(frames.back().type, H2_GOAWAY);
+  EXPECT_EQ(uint8_t(frames.back().payload[7]), H2_PROTOCOL_ERROR);
+
+  session.consumeOutput(session.output().size());
+  EXPECT_TRUE(session.isDone());
+}
+
+TEST(Http2Session, ResetsAStreamPastTheHeaderListSize)
+{
+  Http2Session session(8192);
+  session.start();
+
+  HpackEncoder encoder;
+  std::string block;
+  encoder.encode(block, ":method", "GET");
+  encoder.encode(block, ":scheme", "http");
+  encoder.encode(block, ":path", "/");
+  encoder.encode(block, "x-big", std::string(4000, 'a'));
+  block.append(4000, '\xbe'); // 16 MB once decoded.
+  session.feed(std::string(H2_PREFACE) + frame(H2_SETTINGS, 0, 0, "") + frame(H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, 1, block));
+
+  EXPECT_TRUE(session.takeOpenedStreams().empty());
+  const std::vector<t_frame> frames = parseFrames(session.output());
+  ASSERT_FALSE(frames.empty());
+  EXPECT_EQ(frames.back().type, H2_RST_STREAM);
+  EXPECT_EQ(frames.back().stream_id, 1u);
+  EXPECT_EQ(uint8_t(frames.back().payload[3]), H2_ENHANCE_YOUR_CALM);
+  EXPECT_FALSE(session.isDone()); // Only the stream is reset.
+}
+
+TEST(Http2Session, HoldsTheInputWhileTheOutputIsFull)
+{
+  Http2Session session(8192);
+  session.start();
+  session.feed(std::string(H2_PREFACE) + frame(H2_SETTINGS, 0, 0, ""));
+  session.consumeOutput(session.output().size());
+
+  const std::string ping = frame(H2_PING, 0, 0, "12345678");
+  std::string pings;
+  for (int i = 0; i < 20000; ++i)
+    pings += ping;
+  session.feed(pings);
+  EXPECT_LT(session.output().size(), H2_MAX_OUTPUT + ping.size());
+
+  // Resumed once the client reads.
+  size_t acks = 0;
+  for (int round = 0; round < 3; ++round)
+  {
+    acks += parseFrames(session.output()).size();
+    session.consumeOutput(session.output().size());
+    session.feed("");
+  }
+  EXPECT_EQ(acks, 20000u);
+
+  // A client which never reads cannot queue more than a bounded input.
+  for (int i = 0; i < 5 && !session.isDone(); ++i)
+    session.feed(pings);
+  const std::vector<t_frame> frames = parseFrames(session.output());
+  ASSERT_FALSE(frames.empty());
+  EXPECT_EQ(frames.back().type, H2_GOAWAY);
+  EXPECT_EQ(uint8_t(frames.back().payload[7]), H2_ENHANCE_YOUR_CALM);
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <atomic>
+#include <thread>
+#include "../../includes/IoPool.hpp"
+
+TEST(IoPool, RunsTheWorkOffTheLoopAndTheDoneOnIt)
+{
+  EpollHelper epoll;
+  IoPool pool(epoll, 2);
+  const std::thread::id loop = std::this_thread::get_id();
+  std::atomic<int> worked = 0;
+  int done = 0;
+  int wake = -1;
+
+  for (int i = 0; i < 10; ++i)
+  {
+    t_msg_from_serv msg = pool.submit(t_io_task{
+        [&worked, loop]()
+        {
+          EXPECT_NE(std::this_thread::get_id(), loop);
+          ++worked;
+        },
+        [&done, loop](t_msg_from_serv &)
+        {
+          EXPECT_EQ(std::this_thread::get_id(), loop);
+          ++done;
+        }});
+    if (i == 0)
+    {
+      ASSERT_EQ(msg.fds_to_register.size(), 1u); // The wake-up pipe, once
+      wake = msg.fds_to_register[0]->get();
+    }
+    else
+      EXPECT_TRUE(msg.fds_to_register.empty());
+  }
+  EXPECT_TRUE(pool.owns(wake));
+
+  while (done < 10)
+  {
+    struct pollfd pfd = {wake, POLLIN, 0};
+    ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+    pool.handleEvent(wake, READ_EVENT);
+  }
+  EXPECT_EQ(worked, 10);
+}
+
+TEST(IoPool, ASlowTaskDoesNotHoldTheNextOnes)
+{
+  EpollHelper epoll;
+  IoPool pool(epoll, 2);
+  std::atomic<bool> release = false;
+  int done = 0;
+
+  t_msg_from_serv msg = pool.submit(t_io_task{
+      [&release]()
+      {
+        while (!release)
+          std::this_thread::yield();
+      },
+      [&done](t_msg_from_serv &)
+      { ++done; }});
+  ASSERT_EQ(msg.fds_to_register.size(), 1u);
+  const int wake = msg.fds_to_register[0]->get();
+  pool.submit(t_io_task{[]() {}, [&done](t_msg_from_serv &)
+                        { ++done; }});
+
+  struct pollfd pfd = {wake, POLLIN, 0};
+  ASSERT_EQ(poll(&pfd, 1, 5000), 1); // The second task, on a second thread
+  pool.handleEvent(wake, READ_EVENT);
+  EXPECT_EQ(done, 1);
+
+  release = true;
+  while (done < 2)
+  {
+    ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+    pool.handleEvent(wake, READ_EVENT);
+  }
+}
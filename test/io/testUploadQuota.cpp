@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <poll.h>
+#include <unistd.h>
+#include "../../includes/UploadQuota.hpp"
+#include "../../includes/WebServErr.hpp"
+
+static std::string makeRoot()
+{
+  const std::string root = std::filesystem::temp_directory_path() / ("quota_" + std::to_string(getpid()));
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root + "/sub");
+  std::ofstream(root + "/a.txt") << "12345";
+  std::ofstream(root + "/sub/b.txt") << "123";
+  return root;
+}
+
+// Runs the scans the next tick starts, till the pool is quiet, as the event loop would.
+static void runScans(UploadQuota &quota, IoPool &pool)
+{
+  t_msg_from_serv msg = quota.tick(time(NULL), pool);
+  ASSERT_FALSE(msg.fds_to_register.empty());
+  const int wake = msg.fds_to_register[0]->get();
+  struct pollfd pfd = {wake, POLLIN, 0};
+  ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+  do
+    pool.handleEvent(wake, READ_EVENT);
+  while (poll(&pfd, 1, 200) == 1);
+}
+
+TEST(UploadQuota, ScanCountsTheWholeTree)
+{
+  const std::string root = makeRoot();
+  const t_dir_usage usage = UploadQuota::scan(root);
+  EXPECT_EQ(usage.files, 2u);
+  EXPECT_EQ(usage.bytes, 8u);
+  EXPECT_FALSE(usage.is_dirty);
+  std::filesystem::remove_all(root);
+}
+
+TEST(UploadQuota, LimitsOfTheLocation)
+{
+  const std::string root = makeRoot();
+  EpollHelper epoll;
+  IoPool pool(epoll, 1);
+  UploadQuota quota;
+  quota.track(root);
+  runScans(quota, pool);
+  t_location_config location;
+  location.root = root;
+  location.max_files = 3;
+  location.max_bytes = 10;
+
+  try
+  {
+    quota.addFile(location, 3);
+    FAIL() << "bytes over the quota";
+  }
+  catch (const WebServErr::MethodException &e)
+  {
+    EXPECT_EQ(e.code(), ERR_413_CONTENT_TOO_LARGE);
+  }
+
+  t_dir_usage *usage = quota.addFile(location, 2);
+  ASSERT_NE(usage, nullptr);
+  EXPECT_EQ(usage->files, 3u);
+  EXPECT_TRUE(usage->is_dirty);
+  quota.addBytes(usage, 2);
+
+  try
+  {
+    quota.addFile(location, 0);
+    FAIL() << "files over the quota";
+  }
+  catch (const WebServErr::MethodException &e)
+  {
+    EXPECT_EQ(e.code(), ERR_403_FORBIDDEN);
+  }
+
+  quota.removeFile(root + "/a.txt", 5);
+  EXPECT_EQ(usage->files, 2u);
+  EXPECT_EQ(usage->bytes, 5u);
+  EXPECT_EQ(quota.addFile(location, 5), usage); // Fills the quota exactly
+  std::filesystem::remove_all(root);
+}
+
+// The tracked roots are counted by the pool, not when tracked, and a file only under the most specific of them.
+TEST(UploadQuota, NestedRootsAreCountedOnce)
+{
+  const std::string root = makeRoot();
+  EpollHelper epoll;
+  IoPool pool(epoll, 1);
+  UploadQuota quota;
+  t_location_config outer;
+  outer.root = root + "/";
+  outer.max_files = 2;
+  t_location_config inner;
+  inner.root = root + "/sub";
+  inner.max_files = 1;
+  quota.track(outer.root);
+  quota.track(inner.root);
+  EXPECT_NE(quota.addFile(outer, 0), nullptr); // Not scanned yet, nothing counted
+  runScans(quota, pool);
+
+  try
+  {
+    quota.addFile(inner, 0);
+    FAIL() << "files over the quota of the inner root";
+  }
+  catch (const WebServErr::MethodException &e)
+  {
+    EXPECT_EQ(e.code(), ERR_403_FORBIDDEN);
+  }
+  t_dir_usage *usage = quota.addFile(outer, 0); // a.txt only, sub/b.txt is the inner root's
+  ASSERT_NE(usage, nullptr);
+  EXPECT_EQ(usage->files, 2u);
+  EXPECT_EQ(usage->bytes, 5u);
+
+  quota.removeFile(root + "/sub/b.txt", 3);
+  EXPECT_EQ(usage->files, 2u);
+  EXPECT_NE(quota.addFile(inner, 0), nullptr);
+  quota.removeFile("/elsewhere/c.txt", 7); // Under no root
+  EXPECT_EQ(usage->files, 2u);
+  EXPECT_EQ(usage->bytes, 5u);
+  std::filesystem::remove_all(root);
+}
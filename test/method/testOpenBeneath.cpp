@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+#include "../../includes/MethodHandler.hpp"
+
+namespace
+{
+
+  // A server of one GET location, its root opened as the server opens it for `openat2`.
+  class Beneath : public ::testing::Test
+  {
+  protected:
+    std::string base;
+    std::string root;
+    t_server_config server{};
+    EpollHelper epoll;
+    UploadQuota quota;
+
+    void SetUp() override
+    {
+      base = std::filesystem::temp_directory_path() / ("beneath_" + std::to_string(getpid()));
+      root = base + "/root";
+      std::filesystem::remove_all(base);
+      std::filesystem::create_directories(root + "/a/b");
+      std::ofstream(root + "/a/b/c.txt") << "nested";
+      std::ofstream(base + "/secret.txt") << "outside";
+      std::filesystem::create_symlink(base + "/secret.txt", root + "/abs_file");
+      std::filesystem::create_symlink(base, root + "/abs_dir");
+      std::filesystem::create_symlink("/proc/self/fd", root + "/fds");
+
+      t_location_config location{};
+      location.methods = {GET};
+      location.root = root;
+      location.root_fd = open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+      ASSERT_NE(location.root_fd, -1);
+      server.locations["/"] = location;
+    }
+
+    void TearDown() override
+    {
+      close(server.locations["/"].root_fd);
+      std::filesystem::remove_all(base);
+    }
+
+    t_file get(const std::string &target)
+    {
+      return MethodHandler(epoll, quota).handleRequest(server, {{"Method", "GET"}, {"Target", target}}, HttpHeaders(), epoll);
+    }
+
+    // The status a GET of `target` is refused with, or 0 when it is served.
+    int refusal(const std::string &target)
+    {
+      try
+      {
+        get(target);
+        return 0;
+      }
+      catch (const WebServErr::MethodException &e)
+      {
+        return e.code();
+      }
+    }
+  };
+
+} // namespace
+
+TEST_F(Beneath, NestedPathIsServed)
+{
+  const t_file file = get("/a/b/c.txt");
+  EXPECT_EQ(file.fileSize, 6);
+  char data[16];
+  EXPECT_EQ(read(file.FD_handler_OUT->get(), data, sizeof(data)), 6);
+  EXPECT_EQ(std::string(data, 6), "nested");
+  EXPECT_EQ(refusal("/a/./b/../b/c.txt"), 0);
+  EXPECT_EQ(refusal("/a/b/missing.txt"), ERR_404_NOT_FOUND);
+}
+
+TEST_F(Beneath, DotDotCannotLeaveTheRoot)
+{
+  EXPECT_EQ(refusal("/../secret.txt"), ERR_403_FORBIDDEN);
+  EXPECT_EQ(refusal("/a/../../secret.txt"), ERR_403_FORBIDDEN);
+  EXPECT_EQ(refusal("/a/b/../../../root/a/b/c.txt"), ERR_403_FORBIDDEN);
+}
+
+TEST_F(Beneath, AbsoluteSymlinksAreNotFollowed)
+{
+  EXPECT_EQ(refusal("/abs_file"), ERR_500_INTERNAL_SERVER_ERROR);
+  EXPECT_EQ(refusal("/abs_dir/secret.txt"), ERR_500_INTERNAL_SERVER_ERROR);
+}
+
+// The fd of the root itself, through a symlink to `/proc/self/fd` or as a magic link of a `/proc` root.
+TEST_F(Beneath, ProcFdLinksAreNotFollowed)
+{
+  const int root_fd = server.locations["/"].root_fd;
+  EXPECT_EQ(refusal("/fds/" + std::to_string(root_fd) + "/../secret.txt"), ERR_500_INTERNAL_SERVER_ERROR);
+
+  const int outside = open((base + "/secret.txt").c_str(), O_RDONLY | O_CLOEXEC);
+  ASSERT_NE(outside, -1);
+  int proc_fd = open("/proc", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  ASSERT_NE(proc_fd, -1);
+  server.locations["/"].root = "/proc";
+  std::swap(server.locations["/"].root_fd, proc_fd);
+  EXPECT_EQ(refusal("/" + std::to_string(getpid()) + "/fd/" + std::to_string(outside)), ERR_500_INTERNAL_SERVER_ERROR);
+  std::swap(server.locations["/"].root_fd, proc_fd);
+  close(proc_fd);
+  close(outside);
+}
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../includes/ProxyPool.hpp"
+#include "../../includes/utils.hpp"
+
+TEST(Proxy, RequestHead)
+{
+  HttpHeaders headers;
+  headers["Host"] = "example.com";
+  headers["Accept"] = "*/*";
+  headers["Connection"] = "keep-alive, x-custom";
+  headers["Transfer-Encoding"] = "chunked";
+  headers["Keep-Alive"] = "timeout=5";
+  headers["X-Forwarded-For"] = "10.0.0.1";
+
+  const std::string head = toLower(proxyRequestHead("GET", "/a b/é?q=1", headers, 0));
+  EXPECT_TRUE(head.starts_with("get /a%20b/%c3%a9?q=1 http/1.1\r\n"));
+  EXPECT_NE(head.find("host: example.com\r\n"), std::string::npos);
+  EXPECT_NE(head.find("accept: */*\r\n"), std::string::npos);
+  EXPECT_EQ(head.find("connection"), std::string::npos);
+  EXPECT_EQ(head.find("keep-alive"), std::string::npos);
+  EXPECT_EQ(head.find("transfer-encoding"), std::string::npos);
+  EXPECT_EQ(head.find("x-forwarded-for"), std::string::npos); // Appended by the server, with the client
+  EXPECT_EQ(head.find("content-length"), std::string::npos);
+  EXPECT_TRUE(head.ends_with("\r\n"));
+
+  EXPECT_NE(toLower(proxyRequestHead("POST", "/", headers, 42)).find("content-length: 42\r\n"), std::string::npos);
+  EXPECT_NE(toLower(proxyRequestHead("POST", "/", headers, SIZE_MAX)).find("transfer-encoding: chunked\r\n"), std::string::npos);
+}
+
+TEST(Proxy, ResponseHead)
+{
+  int status = 0;
+  std::string cgi_header;
+  t_proxy_framing framing = PROXY_BODY_CLOSE;
+  size_t remaining = 0;
+  bool keep_alive = false;
+
+  ASSERT_TRUE(proxyResponseHead("HTTP/1.1 404 Not Found\r\nContent-Length: 12\r\nConnection: keep-alive\r\nX-A: b\r\n\r\n",
+                                status, cgi_header, framing, remaining, keep_alive));
+  EXPECT_EQ(status, 404);
+  EXPECT_EQ(framing, PROXY_BODY_LENGTH);
+  EXPECT_EQ(remaining, 12u);
+  EXPECT_TRUE(keep_alive);
+  EXPECT_EQ(cgi_header, "Status: 404 Not Found\r\nX-A: b\r\nContent-Length: 12\r\n\r\n");
+
+  ASSERT_TRUE(proxyResponseHead("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n",
+                                status, cgi_header, framing, remaining, keep_alive));
+  EXPECT_EQ(framing, PROXY_BODY_CHUNKED);
+  EXPECT_FALSE(keep_alive);
+  EXPECT_EQ(cgi_header, "Status: 200 OK\r\n\r\n");
+
+  // Without a length the body ends at the EOF, the connection is not reused.
+  ASSERT_TRUE(proxyResponseHead("HTTP/1.0 200 OK\r\n\r\n", status, cgi_header, framing, remaining, keep_alive));
+  EXPECT_EQ(framing, PROXY_BODY_CLOSE);
+  EXPECT_FALSE(keep_alive);
+
+  ASSERT_TRUE(proxyResponseHead("HTTP/1.1 304 Not Modified\r\nContent-Length: 99\r\n\r\n", status, cgi_header, framing, remaining, keep_alive));
+  EXPECT_EQ(framing, PROXY_BODY_NONE);
+
+  EXPECT_FALSE(proxyResponseHead("HTTP/2 200 OK\r\n\r\n", status, cgi_header, framing, remaining, keep_alive));
+  EXPECT_FALSE(proxyResponseHead("HTTP/1.1 2x0 OK\r\n\r\n", status, cgi_header, framing, remaining, keep_alive));
+  EXPECT_FALSE(proxyResponseHead("HTTP/1.1 200 OK\r\nContent-Length: -1\r\n\r\n", status, cgi_header, framing, remaining, keep_alive));
+  EXPECT_FALSE(proxyResponseHead("HTTP/1.1 200 OK\r\n folded\r\n\r\n", status, cgi_header, framing, remaining, keep_alive));
+}
+
+TEST(Proxy, UnreachableUpstreamsAnswerBadGateway)
+{
+  EpollHelper epoll;
+  ProxyPool pool(epoll);
+
+  int body[2];
+  int output[2];
+  ASSERT_EQ(pipe2(body, O_NONBLOCK), 0);
+  ASSERT_EQ(pipe2(output, O_NONBLOCK), 0);
+
+  auto job = std::make_shared<t_proxy_job>();
+  job->config = {{"unix:/nonexistent/webserv-a.sock", "unix:/nonexistent/webserv-b.sock"}, PROXY_ROUND_ROBIN, 1, 10};
+  job->group = "/api";
+  job->head = "GET / HTTP/1.1\r\n";
+  job->content_length = 0;
+  job->is_idempotent = true; // Both are tried
+  job->body_fd = std::make_shared<RaiiFd>(epoll, body[0]);
+  job->output_fd = std::make_shared<RaiiFd>(epoll, output[1]);
+  job->body = body[0];
+  job->output = output[1];
+  job->conn_fd = -1;
+  job->body_sent = 0;
+  job->output_started = false;
+  job->is_ended = false;
+  job->is_aborted = false;
+
+  t_msg_from_serv msg = pool.submit(job);
+  EXPECT_EQ(job->tried.size(), 2u);
+  EXPECT_EQ(msg.fds_to_register.size(), 2u);
+  EXPECT_EQ(msg.fds_to_unregister.size(), 2u); // Both pipes are done with.
+  EXPECT_FALSE(pool.owns(body[0]));
+
+  char buf[128];
+  const ssize_t n = read(output[0], buf, sizeof(buf));
+  ASSERT_GT(n, 0);
+  EXPECT_EQ(std::string_view(buf, n), PROXY_BAD_GATEWAY);
+
+  close(body[1]);
+  close(output[0]);
+}
@@ -526,7 +526,7 @@ def test_max_request_size_exceeded():
     resp = send_raw(req)
     status_line, headers, body_resp = parse_http_response(resp)
 
-    assert status_line.startswith("HTTP/1.1 400"), f"expected 400, got {status_line}"
+    assert status_line.startswith("HTTP/1.1 413"), f"expected 413, got {status_line}"
     print("Max request size exceeded test passed.")
 
 
@@ -558,6 +558,82 @@ def test_timeout():
     sock.close()
     print("Timeout test passed.")
 
+def recv_available(sock, timeout=1.0) -> bytes:
+    sock.settimeout(timeout)
+    data = b""
+    try:
+        while True:
+            chunk = sock.recv(4096)
+            if not chunk:
+                break
+            data += chunk
+    except socket.timeout:
+        pass
+    return data
+
+def test_expect_continue():
+    body = b"continue body"
+    sock = socket.create_connection((HOST, PORT), timeout=5)
+    sock.sendall(
+        b"POST /uploads/ HTTP/1.1\r\n"
+        b"Host: localhost\r\n"
+        b"Content-Type: text/plain\r\n"
+        b"Expect: 100-continue\r\n"
+        + f"Content-Length: {len(body)}\r\n".encode()
+        + b"\r\n"
+    )
+    interim = recv_available(sock)
+    assert interim == b"HTTP/1.1 100 Continue\r\n\r\n", f"expected 100 Continue, got {interim}"
+
+    sock.sendall(body)
+    status_line, headers, _ = parse_http_response(recv_available(sock))
+    assert status_line.startswith("HTTP/1.1 201"), f"expected 201, got {status_line}"
+    sock.close()
+    print("Expect 100-continue test passed.")
+
+def test_expect_continue_rejected_head():
+    for host, target, status in ((b"localhost", b"/second/", "405"), (b"size_limit.com", b"/", "413")):
+        sock = socket.create_connection((HOST, PORT), timeout=5)
+        sock.sendall(
+            b"POST " + target + b" HTTP/1.1\r\n"
+            b"Host: " + host + b"\r\n"
+            b"Content-Type: text/plain\r\n"
+            b"Expect: 100-continue\r\n"
+            b"Content-Length: 2048\r\n"
+            b"\r\n"
+        )
+        resp = recv_available(sock)
+        status_line, headers, _ = parse_http_response(resp)
+        assert b"100 Continue" not in resp, "100 Continue sent for a rejected head"
+        assert status_line.startswith("HTTP/1.1 " + status), f"expected {status}, got {status_line}"
+        assert headers.get("Connection") == "close", "the unread body must close the connection"
+        try:
+            assert sock.recv(1024) == b"", "expected closed connection"
+        except ConnectionResetError:
+            pass
+        sock.close()
+    print("Expect 100-continue rejected head test passed.")
+
+def test_expect_continue_not_sent():
+    for version, body in ((b"HTTP/1.0", b"old client"), (b"HTTP/1.1", b"")):
+        sock = socket.create_connection((HOST, PORT), timeout=5)
+        sock.sendall(
+            b"POST /uploads/ " + version + b"\r\n"
+            b"Host: localhost\r\n"
+            b"Content-Type: text/plain\r\n"
+            b"Expect: 100-continue\r\n"
+            + f"Content-Length: {len(body)}\r\n".encode()
+            + b"\r\n"
+        )
+        if body:
+            assert recv_available(sock) == b"", "100 Continue sent to an HTTP/1.0 client"
+            sock.sendall(body)
+        resp = recv_available(sock)
+        assert b"100 Continue" not in resp, f"100 Continue sent: {resp}"
+        assert resp.startswith(b"HTTP/1.1 201"), f"expected 201, got {resp[:40]}"
+        sock.close()
+    print("Expect 100-continue not sent test passed.")
+
 def test_simple_cgi_py():
     r = requests.get(f"{BASE_CGI}test.py")
     assert r.status_code == 200
@@ -629,6 +705,9 @@ def run_all():
     test_post_chunked_incorrect_chunk_size()
     test_post_chunked_incorrect_chunk_tail()
     test_post_chunked_extra_data_after_last_chunk()
+    test_expect_continue()
+    test_expect_continue_rejected_head()
+    test_expect_continue_not_sent()
 
     test_simple_cgi_py()
     test_simple_cgi_py_post()
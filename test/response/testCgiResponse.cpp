@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+#include "../../includes/HttpResponse.hpp"
+#include "../../includes/ResponseHead.hpp"
+
+/**
+ * @brief The head made of `cgi_output` for a request of `version`, without its `Date` field.
+ */
+static std::string cgiHead(t_conn &conn, std::string_view version, std::string_view cgi_output)
+{
+  conn.request = std::make_shared<HttpRequests>();
+  conn.request->httpParser("GET /cgi HTTP/" + std::string(version) + "\r\nHost: localhost\r\n\r\n");
+  conn.res_framing = FRAMING_LENGTH;
+  conn.must_close = false;
+  conn.output_length = SIZE_MAX;
+  size_t cgi_head_size = 0;
+  std::string head = HttpResponse().CGIResponse(&conn, cgi_output, 8192, cgi_head_size);
+  const size_t date = head.find("Date: ");
+  head.erase(date, head.find("\r\n", date) + 2 - date);
+  return head;
+}
+
+TEST(CgiResponse, UnknownLengthIsChunked)
+{
+  t_conn conn{};
+  EXPECT_EQ(cgiHead(conn, "1.1", "Content-Type: text/plain\n\nhello"),
+            "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\n\r\n");
+  EXPECT_EQ(conn.res_framing, FRAMING_CHUNKED);
+
+  EXPECT_EQ(cgiHead(conn, "1.0", "Content-Type: text/plain\n\nhello"),
+            "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nConnection: close\r\n\r\n");
+  EXPECT_EQ(conn.res_framing, FRAMING_CLOSE);
+}
+
+TEST(CgiResponse, NoBodyHasNoFraming)
+{
+  for (const char *status : {"204 No Content", "304 Not Modified", "103 Early Hints"})
+  {
+    t_conn conn{};
+    const std::string head = cgiHead(conn, "1.1", std::string("Status: ") + status + "\r\nX-Id: 7\r\n\r\nignored");
+    EXPECT_EQ(head, std::string("HTTP/1.1 ") + status + "\r\nX-Id: 7\r\n\r\n");
+    EXPECT_EQ(conn.res_framing, FRAMING_LENGTH);
+    EXPECT_EQ(conn.output_length, head.size() + ResponseHead::dateField().size());
+
+    EXPECT_EQ(cgiHead(conn, "1.0", std::string("Status: ") + status + "\n\n").find("Connection"), std::string::npos);
+    EXPECT_FALSE(conn.must_close);
+  }
+}
@@ -0,0 +1,24 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+#include "../../includes/ErrorResponse.hpp"
+
+// The pages are read once: a page removed after the start is still served, a missing or too large one is left out.
+TEST(ErrorResponse, PagesAreReadAtStart)
+{
+  const std::string dir = std::filesystem::temp_directory_path() / ("errors_" + std::to_string(getpid()));
+  std::filesystem::create_directories(dir);
+  std::ofstream(dir + "/404.html") << "<h1>404</h1>";
+  std::ofstream(dir + "/500.html") << std::string(ERROR_PAGE_MAX_SIZE + 1, 'x');
+
+  const ErrorResponse pages({{ERR_404_NOT_FOUND, dir + "/404.html"},
+                             {ERR_403_FORBIDDEN, dir + "/missing.html"},
+                             {ERR_500_INTERNAL_SERVER_ERROR, dir + "/500.html"}});
+  std::filesystem::remove_all(dir);
+
+  EXPECT_EQ(pages.getErrorPage(ERR_404_NOT_FOUND), "<h1>404</h1>");
+  EXPECT_THROW(pages.getErrorPage(ERR_403_FORBIDDEN), WebServErr::ErrorResponseException);
+  EXPECT_THROW(pages.getErrorPage(ERR_500_INTERNAL_SERVER_ERROR), WebServErr::ErrorResponseException);
+  EXPECT_THROW(pages.getErrorPage(ERR_400_BAD_REQUEST), WebServErr::ErrorResponseException);
+}
@@ -0,0 +1,48 @@
+#include <gtest/gtest.h>
+#include "../../includes/Buffer.hpp"
+#include "../../includes/ResponseHead.hpp"
+
+TEST(ResponseHead, SerializesHead)
+{
+  std::string out;
+  ResponseHead(out).status(201).raw(FIELD_CONTENT_TYPE_HTML).field("Location", "/up/a.txt").field("Content-Length", static_cast<size_t>(1234567)).end();
+  EXPECT_EQ(out, "HTTP/1.1 201 Created\r\n"
+                 "Content-Type: text/html\r\n"
+                 "Location: /up/a.txt\r\n"
+                 "Content-Length: 1234567\r\n"
+                 "\r\n");
+}
+
+TEST(ResponseHead, StatusText)
+{
+  EXPECT_EQ(ResponseHead::statusText(404), "404 Not Found");
+  EXPECT_EQ(ResponseHead::statusText(405), "405 Method Not Allowed");
+  EXPECT_EQ(ResponseHead::statusText(999), "500 Internal Server Error");
+}
+
+TEST(ResponseHead, DateIsCachedPerSecond)
+{
+  EXPECT_EQ(ResponseHead::dateField(0), "Date: Thu, 01 Jan 1970 00:00:00 GMT\r\n");
+  const char *cached = ResponseHead::dateField(784111777).data();
+  EXPECT_EQ(ResponseHead::dateField(784111777), "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n");
+  EXPECT_EQ(ResponseHead::dateField(784111777).data(), cached);
+}
+
+TEST(ResponseHead, ContentTypeFromLastExtension)
+{
+  EXPECT_EQ(ResponseHead::contentTypeField("/img/cat.png"), "Content-Type: image/png\r\n");
+  EXPECT_EQ(ResponseHead::contentTypeField("/a.png.txt"), "Content-Type: text/plain\r\n");
+  EXPECT_EQ(ResponseHead::contentTypeField("/v1.2/index"), FIELD_CONTENT_TYPE_HTML);
+  EXPECT_EQ(ResponseHead::contentTypeField("/file.bin"), "Content-Type: application/octet-stream\r\n");
+}
+
+TEST(ResponseHead, PooledBlockIsReused)
+{
+  std::string block = Buffer::acquireBlock();
+  const char *data = block.data();
+  Buffer::recycleBlock(std::move(block));
+
+  std::string head = Buffer::acquireBlock(0);
+  EXPECT_TRUE(head.empty());
+  EXPECT_EQ(head.data(), data);
+}
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <random>
+#include "../../includes/ScanKernels.hpp"
+
+namespace
+{
+
+  const t_scan_level LEVELS[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+
+  std::string randomText(std::mt19937 &rng, size_t size, const std::string &alphabet)
+  {
+    std::uniform_int_distribution<size_t> dist(0, alphabet.size() - 1);
+    std::string s(size, '\0');
+    for (auto &c : s)
+      c = alphabet[dist(rng)];
+    return s;
+  }
+
+  size_t naiveFind(const std::string &s, const std::string &needle)
+  {
+    size_t pos = s.find(needle);
+    return pos == std::string::npos ? s.size() : pos;
+  }
+
+  size_t naiveFirstOf(const std::string &s, const std::string &set)
+  {
+    size_t pos = s.find_first_of(set);
+    return pos == std::string::npos ? s.size() : pos;
+  }
+
+} // namespace
+
+TEST(ScanKernels, CharClassTables)
+{
+  constexpr CharClass cls(" <>\"{}|\\^`");
+  EXPECT_TRUE(cls.simd_ok);
+  EXPECT_TRUE(cls.contains('<'));
+  EXPECT_TRUE(cls.contains(' '));
+  EXPECT_FALSE(cls.contains('a'));
+  EXPECT_FALSE(cls.contains(0xFC)); // '|' | 0x80, must not alias through the nibbles
+
+  constexpr CharClass wide("\x80\x81");
+  EXPECT_FALSE(wide.simd_ok);
+  EXPECT_TRUE(wide.contains(0x80));
+}
+
+// Every level must agree with the naive reference, for all lengths and match positions
+// around the vector widths.
+TEST(ScanKernels, AllLevelsMatchReference)
+{
+  std::mt19937 rng(42);
+  const std::string alphabet = "ab\r\n,%<";
+  const CharClass cls("<>\"{}|\\^`");
+  char quad[4] = {'\r', '\n', '\r', '\n'};
+
+  for (size_t size = 0; size < 200; ++size)
+  {
+    for (int round = 0; round < 20; ++round)
+    {
+      const std::string s = randomText(rng, size, alphabet);
+      for (t_scan_level level : LEVELS)
+      {
+        const t_scan_kernels &k = scanKernels(level);
+        ASSERT_EQ(k.find_byte(s.data(), s.size(), '%'), naiveFind(s, "%")) << s;
+        ASSERT_EQ(k.find_pair(s.data(), s.size(), '\r', '\n'), naiveFind(s, "\r\n")) << s;
+        ASSERT_EQ(k.find_pair(s.data(), s.size(), ',', ','), naiveFind(s, ",,")) << s;
+        ASSERT_EQ(k.find_quad(s.data(), s.size(), quad), naiveFind(s, "\r\n\r\n")) << s;
+        ASSERT_EQ(k.find_first_of(s.data(), s.size(), cls), naiveFirstOf(s, "<>\"{}|\\^`")) << s;
+      }
+    }
+  }
+}
+
+TEST(ScanKernels, HighBytesNeverMatchAsciiClass)
+{
+  std::string s(100, static_cast<char>(0xBC)); // high nibble 0xB, low nibble '<' & 0xF
+  const CharClass cls("<");
+  for (t_scan_level level : LEVELS)
+    EXPECT_EQ(scanKernels(level).find_first_of(s.data(), s.size(), cls), s.size());
+}
+
+TEST(ScanKernels, Helpers)
+{
+  const std::string head = "GET / HTTP/1.1\r\nHost: a\r\n\r\nbody";
+  EXPECT_EQ(scanFindCRLF(head), 14u);
+  EXPECT_EQ(scanFindCRLF(head, 15), 23u);
+  EXPECT_EQ(scanFindDoubleCRLF(head), 23u);
+  EXPECT_EQ(scanFindDoubleCRLF("\r\n\r"), std::string_view::npos);
+  EXPECT_EQ(scanFindByte(head, 'z'), std::string_view::npos);
+  EXPECT_EQ(scanFindByte(head, 'G', 100), std::string_view::npos);
+}
+
+TEST(ScanKernels, PercentDecode)
+{
+  std::string out;
+  EXPECT_TRUE(scanPercentDecode("/a%20b%2Fc", out));
+  EXPECT_EQ(out, "/a b/c");
+  EXPECT_TRUE(scanPercentDecode("plain", out));
+  EXPECT_EQ(out, "plain");
+  EXPECT_FALSE(scanPercentDecode("/bad%", out));
+  EXPECT_FALSE(scanPercentDecode("/bad%2", out));
+  EXPECT_FALSE(scanPercentDecode("/bad%zz", out));
+  EXPECT_FALSE(scanPercentDecode("/bad%%41", out));
+  EXPECT_EQ(hexDigitValue('f'), 15);
+  EXPECT_EQ(hexDigitValue('G'), -1);
+}
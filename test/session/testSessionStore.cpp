@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <functional>
+#include <unistd.h>
+#include "../../includes/SessionStore.hpp"
+#include "../../includes/Cookie.hpp"
+
+TEST(SessionStore, TouchExtendsAndExpires)
+{
+  SessionStore store(4, 10);
+  const t_session_id id = store.create(100);
+  EXPECT_TRUE(store.touch(id, 105));
+  EXPECT_TRUE(store.touch(id, 114)); // Extended to 115 by the previous touch
+  EXPECT_FALSE(store.touch(id, 124));
+  EXPECT_EQ(store.size(), 0u);
+}
+
+TEST(SessionStore, BoundedByTheLeastRecentlyUsed)
+{
+  SessionStore store(3, 1000);
+  const t_session_id a = store.create(1);
+  const t_session_id b = store.create(2);
+  const t_session_id c = store.create(3);
+  EXPECT_TRUE(store.touch(a, 4));
+  const t_session_id d = store.create(5); // Evicts b
+  EXPECT_EQ(store.size(), 3u);
+  EXPECT_FALSE(store.touch(b, 6));
+  EXPECT_TRUE(store.touch(a, 6));
+  EXPECT_TRUE(store.touch(c, 6));
+  EXPECT_TRUE(store.touch(d, 6));
+
+  for (int i = 0; i < 10000; ++i)
+    store.create(7 + i);
+  EXPECT_EQ(store.size(), 3u);
+  store.expire(100000);
+  EXPECT_EQ(store.size(), 0u);
+}
+
+TEST(SessionStore, IdsRoundTripThroughTheCookie)
+{
+  SessionStore store(2, 10);
+  const t_session_id id = store.create(0);
+  const std::string hex = SessionStore::format(id);
+  EXPECT_EQ(hex.size(), SESSION_ID_SIZE * 2);
+
+  const std::string header = "theme=dark; session_id=" + hex + "; lang=en";
+  t_session_id parsed;
+  ASSERT_TRUE(SessionStore::parse(Cookie::sessionId(header), parsed));
+  EXPECT_EQ(parsed, id);
+  EXPECT_FALSE(SessionStore::parse("1234", parsed));
+  EXPECT_FALSE(SessionStore::parse(std::string(SESSION_ID_SIZE * 2, 'z'), parsed));
+  EXPECT_TRUE(Cookie::sessionId("theme=dark").empty());
+}
+
+TEST(SessionStore, ResumedFromItsFile)
+{
+  const std::string path = "/tmp/sessions_" + std::to_string(getpid());
+  unlink(path.c_str());
+  t_session_id a, b;
+  {
+    SessionStore store(8, 100, path);
+    a = store.create(10);
+    b = store.create(20);
+  }
+  {
+    SessionStore store(8, 100, path);
+    EXPECT_EQ(store.size(), 2u);
+    EXPECT_TRUE(store.touch(a, 30));
+    EXPECT_TRUE(store.touch(b, 30));
+  }
+  {
+    SessionStore store(16, 100, path); // Another capacity starts afresh
+    EXPECT_EQ(store.size(), 0u);
+    EXPECT_FALSE(store.touch(a, 30));
+  }
+  unlink(path.c_str());
+}
+
+// A file with broken links is started afresh, rather than walked into a loop or out of the table.
+TEST(SessionStore, CorruptedFileStartsAfresh)
+{
+  const std::string path = "/tmp/sessions_" + std::to_string(getpid());
+  const size_t sessions = sizeof(t_session_table);
+  const size_t index = sessions + sizeof(t_session) * 8;
+  const auto corrupted = [&](const std::function<void(int)> &corrupt)
+  {
+    unlink(path.c_str());
+    t_session_id a;
+    {
+      SessionStore store(8, 100, path);
+      a = store.create(10); // Slot 0, the tail
+      store.create(20);     // Slot 1, the head
+    }
+    const int fd = open(path.c_str(), O_RDWR);
+    corrupt(fd);
+    close(fd);
+    SessionStore store(8, 100, path);
+    const bool is_fresh = store.size() == 0 && !store.touch(a, 30);
+    unlink(path.c_str());
+    return is_fresh;
+  };
+  const auto link = [&](int fd, size_t slot, size_t field, uint32_t value)
+  { ASSERT_EQ(pwrite(fd, &value, sizeof(value), sessions + sizeof(t_session) * slot + field), 4); };
+
+  EXPECT_FALSE(corrupted([](int) {}));
+  EXPECT_TRUE(corrupted([&](int fd) { link(fd, 0, offsetof(t_session, next), 1); })); // tail -> head, a cycle
+  EXPECT_TRUE(corrupted([&](int fd) { link(fd, 0, offsetof(t_session, prev), 5); })); // In range, wrong
+  EXPECT_TRUE(corrupted([&](int fd) { link(fd, 2, offsetof(t_session, next), 2); })); // A cycle of free slots
+  EXPECT_TRUE(corrupted([&](int fd) { link(fd, 1, offsetof(t_session, next), 1000); }));
+  EXPECT_TRUE(corrupted([&](int fd)
+                        {
+                          for (size_t i = 0; i < 16; ++i)
+                          {
+                            uint32_t entry;
+                            ASSERT_EQ(pread(fd, &entry, sizeof(entry), index + i * 4), 4);
+                            if (entry == SESSION_NONE)
+                            {
+                              entry = 1000;
+                              ASSERT_EQ(pwrite(fd, &entry, sizeof(entry), index + i * 4), 4);
+                              return;
+                            }
+                          } }));
+}